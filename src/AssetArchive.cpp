@@ -0,0 +1,174 @@
+#include "AssetArchive.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+static constexpr char AssetArchiveMagic[8] = {'S', 'G', 'T', 'P', 'A', 'C', 'K', '\0'};
+static constexpr uint32_t AssetArchiveFormatVersion = 1;
+
+void AssetArchiveHeader::initialize()
+{
+    memset(this, 0, sizeof(*this));
+    memcpy(magic, AssetArchiveMagic, sizeof(magic));
+    formatVersion = AssetArchiveFormatVersion;
+}
+
+bool AssetArchiveHeader::isValid(uint64_t fileSize) const
+{
+    return memcmp(magic, AssetArchiveMagic, sizeof(magic)) == 0 &&
+        formatVersion == AssetArchiveFormatVersion &&
+        entriesOffset <= fileSize && entriesOffset % alignof(AssetArchiveEntry) == 0 &&
+        uint64_t(entryCount)*sizeof(AssetArchiveEntry) <= fileSize - entriesOffset &&
+        namesOffset <= fileSize && namesSize <= fileSize - namesOffset;
+}
+
+// Orders the entry names like strcmp, without requiring them to be terminated.
+static int compareEntryName(const char *entryName, uint32_t entryNameLength, const char *name, size_t nameLength)
+{
+    auto result = memcmp(entryName, name, std::min(size_t(entryNameLength), nameLength));
+    if(result != 0)
+        return result;
+    if(entryNameLength == nameLength)
+        return 0;
+    return entryNameLength < nameLength ? -1 : 1;
+}
+
+AssetArchive::AssetArchive()
+    : header(nullptr), entries(nullptr), names(nullptr)
+{
+}
+
+AssetArchive::~AssetArchive()
+{
+    close();
+}
+
+bool AssetArchive::open(const char *fileName)
+{
+    close();
+    if(!VirtualMemory::mapFileForReading(fileName, mappedFile))
+    {
+        fprintf(stderr, "Failed to map the asset archive %s\n", fileName);
+        return false;
+    }
+
+    header = reinterpret_cast<const AssetArchiveHeader*> (mappedFile.data);
+    if(mappedFile.size < sizeof(AssetArchiveHeader) || !header->isValid(mappedFile.size))
+    {
+        fprintf(stderr, "The asset archive %s is not valid\n", fileName);
+        close();
+        return false;
+    }
+
+    entries = reinterpret_cast<const AssetArchiveEntry*> (mappedFile.data + header->entriesOffset);
+    names = reinterpret_cast<const char*> (mappedFile.data + header->namesOffset);
+    if(!validateEntries())
+    {
+        fprintf(stderr, "The asset archive %s has corrupted entries\n", fileName);
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void AssetArchive::close()
+{
+    VirtualMemory::unmapFile(mappedFile);
+    header = nullptr;
+    entries = nullptr;
+    names = nullptr;
+}
+
+bool AssetArchive::validateEntries() const
+{
+    // Everything is checked once here, so that the lookups can trust the index.
+    for(uint32_t i = 0; i < header->entryCount; ++i)
+    {
+        auto &entry = entries[i];
+        if(uint64_t(entry.nameOffset) + entry.nameLength > header->namesSize ||
+            entry.dataOffset > mappedFile.size || entry.storedSize > mappedFile.size - entry.dataOffset)
+            return false;
+
+        if(entry.compression == AssetArchiveCompression::None && entry.storedSize != entry.size)
+            return false;
+
+        if(entry.type == AssetArchiveEntryType::Image &&
+            (entry.pitch < uint64_t(entry.width)*4 || uint64_t(entry.pitch)*entry.height > entry.size))
+            return false;
+
+        if(i > 0 && compareEntryName(names + entries[i - 1].nameOffset, entries[i - 1].nameLength,
+            names + entry.nameOffset, entry.nameLength) >= 0)
+            return false;
+    }
+
+    return true;
+}
+
+const AssetArchiveEntry *AssetArchive::findEntry(const char *name) const
+{
+    if(!isOpen())
+        return nullptr;
+
+    auto nameLength = strlen(name);
+    size_t first = 0;
+    size_t last = header->entryCount;
+    while(first < last)
+    {
+        auto middle = first + (last - first) / 2;
+        auto &entry = entries[middle];
+        auto comparison = compareEntryName(names + entry.nameOffset, entry.nameLength, name, nameLength);
+        if(comparison == 0)
+            return &entry;
+        else if(comparison < 0)
+            first = middle + 1;
+        else
+            last = middle;
+    }
+
+    return nullptr;
+}
+
+Image *AssetArchive::loadImage(const char *name) const
+{
+    auto entry = findEntry(name);
+    if(!entry || entry->type != AssetArchiveEntryType::Image)
+        return nullptr;
+
+    auto result = ImagePtr(new Image);
+    result->width = entry->width;
+    result->height = entry->height;
+    result->pitch = entry->pitch;
+    result->bpp = 32;
+
+    switch(entry->compression)
+    {
+    case AssetArchiveCompression::None:
+        result->pixels = getEntryData(*entry);
+        break;
+#ifdef HAVE_LZ4
+    case AssetArchiveCompression::LZ4:
+        {
+            result->data.reset(new uint8_t[entry->size]);
+            auto decompressedSize = LZ4_decompress_safe(reinterpret_cast<const char*> (getEntryData(*entry)),
+                reinterpret_cast<char*> (result->data.get()), int(entry->storedSize), int(entry->size));
+            if(decompressedSize < 0 || uint64_t(decompressedSize) != entry->size)
+            {
+                fprintf(stderr, "Failed to decompress the image %s\n", name);
+                return nullptr;
+            }
+            result->pixels = result->data.get();
+        }
+        break;
+#endif
+    default:
+        fprintf(stderr, "The image %s uses an unsupported compression\n", name);
+        return nullptr;
+    }
+
+    return result.release();
+}
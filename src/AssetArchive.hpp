@@ -0,0 +1,121 @@
+#ifndef SIMPLE_GAME_TEMPLATE_ASSET_ARCHIVE_HPP
+#define SIMPLE_GAME_TEMPLATE_ASSET_ARCHIVE_HPP
+
+#include "Image.hpp"
+#include "VirtualMemory.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+// The sound samples are packed in the format used for opening the audio device.
+static constexpr uint32_t AssetArchiveSoundFrequency = 44100;
+static constexpr uint32_t AssetArchiveSoundChannels = 2;
+
+// The data of every entry starts at this alignment inside of the archive.
+static constexpr uint64_t AssetArchiveDataAlignment = 64;
+
+namespace AssetArchiveEntryType
+{
+
+enum Type
+{
+    // ABGR8888 pixels.
+    Image = 0,
+
+    // Interleaved samples in the format of the audio device.
+    SoundSample,
+};
+
+}
+
+namespace AssetArchiveCompression
+{
+
+enum Type
+{
+    None = 0,
+    LZ4,
+};
+
+}
+
+/**
+ * The header at the beginning of an asset archive. The data of the entries
+ * follows the header, and the index with the entries sorted by name and their
+ * names is at the end of the file.
+ */
+struct AssetArchiveHeader
+{
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t entryCount;
+    uint64_t entriesOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+
+    void initialize();
+    bool isValid(uint64_t fileSize) const;
+};
+
+struct AssetArchiveEntry
+{
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t type;
+    uint32_t compression;
+    uint64_t dataOffset;
+    uint64_t storedSize;
+    uint64_t size;
+
+    // Image entries.
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+
+    // Sound sample entries. The format is an SDL audio format.
+    uint32_t frequency;
+    uint32_t channels;
+    uint32_t sampleFormat;
+};
+
+static_assert(sizeof(AssetArchiveEntry) == 64, "The asset archive entries must be tightly packed");
+
+/**
+ * An asset archive that is mapped into memory. The uncompressed images are
+ * returned as views of the mapping, so they are valid until the archive is
+ * closed.
+ */
+class AssetArchive
+{
+public:
+    AssetArchive();
+    ~AssetArchive();
+
+    bool open(const char *fileName);
+    void close();
+
+    bool isOpen() const
+    {
+        return mappedFile.data != nullptr;
+    }
+
+    // Returns nullptr when the archive does not have an entry with the name.
+    const AssetArchiveEntry *findEntry(const char *name) const;
+
+    const uint8_t *getEntryData(const AssetArchiveEntry &entry) const
+    {
+        return mappedFile.data + entry.dataOffset;
+    }
+
+    // Returns nullptr when the archive does not have an image with the name.
+    Image *loadImage(const char *name) const;
+
+private:
+    bool validateEntries() const;
+
+    VirtualMemory::MappedFile mappedFile;
+    const AssetArchiveHeader *header;
+    const AssetArchiveEntry *entries;
+    const char *names;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_ASSET_ARCHIVE_HPP
@@ -0,0 +1,442 @@
+#include "SDL.h"
+#include "SDL_image.h"
+#include "AssetArchive.hpp"
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <sys/stat.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+/**
+ * Packs the assets directory into a single archive, with the images already
+ * converted into ABGR8888 and the sound samples into the format of the audio
+ * device. The hosts map the archive instead of decoding the files at startup.
+ */
+
+// Appends the paths of the files below the directory, relative to the root.
+static void listFiles(const std::string &root, const std::string &relativePath, std::vector<std::string> &result)
+{
+    auto directoryPath = relativePath.empty() ? root : root + "/" + relativePath;
+#ifdef _WIN32
+    WIN32_FIND_DATAA findData;
+    auto findHandle = FindFirstFileA((directoryPath + "/*").c_str(), &findData);
+    if(findHandle == INVALID_HANDLE_VALUE)
+        return;
+
+    do
+    {
+        std::string name = findData.cFileName;
+        if(name == "." || name == "..")
+            continue;
+
+        auto path = relativePath.empty() ? name : relativePath + "/" + name;
+        if(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+            listFiles(root, path, result);
+        else
+            result.push_back(path);
+    } while(FindNextFileA(findHandle, &findData));
+    FindClose(findHandle);
+#else
+    auto directory = opendir(directoryPath.c_str());
+    if(!directory)
+        return;
+
+    while(auto entry = readdir(directory))
+    {
+        std::string name = entry->d_name;
+        if(name == "." || name == "..")
+            continue;
+
+        auto path = relativePath.empty() ? name : relativePath + "/" + name;
+        struct stat fileStat;
+        if(stat((root + "/" + path).c_str(), &fileStat) != 0)
+            continue;
+
+        if(S_ISDIR(fileStat.st_mode))
+            listFiles(root, path, result);
+        else if(S_ISREG(fileStat.st_mode))
+            result.push_back(path);
+    }
+    closedir(directory);
+#endif
+}
+
+static bool hasExtension(const std::string &path, const char *extension)
+{
+    auto extensionLength = strlen(extension);
+    if(path.size() < extensionLength)
+        return false;
+
+    auto pathExtension = path.substr(path.size() - extensionLength);
+    std::transform(pathExtension.begin(), pathExtension.end(), pathExtension.begin(), ::tolower);
+    return pathExtension == extension;
+}
+
+static bool isImagePath(const std::string &path)
+{
+    return hasExtension(path, ".png") || hasExtension(path, ".jpg") || hasExtension(path, ".jpeg") ||
+        hasExtension(path, ".bmp") || hasExtension(path, ".tga");
+}
+
+static bool isSoundSamplePath(const std::string &path)
+{
+    return hasExtension(path, ".wav");
+}
+
+class ArchiveWriter
+{
+public:
+    ArchiveWriter()
+        : file(nullptr), position(0), compressionEnabled(false), storedBytes(0), uncompressedBytes(0) {}
+
+    ~ArchiveWriter()
+    {
+        if(file)
+            fclose(file);
+    }
+
+    bool begin(const char *fileName, bool enableCompression)
+    {
+        file = fopen(fileName, "wb");
+        if(!file)
+        {
+            fprintf(stderr, "Failed to create the asset archive %s\n", fileName);
+            return false;
+        }
+
+        compressionEnabled = enableCompression;
+
+        // The header is written again at the end, once the index is known.
+        AssetArchiveHeader header;
+        header.initialize();
+        return write(&header, sizeof(header));
+    }
+
+    bool addImage(const std::string &name, const std::string &path)
+    {
+        auto surface = IMG_Load(path.c_str());
+        if(!surface)
+        {
+            fprintf(stderr, "Failed to load image %s: %s\n", path.c_str(), IMG_GetError());
+            return false;
+        }
+
+        auto convertedSurface = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0);
+        SDL_FreeSurface(surface);
+        if(!convertedSurface)
+        {
+            fprintf(stderr, "Failed to convert image %s: %s\n", path.c_str(), SDL_GetError());
+            return false;
+        }
+
+        // The rows are stored without padding.
+        AssetArchiveEntry entry = makeEntry(name, AssetArchiveEntryType::Image);
+        entry.width = convertedSurface->w;
+        entry.height = convertedSurface->h;
+        entry.pitch = entry.width*4;
+        std::vector<uint8_t> pixels(size_t(entry.pitch)*entry.height);
+        for(uint32_t y = 0; y < entry.height; ++y)
+            memcpy(&pixels[y*entry.pitch], reinterpret_cast<uint8_t*> (convertedSurface->pixels) + y*convertedSurface->pitch, entry.pitch);
+        SDL_FreeSurface(convertedSurface);
+
+        return addEntryData(entry, pixels.data(), pixels.size(), compressionEnabled);
+    }
+
+    bool addSoundSample(const std::string &name, const std::string &path)
+    {
+        SDL_AudioSpec spec;
+        Uint8 *buffer = nullptr;
+        Uint32 bufferSize = 0;
+        if(!SDL_LoadWAV(path.c_str(), &spec, &buffer, &bufferSize))
+        {
+            fprintf(stderr, "Failed to load sound sample %s: %s\n", path.c_str(), SDL_GetError());
+            return false;
+        }
+
+        SDL_AudioCVT conversion;
+        auto conversionResult = SDL_BuildAudioCVT(&conversion, spec.format, spec.channels, spec.freq,
+            AUDIO_S16SYS, Uint8(AssetArchiveSoundChannels), int(AssetArchiveSoundFrequency));
+        if(conversionResult < 0)
+        {
+            fprintf(stderr, "Failed to convert sound sample %s: %s\n", path.c_str(), SDL_GetError());
+            SDL_FreeWAV(buffer);
+            return false;
+        }
+
+        std::vector<uint8_t> samples(size_t(bufferSize)*std::max(conversion.len_mult, 1));
+        memcpy(samples.data(), buffer, bufferSize);
+        SDL_FreeWAV(buffer);
+        size_t samplesSize = bufferSize;
+        if(conversionResult > 0)
+        {
+            conversion.buf = samples.data();
+            conversion.len = int(bufferSize);
+            if(SDL_ConvertAudio(&conversion) < 0)
+            {
+                fprintf(stderr, "Failed to convert sound sample %s: %s\n", path.c_str(), SDL_GetError());
+                return false;
+            }
+            samplesSize = size_t(conversion.len_cvt);
+        }
+
+        AssetArchiveEntry entry = makeEntry(name, AssetArchiveEntryType::SoundSample);
+        entry.frequency = AssetArchiveSoundFrequency;
+        entry.channels = AssetArchiveSoundChannels;
+        entry.sampleFormat = AUDIO_S16SYS;
+
+        // The mixer plays the samples directly from the mapping, so they are never compressed.
+        return addEntryData(entry, samples.data(), samplesSize, false);
+    }
+
+    bool end()
+    {
+        // The index is written after the data, with the entries in the order of
+        // their names for the binary search.
+        std::sort(entries.begin(), entries.end(), [this](const AssetArchiveEntry &a, const AssetArchiveEntry &b) {
+            return getEntryName(a) < getEntryName(b);
+        });
+
+        if(!alignPosition())
+            return false;
+
+        AssetArchiveHeader header;
+        header.initialize();
+        header.entryCount = uint32_t(entries.size());
+        header.entriesOffset = position;
+        header.namesOffset = header.entriesOffset + entries.size()*sizeof(AssetArchiveEntry);
+        header.namesSize = names.size();
+        if(!write(entries.data(), entries.size()*sizeof(AssetArchiveEntry)) ||
+            !write(names.data(), names.size()))
+            return false;
+
+        auto headerWritten = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+        auto closed = fclose(file) == 0;
+        file = nullptr;
+        if(!headerWritten || !closed)
+        {
+            fprintf(stderr, "Failed to write the asset archive index\n");
+            return false;
+        }
+
+        return true;
+    }
+
+    size_t getEntryCount() const
+    {
+        return entries.size();
+    }
+
+    uint64_t getStoredBytes() const
+    {
+        return storedBytes;
+    }
+
+    uint64_t getUncompressedBytes() const
+    {
+        return uncompressedBytes;
+    }
+
+private:
+    AssetArchiveEntry makeEntry(const std::string &name, AssetArchiveEntryType::Type type)
+    {
+        AssetArchiveEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.nameOffset = uint32_t(names.size());
+        entry.nameLength = uint32_t(name.size());
+        entry.type = type;
+        names.insert(names.end(), name.begin(), name.end());
+        return entry;
+    }
+
+    std::string getEntryName(const AssetArchiveEntry &entry) const
+    {
+        return std::string(names.data() + entry.nameOffset, entry.nameLength);
+    }
+
+    bool addEntryData(AssetArchiveEntry &entry, const uint8_t *data, size_t size, bool compress)
+    {
+        if(!alignPosition())
+            return false;
+
+        entry.dataOffset = position;
+        entry.size = size;
+        entry.storedSize = size;
+        entry.compression = AssetArchiveCompression::None;
+
+#ifdef HAVE_LZ4
+        std::unique_ptr<char[]> compressedData;
+        if(compress && size > 0 && size <= size_t(LZ4_MAX_INPUT_SIZE))
+        {
+            auto compressedBound = LZ4_compressBound(int(size));
+            compressedData.reset(new char[compressedBound]);
+            auto compressedSize = LZ4_compress_default(reinterpret_cast<const char*> (data), compressedData.get(), int(size), compressedBound);
+
+            // Incompressible data is kept as it is, so that it can be used without a copy.
+            if(compressedSize > 0 && size_t(compressedSize) < size - size / 8)
+            {
+                entry.compression = AssetArchiveCompression::LZ4;
+                entry.storedSize = size_t(compressedSize);
+                data = reinterpret_cast<const uint8_t*> (compressedData.get());
+            }
+        }
+#else
+        (void)compress;
+#endif
+
+        storedBytes += entry.storedSize;
+        uncompressedBytes += entry.size;
+        entries.push_back(entry);
+        return write(data, size_t(entry.storedSize));
+    }
+
+    bool alignPosition()
+    {
+        static const uint8_t padding[AssetArchiveDataAlignment] = {};
+        auto paddingSize = size_t((AssetArchiveDataAlignment - position % AssetArchiveDataAlignment) % AssetArchiveDataAlignment);
+        return write(padding, paddingSize);
+    }
+
+    bool write(const void *data, size_t size)
+    {
+        if(size > 0 && fwrite(data, size, 1, file) != 1)
+        {
+            fprintf(stderr, "Failed to write into the asset archive\n");
+            return false;
+        }
+
+        position += size;
+        return true;
+    }
+
+    FILE *file;
+    uint64_t position;
+    bool compressionEnabled;
+    std::vector<AssetArchiveEntry> entries;
+    std::vector<char> names;
+    uint64_t storedBytes;
+    uint64_t uncompressedBytes;
+};
+
+struct ArchiveStatistics
+{
+    size_t entryCount;
+    uint64_t storedBytes;
+    uint64_t uncompressedBytes;
+};
+
+static bool packAssets(const std::string &assetsDirectory, const std::string &archiveFileName, bool compressionEnabled, ArchiveStatistics &statistics)
+{
+    std::vector<std::string> files;
+    listFiles(assetsDirectory, std::string(), files);
+    std::sort(files.begin(), files.end());
+
+    ArchiveWriter writer;
+    if(!writer.begin(archiveFileName.c_str(), compressionEnabled))
+        return false;
+
+    for(auto &name : files)
+    {
+        auto path = assetsDirectory + "/" + name;
+        bool added = true;
+        if(isImagePath(name))
+            added = writer.addImage(name, path);
+        else if(isSoundSamplePath(name))
+            added = writer.addSoundSample(name, path);
+        else
+            printf("Skipping %s\n", name.c_str());
+
+        if(!added)
+            return false;
+    }
+
+    if(!writer.end())
+        return false;
+
+    statistics.entryCount = writer.getEntryCount();
+    statistics.storedBytes = writer.getStoredBytes();
+    statistics.uncompressedBytes = writer.getUncompressedBytes();
+    return true;
+}
+
+static void printHelp()
+{
+    printf("Usage: SimpleGameTemplateAssetPacker [options] <assets directory> <archive>\n");
+#ifdef HAVE_LZ4
+    printf("  --lz4                     Compress the images with LZ4.\n");
+#else
+    printf("  --lz4                     Compress the images with LZ4. Not available in this build.\n");
+#endif
+}
+
+int main(int argc, char* argv[])
+{
+    bool compressionEnabled = false;
+    std::vector<std::string> positionalArguments;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--lz4")
+        {
+            compressionEnabled = true;
+        }
+        else if(arg == "-h" || arg == "--help")
+        {
+            printHelp();
+            return 0;
+        }
+        else if(!arg.empty() && arg[0] == '-')
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            printHelp();
+            return 1;
+        }
+        else
+        {
+            positionalArguments.push_back(arg);
+        }
+    }
+
+    if(positionalArguments.size() != 2)
+    {
+        printHelp();
+        return 1;
+    }
+
+#ifndef HAVE_LZ4
+    if(compressionEnabled)
+    {
+        fprintf(stderr, "LZ4 is not available in this build, the images are stored uncompressed\n");
+        compressionEnabled = false;
+    }
+#endif
+
+    IMG_Init(IMG_INIT_PNG | IMG_INIT_JPG);
+    auto &archiveFileName = positionalArguments[1];
+    ArchiveStatistics statistics;
+    auto succeeded = packAssets(positionalArguments[0], archiveFileName, compressionEnabled, statistics);
+    IMG_Quit();
+    if(!succeeded)
+    {
+        remove(archiveFileName.c_str());
+        return 1;
+    }
+
+    printf("Packed %u assets into %s: %.1f MB stored, %.1f MB uncompressed\n",
+        unsigned(statistics.entryCount), archiveFileName.c_str(),
+        statistics.storedBytes / (1024.0*1024.0), statistics.uncompressedBytes / (1024.0*1024.0));
+    return 0;
+}
@@ -0,0 +1,301 @@
+#include "AsyncAssetLoader.hpp"
+#include "Profiler.hpp"
+#include <stdio.h>
+
+// The handles hold the slot index plus one in the low bits, and the generation
+// of the slot in the high bits, so that stale handles are detected.
+static constexpr uint32_t HandleIndexBits = 20;
+static constexpr uint32_t HandleIndexMask = (1u << HandleIndexBits) - 1;
+static constexpr uint32_t HandleGenerationMask = (1u << (32 - HandleIndexBits)) - 1;
+
+static AssetHandle makeHandle(uint32_t slotIndex, uint32_t generation)
+{
+    return ((generation & HandleGenerationMask) << HandleIndexBits) | (slotIndex + 1);
+}
+
+AsyncAssetLoader::AsyncAssetLoader()
+    : host(nullptr), memoryBudget(DefaultMemoryBudget), shuttingDown(false), nextSequence(0), loadedBytes(0)
+{
+}
+
+AsyncAssetLoader::~AsyncAssetLoader()
+{
+    shutdown();
+}
+
+void AsyncAssetLoader::start(HostInterface *theHost, size_t threadCount, size_t theMemoryBudget)
+{
+    shutdown();
+
+    host = theHost;
+    memoryBudget = theMemoryBudget;
+    shuttingDown = false;
+#ifdef __EMSCRIPTEN__
+    // Emscripten builds are single threaded.
+    (void)threadCount;
+#else
+    for(size_t i = 0; i < threadCount; ++i)
+        workers.push_back(std::thread([this]() { workerThreadEntry(); }));
+#endif
+}
+
+void AsyncAssetLoader::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shuttingDown = true;
+    }
+    requestAvailableCondition.notify_all();
+
+    for(auto &worker : workers)
+        worker.join();
+    workers.clear();
+
+    for(auto &slot : slots)
+    {
+        delete slot.image;
+        delete slot.soundSample;
+    }
+    slots.clear();
+    freeSlots.clear();
+    slotsByKey.clear();
+    queue = std::priority_queue<QueuedRequest> ();
+    loadedBytes = 0;
+}
+
+AssetHandle AsyncAssetLoader::requestImage(const char *fileName, AssetLoadPriority::Type priority)
+{
+    return request(ImageAsset, fileName, priority);
+}
+
+AssetHandle AsyncAssetLoader::requestSoundSample(const char *fileName, AssetLoadPriority::Type priority)
+{
+    return request(SoundSampleAsset, fileName, priority);
+}
+
+AssetHandle AsyncAssetLoader::request(AssetType type, const char *fileName, AssetLoadPriority::Type priority)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto key = std::string(1, char('0' + type)) + fileName;
+    auto it = slotsByKey.find(key);
+    if(it != slotsByKey.end())
+    {
+        auto &slot = slots[it->second];
+        ++slot.referenceCount;
+        if(slot.status == AssetLoadStatus::Queued && priority > slot.priority)
+        {
+            slot.priority = priority;
+            pushRequest(it->second);
+        }
+        return makeHandle(it->second, slot.generation);
+    }
+
+    uint32_t slotIndex;
+    if(!freeSlots.empty())
+    {
+        slotIndex = freeSlots.back();
+        freeSlots.pop_back();
+    }
+    else
+    {
+        if(slots.size() >= HandleIndexMask)
+        {
+            fprintf(stderr, "Too many assets requested\n");
+            return 0;
+        }
+
+        slotIndex = uint32_t(slots.size());
+        slots.push_back(Slot());
+        slots.back().generation = 0;
+        slots.back().image = nullptr;
+        slots.back().soundSample = nullptr;
+    }
+
+    auto &slot = slots[slotIndex];
+    slot.type = type;
+    slot.status = AssetLoadStatus::Queued;
+    slot.priority = priority;
+    slot.referenceCount = 1;
+    slot.key = key;
+    slot.byteSize = 0;
+    slotsByKey[key] = slotIndex;
+    auto handle = makeHandle(slotIndex, slot.generation);
+    pushRequest(slotIndex);
+
+    // Without worker threads, the request is served right away.
+    if(workers.empty())
+    {
+        uint32_t pendingSlotIndex;
+        while(popRequest(pendingSlotIndex))
+            loadSlot(lock, pendingSlotIndex);
+    }
+
+    return handle;
+}
+
+AsyncAssetLoader::Slot *AsyncAssetLoader::findSlot(AssetHandle handle)
+{
+    auto slotIndex = (handle & HandleIndexMask);
+    if(slotIndex == 0 || slotIndex > slots.size())
+        return nullptr;
+
+    auto &slot = slots[slotIndex - 1];
+    if(slot.status == AssetLoadStatus::Invalid || makeHandle(slotIndex - 1, slot.generation) != handle)
+        return nullptr;
+    return &slot;
+}
+
+AssetLoadStatus::Type AsyncAssetLoader::getStatus(AssetHandle handle)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto slot = findSlot(handle);
+    return slot ? slot->status : AssetLoadStatus::Invalid;
+}
+
+Image *AsyncAssetLoader::getImage(AssetHandle handle)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto slot = findSlot(handle);
+    return slot && slot->status == AssetLoadStatus::Loaded ? slot->image : nullptr;
+}
+
+SoundSamplePtr AsyncAssetLoader::getSoundSample(AssetHandle handle)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto slot = findSlot(handle);
+    return slot && slot->status == AssetLoadStatus::Loaded ? slot->soundSample : nullptr;
+}
+
+void AsyncAssetLoader::release(AssetHandle handle)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto slot = findSlot(handle);
+    if(!slot || --slot->referenceCount > 0)
+        return;
+
+    // A slot that is being loaded is freed by its loader thread.
+    slotsByKey.erase(slot->key);
+    if(slot->status != AssetLoadStatus::Loading)
+        freeSlot(uint32_t(slot - slots.data()));
+
+    // Releasing memory may unblock the requests that wait for the budget.
+    if(workers.empty())
+    {
+        uint32_t pendingSlotIndex;
+        while(popRequest(pendingSlotIndex))
+            loadSlot(lock, pendingSlotIndex);
+    }
+    else
+    {
+        requestAvailableCondition.notify_all();
+    }
+}
+
+size_t AsyncAssetLoader::getLoadedBytes()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    return loadedBytes;
+}
+
+void AsyncAssetLoader::pushRequest(uint32_t slotIndex)
+{
+    auto &slot = slots[slotIndex];
+    queue.push(QueuedRequest{slot.priority, nextSequence++, slotIndex, slot.generation});
+    requestAvailableCondition.notify_one();
+}
+
+bool AsyncAssetLoader::popRequest(uint32_t &slotIndex)
+{
+    while(!queue.empty())
+    {
+        auto request = queue.top();
+        auto &slot = slots[request.slotIndex];
+        if(slot.generation != request.generation || slot.status != AssetLoadStatus::Queued || slot.priority != request.priority)
+        {
+            queue.pop();
+            continue;
+        }
+
+        // The queue is ordered by priority, so everything else waits too.
+        if(request.priority != AssetLoadPriority::Urgent && loadedBytes >= memoryBudget)
+            return false;
+
+        queue.pop();
+        slotIndex = request.slotIndex;
+        return true;
+    }
+
+    return false;
+}
+
+void AsyncAssetLoader::loadSlot(std::unique_lock<std::mutex> &lock, uint32_t slotIndex)
+{
+    slots[slotIndex].status = AssetLoadStatus::Loading;
+    auto type = slots[slotIndex].type;
+    auto fileName = slots[slotIndex].key.substr(1);
+
+    // The decoding is done without holding the lock.
+    lock.unlock();
+    Image *image = nullptr;
+    SoundSample *soundSample = nullptr;
+    size_t byteSize = 0;
+    {
+        PROFILE_ZONE("Load asset");
+        if(type == ImageAsset)
+        {
+            image = host->loadImage(fileName.c_str());
+            if(image && image->data)
+                byteSize = size_t(image->pitch)*image->height;
+        }
+        else
+        {
+            soundSample = host->loadSoundSample(fileName.c_str());
+            if(soundSample)
+                byteSize = soundSample->getByteSize();
+        }
+    }
+    lock.lock();
+
+    // The slots may have been reallocated while loading.
+    auto &slot = slots[slotIndex];
+    slot.image = image;
+    slot.soundSample = soundSample;
+    slot.byteSize = byteSize;
+    loadedBytes += byteSize;
+    if(slot.referenceCount == 0)
+        freeSlot(slotIndex);
+    else
+        slot.status = image || soundSample ? AssetLoadStatus::Loaded : AssetLoadStatus::Failed;
+}
+
+void AsyncAssetLoader::freeSlot(uint32_t slotIndex)
+{
+    auto &slot = slots[slotIndex];
+    delete slot.image;
+    delete slot.soundSample;
+    loadedBytes -= slot.byteSize;
+
+    slot.image = nullptr;
+    slot.soundSample = nullptr;
+    slot.byteSize = 0;
+    slot.status = AssetLoadStatus::Invalid;
+    slot.key.clear();
+    ++slot.generation;
+    freeSlots.push_back(slotIndex);
+}
+
+void AsyncAssetLoader::workerThreadEntry()
+{
+    Profiler::singleton.setThreadName("Asset loader");
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;)
+    {
+        uint32_t slotIndex = 0;
+        while(!shuttingDown && !popRequest(slotIndex))
+            requestAvailableCondition.wait(lock);
+        if(shuttingDown)
+            return;
+
+        loadSlot(lock, slotIndex);
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef SIMPLE_GAME_TEMPLATE_ASYNC_ASSET_LOADER_HPP
+#define SIMPLE_GAME_TEMPLATE_ASYNC_ASSET_LOADER_HPP
+
+#include "HostInterface.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Loads the assets of the asynchronous HostInterface requests in background
+ * threads, by calling the synchronous loads of the host. The pending requests
+ * are served in priority order, and the ones that are not urgent wait while
+ * the loaded assets exceed the memory budget.
+ */
+class AsyncAssetLoader
+{
+public:
+    static constexpr size_t DefaultThreadCount = 2;
+    static constexpr size_t DefaultMemoryBudget = size_t(512)*1024*1024;
+
+    AsyncAssetLoader();
+    ~AsyncAssetLoader();
+
+    // Without threads the assets are loaded when they are requested.
+    void start(HostInterface *theHost, size_t threadCount, size_t theMemoryBudget);
+
+    // Stops the threads, and destroys all of the loaded assets.
+    void shutdown();
+
+    AssetHandle requestImage(const char *fileName, AssetLoadPriority::Type priority);
+    AssetHandle requestSoundSample(const char *fileName, AssetLoadPriority::Type priority);
+    AssetLoadStatus::Type getStatus(AssetHandle handle);
+    Image *getImage(AssetHandle handle);
+    SoundSamplePtr getSoundSample(AssetHandle handle);
+    void release(AssetHandle handle);
+
+    size_t getLoadedBytes();
+
+private:
+    enum AssetType
+    {
+        ImageAsset = 0,
+        SoundSampleAsset,
+    };
+
+    struct Slot
+    {
+        uint32_t generation;
+        AssetType type;
+        AssetLoadStatus::Type status;
+        AssetLoadPriority::Type priority;
+        uint32_t referenceCount;
+        std::string key;
+        Image *image;
+        SoundSample *soundSample;
+        size_t byteSize;
+    };
+
+    // Entries with an outdated priority or generation are skipped when they
+    // are popped, instead of being removed from the queue.
+    struct QueuedRequest
+    {
+        AssetLoadPriority::Type priority;
+        uint64_t sequence;
+        uint32_t slotIndex;
+        uint32_t generation;
+
+        bool operator<(const QueuedRequest &other) const
+        {
+            if(priority != other.priority)
+                return priority < other.priority;
+            return sequence > other.sequence;
+        }
+    };
+
+    AssetHandle request(AssetType type, const char *fileName, AssetLoadPriority::Type priority);
+    Slot *findSlot(AssetHandle handle);
+    void pushRequest(uint32_t slotIndex);
+    bool popRequest(uint32_t &slotIndex);
+    void loadSlot(std::unique_lock<std::mutex> &lock, uint32_t slotIndex);
+    void freeSlot(uint32_t slotIndex);
+    void workerThreadEntry();
+
+    HostInterface *host;
+    size_t memoryBudget;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable requestAvailableCondition;
+    bool shuttingDown;
+
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::unordered_map<std::string, uint32_t> slotsByKey;
+    std::priority_queue<QueuedRequest> queue;
+    uint64_t nextSequence;
+    size_t loadedBytes;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_ASYNC_ASSET_LOADER_HPP
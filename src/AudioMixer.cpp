@@ -0,0 +1,453 @@
+#include "AudioMixer.hpp"
+#include "AudioStream.hpp"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define AUDIO_MIXER_SSE2
+#include <emmintrin.h>
+#endif
+
+// Adds the samples multiplied by the channel gains into the mix buffer.
+static void accumulateSamples(float *mixBuffer, const int16_t *samples, size_t frameCount, float leftGain, float rightGain)
+{
+    size_t sampleIndex = 0;
+    auto sampleCount = frameCount*AudioMixer::ChannelCount;
+#ifdef AUDIO_MIXER_SSE2
+    auto gains = _mm_setr_ps(leftGain, rightGain, leftGain, rightGain);
+    for(; sampleIndex + 8 <= sampleCount; sampleIndex += 8)
+    {
+        // Sign extend the 16 bits samples by shifting them from the high half.
+        auto packed = _mm_loadu_si128(reinterpret_cast<const __m128i*> (samples + sampleIndex));
+        auto low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(packed, packed), 16));
+        auto high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(packed, packed), 16));
+        auto mixLow = _mm_loadu_ps(mixBuffer + sampleIndex);
+        auto mixHigh = _mm_loadu_ps(mixBuffer + sampleIndex + 4);
+        _mm_storeu_ps(mixBuffer + sampleIndex, _mm_add_ps(mixLow, _mm_mul_ps(low, gains)));
+        _mm_storeu_ps(mixBuffer + sampleIndex + 4, _mm_add_ps(mixHigh, _mm_mul_ps(high, gains)));
+    }
+#endif
+
+    for(; sampleIndex < sampleCount; sampleIndex += 2)
+    {
+        mixBuffer[sampleIndex] += float(samples[sampleIndex])*leftGain;
+        mixBuffer[sampleIndex + 1] += float(samples[sampleIndex + 1])*rightGain;
+    }
+}
+
+// Rounds the mixed samples to the nearest integer, and saturates them.
+static void convertMixBuffer(int16_t *output, const float *mixBuffer, size_t frameCount)
+{
+    size_t sampleIndex = 0;
+    auto sampleCount = frameCount*AudioMixer::ChannelCount;
+#ifdef AUDIO_MIXER_SSE2
+    // The conversion of out of range values is undefined, so they are clamped first.
+    auto minimum = _mm_set1_ps(-32768.0f);
+    auto maximum = _mm_set1_ps(32767.0f);
+    for(; sampleIndex + 8 <= sampleCount; sampleIndex += 8)
+    {
+        auto low = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_load_ps(mixBuffer + sampleIndex), minimum), maximum));
+        auto high = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(_mm_load_ps(mixBuffer + sampleIndex + 4), minimum), maximum));
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (output + sampleIndex), _mm_packs_epi32(low, high));
+    }
+#endif
+
+    for(; sampleIndex < sampleCount; ++sampleIndex)
+    {
+        auto sample = std::min(std::max(mixBuffer[sampleIndex], -32768.0f), 32767.0f);
+        output[sampleIndex] = int16_t(lrintf(sample));
+    }
+}
+
+AudioMixer::AudioMixer()
+    : frequency(0), nextVoiceId(1), hasPendingReleasedResource(false)
+{
+    memset(voices, 0, sizeof(voices));
+}
+
+AudioMixer::~AudioMixer()
+{
+    shutdown();
+}
+
+void AudioMixer::initialize(uint32_t theFrequency)
+{
+    shutdown();
+    frequency = theFrequency;
+}
+
+void AudioMixer::shutdown()
+{
+    // The audio thread is not running anymore, so the resources of the pending
+    // release commands are released here.
+    collectReleasedResources();
+    if(hasPendingReleasedResource)
+        releaseResource(pendingReleasedResource);
+    hasPendingReleasedResource = false;
+
+    Command command;
+    for(;;)
+    {
+        if(!commands.pop(command))
+        {
+            if(overflowCommands.empty())
+                break;
+            command = overflowCommands.front();
+            overflowCommands.erase(overflowCommands.begin());
+        }
+
+        if(command.type == ReleaseBufferCommand || command.type == ReleaseStreamCommand)
+            releaseResource(ReleasedResource{command.buffer, command.stream});
+    }
+
+    memset(voices, 0, sizeof(voices));
+}
+
+AudioMixer::Command AudioMixer::makeCommand(CommandType type, AudioVoiceId voiceId)
+{
+    return Command{type, voiceId, nullptr, nullptr, false, 0, 0, 0};
+}
+
+AudioVoiceId AudioMixer::allocateVoiceId()
+{
+    auto voiceId = nextVoiceId++;
+    if(nextVoiceId == 0)
+        nextVoiceId = 1;
+    return voiceId;
+}
+
+AudioVoiceId AudioMixer::play(const AudioBuffer *buffer, bool looped, float volume, float pan)
+{
+    auto command = makeCommand(PlayCommand, allocateVoiceId());
+    command.buffer = buffer;
+    command.looped = looped;
+    command.volume = volume;
+    command.pan = pan;
+    sendCommand(command);
+    return command.voiceId;
+}
+
+AudioVoiceId AudioMixer::playStream(AudioStream *stream, float volume, float pan)
+{
+    auto command = makeCommand(PlayStreamCommand, allocateVoiceId());
+    command.stream = stream;
+    command.volume = volume;
+    command.pan = pan;
+    sendCommand(command);
+    return command.voiceId;
+}
+
+void AudioMixer::pause(AudioVoiceId voiceId)
+{
+    sendCommand(makeCommand(PauseCommand, voiceId));
+}
+
+void AudioMixer::resume(AudioVoiceId voiceId)
+{
+    sendCommand(makeCommand(ResumeCommand, voiceId));
+}
+
+void AudioMixer::stop(AudioVoiceId voiceId)
+{
+    sendCommand(makeCommand(StopCommand, voiceId));
+}
+
+void AudioMixer::seek(AudioVoiceId voiceId, uint64_t frame)
+{
+    auto command = makeCommand(SeekCommand, voiceId);
+    command.position = frame;
+    sendCommand(command);
+}
+
+void AudioMixer::setVolume(AudioVoiceId voiceId, float volume, float pan)
+{
+    auto command = makeCommand(SetVolumeCommand, voiceId);
+    command.volume = volume;
+    command.pan = pan;
+    sendCommand(command);
+}
+
+void AudioMixer::releaseBuffer(AudioBuffer *buffer)
+{
+    auto command = makeCommand(ReleaseBufferCommand, 0);
+    command.buffer = buffer;
+    sendCommand(command);
+}
+
+void AudioMixer::releaseStream(AudioStream *stream)
+{
+    auto command = makeCommand(ReleaseStreamCommand, 0);
+    command.stream = stream;
+    sendCommand(command);
+}
+
+void AudioMixer::sendCommand(const Command &command)
+{
+    // The commands that do not fit are kept in order, and sent later.
+    if(!overflowCommands.empty() || !commands.push(command))
+        overflowCommands.push_back(command);
+}
+
+void AudioMixer::releaseResource(const ReleasedResource &resource)
+{
+    delete resource.buffer;
+    if(resource.stream)
+        resource.stream->close();
+}
+
+void AudioMixer::collectReleasedResources()
+{
+    ReleasedResource resource;
+    while(releasedResources.pop(resource))
+        releaseResource(resource);
+
+    size_t sentCount = 0;
+    while(sentCount < overflowCommands.size() && commands.push(overflowCommands[sentCount]))
+        ++sentCount;
+    overflowCommands.erase(overflowCommands.begin(), overflowCommands.begin() + sentCount);
+}
+
+void AudioMixer::processCommands()
+{
+    // A released resource that did not fit in the queue is sent before anything else.
+    if(hasPendingReleasedResource)
+    {
+        if(!releasedResources.push(pendingReleasedResource))
+            return;
+        hasPendingReleasedResource = false;
+    }
+
+    Command command;
+    while(!hasPendingReleasedResource && commands.pop(command))
+        processCommand(command);
+}
+
+void AudioMixer::startVoice(const Command &command)
+{
+    // When every voice is busy, the sound is dropped.
+    auto voice = findVoice(0);
+    if(!voice)
+        return;
+
+    voice->id = command.voiceId;
+    voice->buffer = command.buffer;
+    voice->stream = command.stream;
+    voice->position = 0;
+    voice->looped = command.looped;
+    voice->paused = false;
+    voice->leftGain = command.volume*std::min(1.0f, 1.0f - command.pan);
+    voice->rightGain = command.volume*std::min(1.0f, 1.0f + command.pan);
+}
+
+void AudioMixer::processCommand(const Command &command)
+{
+    switch(command.type)
+    {
+    case PlayCommand:
+        if(command.buffer && command.buffer->frameCount > 0)
+            startVoice(command);
+        break;
+    case PlayStreamCommand:
+        startVoice(command);
+        break;
+    case PauseCommand:
+    case ResumeCommand:
+        {
+            auto voice = findVoice(command.voiceId);
+            if(voice)
+                voice->paused = command.type == PauseCommand;
+        }
+        break;
+    case StopCommand:
+        {
+            auto voice = findVoice(command.voiceId);
+            if(voice)
+                voice->id = 0;
+        }
+        break;
+    case SeekCommand:
+        {
+            // The streams are sought by their decoder instead.
+            auto voice = findVoice(command.voiceId);
+            if(!voice || !voice->buffer)
+                break;
+
+            if(command.position < voice->buffer->frameCount)
+                voice->position = size_t(command.position);
+            else if(voice->looped)
+                voice->position = size_t(command.position % voice->buffer->frameCount);
+            else
+                voice->id = 0;
+        }
+        break;
+    case SetVolumeCommand:
+        {
+            auto voice = findVoice(command.voiceId);
+            if(voice)
+            {
+                voice->leftGain = command.volume*std::min(1.0f, 1.0f - command.pan);
+                voice->rightGain = command.volume*std::min(1.0f, 1.0f + command.pan);
+            }
+        }
+        break;
+    case ReleaseBufferCommand:
+    case ReleaseStreamCommand:
+        {
+            for(auto &voice : voices)
+            {
+                if(voice.id && ((command.buffer && voice.buffer == command.buffer) || (command.stream && voice.stream == command.stream)))
+                    voice.id = 0;
+            }
+
+            auto resource = ReleasedResource{command.buffer, command.stream};
+            if(!releasedResources.push(resource))
+            {
+                pendingReleasedResource = resource;
+                hasPendingReleasedResource = true;
+            }
+        }
+        break;
+    }
+}
+
+AudioMixer::Voice *AudioMixer::findVoice(AudioVoiceId voiceId)
+{
+    for(auto &voice : voices)
+    {
+        if(voice.id == voiceId)
+            return &voice;
+    }
+
+    return nullptr;
+}
+
+void AudioMixer::mix(int16_t *output, size_t frameCount)
+{
+    // Not profiled, because a zone locks the profiler and allocates the
+    // buffer of the thread, which the audio callback must not do.
+    processCommands();
+
+    while(frameCount > 0)
+    {
+        auto chunkFrameCount = std::min(frameCount, size_t(MixChunkFrameCount));
+        memset(mixBuffer, 0, chunkFrameCount*ChannelCount*sizeof(float));
+        for(auto &voice : voices)
+        {
+            if(!voice.id || voice.paused)
+                continue;
+
+            if(voice.stream)
+                mixStreamVoice(voice, chunkFrameCount);
+            else
+                mixVoice(voice, chunkFrameCount);
+        }
+
+        convertMixBuffer(output, mixBuffer, chunkFrameCount);
+        output += chunkFrameCount*ChannelCount;
+        frameCount -= chunkFrameCount;
+    }
+}
+
+void AudioMixer::mixVoice(Voice &voice, size_t frameCount)
+{
+    size_t mixedFrameCount = 0;
+    while(mixedFrameCount < frameCount)
+    {
+        // Looped voices wrap around without a gap.
+        auto segmentFrameCount = std::min(frameCount - mixedFrameCount, voice.buffer->frameCount - voice.position);
+        accumulateSamples(mixBuffer + mixedFrameCount*ChannelCount, voice.buffer->samples + voice.position*ChannelCount,
+            segmentFrameCount, voice.leftGain, voice.rightGain);
+        mixedFrameCount += segmentFrameCount;
+        voice.position += segmentFrameCount;
+        if(voice.position < voice.buffer->frameCount)
+            continue;
+
+        voice.position = 0;
+        if(!voice.looped)
+        {
+            voice.id = 0;
+            return;
+        }
+    }
+}
+
+void AudioMixer::mixStreamVoice(Voice &voice, size_t frameCount)
+{
+    size_t mixedFrameCount = 0;
+    while(mixedFrameCount < frameCount)
+    {
+        // When the decoding falls behind, the rest of the chunk is silent.
+        const int16_t *samples;
+        auto segmentFrameCount = std::min(frameCount - mixedFrameCount, voice.stream->beginRead(samples));
+        if(segmentFrameCount == 0)
+        {
+            if(voice.stream->hasEnded())
+                voice.id = 0;
+            return;
+        }
+
+        accumulateSamples(mixBuffer + mixedFrameCount*ChannelCount, samples, segmentFrameCount, voice.leftGain, voice.rightGain);
+        voice.stream->endRead(segmentFrameCount);
+        mixedFrameCount += segmentFrameCount;
+    }
+}
+
+AudioMixerSoundSample::AudioMixerSoundSample(AudioMixer &theMixer, AudioBuffer *theBuffer)
+    : mixer(theMixer), buffer(theBuffer), voiceId(0), hasBeenPlayed(false), volume(1.0f), pan(0.0f)
+{
+}
+
+AudioMixerSoundSample::~AudioMixerSoundSample()
+{
+    // A sample that was never played can be destroyed in any thread, such as
+    // the asset loading threads.
+    if(hasBeenPlayed)
+        mixer.releaseBuffer(buffer);
+    else
+        delete buffer;
+}
+
+void AudioMixerSoundSample::play(bool looped)
+{
+    voiceId = mixer.play(buffer, looped, volume, pan);
+    hasBeenPlayed = true;
+}
+
+void AudioMixerSoundSample::resume()
+{
+    if(voiceId)
+        mixer.resume(voiceId);
+}
+
+void AudioMixerSoundSample::pause()
+{
+    if(voiceId)
+        mixer.pause(voiceId);
+}
+
+void AudioMixerSoundSample::stop()
+{
+    if(voiceId)
+        mixer.stop(voiceId);
+    voiceId = 0;
+}
+
+void AudioMixerSoundSample::seek(double seconds)
+{
+    if(voiceId)
+        mixer.seek(voiceId, uint64_t(std::max(seconds, 0.0)*mixer.getFrequency()));
+}
+
+void AudioMixerSoundSample::setVolume(float newVolume, float newPan)
+{
+    volume = newVolume;
+    pan = std::min(std::max(newPan, -1.0f), 1.0f);
+    if(voiceId)
+        mixer.setVolume(voiceId, volume, pan);
+}
+
+size_t AudioMixerSoundSample::getByteSize() const
+{
+    return buffer->ownedSamples ? buffer->frameCount*AudioMixer::ChannelCount*sizeof(int16_t) : 0;
+}
@@ -0,0 +1,182 @@
+#ifndef SIMPLE_GAME_TEMPLATE_AUDIO_MIXER_HPP
+#define SIMPLE_GAME_TEMPLATE_AUDIO_MIXER_HPP
+
+#include "SoundSample.hpp"
+#include "SpscQueue.hpp"
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+/**
+ * Interleaved stereo signed 16 bits samples at the frequency of the mixer.
+ * The samples are either owned by the buffer, or they point into memory that
+ * outlives it, such as a mapped asset archive.
+ */
+struct AudioBuffer
+{
+    AudioBuffer()
+        : samples(nullptr), frameCount(0) {}
+
+    const int16_t *samples;
+    size_t frameCount;
+    std::unique_ptr<int16_t[]> ownedSamples;
+};
+
+typedef uint32_t AudioVoiceId;
+
+class AudioStream;
+
+/**
+ * A software mixer that runs in the audio callback. The game thread controls
+ * the voices through a lock free command queue, so it never waits for the
+ * audio thread, and the audio thread never waits for it or allocates memory.
+ *
+ * Only a single thread may send commands, and only a single thread may call
+ * mix. Without an audio device, mix can be called by the same thread for
+ * rendering the audio into a buffer.
+ */
+class AudioMixer
+{
+public:
+    static constexpr uint32_t ChannelCount = 2;
+    static constexpr size_t MaxVoiceCount = 32;
+    static constexpr uint32_t DefaultBufferFrameCount = 512;
+
+    AudioMixer();
+    ~AudioMixer();
+
+    void initialize(uint32_t theFrequency);
+    void shutdown();
+
+    uint32_t getFrequency() const
+    {
+        return frequency;
+    }
+
+    // Game thread. The voice starts from the beginning of the buffer. The pan
+    // goes from -1 for the left channel to 1 for the right channel.
+    AudioVoiceId play(const AudioBuffer *buffer, bool looped, float volume, float pan);
+    void pause(AudioVoiceId voiceId);
+    void resume(AudioVoiceId voiceId);
+    void stop(AudioVoiceId voiceId);
+    void seek(AudioVoiceId voiceId, uint64_t frame);
+    void setVolume(AudioVoiceId voiceId, float volume, float pan);
+
+    // Game thread. The stream keeps playing from where its decoding is, and
+    // it is looped by its decoder. A stream must only be played by one voice.
+    AudioVoiceId playStream(AudioStream *stream, float volume, float pan);
+
+    // Game thread. The buffer is destroyed, and the stream is closed, once the
+    // audio thread is not using them anymore, by a later call to
+    // collectReleasedResources.
+    void releaseBuffer(AudioBuffer *buffer);
+    void releaseStream(AudioStream *stream);
+    void collectReleasedResources();
+
+    // Audio thread. Writes interleaved stereo samples.
+    void mix(int16_t *output, size_t frameCount);
+
+private:
+    enum CommandType
+    {
+        PlayCommand = 0,
+        PauseCommand,
+        ResumeCommand,
+        StopCommand,
+        SeekCommand,
+        SetVolumeCommand,
+        PlayStreamCommand,
+        ReleaseBufferCommand,
+        ReleaseStreamCommand,
+    };
+
+    struct Command
+    {
+        CommandType type;
+        AudioVoiceId voiceId;
+        const AudioBuffer *buffer;
+        AudioStream *stream;
+        bool looped;
+        float volume;
+        float pan;
+        uint64_t position;
+    };
+
+    // Only one of the pointers is set.
+    struct ReleasedResource
+    {
+        const AudioBuffer *buffer;
+        AudioStream *stream;
+    };
+
+    struct Voice
+    {
+        AudioVoiceId id;
+        const AudioBuffer *buffer;
+        AudioStream *stream;
+        size_t position;
+        bool looped;
+        bool paused;
+        float leftGain;
+        float rightGain;
+    };
+
+    static constexpr size_t CommandQueueCapacity = 256;
+    static constexpr size_t MixChunkFrameCount = 256;
+
+    static Command makeCommand(CommandType type, AudioVoiceId voiceId);
+
+    AudioVoiceId allocateVoiceId();
+    void sendCommand(const Command &command);
+    void processCommands();
+    void processCommand(const Command &command);
+    void startVoice(const Command &command);
+    void releaseResource(const ReleasedResource &resource);
+    Voice *findVoice(AudioVoiceId voiceId);
+    void mixVoice(Voice &voice, size_t frameCount);
+    void mixStreamVoice(Voice &voice, size_t frameCount);
+
+    uint32_t frequency;
+    AudioVoiceId nextVoiceId;
+    SpscQueue<Command, CommandQueueCapacity> commands;
+    SpscQueue<ReleasedResource, CommandQueueCapacity> releasedResources;
+
+    // Game thread.
+    std::vector<Command> overflowCommands;
+
+    // Audio thread.
+    Voice voices[MaxVoiceCount];
+    bool hasPendingReleasedResource;
+    ReleasedResource pendingReleasedResource;
+    alignas(16) float mixBuffer[MixChunkFrameCount*ChannelCount];
+};
+
+/**
+ * A sound sample that is played by the software mixer. Playing it again
+ * starts a new voice, and the other functions control the last voice.
+ */
+class AudioMixerSoundSample : public SoundSample
+{
+public:
+    AudioMixerSoundSample(AudioMixer &theMixer, AudioBuffer *theBuffer);
+    ~AudioMixerSoundSample();
+
+    virtual void play(bool looped) override;
+    virtual void resume() override;
+    virtual void pause() override;
+    virtual void stop() override;
+    virtual void seek(double seconds) override;
+    virtual void setVolume(float newVolume, float newPan) override;
+    virtual size_t getByteSize() const override;
+
+private:
+    AudioMixer &mixer;
+    AudioBuffer *buffer;
+    AudioVoiceId voiceId;
+    bool hasBeenPlayed;
+    float volume;
+    float pan;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_AUDIO_MIXER_HPP
@@ -0,0 +1,550 @@
+#include "AudioStream.hpp"
+#include "Profiler.hpp"
+#include "SDL.h"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+static constexpr size_t OutputFrameSize = AudioMixer::ChannelCount*sizeof(int16_t);
+
+/**
+ * Reads the samples of a stream, and converts them into the format of the
+ * mixer when they are in another format.
+ */
+struct AudioStreamDecoder
+{
+    AudioStreamDecoder()
+        : source(nullptr), conversion(nullptr), dataOffset(0), frameCount(0), frameSize(0),
+          frequency(0), outputFrequency(0), position(0), isFlushed(false) {}
+
+    ~AudioStreamDecoder()
+    {
+        if(conversion)
+            SDL_FreeAudioStream(conversion);
+        if(source)
+            SDL_RWclose(source);
+    }
+
+    bool initialize(uint64_t dataSize, SDL_AudioFormat format, uint32_t channels, uint32_t theFrequency, uint32_t theOutputFrequency)
+    {
+        frameSize = uint32_t(channels*(SDL_AUDIO_BITSIZE(format) / 8));
+        if(frameSize == 0 || theFrequency == 0)
+            return false;
+
+        frequency = theFrequency;
+        outputFrequency = theOutputFrequency;
+        frameCount = dataSize / frameSize;
+        if(format != AUDIO_S16SYS || channels != AudioMixer::ChannelCount || frequency != outputFrequency)
+        {
+            conversion = SDL_NewAudioStream(format, Uint8(channels), int(frequency), AUDIO_S16SYS, Uint8(AudioMixer::ChannelCount), int(outputFrequency));
+            if(!conversion)
+            {
+                fprintf(stderr, "Failed to create an audio conversion stream: %s\n", SDL_GetError());
+                return false;
+            }
+            chunk.reset(new uint8_t[AudioStream::DecodeChunkFrameCount*frameSize]);
+        }
+
+        return seekSource(0);
+    }
+
+    bool seekSource(uint64_t frame)
+    {
+        position = frame;
+        return SDL_RWseek(source, dataOffset + Sint64(frame*frameSize), RW_SEEK_SET) >= 0;
+    }
+
+    // The frame is given in the output frequency.
+    void seek(uint64_t outputFrame, bool looped)
+    {
+        auto frame = outputFrame*frequency / outputFrequency;
+        if(frame >= frameCount)
+            frame = looped && frameCount > 0 ? frame % frameCount : frameCount;
+
+        if(conversion)
+            SDL_AudioStreamClear(conversion);
+        isFlushed = false;
+        seekSource(frame);
+    }
+
+    // Looped streams go back to the beginning of the data without flushing
+    // the conversion, so that there is no gap in the resampled output.
+    size_t read(int16_t *output, size_t outputFrameCount, bool looped, bool &ended)
+    {
+        return conversion ? readConverted(output, outputFrameCount, looped, ended) : readDirect(output, outputFrameCount, looped, ended);
+    }
+
+    size_t readDirect(int16_t *output, size_t outputFrameCount, bool looped, bool &ended)
+    {
+        size_t readFrameCount = 0;
+        while(readFrameCount < outputFrameCount)
+        {
+            if(position >= frameCount)
+            {
+                if(!looped || frameCount == 0 || !seekSource(0))
+                {
+                    ended = true;
+                    break;
+                }
+            }
+
+            auto count = size_t(std::min(uint64_t(outputFrameCount - readFrameCount), frameCount - position));
+            count = SDL_RWread(source, output + readFrameCount*AudioMixer::ChannelCount, frameSize, count);
+            if(count == 0)
+            {
+                ended = true;
+                break;
+            }
+
+            position += count;
+            readFrameCount += count;
+        }
+
+        return readFrameCount;
+    }
+
+    size_t readConverted(int16_t *output, size_t outputFrameCount, bool looped, bool &ended)
+    {
+        size_t readFrameCount = 0;
+        while(readFrameCount < outputFrameCount)
+        {
+            auto availableFrameCount = size_t(SDL_AudioStreamAvailable(conversion)) / OutputFrameSize;
+            if(availableFrameCount > 0)
+            {
+                auto count = std::min(availableFrameCount, outputFrameCount - readFrameCount);
+                auto gotten = SDL_AudioStreamGet(conversion, output + readFrameCount*AudioMixer::ChannelCount, int(count*OutputFrameSize));
+                if(gotten <= 0)
+                {
+                    ended = true;
+                    break;
+                }
+
+                readFrameCount += size_t(gotten) / OutputFrameSize;
+                continue;
+            }
+
+            if(isFlushed)
+            {
+                ended = true;
+                break;
+            }
+
+            if(position >= frameCount && looped && frameCount > 0)
+                seekSource(0);
+
+            size_t count = 0;
+            if(position < frameCount)
+            {
+                count = size_t(std::min(uint64_t(AudioStream::DecodeChunkFrameCount), frameCount - position));
+                count = SDL_RWread(source, chunk.get(), frameSize, count);
+            }
+
+            // The end of the data, or a read error, flushes the resampler.
+            if(count == 0 || SDL_AudioStreamPut(conversion, chunk.get(), int(count*frameSize)) < 0)
+            {
+                SDL_AudioStreamFlush(conversion);
+                isFlushed = true;
+                continue;
+            }
+
+            position += count;
+        }
+
+        return readFrameCount;
+    }
+
+    SDL_RWops *source;
+    SDL_AudioStream *conversion;
+    Sint64 dataOffset;
+    uint64_t frameCount;
+    uint32_t frameSize;
+    uint32_t frequency;
+    uint32_t outputFrequency;
+    uint64_t position;
+    bool isFlushed;
+    std::unique_ptr<uint8_t[]> chunk;
+};
+
+static uint16_t readLittleEndian16(const uint8_t *source)
+{
+    return uint16_t(source[0] | (source[1] << 8));
+}
+
+static uint32_t readLittleEndian32(const uint8_t *source)
+{
+    return uint32_t(readLittleEndian16(source)) | (uint32_t(readLittleEndian16(source + 2)) << 16);
+}
+
+// Finds the format and the samples of a RIFF wave file.
+static bool parseWaveHeader(SDL_RWops *source, SDL_AudioFormat &format, uint32_t &channels, uint32_t &frequency, Sint64 &dataOffset, uint64_t &dataSize)
+{
+    uint8_t header[12];
+    if(SDL_RWread(source, header, sizeof(header), 1) != 1 || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+        return false;
+
+    bool hasFormat = false;
+    uint8_t chunkHeader[8];
+    while(SDL_RWread(source, chunkHeader, sizeof(chunkHeader), 1) == 1)
+    {
+        auto chunkSize = readLittleEndian32(chunkHeader + 4);
+        auto chunkOffset = SDL_RWtell(source);
+        if(memcmp(chunkHeader, "fmt ", 4) == 0)
+        {
+            uint8_t formatChunk[26];
+            if(chunkSize < 16 || SDL_RWread(source, formatChunk, std::min(size_t(chunkSize), sizeof(formatChunk)), 1) != 1)
+                return false;
+
+            // The extensible format keeps the actual format in its sub format.
+            auto formatTag = readLittleEndian16(formatChunk);
+            if(formatTag == 0xFFFE && chunkSize >= 26)
+                formatTag = readLittleEndian16(formatChunk + 24);
+
+            channels = readLittleEndian16(formatChunk + 2);
+            frequency = readLittleEndian32(formatChunk + 4);
+            auto bitsPerSample = readLittleEndian16(formatChunk + 14);
+            if(formatTag == 1 && bitsPerSample == 8)
+                format = AUDIO_U8;
+            else if(formatTag == 1 && bitsPerSample == 16)
+                format = AUDIO_S16LSB;
+            else if(formatTag == 1 && bitsPerSample == 32)
+                format = AUDIO_S32LSB;
+            else if(formatTag == 3 && bitsPerSample == 32)
+                format = AUDIO_F32LSB;
+            else
+                return false;
+            hasFormat = channels > 0;
+        }
+        else if(memcmp(chunkHeader, "data", 4) == 0)
+        {
+            dataOffset = chunkOffset;
+            dataSize = chunkSize;
+            return hasFormat;
+        }
+
+        // The chunks are padded to an even size.
+        if(SDL_RWseek(source, chunkOffset + Sint64(chunkSize) + (chunkSize & 1), RW_SEEK_SET) < 0)
+            return false;
+    }
+
+    return false;
+}
+
+AudioStream::AudioStream()
+    : closed(false), requestedGeneration(0), requestedFrame(0), requestedLooped(false),
+      decodedGeneration(0), decodedLooped(false), decodedEnd(false), waitingForReader(false),
+      writeFrame(0), generationStartFrame(0), generation(0), endedGeneration(0),
+      readFrame(0), readGeneration(0)
+{
+}
+
+AudioStream::~AudioStream()
+{
+}
+
+bool AudioStream::openWaveFile(const char *fileName, uint32_t outputFrequency)
+{
+    auto source = SDL_RWFromFile(fileName, "rb");
+    if(!source)
+        return false;
+
+    decoder.reset(new AudioStreamDecoder);
+    decoder->source = source;
+    SDL_AudioFormat format = 0;
+    uint32_t channels = 0;
+    uint32_t frequency = 0;
+    uint64_t dataSize = 0;
+    if(!parseWaveHeader(source, format, channels, frequency, decoder->dataOffset, dataSize) ||
+        !decoder->initialize(dataSize, format, channels, frequency, outputFrequency))
+    {
+        decoder.reset();
+        return false;
+    }
+
+    ringSamples.reset(new int16_t[RingFrameCount*AudioMixer::ChannelCount]);
+    return true;
+}
+
+bool AudioStream::openSamples(const void *data, size_t size, uint32_t frequency, uint32_t channels, uint16_t sampleFormat, uint32_t outputFrequency)
+{
+    auto source = SDL_RWFromConstMem(data, int(size));
+    if(!source)
+        return false;
+
+    decoder.reset(new AudioStreamDecoder);
+    decoder->source = source;
+    if(!decoder->initialize(size, sampleFormat, channels, frequency, outputFrequency))
+    {
+        decoder.reset();
+        return false;
+    }
+
+    ringSamples.reset(new int16_t[RingFrameCount*AudioMixer::ChannelCount]);
+    return true;
+}
+
+void AudioStream::requestPlayback(uint64_t frame, bool looped)
+{
+    auto nextGeneration = requestedGeneration.load(std::memory_order_relaxed) + 1;
+    if(nextGeneration == 0)
+        nextGeneration = 1;
+
+    requestedFrame.store(frame, std::memory_order_relaxed);
+    requestedLooped.store(looped, std::memory_order_relaxed);
+    requestedGeneration.store(nextGeneration, std::memory_order_release);
+}
+
+void AudioStream::close()
+{
+    closed.store(true, std::memory_order_release);
+}
+
+bool AudioStream::decode()
+{
+    if(!decoder)
+        return false;
+
+    // A new request discards everything that was decoded before it.
+    auto requested = requestedGeneration.load(std::memory_order_acquire);
+    if(requested != decodedGeneration)
+    {
+        decodedLooped = requestedLooped.load(std::memory_order_relaxed);
+        decoder->seek(requestedFrame.load(std::memory_order_relaxed), decodedLooped);
+        decodedGeneration = requested;
+        decodedEnd = false;
+        waitingForReader = true;
+        generationStartFrame.store(writeFrame.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        generation.store(requested, std::memory_order_release);
+    }
+
+    if(decodedGeneration == 0 || decodedEnd)
+        return false;
+
+    auto write = writeFrame.load(std::memory_order_relaxed);
+    auto freeFrameCount = RingFrameCount - (write - readFrame.load(std::memory_order_acquire));
+    if(freeFrameCount < DecodeChunkFrameCount)
+        return false;
+    waitingForReader = false;
+
+    auto contiguousFrameCount = RingFrameCount - (write & (RingFrameCount - 1));
+    auto frameCount = std::min(std::min(freeFrameCount, contiguousFrameCount), size_t(DecodeChunkFrameCount));
+    auto decodedFrameCount = decoder->read(getFrame(write), frameCount, decodedLooped, decodedEnd);
+    writeFrame.store(write + decodedFrameCount, std::memory_order_release);
+    if(decodedEnd)
+        endedGeneration.store(decodedGeneration, std::memory_order_release);
+    return decodedFrameCount > 0 || decodedEnd;
+}
+
+size_t AudioStream::beginRead(const int16_t *&samples)
+{
+    auto read = readFrame.load(std::memory_order_relaxed);
+    auto currentGeneration = generation.load(std::memory_order_acquire);
+    if(currentGeneration != readGeneration)
+    {
+        read = std::max(read, generationStartFrame.load(std::memory_order_relaxed));
+        readFrame.store(read, std::memory_order_release);
+        readGeneration = currentGeneration;
+    }
+
+    // The old frames are not played while a request waits for its decoding.
+    samples = getFrame(read);
+    if(requestedGeneration.load(std::memory_order_acquire) != readGeneration)
+        return 0;
+
+    auto availableFrameCount = writeFrame.load(std::memory_order_acquire) - read;
+    return std::min(availableFrameCount, RingFrameCount - (read & (RingFrameCount - 1)));
+}
+
+void AudioStream::endRead(size_t frameCount)
+{
+    readFrame.store(readFrame.load(std::memory_order_relaxed) + frameCount, std::memory_order_release);
+}
+
+bool AudioStream::hasEnded()
+{
+    // The end is loaded before the available frames, so that the frames that
+    // are decoded right before the end are not missed.
+    auto ended = endedGeneration.load(std::memory_order_acquire);
+    const int16_t *samples;
+    if(beginRead(samples) > 0)
+        return false;
+
+    return ended != 0 && ended == readGeneration && requestedGeneration.load(std::memory_order_relaxed) == readGeneration;
+}
+
+AudioStreamer::AudioStreamer()
+    : isWoken(false), shuttingDown(false)
+{
+}
+
+AudioStreamer::~AudioStreamer()
+{
+    shutdown();
+}
+
+void AudioStreamer::start(bool threaded)
+{
+    shutdown();
+
+    shuttingDown = false;
+#ifdef __EMSCRIPTEN__
+    // Emscripten builds are single threaded.
+    (void)threaded;
+#else
+    if(threaded)
+        thread = std::thread([this]() { threadEntry(); });
+#endif
+}
+
+void AudioStreamer::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shuttingDown = true;
+    }
+    wakeCondition.notify_all();
+    if(thread.joinable())
+        thread.join();
+
+    for(auto stream : streams)
+        delete stream;
+    streams.clear();
+    for(auto stream : addedStreams)
+        delete stream;
+    addedStreams.clear();
+}
+
+void AudioStreamer::addStream(AudioStream *stream)
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        addedStreams.push_back(stream);
+    }
+    wake();
+}
+
+void AudioStreamer::wake()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        isWoken = true;
+    }
+    wakeCondition.notify_one();
+}
+
+void AudioStreamer::update()
+{
+    if(!thread.joinable())
+        decodeStreams();
+}
+
+bool AudioStreamer::decodeStreams()
+{
+    PROFILE_ZONE("Decode audio streams");
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        streams.insert(streams.end(), addedStreams.begin(), addedStreams.end());
+        addedStreams.clear();
+    }
+
+    // The closed streams are destroyed by the thread that decodes them.
+    streams.erase(std::remove_if(streams.begin(), streams.end(), [](AudioStream *stream) {
+        if(!stream->isClosed())
+            return false;
+        delete stream;
+        return true;
+    }), streams.end());
+
+    // The chunks are interleaved, so that one stream does not delay the others.
+    bool hasDecoded = true;
+    while(hasDecoded)
+    {
+        hasDecoded = false;
+        for(auto stream : streams)
+            hasDecoded = stream->decode() || hasDecoded;
+    }
+
+    return std::any_of(streams.begin(), streams.end(), [](AudioStream *stream) {
+        return stream->isWaitingForReader();
+    });
+}
+
+void AudioStreamer::threadEntry()
+{
+    Profiler::singleton.setThreadName("Audio streaming");
+    std::unique_lock<std::mutex> lock(mutex);
+    while(!shuttingDown)
+    {
+        isWoken = false;
+        lock.unlock();
+        auto isWaitingForReader = decodeStreams();
+        lock.lock();
+
+        // A restarted stream is polled more often, since its ring buffer is
+        // freed by the audio thread, which never wakes this thread.
+        auto interval = isWaitingForReader ? ShortPollingIntervalMilliseconds : PollingIntervalMilliseconds;
+        if(!isWoken && !shuttingDown)
+            wakeCondition.wait_for(lock, std::chrono::milliseconds(interval));
+    }
+}
+
+AudioStreamSoundSample::AudioStreamSoundSample(AudioMixer &theMixer, AudioStreamer &theStreamer, AudioStream *theStream)
+    : mixer(theMixer), streamer(theStreamer), stream(theStream), voiceId(0), isLooped(false), hasBeenPlayed(false), volume(1.0f), pan(0.0f)
+{
+}
+
+AudioStreamSoundSample::~AudioStreamSoundSample()
+{
+    if(hasBeenPlayed)
+        mixer.releaseStream(stream);
+    else
+        stream->close();
+}
+
+void AudioStreamSoundSample::play(bool looped)
+{
+    if(voiceId)
+        mixer.stop(voiceId);
+
+    stream->requestPlayback(0, looped);
+    streamer.wake();
+    voiceId = mixer.playStream(stream, volume, pan);
+    isLooped = looped;
+    hasBeenPlayed = true;
+}
+
+void AudioStreamSoundSample::resume()
+{
+    if(voiceId)
+        mixer.resume(voiceId);
+}
+
+void AudioStreamSoundSample::pause()
+{
+    if(voiceId)
+        mixer.pause(voiceId);
+}
+
+void AudioStreamSoundSample::stop()
+{
+    if(voiceId)
+        mixer.stop(voiceId);
+    voiceId = 0;
+}
+
+void AudioStreamSoundSample::seek(double seconds)
+{
+    if(!voiceId)
+        return;
+
+    stream->requestPlayback(uint64_t(std::max(seconds, 0.0)*mixer.getFrequency()), isLooped);
+    streamer.wake();
+}
+
+void AudioStreamSoundSample::setVolume(float newVolume, float newPan)
+{
+    volume = newVolume;
+    pan = std::min(std::max(newPan, -1.0f), 1.0f);
+    if(voiceId)
+        mixer.setVolume(voiceId, volume, pan);
+}
@@ -0,0 +1,173 @@
+#ifndef SIMPLE_GAME_TEMPLATE_AUDIO_STREAM_HPP
+#define SIMPLE_GAME_TEMPLATE_AUDIO_STREAM_HPP
+
+#include "AudioMixer.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct AudioStreamDecoder;
+
+/**
+ * A sound that is decoded in chunks while it plays, into a ring buffer that is
+ * read by the audio thread. The memory of a stream does not depend on the
+ * length of the sound, so it is meant for music and long ambience tracks.
+ *
+ * The ring buffer has a single producer, the streaming thread, and a single
+ * consumer, the audio thread. Playback restarts and seeks are requested by the
+ * game thread, and they are tagged with a generation, so that the audio thread
+ * discards the frames that were decoded before them.
+ */
+class AudioStream
+{
+public:
+    // About 0.75 seconds at 44100 Hz, or 128 KB per stream.
+    static constexpr size_t RingFrameCount = 32768;
+    static constexpr size_t DecodeChunkFrameCount = 4096;
+
+    AudioStream();
+    ~AudioStream();
+
+    // Opens a wave file with PCM or float samples. Compressed wave files are
+    // not supported, and they are left to the fully decoding loaders.
+    bool openWaveFile(const char *fileName, uint32_t outputFrequency);
+
+    // Streams raw interleaved samples that stay valid while the stream is
+    // alive, such as an entry of a mapped asset archive.
+    bool openSamples(const void *data, size_t size, uint32_t frequency, uint32_t channels, uint16_t sampleFormat, uint32_t outputFrequency);
+
+    // Game thread. Nothing is decoded until the first request.
+    void requestPlayback(uint64_t frame, bool looped);
+
+    // Any thread. The streaming thread destroys the stream later.
+    void close();
+
+    bool isClosed() const
+    {
+        return closed.load(std::memory_order_acquire);
+    }
+
+    // Streaming thread. Returns false when there is nothing to decode.
+    bool decode();
+
+    // Streaming thread. True while the frames of a previous request fill the
+    // ring buffer, until the audio thread discards them.
+    bool isWaitingForReader() const
+    {
+        return waitingForReader;
+    }
+
+    // Audio thread. Returns the frames that can be read contiguously.
+    size_t beginRead(const int16_t *&samples);
+    void endRead(size_t frameCount);
+
+    // Audio thread. True once every frame of a sound that is not looped is read.
+    bool hasEnded();
+
+private:
+    int16_t *getFrame(size_t frame)
+    {
+        return ringSamples.get() + (frame & (RingFrameCount - 1))*AudioMixer::ChannelCount;
+    }
+
+    std::unique_ptr<AudioStreamDecoder> decoder;
+    std::unique_ptr<int16_t[]> ringSamples;
+    std::atomic<bool> closed;
+
+    // Written by the game thread.
+    std::atomic<uint32_t> requestedGeneration;
+    std::atomic<uint64_t> requestedFrame;
+    std::atomic<bool> requestedLooped;
+
+    // Written by the streaming thread. The streams are allocated with the
+    // default alignment of new, so the sides are not aligned to cache lines.
+    uint32_t decodedGeneration;
+    bool decodedLooped;
+    bool decodedEnd;
+    bool waitingForReader;
+    std::atomic<size_t> writeFrame;
+    std::atomic<size_t> generationStartFrame;
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> endedGeneration;
+
+    // Written by the audio thread.
+    std::atomic<size_t> readFrame;
+    uint32_t readGeneration;
+};
+
+/**
+ * Decodes the open streams in a background thread. Without the thread, the
+ * streams are decoded by calling update.
+ */
+class AudioStreamer
+{
+public:
+    AudioStreamer();
+    ~AudioStreamer();
+
+    void start(bool threaded);
+
+    // Destroys all of the streams, so it must be called after the mixer is shut down.
+    void shutdown();
+
+    // Takes the ownership of the stream.
+    void addStream(AudioStream *stream);
+
+    // Decodes the pending chunks right away.
+    void wake();
+
+    // Decodes the streams when there is no streaming thread.
+    void update();
+
+private:
+    // The thread sleeps for at most this long, which is well below the
+    // duration of the ring buffers.
+    static constexpr int PollingIntervalMilliseconds = 10;
+    static constexpr int ShortPollingIntervalMilliseconds = 1;
+
+    // Returns true when a stream waits for the audio thread.
+    bool decodeStreams();
+    void threadEntry();
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    bool isWoken;
+    bool shuttingDown;
+    std::vector<AudioStream*> addedStreams;
+
+    // Owned by the thread that decodes.
+    std::vector<AudioStream*> streams;
+};
+
+/**
+ * A sound sample that is played from a stream. Playing it again restarts it.
+ */
+class AudioStreamSoundSample : public SoundSample
+{
+public:
+    AudioStreamSoundSample(AudioMixer &theMixer, AudioStreamer &theStreamer, AudioStream *theStream);
+    ~AudioStreamSoundSample();
+
+    virtual void play(bool looped) override;
+    virtual void resume() override;
+    virtual void pause() override;
+    virtual void stop() override;
+    virtual void seek(double seconds) override;
+    virtual void setVolume(float newVolume, float newPan) override;
+
+private:
+    AudioMixer &mixer;
+    AudioStreamer &streamer;
+    AudioStream *stream;
+    AudioVoiceId voiceId;
+    bool isLooped;
+    bool hasBeenPlayed;
+    float volume;
+    float pan;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_AUDIO_STREAM_HPP
@@ -0,0 +1,633 @@
+#include "SDL.h"
+#include "AudioMixer.hpp"
+#include "Blitter.hpp"
+#include "ControllerState.hpp"
+#include "GameInterface.hpp"
+#include "HostAssets.hpp"
+#include "HostInterface.hpp"
+#include "Profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern "C" GameInterface *getGameInterface();
+
+static constexpr uint32_t FramebufferWidth = 640;
+static constexpr uint32_t FramebufferHeight = 480;
+static constexpr uint32_t SpriteSize = 64;
+static constexpr uint32_t LoadedImageSize = 256;
+static constexpr size_t MixerVoiceCount = 16;
+static constexpr size_t MixerBufferFrameCount = AudioMixer::DefaultBufferFrameCount;
+static constexpr double DefaultRegressionThreshold = 10.0;
+
+// The results are added into it, so that the compiler keeps the work.
+static volatile uint64_t resultSink;
+
+// The game only renders, so the host provides nothing but the profiler.
+class BenchmarkHostInterface : public HostInterface
+{
+public:
+    virtual Image *loadImage(const char *) override { return nullptr; }
+    virtual SoundSamplePtr loadSoundSample(const char *) override { return nullptr; }
+    virtual SoundSamplePtr openSoundStream(const char *) override { return nullptr; }
+
+    virtual AssetHandle requestImage(const char *, AssetLoadPriority::Type) override { return 0; }
+    virtual AssetHandle requestSoundSample(const char *, AssetLoadPriority::Type) override { return 0; }
+    virtual AssetLoadStatus::Type getAssetLoadStatus(AssetHandle) override { return AssetLoadStatus::Invalid; }
+    virtual Image *getLoadedImage(AssetHandle) override { return nullptr; }
+    virtual SoundSamplePtr getLoadedSoundSample(AssetHandle) override { return nullptr; }
+    virtual void releaseAsset(AssetHandle) override {}
+
+    virtual uint32_t registerProfileZone(const char *name) override
+    {
+        return Profiler::singleton.registerProfileZone(name);
+    }
+
+    virtual void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime) override
+    {
+        Profiler::singleton.recordProfileZone(zoneId, startTime, endTime);
+    }
+
+    virtual void parallelFor(size_t count, HostParallelForFunction function, void *userData) override
+    {
+        for(size_t i = 0; i < count; ++i)
+            function(userData, i);
+    }
+
+    static BenchmarkHostInterface singleton;
+};
+
+BenchmarkHostInterface BenchmarkHostInterface::singleton;
+
+/**
+ * A primitive that is timed. The function runs the operation the given number
+ * of times, and the result is the time of a single operation.
+ */
+struct Benchmark
+{
+    std::string name;
+
+    // What an operation is, such as a frame or an allocation.
+    const char *operation;
+    std::function<void(uint64_t)> run;
+};
+
+struct BenchmarkResult
+{
+    std::string name;
+    const char *operation;
+    uint64_t iterationCount;
+    double medianNanoseconds;
+    double minimumNanoseconds;
+    double maximumNanoseconds;
+
+    // Filled in when comparing against a baseline.
+    bool hasBaseline;
+    double baselineNanoseconds;
+    bool isRegression;
+};
+
+static double secondsSince(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration<double> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+// The iteration count doubles until a sample takes long enough for the timer,
+// and every sample then runs that many iterations.
+static BenchmarkResult measure(const Benchmark &benchmark, int sampleCount, double minimumSampleTime)
+{
+    uint64_t iterationCount = 1;
+    for(;;)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        benchmark.run(iterationCount);
+        if(secondsSince(startTime) >= minimumSampleTime || iterationCount >= (uint64_t(1) << 40))
+            break;
+        iterationCount *= 2;
+    }
+
+    std::vector<double> samples;
+    for(int i = 0; i < sampleCount; ++i)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        benchmark.run(iterationCount);
+        samples.push_back(secondsSince(startTime)*1e9 / double(iterationCount));
+    }
+
+    std::sort(samples.begin(), samples.end());
+    BenchmarkResult result = {};
+    result.name = benchmark.name;
+    result.operation = benchmark.operation;
+    result.iterationCount = iterationCount;
+    result.medianNanoseconds = samples[samples.size() / 2];
+    result.minimumNanoseconds = samples.front();
+    result.maximumNanoseconds = samples.back();
+    return result;
+}
+
+// A 24 bits BMP file with a gradient, which the loading converts like the
+// images without alpha.
+static std::vector<uint8_t> makeBmpFile(uint32_t width, uint32_t height)
+{
+    auto rowSize = (width*3 + 3) & ~3u;
+    auto pixelOffset = 14u + 40u;
+    auto fileSize = pixelOffset + rowSize*height;
+    std::vector<uint8_t> file(fileSize, 0);
+    auto write16 = [&](size_t offset, uint32_t value) {
+        file[offset] = uint8_t(value);
+        file[offset + 1] = uint8_t(value >> 8);
+    };
+    auto write32 = [&](size_t offset, uint32_t value) {
+        write16(offset, value & 0xffff);
+        write16(offset + 2, value >> 16);
+    };
+
+    file[0] = 'B';
+    file[1] = 'M';
+    write32(2, fileSize);
+    write32(10, pixelOffset);
+    write32(14, 40);
+    write32(18, width);
+    write32(22, height);
+    write16(26, 1);
+    write16(28, 24);
+    write32(34, rowSize*height);
+    for(uint32_t y = 0; y < height; ++y)
+    {
+        auto row = &file[pixelOffset + (height - 1 - y)*rowSize];
+        for(uint32_t x = 0; x < width; ++x)
+        {
+            row[x*3] = uint8_t(x + y);
+            row[x*3 + 1] = uint8_t(y);
+            row[x*3 + 2] = uint8_t(x);
+        }
+    }
+
+    return file;
+}
+
+// A sprite with an opaque center, a translucent border and a transparent
+// corner, so that the blends take all of their paths.
+static void makeSprite(Image &image)
+{
+    image.width = SpriteSize;
+    image.height = SpriteSize;
+    image.pitch = SpriteSize*4;
+    image.bpp = 32;
+    image.data.reset(new uint8_t[image.pitch*image.height]);
+    image.pixels = image.data.get();
+    auto pixels = reinterpret_cast<uint32_t*> (image.data.get());
+    for(uint32_t y = 0; y < SpriteSize; ++y)
+    {
+        for(uint32_t x = 0; x < SpriteSize; ++x)
+        {
+            uint32_t alpha = 0xff;
+            if(x < 4 || y < 4 || x >= SpriteSize - 4 || y >= SpriteSize - 4)
+                alpha = 0x80;
+            if(x + y < 8)
+                alpha = 0;
+            pixels[y*SpriteSize + x] = (alpha << 24) | ((x*4) << 16) | ((y*4) << 8) | 0x40;
+        }
+    }
+}
+
+static void addMemoryZoneBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    auto zone = std::make_shared<MemoryZone> ();
+    zone->reserve(64*1024*1024);
+    benchmarks.push_back(Benchmark{"memory_zone/allocate_bytes_64", "allocation", [=](uint64_t iterationCount) {
+        zone->beginFrame();
+        for(uint64_t i = 0; i < iterationCount; ++i)
+        {
+            if((i & 0xffff) == 0xffff)
+                zone->beginFrame();
+            resultSink += reinterpret_cast<uintptr_t> (zone->allocateBytes(64));
+        }
+    }});
+
+    benchmarks.push_back(Benchmark{"memory_zone/allocate_array_1k", "allocation", [=](uint64_t iterationCount) {
+        zone->beginFrame();
+        for(uint64_t i = 0; i < iterationCount; ++i)
+        {
+            if((i & 0xfff) == 0xfff)
+                zone->beginFrame();
+            resultSink += zone->allocateArray<uint32_t> (256)[i & 0xff];
+        }
+    }});
+
+    // The reset of a heap zone clears all of its megabyte.
+    auto resetZone = std::make_shared<MemoryZone> ();
+    resetZone->reserve(1024*1024, MemoryZoneBackend::Heap);
+    benchmarks.push_back(Benchmark{"memory_zone/reset_heap_1m", "reset", [=](uint64_t iterationCount) {
+        for(uint64_t i = 0; i < iterationCount; ++i)
+        {
+            resetZone->allocateBytes(resetZone->getSize())[i & 0xfffff] = 1;
+            resetZone->reset();
+        }
+    }});
+}
+
+static void addControllerStateBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    // Every other state presses a button and moves a stick, like the merging
+    // of the keyboard and the gamepad in the host.
+    auto states = std::make_shared<std::vector<ControllerState>> (16);
+    for(size_t i = 0; i < states->size(); ++i)
+    {
+        auto &state = (*states)[i];
+        state.leftXAxis = (i & 1) ? 1.0f : 0.0f;
+        state.rightYAxis = (i & 2) ? -1.0f : 0.0f;
+        state.setButton(ControllerButton::A, (i & 1) != 0);
+        state.setButton(ControllerButton::Start, (i & 4) != 0);
+    }
+
+    benchmarks.push_back(Benchmark{"controller_state/apply_differences", "call", [=](uint64_t iterationCount) {
+        ControllerState current;
+        for(uint64_t i = 0; i < iterationCount; ++i)
+            current.applyDifferencesOf((*states)[i & 15], (*states)[(i + 1) & 15]);
+        resultSink += current.buttons;
+    }});
+}
+
+struct FramebufferFixture
+{
+    FramebufferFixture()
+    {
+        dirtyRegion.clear();
+        framebuffer.width = FramebufferWidth;
+        framebuffer.height = FramebufferHeight;
+        framebuffer.pitch = int(FramebufferWidth*sizeof(FramebufferPixel));
+        framebuffer.scale = 1.0f;
+        pixels.reset(new uint8_t[framebuffer.pitch*FramebufferHeight]());
+        framebuffer.pixels = pixels.get();
+        framebuffer.dirtyRegion = &dirtyRegion;
+    }
+
+    Framebuffer framebuffer;
+    FramebufferDirtyRegion dirtyRegion;
+    std::unique_ptr<uint8_t[]> pixels;
+};
+
+static void addFramebufferBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    auto fixture = std::make_shared<FramebufferFixture> ();
+    benchmarks.push_back(Benchmark{"framebuffer/fill_rect", "frame", [=](uint64_t iterationCount) {
+        auto view = fixture->framebuffer.getView();
+        for(uint64_t i = 0; i < iterationCount; ++i)
+            fillSurfaceRect(view, 0, 0, view.width, view.height, 0xff000000 | uint32_t(i));
+    }});
+
+    // The pattern of the template game, drawn as a single tile.
+    struct GameFixture
+    {
+        MemoryZone persistentMemory;
+        MemoryZone transientMemory;
+        MemoryZone snapshotMemory;
+        MemoryZone cacheMemory;
+        RenderSnapshot snapshot;
+        GameInterface *gameInterface;
+    };
+
+    auto game = std::make_shared<GameFixture> ();
+    game->persistentMemory.reserve(PersistentMemorySize);
+    game->transientMemory.reserve(TransientMemorySize);
+    game->snapshotMemory.reserve(RenderSnapshotMemorySize);
+    game->cacheMemory.reserve(RenderCacheMemorySize);
+    game->gameInterface = getGameInterface();
+    game->gameInterface->setPersistentMemory(&game->persistentMemory);
+    game->gameInterface->setTransientMemory(&game->transientMemory);
+    game->gameInterface->setHostInterface(&BenchmarkHostInterface::singleton);
+    auto snapshotData = game->gameInterface->makeRenderSnapshot(&game->snapshotMemory);
+    game->snapshot = RenderSnapshot{snapshotData, &game->snapshotMemory, &game->cacheMemory, 1.0f};
+    game->gameInterface->render(fixture->framebuffer, game->snapshot);
+
+    benchmarks.push_back(Benchmark{"framebuffer/game_render_tile", "frame", [=](uint64_t iterationCount) {
+        FramebufferTile tile = {0, 0, FramebufferWidth, FramebufferHeight};
+        for(uint64_t i = 0; i < iterationCount; ++i)
+            game->gameInterface->renderTile(fixture->framebuffer, game->snapshot, tile);
+    }});
+}
+
+static void addImageBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    auto file = std::make_shared<std::vector<uint8_t>> (makeBmpFile(LoadedImageSize, LoadedImageSize));
+    std::unique_ptr<Image> image(loadImageAssetFromMemory(file->data(), file->size(), "benchmark.bmp"));
+    if(!image)
+    {
+        fprintf(stderr, "Skipping the image benchmarks\n");
+        return;
+    }
+
+    benchmarks.push_back(Benchmark{"image/load_bmp_256", "image", [=](uint64_t iterationCount) {
+        for(uint64_t i = 0; i < iterationCount; ++i)
+        {
+            std::unique_ptr<Image> loadedImage(loadImageAssetFromMemory(file->data(), file->size(), "benchmark.bmp"));
+            resultSink += loadedImage->pixels[i & 0xff];
+        }
+    }});
+
+    // The conversion of the ABGR8888 pixels into the framebuffer format.
+    std::shared_ptr<Image> sharedImage(image.release());
+    auto fixture = std::make_shared<FramebufferFixture> ();
+    benchmarks.push_back(Benchmark{"image/convert_to_framebuffer_256", "image", [=](uint64_t iterationCount) {
+        for(uint64_t i = 0; i < iterationCount; ++i)
+        {
+            for(uint32_t y = 0; y < LoadedImageSize; ++y)
+            {
+                convertPixelRow<PixelFormatABGR8888, FramebufferFormat> (fixture->framebuffer.getRow(y),
+                    reinterpret_cast<const uint32_t*> (sharedImage->pixels + y*sharedImage->pitch), LoadedImageSize);
+            }
+        }
+    }});
+}
+
+static void addBlitBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    static const BlitMode::Mode modes[] = {BlitMode::Opaque, BlitMode::AlphaBlend, BlitMode::ColorKey, BlitMode::Tinted};
+    static const char *modeNames[] = {"opaque", "alpha_blend", "color_key", "tinted"};
+    static const BlitterKernelSet::Set kernelSets[] = {BlitterKernelSet::Scalar, BlitterKernelSet::SSE2, BlitterKernelSet::AVX2};
+
+    auto sprite = std::make_shared<Image> ();
+    makeSprite(*sprite);
+    auto fixture = std::make_shared<FramebufferFixture> ();
+    auto defaultKernelSet = getBlitterKernelSet();
+    for(auto kernelSet : kernelSets)
+    {
+        if(!setBlitterKernelSet(kernelSet))
+            continue;
+
+        for(size_t modeIndex = 0; modeIndex < 4; ++modeIndex)
+        {
+            auto mode = modes[modeIndex];
+            auto name = std::string("blit/") + modeNames[modeIndex] + "_64/" + getBlitterKernelSetName(kernelSet);
+            benchmarks.push_back(Benchmark{name, "blit", [=](uint64_t iterationCount) {
+                setBlitterKernelSet(kernelSet);
+                auto &framebuffer = fixture->framebuffer;
+                for(uint64_t i = 0; i < iterationCount; ++i)
+                {
+                    // Unaligned positions all over the framebuffer.
+                    auto x = int32_t((i*37) % (FramebufferWidth - SpriteSize));
+                    auto y = int32_t((i*53) % (FramebufferHeight - SpriteSize));
+                    blitImage(framebuffer, *sprite, x, y, mode, 0xff80c0ff);
+                }
+                setBlitterKernelSet(defaultKernelSet);
+            }});
+        }
+    }
+    setBlitterKernelSet(defaultKernelSet);
+}
+
+static void addMixerBenchmarks(std::vector<Benchmark> &benchmarks)
+{
+    struct MixerFixture
+    {
+        AudioMixer mixer;
+        AudioBuffer buffer;
+        std::vector<int16_t> output;
+    };
+
+    // A second of noise, played by voices with different volumes and pans.
+    auto fixture = std::make_shared<MixerFixture> ();
+    fixture->mixer.initialize(44100);
+    auto frameCount = size_t(fixture->mixer.getFrequency());
+    fixture->buffer.ownedSamples.reset(new int16_t[frameCount*AudioMixer::ChannelCount]);
+    fixture->buffer.samples = fixture->buffer.ownedSamples.get();
+    fixture->buffer.frameCount = frameCount;
+    uint32_t random = 1;
+    for(size_t i = 0; i < frameCount*AudioMixer::ChannelCount; ++i)
+    {
+        random = random*1664525u + 1013904223u;
+        fixture->buffer.ownedSamples[i] = int16_t(random >> 16);
+    }
+
+    for(size_t i = 0; i < MixerVoiceCount; ++i)
+        fixture->mixer.play(&fixture->buffer, true, 0.05f + 0.05f*float(i % 4), float(i % 5)*0.5f - 1.0f);
+    fixture->output.resize(MixerBufferFrameCount*AudioMixer::ChannelCount);
+    fixture->mixer.mix(fixture->output.data(), MixerBufferFrameCount);
+
+    benchmarks.push_back(Benchmark{"mixer/mix_16_voices_512", "buffer", [=](uint64_t iterationCount) {
+        for(uint64_t i = 0; i < iterationCount; ++i)
+            fixture->mixer.mix(fixture->output.data(), MixerBufferFrameCount);
+        resultSink += uint16_t(fixture->output[0]);
+    }});
+}
+
+static bool readFile(const char *fileName, std::string &contents)
+{
+    auto file = fopen(fileName, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open %s\n", fileName);
+        return false;
+    }
+
+    char buffer[4096];
+    size_t readSize;
+    while((readSize = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        contents.append(buffer, readSize);
+    fclose(file);
+    return true;
+}
+
+// Reads the medians of the results in a file written by --output. Only the
+// fields of that output are understood, rather than any JSON.
+static bool loadBaseline(const char *fileName, std::vector<BenchmarkResult> &baseline)
+{
+    std::string contents;
+    if(!readFile(fileName, contents))
+        return false;
+
+    static const std::string nameKey = "\"name\": \"";
+    static const std::string medianKey = "\"median_ns\": ";
+    size_t position = 0;
+    while((position = contents.find(nameKey, position)) != std::string::npos)
+    {
+        auto nameStart = position + nameKey.size();
+        auto nameEnd = contents.find('"', nameStart);
+        auto medianPosition = contents.find(medianKey, nameEnd);
+        if(nameEnd == std::string::npos || medianPosition == std::string::npos)
+            break;
+
+        BenchmarkResult result = {};
+        result.name = contents.substr(nameStart, nameEnd - nameStart);
+        result.medianNanoseconds = atof(contents.c_str() + medianPosition + medianKey.size());
+        baseline.push_back(result);
+        position = medianPosition;
+    }
+
+    if(baseline.empty())
+    {
+        fprintf(stderr, "No results in the baseline %s\n", fileName);
+        return false;
+    }
+
+    return true;
+}
+
+static const char *getPixelFormatName()
+{
+    switch(FramebufferFormat::Id)
+    {
+    case PixelFormat::ABGR8888: return "ABGR8888";
+    case PixelFormat::RGB565: return "RGB565";
+    case PixelFormat::Indexed8: return "INDEXED8";
+    }
+
+    return "unknown";
+}
+
+static void writeJson(FILE *output, const std::vector<BenchmarkResult> &results, int sampleCount, double threshold, bool hasBaseline)
+{
+    fprintf(output, "{\n");
+    fprintf(output, "  \"benchmark\": \"SimpleGameTemplateBench\",\n");
+    fprintf(output, "  \"pixel_format\": \"%s\",\n", getPixelFormatName());
+    fprintf(output, "  \"blitter_kernel_set\": \"%s\",\n", getBlitterKernelSetName(getBlitterKernelSet()));
+    fprintf(output, "  \"samples\": %d,\n", sampleCount);
+    if(hasBaseline)
+        fprintf(output, "  \"regression_threshold_percent\": %g,\n", threshold);
+    fprintf(output, "  \"results\": [\n");
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        auto &result = results[i];
+        fprintf(output, "    {\"name\": \"%s\", \"operation\": \"%s\", \"iterations\": %llu, \"median_ns\": %.3f, \"min_ns\": %.3f, \"max_ns\": %.3f",
+            result.name.c_str(), result.operation, (unsigned long long)result.iterationCount,
+            result.medianNanoseconds, result.minimumNanoseconds, result.maximumNanoseconds);
+        if(result.hasBaseline)
+        {
+            fprintf(output, ", \"baseline_median_ns\": %.3f, \"change_percent\": %.2f, \"regression\": %s",
+                result.baselineNanoseconds, (result.medianNanoseconds / result.baselineNanoseconds - 1.0)*100.0,
+                result.isRegression ? "true" : "false");
+        }
+        fprintf(output, "}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(output, "  ]\n");
+    fprintf(output, "}\n");
+}
+
+static void printHelp()
+{
+    printf("Usage: SimpleGameTemplateBench [options]\n");
+    printf("  --output <file>           Write the JSON results into the file instead of the standard output.\n");
+    printf("  --compare <file>          Compare against the results of an earlier --output, and fail on regressions.\n");
+    printf("  --threshold <percent>     Slowdown of the median that counts as a regression. Default %g.\n", DefaultRegressionThreshold);
+    printf("  --filter <text>           Only run the benchmarks whose name contains the text.\n");
+    printf("  --samples <count>         Number of timed samples per benchmark. Default 15.\n");
+    printf("  --sample-time <ms>        Minimum duration of a sample. Default 10.\n");
+    printf("  --list                    List the benchmarks without running them.\n");
+}
+
+int main(int argc, char* argv[])
+{
+    const char *outputFileName = nullptr;
+    const char *baselineFileName = nullptr;
+    double threshold = DefaultRegressionThreshold;
+    std::string filter;
+    int sampleCount = 15;
+    double minimumSampleTime = 0.01;
+    bool listOnly = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--output" && i + 1 < argc)
+            outputFileName = argv[++i];
+        else if(arg == "--compare" && i + 1 < argc)
+            baselineFileName = argv[++i];
+        else if(arg == "--threshold" && i + 1 < argc)
+            threshold = std::max(0.0, atof(argv[++i]));
+        else if(arg == "--filter" && i + 1 < argc)
+            filter = argv[++i];
+        else if(arg == "--samples" && i + 1 < argc)
+            sampleCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--sample-time" && i + 1 < argc)
+            minimumSampleTime = std::max(0.1, atof(argv[++i])) / 1000.0;
+        else if(arg == "--list")
+            listOnly = true;
+        else if(arg == "-h" || arg == "--help")
+        {
+            printHelp();
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            printHelp();
+            return 1;
+        }
+    }
+
+    std::vector<BenchmarkResult> baseline;
+    if(baselineFileName && !loadBaseline(baselineFileName, baseline))
+        return 1;
+
+    std::vector<Benchmark> benchmarks;
+    addMemoryZoneBenchmarks(benchmarks);
+    addControllerStateBenchmarks(benchmarks);
+    addFramebufferBenchmarks(benchmarks);
+    addImageBenchmarks(benchmarks);
+    addBlitBenchmarks(benchmarks);
+    addMixerBenchmarks(benchmarks);
+
+    std::vector<BenchmarkResult> results;
+    size_t regressionCount = 0;
+    for(auto &benchmark : benchmarks)
+    {
+        if(!filter.empty() && benchmark.name.find(filter) == std::string::npos)
+            continue;
+        if(listOnly)
+        {
+            printf("%s\n", benchmark.name.c_str());
+            continue;
+        }
+
+        auto result = measure(benchmark, sampleCount, minimumSampleTime);
+        for(auto &baselineResult : baseline)
+        {
+            if(baselineResult.name != result.name)
+                continue;
+
+            result.hasBaseline = true;
+            result.baselineNanoseconds = baselineResult.medianNanoseconds;
+            result.isRegression = result.medianNanoseconds > baselineResult.medianNanoseconds*(1.0 + threshold / 100.0);
+            regressionCount += result.isRegression ? 1 : 0;
+        }
+
+        // The progress goes to the standard error, so that the standard
+        // output only has the JSON.
+        fprintf(stderr, "%-44s %12.3f ns/%s", result.name.c_str(), result.medianNanoseconds, result.operation);
+        if(result.hasBaseline)
+        {
+            fprintf(stderr, "  %+7.2f%%%s", (result.medianNanoseconds / result.baselineNanoseconds - 1.0)*100.0,
+                result.isRegression ? "  REGRESSION" : "");
+        }
+        fprintf(stderr, "\n");
+        results.push_back(result);
+    }
+
+    if(listOnly)
+        return 0;
+
+    auto output = outputFileName ? fopen(outputFileName, "wb") : stdout;
+    if(!output)
+    {
+        fprintf(stderr, "Failed to open %s\n", outputFileName);
+        return 1;
+    }
+    writeJson(output, results, sampleCount, threshold, baselineFileName != nullptr);
+    if(outputFileName)
+        fclose(output);
+
+    if(regressionCount > 0)
+    {
+        fprintf(stderr, "%zu of %zu benchmarks are more than %g%% slower than the baseline\n", regressionCount, results.size(), threshold);
+        return 2;
+    }
+
+    return 0;
+}
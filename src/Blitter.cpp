@@ -0,0 +1,499 @@
+#include "Blitter.hpp"
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLITTER_HAS_SSE2
+#include <emmintrin.h>
+
+#if defined(_MSC_VER)
+#define BLITTER_HAS_AVX2
+#define BLITTER_AVX2_FUNCTION
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) || defined(__clang__)
+#define BLITTER_HAS_AVX2
+#define BLITTER_AVX2_FUNCTION __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+#endif
+
+namespace
+{
+
+typedef void (*AlphaBlendRowFunction)(uint32_t *dest, const uint32_t *source, uint32_t count);
+typedef void (*ColorRowFunction)(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t color);
+
+struct BlitterKernels
+{
+    AlphaBlendRowFunction alphaBlendRow;
+    ColorRowFunction colorKeyRow;
+    ColorRowFunction tintedRow;
+};
+
+inline uint32_t tintPixel(uint32_t source, uint32_t tint)
+{
+    uint32_t result = 0;
+    for(uint32_t shift = 0; shift < 32; shift += 8)
+    {
+        auto s = (source >> shift) & 0xff;
+        auto t = (tint >> shift) & 0xff;
+        result |= divideBy255(s*t) << shift;
+    }
+
+    return result;
+}
+
+void alphaBlendRowScalar(uint32_t *dest, const uint32_t *source, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; ++i)
+        dest[i] = blendPixel(dest[i], source[i]);
+}
+
+void colorKeyRowScalar(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t key)
+{
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(source[i] != key)
+            dest[i] = source[i];
+    }
+}
+
+void tintedRowScalar(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t tint)
+{
+    for(uint32_t i = 0; i < count; ++i)
+        dest[i] = blendPixel(dest[i], tintPixel(source[i], tint));
+}
+
+const BlitterKernels ScalarKernels = {
+    alphaBlendRowScalar,
+    colorKeyRowScalar,
+    tintedRowScalar,
+};
+
+#ifdef BLITTER_HAS_SSE2
+
+// Blends 4 pixels with the same arithmetic as blendPixel.
+inline __m128i blendPixelsSSE2(__m128i dest, __m128i source)
+{
+    auto zero = _mm_setzero_si128();
+    auto alpha = _mm_srli_epi32(source, 24);
+    alpha = _mm_or_si128(alpha, _mm_slli_epi32(alpha, 16));
+    auto alphaLow = _mm_unpacklo_epi32(alpha, alpha);
+    auto alphaHigh = _mm_unpackhi_epi32(alpha, alpha);
+    auto all255 = _mm_set1_epi16(255);
+    auto round = _mm_set1_epi16(128);
+
+    source = _mm_or_si128(source, _mm_set1_epi32(int(0xff000000)));
+    auto sourceLow = _mm_unpacklo_epi8(source, zero);
+    auto sourceHigh = _mm_unpackhi_epi8(source, zero);
+    auto destLow = _mm_unpacklo_epi8(dest, zero);
+    auto destHigh = _mm_unpackhi_epi8(dest, zero);
+
+    auto low = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sourceLow, alphaLow), _mm_mullo_epi16(destLow, _mm_sub_epi16(all255, alphaLow))), round);
+    auto high = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(sourceHigh, alphaHigh), _mm_mullo_epi16(destHigh, _mm_sub_epi16(all255, alphaHigh))), round);
+    low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+    return _mm_packus_epi16(low, high);
+}
+
+inline __m128i tintPixelsSSE2(__m128i source, __m128i tintLow, __m128i tintHigh)
+{
+    auto zero = _mm_setzero_si128();
+    auto round = _mm_set1_epi16(128);
+    auto low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(source, zero), tintLow), round);
+    auto high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(source, zero), tintHigh), round);
+    low = _mm_srli_epi16(_mm_add_epi16(low, _mm_srli_epi16(low, 8)), 8);
+    high = _mm_srli_epi16(_mm_add_epi16(high, _mm_srli_epi16(high, 8)), 8);
+    return _mm_packus_epi16(low, high);
+}
+
+// Returns a mask with one bit per pixel that has the given alpha.
+inline int alphaMaskSSE2(__m128i pixels, __m128i alpha)
+{
+    auto alphaChannel = _mm_and_si128(pixels, _mm_set1_epi32(int(0xff000000)));
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(alphaChannel, alpha)));
+}
+
+inline void alphaBlendPixelsSSE2(uint32_t *dest, __m128i source)
+{
+    auto opaqueMask = alphaMaskSSE2(source, _mm_set1_epi32(int(0xff000000)));
+    if(opaqueMask == 0xf)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (dest), source);
+        return;
+    }
+
+    auto transparentMask = alphaMaskSSE2(source, _mm_setzero_si128());
+    if(transparentMask == 0xf)
+        return;
+
+    auto destPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*> (dest));
+    _mm_storeu_si128(reinterpret_cast<__m128i*> (dest), blendPixelsSSE2(destPixels, source));
+}
+
+void alphaBlendRowSSE2(uint32_t *dest, const uint32_t *source, uint32_t count)
+{
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4)
+        alphaBlendPixelsSSE2(dest + i, _mm_loadu_si128(reinterpret_cast<const __m128i*> (source + i)));
+
+    alphaBlendRowScalar(dest + i, source + i, count - i);
+}
+
+void colorKeyRowSSE2(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t key)
+{
+    auto keyPixels = _mm_set1_epi32(int(key));
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        auto sourcePixels = _mm_loadu_si128(reinterpret_cast<const __m128i*> (source + i));
+        auto destPixels = _mm_loadu_si128(reinterpret_cast<const __m128i*> (dest + i));
+        auto keyMask = _mm_cmpeq_epi32(sourcePixels, keyPixels);
+        auto result = _mm_or_si128(_mm_and_si128(keyMask, destPixels), _mm_andnot_si128(keyMask, sourcePixels));
+        _mm_storeu_si128(reinterpret_cast<__m128i*> (dest + i), result);
+    }
+
+    colorKeyRowScalar(dest + i, source + i, count - i, key);
+}
+
+void tintedRowSSE2(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t tint)
+{
+    auto zero = _mm_setzero_si128();
+    auto tintPixels = _mm_set1_epi32(int(tint));
+    auto tintLow = _mm_unpacklo_epi8(tintPixels, zero);
+    auto tintHigh = _mm_unpackhi_epi8(tintPixels, zero);
+
+    uint32_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        auto sourcePixels = _mm_loadu_si128(reinterpret_cast<const __m128i*> (source + i));
+        alphaBlendPixelsSSE2(dest + i, tintPixelsSSE2(sourcePixels, tintLow, tintHigh));
+    }
+
+    tintedRowScalar(dest + i, source + i, count - i, tint);
+}
+
+const BlitterKernels SSE2Kernels = {
+    alphaBlendRowSSE2,
+    colorKeyRowSSE2,
+    tintedRowSSE2,
+};
+
+#endif
+
+#ifdef BLITTER_HAS_AVX2
+
+// The AVX2 unpack and pack instructions work on each 128-bit lane
+// independently, so the same sequence as in SSE2 blends 8 pixels.
+//
+// The rows end with the SSE2 kernels, which are not VEX encoded, so the upper
+// halves of the registers are cleared before calling them. GCC turns those
+// calls into jumps without a vzeroupper, and the SSE2 code after them then
+// runs several times slower.
+BLITTER_AVX2_FUNCTION inline __m256i blendPixelsAVX2(__m256i dest, __m256i source)
+{
+    auto zero = _mm256_setzero_si256();
+    auto alpha = _mm256_srli_epi32(source, 24);
+    alpha = _mm256_or_si256(alpha, _mm256_slli_epi32(alpha, 16));
+    auto alphaLow = _mm256_unpacklo_epi32(alpha, alpha);
+    auto alphaHigh = _mm256_unpackhi_epi32(alpha, alpha);
+    auto all255 = _mm256_set1_epi16(255);
+    auto round = _mm256_set1_epi16(128);
+
+    source = _mm256_or_si256(source, _mm256_set1_epi32(int(0xff000000)));
+    auto sourceLow = _mm256_unpacklo_epi8(source, zero);
+    auto sourceHigh = _mm256_unpackhi_epi8(source, zero);
+    auto destLow = _mm256_unpacklo_epi8(dest, zero);
+    auto destHigh = _mm256_unpackhi_epi8(dest, zero);
+
+    auto low = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(sourceLow, alphaLow), _mm256_mullo_epi16(destLow, _mm256_sub_epi16(all255, alphaLow))), round);
+    auto high = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(sourceHigh, alphaHigh), _mm256_mullo_epi16(destHigh, _mm256_sub_epi16(all255, alphaHigh))), round);
+    low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+    high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+    return _mm256_packus_epi16(low, high);
+}
+
+BLITTER_AVX2_FUNCTION inline __m256i tintPixelsAVX2(__m256i source, __m256i tintLow, __m256i tintHigh)
+{
+    auto zero = _mm256_setzero_si256();
+    auto round = _mm256_set1_epi16(128);
+    auto low = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(source, zero), tintLow), round);
+    auto high = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(source, zero), tintHigh), round);
+    low = _mm256_srli_epi16(_mm256_add_epi16(low, _mm256_srli_epi16(low, 8)), 8);
+    high = _mm256_srli_epi16(_mm256_add_epi16(high, _mm256_srli_epi16(high, 8)), 8);
+    return _mm256_packus_epi16(low, high);
+}
+
+BLITTER_AVX2_FUNCTION inline int alphaMaskAVX2(__m256i pixels, __m256i alpha)
+{
+    auto alphaChannel = _mm256_and_si256(pixels, _mm256_set1_epi32(int(0xff000000)));
+    return _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(alphaChannel, alpha)));
+}
+
+BLITTER_AVX2_FUNCTION inline void alphaBlendPixelsAVX2(uint32_t *dest, __m256i source)
+{
+    auto opaqueMask = alphaMaskAVX2(source, _mm256_set1_epi32(int(0xff000000)));
+    if(opaqueMask == 0xff)
+    {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*> (dest), source);
+        return;
+    }
+
+    auto transparentMask = alphaMaskAVX2(source, _mm256_setzero_si256());
+    if(transparentMask == 0xff)
+        return;
+
+    auto destPixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (dest));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*> (dest), blendPixelsAVX2(destPixels, source));
+}
+
+BLITTER_AVX2_FUNCTION void alphaBlendRowAVX2(uint32_t *dest, const uint32_t *source, uint32_t count)
+{
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8)
+        alphaBlendPixelsAVX2(dest + i, _mm256_loadu_si256(reinterpret_cast<const __m256i*> (source + i)));
+
+    _mm256_zeroupper();
+    alphaBlendRowSSE2(dest + i, source + i, count - i);
+}
+
+BLITTER_AVX2_FUNCTION void colorKeyRowAVX2(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t key)
+{
+    auto keyPixels = _mm256_set1_epi32(int(key));
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        auto sourcePixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (source + i));
+        auto destPixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (dest + i));
+        auto keyMask = _mm256_cmpeq_epi32(sourcePixels, keyPixels);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*> (dest + i), _mm256_blendv_epi8(sourcePixels, destPixels, keyMask));
+    }
+
+    _mm256_zeroupper();
+    colorKeyRowSSE2(dest + i, source + i, count - i, key);
+}
+
+BLITTER_AVX2_FUNCTION void tintedRowAVX2(uint32_t *dest, const uint32_t *source, uint32_t count, uint32_t tint)
+{
+    auto zero = _mm256_setzero_si256();
+    auto tintPixels = _mm256_set1_epi32(int(tint));
+    auto tintLow = _mm256_unpacklo_epi8(tintPixels, zero);
+    auto tintHigh = _mm256_unpackhi_epi8(tintPixels, zero);
+
+    uint32_t i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        auto sourcePixels = _mm256_loadu_si256(reinterpret_cast<const __m256i*> (source + i));
+        alphaBlendPixelsAVX2(dest + i, tintPixelsAVX2(sourcePixels, tintLow, tintHigh));
+    }
+
+    _mm256_zeroupper();
+    tintedRowSSE2(dest + i, source + i, count - i, tint);
+}
+
+const BlitterKernels AVX2Kernels = {
+    alphaBlendRowAVX2,
+    colorKeyRowAVX2,
+    tintedRowAVX2,
+};
+
+bool isAVX2Supported()
+{
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    auto hasOSXSave = (info[2] & (1 << 27)) != 0;
+    auto hasAVX = (info[2] & (1 << 28)) != 0;
+    if(!hasOSXSave || !hasAVX || (_xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+BlitterKernelSet::Set detectBlitterKernelSet()
+{
+#if defined(BLITTER_HAS_AVX2)
+    if(isAVX2Supported())
+        return BlitterKernelSet::AVX2;
+#endif
+
+#if defined(BLITTER_HAS_SSE2)
+    return BlitterKernelSet::SSE2;
+#else
+    return BlitterKernelSet::Scalar;
+#endif
+}
+
+const BlitterKernels *kernelsFor(BlitterKernelSet::Set kernelSet)
+{
+    switch(kernelSet)
+    {
+#ifdef BLITTER_HAS_SSE2
+    case BlitterKernelSet::SSE2:
+        return &SSE2Kernels;
+#endif
+#ifdef BLITTER_HAS_AVX2
+    case BlitterKernelSet::AVX2:
+        return &AVX2Kernels;
+#endif
+    case BlitterKernelSet::Scalar:
+    default:
+        return &ScalarKernels;
+    }
+}
+
+BlitterKernelSet::Set &currentKernelSet()
+{
+    static BlitterKernelSet::Set kernelSet = detectBlitterKernelSet();
+    return kernelSet;
+}
+
+// The kernels blend ABGR8888 pixels, so they write an ABGR8888 framebuffer
+// directly.
+void blitRowsABGR8888(uint8_t *destRow, int destPitch, const uint8_t *sourceRow, uint32_t sourcePitch,
+    uint32_t width, uint32_t height, BlitMode::Mode mode, uint32_t color)
+{
+    auto kernels = kernelsFor(currentKernelSet());
+    for(uint32_t y = 0; y < height; ++y)
+    {
+        auto source = reinterpret_cast<const uint32_t*> (sourceRow);
+        auto dest = reinterpret_cast<uint32_t*> (destRow);
+        switch(mode)
+        {
+        case BlitMode::Opaque:
+            memcpy(dest, source, width*4);
+            break;
+        case BlitMode::AlphaBlend:
+            kernels->alphaBlendRow(dest, source, width);
+            break;
+        case BlitMode::ColorKey:
+            kernels->colorKeyRow(dest, source, width, color);
+            break;
+        case BlitMode::Tinted:
+            kernels->tintedRow(dest, source, width, color);
+            break;
+        }
+
+        sourceRow += sourcePitch;
+        destRow += destPitch;
+    }
+}
+
+// The other formats convert every pixel.
+template<typename Format>
+void blitRows(uint8_t *destRow, int destPitch, const uint8_t *sourceRow, uint32_t sourcePitch,
+    uint32_t width, uint32_t height, BlitMode::Mode mode, uint32_t color)
+{
+    if(Format::Id == PixelFormat::ABGR8888)
+    {
+        blitRowsABGR8888(destRow, destPitch, sourceRow, sourcePitch, width, height, mode, color);
+        return;
+    }
+
+    for(uint32_t y = 0; y < height; ++y)
+    {
+        auto source = reinterpret_cast<const uint32_t*> (sourceRow);
+        auto dest = reinterpret_cast<typename Format::Pixel*> (destRow);
+        switch(mode)
+        {
+        case BlitMode::Opaque:
+            convertPixelRow<PixelFormatABGR8888, Format> (dest, source, width);
+            break;
+        case BlitMode::AlphaBlend:
+            for(uint32_t i = 0; i < width; ++i)
+                dest[i] = Format::blend(dest[i], source[i]);
+            break;
+        case BlitMode::ColorKey:
+            for(uint32_t i = 0; i < width; ++i)
+            {
+                if(source[i] != color)
+                    dest[i] = Format::fromABGR8888(source[i]);
+            }
+            break;
+        case BlitMode::Tinted:
+            for(uint32_t i = 0; i < width; ++i)
+                dest[i] = Format::blend(dest[i], tintPixel(source[i], color));
+            break;
+        }
+
+        sourceRow += sourcePitch;
+        destRow += destPitch;
+    }
+}
+
+}
+
+BlitterKernelSet::Set getBlitterKernelSet()
+{
+    return currentKernelSet();
+}
+
+bool setBlitterKernelSet(BlitterKernelSet::Set kernelSet)
+{
+    if(kernelSet > detectBlitterKernelSet())
+        return false;
+
+    currentKernelSet() = kernelSet;
+    return true;
+}
+
+const char *getBlitterKernelSetName(BlitterKernelSet::Set kernelSet)
+{
+    switch(kernelSet)
+    {
+    case BlitterKernelSet::SSE2: return "sse2";
+    case BlitterKernelSet::AVX2: return "avx2";
+    case BlitterKernelSet::Scalar:
+    default:
+        return "scalar";
+    }
+}
+
+void blitImageRegion(const Framebuffer &framebuffer, const BlitClipRect &clipRect,
+    const Image &image, int32_t sourceX, int32_t sourceY, int32_t sourceWidth, int32_t sourceHeight,
+    int32_t destX, int32_t destY, BlitMode::Mode mode, uint32_t color)
+{
+    assert(image.bpp == 32);
+
+    // Clip the source region against the image.
+    if(sourceX < 0)
+    {
+        sourceWidth += sourceX;
+        destX -= sourceX;
+        sourceX = 0;
+    }
+    if(sourceY < 0)
+    {
+        sourceHeight += sourceY;
+        destY -= sourceY;
+        sourceY = 0;
+    }
+    sourceWidth = std::min(sourceWidth, int32_t(image.width) - sourceX);
+    sourceHeight = std::min(sourceHeight, int32_t(image.height) - sourceY);
+
+    // Clip the destination against the clip rectangle and the framebuffer.
+    auto minX = std::max(clipRect.minX, 0);
+    auto minY = std::max(clipRect.minY, 0);
+    auto maxX = std::min(clipRect.maxX, int32_t(framebuffer.width));
+    auto maxY = std::min(clipRect.maxY, int32_t(framebuffer.height));
+
+    auto leftClip = std::max(minX - destX, 0);
+    auto topClip = std::max(minY - destY, 0);
+    auto width = std::min(destX + sourceWidth, maxX) - (destX + leftClip);
+    auto height = std::min(destY + sourceHeight, maxY) - (destY + topClip);
+    if(width <= 0 || height <= 0)
+        return;
+
+    auto sourceRow = image.pixels + (sourceY + topClip)*image.pitch + (sourceX + leftClip)*4;
+    auto destRow = framebuffer.pixels + (destY + topClip)*framebuffer.pitch + (destX + leftClip)*int32_t(sizeof(FramebufferPixel));
+    blitRows<FramebufferFormat> (destRow, framebuffer.pitch, sourceRow, image.pitch, uint32_t(width), uint32_t(height), mode, color);
+}
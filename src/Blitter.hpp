@@ -0,0 +1,87 @@
+#ifndef SIMPLE_GAME_TEMPLATE_BLITTER_HPP
+#define SIMPLE_GAME_TEMPLATE_BLITTER_HPP
+
+#include "Framebuffer.hpp"
+#include "Image.hpp"
+
+namespace BlitMode
+{
+
+enum Mode
+{
+    // Copies the source pixels as they are.
+    Opaque = 0,
+
+    // Blends the source pixels on top of the framebuffer by using the source alpha.
+    AlphaBlend,
+
+    // Copies the source pixels that are different to the key color.
+    ColorKey,
+
+    // Multiplies the source pixels by the tint color, and then alpha blends them.
+    Tinted,
+};
+
+}
+
+namespace BlitterKernelSet
+{
+
+enum Set
+{
+    Scalar = 0,
+    SSE2,
+    AVX2,
+};
+
+}
+
+/**
+ * A rectangle in framebuffer coordinates that limits the pixels that are
+ * written by a blit. This is typically the full framebuffer or a tile.
+ */
+struct BlitClipRect
+{
+    int32_t minX;
+    int32_t minY;
+    int32_t maxX;
+    int32_t maxY;
+
+    static BlitClipRect forFramebuffer(const Framebuffer &framebuffer)
+    {
+        return BlitClipRect{0, 0, int32_t(framebuffer.width), int32_t(framebuffer.height)};
+    }
+
+    static BlitClipRect forTile(const FramebufferTile &tile)
+    {
+        return BlitClipRect{int32_t(tile.x), int32_t(tile.y), int32_t(tile.x + tile.width), int32_t(tile.y + tile.height)};
+    }
+};
+
+// Blits a region of an ABGR8888 image into the framebuffer. The color is the
+// key color for BlitMode::ColorKey and the tint color for BlitMode::Tinted.
+// The SIMD kernels are used when the framebuffer is ABGR8888, and the other
+// formats convert every pixel.
+void blitImageRegion(const Framebuffer &framebuffer, const BlitClipRect &clipRect,
+    const Image &image, int32_t sourceX, int32_t sourceY, int32_t sourceWidth, int32_t sourceHeight,
+    int32_t destX, int32_t destY, BlitMode::Mode mode, uint32_t color = 0xffffffff);
+
+inline void blitImage(const Framebuffer &framebuffer, const BlitClipRect &clipRect, const Image &image,
+    int32_t destX, int32_t destY, BlitMode::Mode mode = BlitMode::AlphaBlend, uint32_t color = 0xffffffff)
+{
+    blitImageRegion(framebuffer, clipRect, image, 0, 0, int32_t(image.width), int32_t(image.height), destX, destY, mode, color);
+}
+
+inline void blitImage(const Framebuffer &framebuffer, const Image &image,
+    int32_t destX, int32_t destY, BlitMode::Mode mode = BlitMode::AlphaBlend, uint32_t color = 0xffffffff)
+{
+    blitImage(framebuffer, BlitClipRect::forFramebuffer(framebuffer), image, destX, destY, mode, color);
+}
+
+// The kernel set is selected according to the CPU features the first time it
+// is needed. Forcing a kernel set is meant for testing and benchmarking.
+BlitterKernelSet::Set getBlitterKernelSet();
+bool setBlitterKernelSet(BlitterKernelSet::Set kernelSet);
+const char *getBlitterKernelSetName(BlitterKernelSet::Set kernelSet);
+
+#endif //SIMPLE_GAME_TEMPLATE_BLITTER_HPP
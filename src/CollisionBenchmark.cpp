@@ -0,0 +1,305 @@
+#include "SpatialHash.hpp"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+
+static constexpr size_t BenchmarkMemorySize = 64*1024*1024;
+static constexpr float CellSize = 16.0f;
+
+// Bodies of 4 to 16 units, at the same density for every count, so that a
+// body overlaps about one other body.
+static void makeBodies(std::vector<CollisionBox> &boxes, uint32_t bodyCount, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    auto worldSize = sqrtf(float(bodyCount))*32.0f;
+    std::uniform_real_distribution<float> position(0.0f, worldSize);
+    std::uniform_real_distribution<float> size(4.0f, 16.0f);
+    boxes.resize(bodyCount);
+    for(auto &box : boxes)
+    {
+        box.minX = position(random);
+        box.minY = position(random);
+        box.maxX = box.minX + size(random);
+        box.maxY = box.minY + size(random);
+    }
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+static double median(std::vector<double> &values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+// Adds bodies that are larger than a cell, and moves the world to negative
+// coordinates, which take the other paths of the hash.
+static void addLargeBodies(std::vector<CollisionBox> &boxes, uint32_t seed)
+{
+    std::mt19937 random(seed);
+    auto worldSize = sqrtf(float(boxes.size()))*32.0f;
+    std::uniform_real_distribution<float> position(0.0f, worldSize);
+    std::uniform_real_distribution<float> size(CellSize, CellSize*8.0f);
+    auto largeBodyCount = boxes.size() / 50 + 1;
+    for(size_t i = 0; i < largeBodyCount; ++i)
+    {
+        auto x = position(random);
+        auto y = position(random);
+        boxes.push_back(CollisionBox{x, y, x + size(random), y + size(random)});
+    }
+
+    for(auto &box : boxes)
+    {
+        box.minX -= worldSize*0.5f;
+        box.maxX -= worldSize*0.5f;
+        box.minY -= worldSize*0.5f;
+        box.maxY -= worldSize*0.5f;
+    }
+}
+
+typedef std::pair<uint32_t, uint32_t> BodyPair;
+
+static bool verifyPairs(const SpatialHash &spatialHash, const std::vector<CollisionBox> &boxes)
+{
+    std::vector<BodyPair> pairs;
+    spatialHash.forEachPair([&](uint32_t first, uint32_t second) { pairs.push_back(BodyPair(first, second)); });
+    std::sort(pairs.begin(), pairs.end());
+
+    std::vector<BodyPair> expectedPairs;
+    for(uint32_t i = 0; i < uint32_t(boxes.size()); ++i)
+    {
+        for(auto j = i + 1; j < uint32_t(boxes.size()); ++j)
+        {
+            if(boxes[i].overlaps(boxes[j]))
+                expectedPairs.push_back(BodyPair(i, j));
+        }
+    }
+
+    // The sorted pairs also catch a pair that is reported twice.
+    return pairs == expectedPairs;
+}
+
+static bool verifyRegions(const SpatialHash &spatialHash, const std::vector<CollisionBox> &boxes, float worldSize)
+{
+    std::mt19937 random(7);
+    std::uniform_real_distribution<float> position(-worldSize*0.6f, worldSize*0.6f);
+    std::uniform_real_distribution<float> size(0.0f, CellSize*6.0f);
+    std::vector<uint32_t> results(boxes.size());
+    for(int query = 0; query < 200; ++query)
+    {
+        auto x = position(random);
+        auto y = position(random);
+        CollisionBox region = {x, y, x + size(random), y + size(random)};
+        auto resultCount = spatialHash.queryRegion(region, results.data(), uint32_t(results.size()));
+        std::vector<uint32_t> found(results.begin(), results.begin() + resultCount);
+        std::sort(found.begin(), found.end());
+
+        std::vector<uint32_t> expected;
+        for(uint32_t i = 0; i < uint32_t(boxes.size()); ++i)
+        {
+            if(boxes[i].overlaps(region))
+                expected.push_back(i);
+        }
+
+        if(found != expected)
+            return false;
+    }
+
+    return true;
+}
+
+static bool intersectRayBruteForce(const CollisionBox &box, float originX, float originY, float directionX, float directionY, float maxDistance, float &distance)
+{
+    auto entry = 0.0f;
+    auto exit = maxDistance;
+    const float origins[2] = {originX, originY};
+    const float directions[2] = {directionX, directionY};
+    const float minima[2] = {box.minX, box.minY};
+    const float maxima[2] = {box.maxX, box.maxY};
+    for(int axis = 0; axis < 2; ++axis)
+    {
+        if(directions[axis] == 0.0f)
+        {
+            if(origins[axis] < minima[axis] || origins[axis] > maxima[axis])
+                return false;
+            continue;
+        }
+
+        auto near = (minima[axis] - origins[axis]) / directions[axis];
+        auto far = (maxima[axis] - origins[axis]) / directions[axis];
+        entry = std::max(entry, std::min(near, far));
+        exit = std::min(exit, std::max(near, far));
+    }
+
+    distance = entry;
+    return entry <= exit;
+}
+
+static bool verifyRaycasts(const SpatialHash &spatialHash, const std::vector<CollisionBox> &boxes, float worldSize)
+{
+    std::mt19937 random(11);
+    std::uniform_real_distribution<float> position(-worldSize*0.6f, worldSize*0.6f);
+    std::uniform_real_distribution<float> angle(0.0f, 6.2832f);
+    std::uniform_real_distribution<float> distance(0.0f, worldSize*0.5f);
+    for(int ray = 0; ray < 200; ++ray)
+    {
+        auto originX = position(random);
+        auto originY = position(random);
+        auto rayAngle = angle(random);
+
+        // Some rays are along an axis.
+        auto directionX = ray % 10 == 0 ? 0.0f : cosf(rayAngle);
+        auto directionY = ray % 10 == 1 ? 0.0f : sinf(rayAngle);
+        auto maxDistance = distance(random);
+
+        auto isExpectedHit = false;
+        auto expectedDistance = maxDistance;
+        for(auto &box : boxes)
+        {
+            float hitDistance;
+            if(intersectRayBruteForce(box, originX, originY, directionX, directionY, maxDistance, hitDistance) &&
+                (!isExpectedHit || hitDistance < expectedDistance))
+            {
+                isExpectedHit = true;
+                expectedDistance = hitDistance;
+            }
+        }
+
+        // Bodies at the same distance can be reported in any order, so only
+        // the distance is compared, and the hit body must be at it.
+        RaycastHit hit;
+        auto isHit = spatialHash.raycast(originX, originY, directionX, directionY, maxDistance, hit);
+        if(isHit != isExpectedHit)
+            return false;
+        if(!isHit)
+            continue;
+
+        float hitDistance;
+        if(fabsf(hit.distance - expectedDistance) > 1e-3f*worldSize ||
+            !intersectRayBruteForce(boxes[hit.body], originX, originY, directionX, directionY, maxDistance, hitDistance) ||
+            fabsf(hitDistance - hit.distance) > 1e-3f*worldSize)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Compares every query against brute force, for the bodies of the benchmark
+// and for a set with large bodies at negative coordinates.
+static bool verifyAgainstBruteForce(MemoryZone &zone, const std::vector<CollisionBox> &benchmarkBoxes, uint32_t seed)
+{
+    auto boxes = benchmarkBoxes;
+    for(int set = 0; set < 2; ++set)
+    {
+        if(set == 1)
+            addLargeBodies(boxes, seed);
+
+        zone.clearAll();
+        SpatialHash spatialHash;
+        if(!spatialHash.build(&zone, boxes.data(), uint32_t(boxes.size()), CellSize))
+            return false;
+
+        auto worldSize = sqrtf(float(benchmarkBoxes.size()))*32.0f;
+        if(!verifyPairs(spatialHash, boxes) || !verifyRegions(spatialHash, boxes, worldSize) || !verifyRaycasts(spatialHash, boxes, worldSize))
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    int repeatCount = 50;
+    uint32_t verifyLimit = 10000;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--repeats" && i + 1 < argc)
+            repeatCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--verify-limit" && i + 1 < argc)
+            verifyLimit = uint32_t(std::max(0, atoi(argv[++i])));
+    }
+
+    MemoryZone zone;
+    zone.reserve(BenchmarkMemorySize);
+
+    printf("Spatial hash broadphase, cell size %.0f, median of %d runs\n", CellSize, repeatCount);
+    printf("   bodies  build ms  pairs ms   pairs  query us  ray us  brute force\n");
+
+    static const uint32_t bodyCounts[] = {1000, 10000, 100000};
+    for(auto bodyCount : bodyCounts)
+    {
+        std::vector<CollisionBox> boxes;
+        makeBodies(boxes, bodyCount, bodyCount);
+        auto worldSize = sqrtf(float(bodyCount))*32.0f;
+
+        std::vector<double> buildTimes;
+        std::vector<double> pairTimes;
+        std::vector<double> queryTimes;
+        std::vector<double> rayTimes;
+        uint64_t pairCount = 0;
+        SpatialHash spatialHash;
+        for(int repeat = 0; repeat < repeatCount; ++repeat)
+        {
+            zone.clearAll();
+            auto startTime = std::chrono::steady_clock::now();
+            if(!spatialHash.build(&zone, boxes.data(), bodyCount, CellSize))
+            {
+                fprintf(stderr, "Failed to build the spatial hash of %u bodies\n", bodyCount);
+                return 1;
+            }
+            buildTimes.push_back(millisecondsSince(startTime));
+
+            pairCount = 0;
+            startTime = std::chrono::steady_clock::now();
+            spatialHash.forEachPair([&](uint32_t, uint32_t) { ++pairCount; });
+            pairTimes.push_back(millisecondsSince(startTime));
+
+            // Queries of a 64 unit square and rays across a quarter of the world.
+            static const int QueryCount = 100;
+            uint32_t results[256];
+            startTime = std::chrono::steady_clock::now();
+            for(int i = 0; i < QueryCount; ++i)
+            {
+                auto x = worldSize*float(i) / QueryCount;
+                auto y = worldSize*float((i*37) % QueryCount) / QueryCount;
+                spatialHash.queryRegion(CollisionBox{x, y, x + 64.0f, y + 64.0f}, results, 256);
+            }
+            queryTimes.push_back(millisecondsSince(startTime)*1000.0 / QueryCount);
+
+            RaycastHit hit;
+            startTime = std::chrono::steady_clock::now();
+            for(int i = 0; i < QueryCount; ++i)
+            {
+                auto angle = float(i)*0.0628f;
+                spatialHash.raycast(worldSize*0.5f, worldSize*0.5f, cosf(angle), sinf(angle), worldSize*0.25f, hit);
+            }
+            rayTimes.push_back(millisecondsSince(startTime)*1000.0 / QueryCount);
+        }
+
+        printf("%9u  %8.3f  %8.3f  %6llu  %8.2f  %6.2f  ", bodyCount, median(buildTimes), median(pairTimes),
+            (unsigned long long)pairCount, median(queryTimes), median(rayTimes));
+        if(bodyCount <= verifyLimit)
+        {
+            auto isSame = verifyAgainstBruteForce(zone, boxes, bodyCount);
+            printf("%s\n", isSame ? "same results" : "DIFFERENT RESULTS");
+            if(!isSame)
+                return 1;
+        }
+        else
+        {
+            printf("skipped\n");
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "DynamicResolution.hpp"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+
+// The weight of a new render time in the average.
+static constexpr double RenderTimeWeight = 0.1;
+
+// The scale drops when the average is over this fraction of the budget, and
+// aims for the lower fraction, which leaves room for the variation of the
+// frames.
+static constexpr double DecreaseThreshold = 0.9;
+static constexpr double DecreaseTarget = 0.75;
+
+// The scale rises when the next step is expected to stay under this fraction
+// of the budget.
+static constexpr double IncreaseThreshold = 0.7;
+static constexpr float IncreaseStep = 1.1f;
+
+static constexpr uint32_t DecreaseFrameCount = 4;
+static constexpr uint32_t IncreaseFrameCount = 60;
+
+// The frames after a change only update the average, so that the render
+// times of the new scale replace the prediction.
+static constexpr uint32_t ChangeCooldownFrameCount = 15;
+
+DynamicResolution::DynamicResolution()
+    : budget(0), minimumScale(1.0f), scale(1.0f), lowestScale(1.0f), averageRenderTime(0), hasAverage(false),
+      framesOverBudget(0), framesUnderBudget(0), framesSinceChange(0), changeCount(0)
+{
+}
+
+void DynamicResolution::start(double theBudget, float theMinimumScale)
+{
+    budget = theBudget;
+    minimumScale = std::min(std::max(theMinimumScale, 0.1f), 1.0f);
+    scale = 1.0f;
+    lowestScale = 1.0f;
+    averageRenderTime = 0;
+    hasAverage = false;
+    framesOverBudget = 0;
+    framesUnderBudget = 0;
+    framesSinceChange = 0;
+    changeCount = 0;
+}
+
+bool DynamicResolution::addRenderTime(double milliseconds)
+{
+    if(budget <= 0 || minimumScale >= 1.0f)
+        return false;
+
+    averageRenderTime = hasAverage ? averageRenderTime + (milliseconds - averageRenderTime)*RenderTimeWeight : milliseconds;
+    hasAverage = true;
+    if(++framesSinceChange < ChangeCooldownFrameCount)
+        return false;
+
+    framesOverBudget = averageRenderTime > budget*DecreaseThreshold ? framesOverBudget + 1 : 0;
+    if(framesOverBudget >= DecreaseFrameCount && scale > minimumScale)
+    {
+        auto fittingScale = scale*float(sqrt(budget*DecreaseTarget / averageRenderTime));
+        setScale(std::max(std::min(fittingScale, scale / IncreaseStep), minimumScale));
+        return true;
+    }
+
+    auto nextScale = std::min(scale*IncreaseStep, 1.0f);
+    auto expectedRenderTime = averageRenderTime*(nextScale / scale)*(nextScale / scale);
+    framesUnderBudget = expectedRenderTime < budget*IncreaseThreshold ? framesUnderBudget + 1 : 0;
+    if(framesUnderBudget >= IncreaseFrameCount && scale < 1.0f)
+    {
+        setScale(nextScale);
+        return true;
+    }
+
+    return false;
+}
+
+void DynamicResolution::setScale(float newScale)
+{
+    // The average is predicted for the new area until it is measured.
+    averageRenderTime *= (newScale / scale)*(newScale / scale);
+    scale = newScale;
+    lowestScale = std::min(lowestScale, scale);
+    framesOverBudget = 0;
+    framesUnderBudget = 0;
+    framesSinceChange = 0;
+    ++changeCount;
+}
+
+void DynamicResolution::printStatistics() const
+{
+    if(budget <= 0 || minimumScale >= 1.0f)
+        return;
+
+    printf("Dynamic resolution: budget %.3f ms, scale %.2f, lowest %.2f, %u changes\n", budget, scale, lowestScale, changeCount);
+}
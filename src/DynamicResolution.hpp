@@ -0,0 +1,54 @@
+#ifndef SIMPLE_GAME_TEMPLATE_DYNAMIC_RESOLUTION_HPP
+#define SIMPLE_GAME_TEMPLATE_DYNAMIC_RESOLUTION_HPP
+
+#include <stdint.h>
+
+/**
+ * Chooses the scale of the framebuffer from the measured render times, so
+ * that a slow machine renders fewer pixels instead of dropping frames. The
+ * render time is assumed to grow with the area of the framebuffer.
+ *
+ * The scale drops as soon as the average render time goes over the budget,
+ * straight to the scale that fits, but it only rises one step at a time, after
+ * the average stayed well under the budget for a second, and only when the
+ * next step is expected to fit too. The gap between the two keeps the scale
+ * from going back and forth.
+ */
+class DynamicResolution
+{
+public:
+    DynamicResolution();
+
+    // A minimum scale of 1 keeps the full resolution.
+    void start(double theBudget, float theMinimumScale);
+
+    // Adds the render time of a frame, in milliseconds, that was rendered at
+    // the current scale. Returns true when the scale changed.
+    bool addRenderTime(double milliseconds);
+
+    float getScale() const
+    {
+        return scale;
+    }
+
+    void printStatistics() const;
+
+private:
+    void setScale(float newScale);
+
+    double budget;
+    float minimumScale;
+    float scale;
+    float lowestScale;
+
+    // An exponential moving average, in milliseconds.
+    double averageRenderTime;
+    bool hasAverage;
+
+    uint32_t framesOverBudget;
+    uint32_t framesUnderBudget;
+    uint32_t framesSinceChange;
+    uint32_t changeCount;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_DYNAMIC_RESOLUTION_HPP
@@ -0,0 +1,95 @@
+#include "EntityStore.hpp"
+#include <stdio.h>
+#include <string.h>
+
+static size_t alignColumnSize(size_t size)
+{
+    return (size + EntityStoreColumnAlignment - 1) & ~(EntityStoreColumnAlignment - 1);
+}
+
+size_t EntityStore::getStorageSize(uint32_t capacity, const uint32_t *columnElementSizes, uint32_t columnCount)
+{
+    auto size = 3*alignColumnSize(sizeof(uint32_t)*capacity);
+    for(uint32_t i = 0; i < columnCount; ++i)
+        size += alignColumnSize(size_t(columnElementSizes[i])*capacity);
+    return size;
+}
+
+bool EntityStore::initialize(uint8_t *storage, uint32_t theCapacity, const uint32_t *theColumnElementSizes, uint32_t theColumnCount)
+{
+    if(!storage || theColumnCount > EntityStoreMaxColumnCount || theCapacity >= InvalidRow)
+    {
+        fprintf(stderr, "Invalid entity store with %u columns\n", theColumnCount);
+        return false;
+    }
+
+    capacity = theCapacity;
+    count = 0;
+    columnCount = theColumnCount;
+    for(uint32_t i = 0; i < columnCount; ++i)
+    {
+        columnElementSizes[i] = theColumnElementSizes[i];
+        columns[i] = storage;
+        storage += alignColumnSize(size_t(columnElementSizes[i])*capacity);
+    }
+
+    auto indexArraySize = alignColumnSize(sizeof(uint32_t)*capacity);
+    slotGenerations = reinterpret_cast<uint32_t*> (storage);
+    slotRows = reinterpret_cast<uint32_t*> (storage + indexArraySize);
+    rowSlots = reinterpret_cast<uint32_t*> (storage + 2*indexArraySize);
+
+    firstFreeSlot = 0;
+    for(uint32_t i = 0; i < capacity; ++i)
+    {
+        slotGenerations[i] = 1;
+        slotRows[i] = i + 1 < capacity ? i + 1 : InvalidRow;
+    }
+
+    return true;
+}
+
+EntityId EntityStore::create()
+{
+    if(firstFreeSlot == InvalidRow || count == capacity)
+        return EntityId{0, 0};
+
+    auto slot = firstFreeSlot;
+    firstFreeSlot = slotRows[slot];
+
+    auto row = count++;
+    slotRows[slot] = row;
+    rowSlots[row] = slot;
+    for(uint32_t i = 0; i < columnCount; ++i)
+        memset(columns[i].get() + size_t(row)*columnElementSizes[i], 0, columnElementSizes[i]);
+
+    return EntityId{slot, slotGenerations[slot]};
+}
+
+bool EntityStore::destroy(EntityId id)
+{
+    if(!isAlive(id))
+        return false;
+
+    // The last row fills the hole, so that the rows stay packed.
+    auto row = slotRows[id.index];
+    auto lastRow = --count;
+    if(row != lastRow)
+    {
+        for(uint32_t i = 0; i < columnCount; ++i)
+        {
+            auto elementSize = columnElementSizes[i];
+            auto column = columns[i].get();
+            memcpy(column + size_t(row)*elementSize, column + size_t(lastRow)*elementSize, elementSize);
+        }
+
+        auto movedSlot = rowSlots[lastRow];
+        rowSlots[row] = movedSlot;
+        slotRows[movedSlot] = row;
+    }
+
+    auto generation = slotGenerations[id.index] + 1;
+    slotGenerations[id.index] = generation != 0 ? generation : 1;
+    slotRows[id.index] = firstFreeSlot;
+    firstFreeSlot = id.index;
+    return true;
+}
@@ -0,0 +1,130 @@
+#ifndef SIMPLE_GAME_TEMPLATE_ENTITY_STORE_HPP
+#define SIMPLE_GAME_TEMPLATE_ENTITY_STORE_HPP
+
+#include "OffsetPointer.hpp"
+#include <stddef.h>
+#include <stdint.h>
+
+static constexpr uint32_t EntityStoreMaxColumnCount = 16;
+
+// The columns start at cache lines, for the vector loads.
+static constexpr size_t EntityStoreColumnAlignment = 64;
+
+/**
+ * Identifies an entity of an EntityStore. The generation of a slot is
+ * increased when its entity is destroyed, so the identifiers of destroyed
+ * entities are never confused with the entities that reuse their slots.
+ */
+struct EntityId
+{
+    uint32_t index;
+
+    // Zero is the null identifier.
+    uint32_t generation;
+
+    bool isNull() const
+    {
+        return generation == 0;
+    }
+
+    bool operator==(const EntityId &other) const
+    {
+        return index == other.index && generation == other.generation;
+    }
+
+    bool operator!=(const EntityId &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Entities with the same components, stored as a column per component field.
+ * The rows of the live entities are packed at the beginning of the columns,
+ * so a system goes through a few arrays linearly, which the compiler can
+ * vectorize. Destroying an entity moves the last row into its place, so the
+ * rows are iterated backwards when the loop destroys entities. Entities with
+ * different components belong to different stores.
+ *
+ * The store has no pointers, only OffsetPointers, so it survives the reloads
+ * of the game logic and the snapshots of the persistent memory, as long as
+ * the store and its storage are both in the persistent memory.
+ */
+class EntityStore
+{
+public:
+    static constexpr uint32_t InvalidRow = ~0u;
+
+    // The number of bytes that initialize needs.
+    static size_t getStorageSize(uint32_t capacity, const uint32_t *columnElementSizes, uint32_t columnCount);
+
+    // The storage must be aligned to EntityStoreColumnAlignment.
+    bool initialize(uint8_t *storage, uint32_t theCapacity, const uint32_t *theColumnElementSizes, uint32_t theColumnCount);
+
+    bool isInitialized() const
+    {
+        return capacity > 0;
+    }
+
+    // Returns a null identifier when the store is full. The components of the
+    // new entity are zeroed.
+    EntityId create();
+
+    // Returns false when the entity was already destroyed.
+    bool destroy(EntityId id);
+
+    // A free slot also has a generation, the one of its next entity, so the
+    // slot must have a row that points back to it too.
+    bool isAlive(EntityId id) const
+    {
+        if(id.index >= capacity || id.generation == 0 || slotGenerations[id.index] != id.generation)
+            return false;
+
+        auto row = slotRows[id.index];
+        return row < count && rowSlots[row] == id.index;
+    }
+
+    // The row of the entity in the columns, or InvalidRow when it is not alive.
+    // The row changes when other entities are destroyed.
+    uint32_t getRow(EntityId id) const
+    {
+        return isAlive(id) ? slotRows[id.index] : InvalidRow;
+    }
+
+    EntityId getEntity(uint32_t row) const
+    {
+        auto slot = rowSlots[row];
+        return EntityId{slot, slotGenerations[slot]};
+    }
+
+    template<typename T>
+    T *getColumn(uint32_t column) const
+    {
+        return reinterpret_cast<T*> (columns[column].get());
+    }
+
+    uint32_t getCount() const
+    {
+        return count;
+    }
+
+    uint32_t getCapacity() const
+    {
+        return capacity;
+    }
+
+private:
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t columnCount;
+    uint32_t columnElementSizes[EntityStoreMaxColumnCount];
+    OffsetPointer<uint8_t> columns[EntityStoreMaxColumnCount];
+
+    // The slots of the free entities are linked through their rows.
+    uint32_t firstFreeSlot;
+    OffsetPointer<uint32_t> slotGenerations;
+    OffsetPointer<uint32_t> slotRows;
+    OffsetPointer<uint32_t> rowSlots;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_ENTITY_STORE_HPP
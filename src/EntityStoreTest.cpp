@@ -0,0 +1,64 @@
+#include "EntityStore.hpp"
+#include "MemoryZone.hpp"
+#include <stdio.h>
+
+static int failureCount;
+
+static void check(bool condition, const char *description)
+{
+    if(!condition)
+    {
+        fprintf(stderr, "Failed: %s\n", description);
+        ++failureCount;
+    }
+}
+
+int main()
+{
+    static const uint32_t columnSizes[] = {sizeof(float), sizeof(uint32_t)};
+    static constexpr uint32_t Capacity = 8;
+
+    MemoryZone zone;
+    zone.reserve(EntityStore::getStorageSize(Capacity, columnSizes, 2) + EntityStoreColumnAlignment, MemoryZoneBackend::Heap);
+    EntityStore store;
+    if(!store.initialize(zone.allocateBytes(EntityStore::getStorageSize(Capacity, columnSizes, 2), EntityStoreColumnAlignment), Capacity, columnSizes, 2))
+        return 1;
+
+    // Every free slot has a generation, so forged identifiers match it.
+    for(uint32_t i = 0; i < Capacity; ++i)
+        check(!store.isAlive(EntityId{i, 1}), "a forged identifier of a fresh store is not alive");
+    check(!store.destroy(EntityId{0, 1}), "destroying a forged identifier of an empty store fails");
+    check(store.getCount() == 0, "the count of an empty store stays zero");
+    check(store.getRow(EntityId{3, 1}) == EntityStore::InvalidRow, "a forged identifier has no row");
+
+    auto first = store.create();
+    auto second = store.create();
+    auto third = store.create();
+    store.getColumn<uint32_t> (1)[store.getRow(first)] = 1;
+    store.getColumn<uint32_t> (1)[store.getRow(second)] = 2;
+    store.getColumn<uint32_t> (1)[store.getRow(third)] = 3;
+    check(store.isAlive(first) && store.isAlive(second) && store.isAlive(third), "created entities are alive");
+    check(!store.isAlive(EntityId{5, 1}), "a forged identifier of a free slot is not alive");
+
+    // The freed slot already holds the generation of its next entity.
+    check(store.destroy(second), "destroying a live entity succeeds");
+    check(!store.isAlive(second), "a destroyed entity is not alive");
+    check(!store.isAlive(EntityId{second.index, second.generation + 1}), "the next identifier of a freed slot is not alive before it is created");
+    check(!store.destroy(second), "destroying a stale identifier fails");
+    check(!store.destroy(EntityId{second.index, second.generation + 1}), "destroying a not yet created identifier fails");
+    check(store.getCount() == 2, "failed destroys keep the count");
+    check(store.getColumn<uint32_t> (1)[store.getRow(first)] == 1 && store.getColumn<uint32_t> (1)[store.getRow(third)] == 3,
+        "failed destroys keep the rows");
+
+    auto reused = store.create();
+    check(reused.index == second.index && reused.generation == second.generation + 1, "a new entity reuses the freed slot");
+    check(store.isAlive(reused) && !store.isAlive(second), "only the new identifier of a reused slot is alive");
+
+    check(store.destroy(first) && store.destroy(third) && store.destroy(reused), "destroying every entity succeeds");
+    check(store.getCount() == 0, "the store is empty after destroying every entity");
+    check(!store.destroy(first) && store.getCount() == 0, "destroying from an empty store fails");
+
+    if(failureCount == 0)
+        printf("EntityStore: all checks passed\n");
+    return failureCount == 0 ? 0 : 1;
+}
@@ -0,0 +1,80 @@
+#include "FramePacer.hpp"
+#include "Profiler.hpp"
+#include "SDL.h"
+#include <math.h>
+
+// The weight of a new sleep measurement in the running estimate.
+static constexpr double SleepEstimateWeight = 0.05;
+
+FramePacer::FramePacer()
+    : counterFrequency(1), framePeriod(0), frameStartTime(0), nextFrameTime(0),
+      sleepMean(0.001), sleepVariance(0),
+      frameTimes(0.25, 200), wakeUpErrors(0.025, 80)
+{
+}
+
+void FramePacer::start(double frameRate)
+{
+    counterFrequency = SDL_GetPerformanceFrequency();
+    framePeriod = frameRate > 0 ? secondsToTicks(1.0 / frameRate) : 0;
+    frameStartTime = SDL_GetPerformanceCounter();
+    nextFrameTime = frameStartTime + framePeriod;
+}
+
+double FramePacer::beginFrame()
+{
+    auto now = SDL_GetPerformanceCounter();
+    auto delta = ticksToSeconds(now - frameStartTime);
+    frameStartTime = now;
+    frameTimes.add(delta*1000.0);
+    return delta;
+}
+
+void FramePacer::waitForNextFrame()
+{
+    PROFILE_ZONE("Wait for next frame");
+    if(framePeriod == 0)
+        return;
+
+    auto now = SDL_GetPerformanceCounter();
+    if(now < nextFrameTime)
+    {
+        sleepUntil(nextFrameTime);
+
+        // The rest is spun, since a sleep may overshoot by more than a millisecond.
+        while((now = SDL_GetPerformanceCounter()) < nextFrameTime)
+            ;
+        wakeUpErrors.add(ticksToSeconds(now - nextFrameTime)*1000.0);
+    }
+
+    // The deadlines advance by whole periods, so that the rounding of the
+    // period does not accumulate. A frame that is late by more than a period
+    // starts a new schedule instead of being followed by short frames.
+    nextFrameTime += framePeriod;
+    if(now > nextFrameTime)
+        nextFrameTime = now + framePeriod;
+}
+
+void FramePacer::sleepUntil(uint64_t deadline)
+{
+    for(;;)
+    {
+        auto start = SDL_GetPerformanceCounter();
+        auto safeSleepDuration = sleepMean + 2.0*sqrt(sleepVariance);
+        if(start >= deadline || ticksToSeconds(deadline - start) <= safeSleepDuration)
+            return;
+
+        SDL_Delay(1);
+
+        auto duration = ticksToSeconds(SDL_GetPerformanceCounter() - start);
+        auto difference = duration - sleepMean;
+        sleepMean += SleepEstimateWeight*difference;
+        sleepVariance = (1.0 - SleepEstimateWeight)*(sleepVariance + SleepEstimateWeight*difference*difference);
+    }
+}
+
+void FramePacer::printStatistics() const
+{
+    frameTimes.print("Frame times");
+    wakeUpErrors.print("Frame start delays");
+}
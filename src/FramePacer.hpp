@@ -0,0 +1,57 @@
+#ifndef SIMPLE_GAME_TEMPLATE_FRAME_PACER_HPP
+#define SIMPLE_GAME_TEMPLATE_FRAME_PACER_HPP
+
+#include "FrameStatistics.hpp"
+#include <stdint.h>
+
+/**
+ * Measures the frames with the performance counter, and waits for the start
+ * of the next frame. The wait sleeps while the remaining time is safely above
+ * the measured sleep granularity of the OS, and it spins for the rest, so that
+ * the frames start within a few tens of microseconds of their deadline.
+ */
+class FramePacer
+{
+public:
+    static constexpr double DefaultFrameRate = 60.0;
+
+    FramePacer();
+
+    // A frame rate of zero disables the waiting.
+    void start(double frameRate);
+
+    // Returns the seconds since the previous frame began.
+    double beginFrame();
+
+    void waitForNextFrame();
+
+    void printStatistics() const;
+
+private:
+    uint64_t secondsToTicks(double seconds) const
+    {
+        return uint64_t(seconds*counterFrequency);
+    }
+
+    double ticksToSeconds(uint64_t ticks) const
+    {
+        return double(ticks) / counterFrequency;
+    }
+
+    void sleepUntil(uint64_t deadline);
+
+    uint64_t counterFrequency;
+    uint64_t framePeriod;
+    uint64_t frameStartTime;
+    uint64_t nextFrameTime;
+
+    // The running mean and variance of the duration of a one millisecond
+    // sleep, in seconds. Old measurements decay, so it adapts to the load.
+    double sleepMean;
+    double sleepVariance;
+
+    DurationHistogram frameTimes;
+    DurationHistogram wakeUpErrors;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_FRAME_PACER_HPP
@@ -0,0 +1,154 @@
+#ifndef SIMPLE_GAME_TEMPLATE_FRAME_STATISTICS_HPP
+#define SIMPLE_GAME_TEMPLATE_FRAME_STATISTICS_HPP
+
+#include "MemoryZone.hpp"
+#include <algorithm>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * A collection of duration samples, in milliseconds, used for computing
+ * the percentiles of the frame times.
+ */
+class DurationSamples
+{
+public:
+    void reserve(size_t count)
+    {
+        samples.reserve(count);
+    }
+
+    void add(double milliseconds)
+    {
+        samples.push_back(milliseconds);
+        isSorted = false;
+    }
+
+    bool isEmpty() const
+    {
+        return samples.empty();
+    }
+
+    double percentile(double fraction)
+    {
+        if(samples.empty())
+            return 0;
+
+        sort();
+        auto index = size_t(fraction*(samples.size() - 1) + 0.5);
+        return samples[std::min(index, samples.size() - 1)];
+    }
+
+    double maximum()
+    {
+        return percentile(1.0);
+    }
+
+    double mean() const
+    {
+        if(samples.empty())
+            return 0;
+
+        double sum = 0;
+        for(auto sample : samples)
+            sum += sample;
+        return sum / samples.size();
+    }
+
+    void printSummary(const char *name)
+    {
+        printf("%-8s p50 %8.3f ms  p95 %8.3f ms  p99 %8.3f ms  max %8.3f ms  mean %8.3f ms\n",
+            name, percentile(0.5), percentile(0.95), percentile(0.99), maximum(), mean());
+    }
+
+private:
+    void sort()
+    {
+        if(isSorted)
+            return;
+
+        std::sort(samples.begin(), samples.end());
+        isSorted = true;
+    }
+
+    std::vector<double> samples;
+    bool isSorted = true;
+};
+
+/**
+ * Counts durations, in milliseconds, into buckets of a fixed width. Unlike
+ * DurationSamples, the memory does not grow with the number of frames, so it
+ * is used for the whole run of the interactive host.
+ */
+class DurationHistogram
+{
+public:
+    DurationHistogram(double theBucketWidth, size_t bucketCount)
+        : bucketWidth(theBucketWidth), buckets(bucketCount + 1), sampleCount(0), sum(0), maximumValue(0) {}
+
+    void add(double milliseconds)
+    {
+        auto index = size_t(std::max(milliseconds, 0.0) / bucketWidth);
+        ++buckets[std::min(index, buckets.size() - 1)];
+        ++sampleCount;
+        sum += milliseconds;
+        maximumValue = std::max(maximumValue, milliseconds);
+    }
+
+    // The upper bound of the bucket that holds the percentile.
+    double percentile(double fraction) const
+    {
+        auto target = uint64_t(fraction*sampleCount);
+        uint64_t count = 0;
+        for(size_t i = 0; i + 1 < buckets.size(); ++i)
+        {
+            count += buckets[i];
+            if(count > target)
+                return (i + 1)*bucketWidth;
+        }
+
+        return maximumValue;
+    }
+
+    void print(const char *name) const
+    {
+        if(sampleCount == 0)
+            return;
+
+        printf("%s: %llu samples, p50 %.3f ms  p99 %.3f ms  max %.3f ms  mean %.3f ms\n", name,
+            (unsigned long long)sampleCount, percentile(0.5), percentile(0.99), maximumValue, sum / sampleCount);
+
+        uint64_t largestCount = *std::max_element(buckets.begin(), buckets.end());
+        for(size_t i = 0; i < buckets.size(); ++i)
+        {
+            if(buckets[i] == 0)
+                continue;
+
+            char bar[41];
+            auto barLength = size_t((buckets[i]*40 + largestCount - 1) / largestCount);
+            memset(bar, '#', barLength);
+            bar[barLength] = 0;
+            if(i + 1 < buckets.size())
+                printf("  %8.3f - %8.3f ms %10llu %s\n", i*bucketWidth, (i + 1)*bucketWidth, (unsigned long long)buckets[i], bar);
+            else
+                printf("  %8.3f ms or more %10llu %s\n", i*bucketWidth, (unsigned long long)buckets[i], bar);
+        }
+    }
+
+private:
+    double bucketWidth;
+    std::vector<uint64_t> buckets;
+    uint64_t sampleCount;
+    double sum;
+    double maximumValue;
+};
+
+inline void printMemoryZoneStats(const char *name, const MemoryZoneStats &stats)
+{
+    printf("%-10s %s, %zu of %zu bytes used, high water mark %zu bytes (%.1f%%), last frame peak %zu bytes, %zu bytes in %zu allocations\n",
+        name, MemoryZoneBackend::getName(stats.backend), stats.usedBytes, stats.size, stats.highWaterMark, stats.size ? stats.highWaterMark*100.0/stats.size : 0.0,
+        stats.lastFramePeakBytes, stats.lastFrameAllocatedBytes, stats.lastFrameAllocationCount);
+}
+
+#endif //SIMPLE_GAME_TEMPLATE_FRAME_STATISTICS_HPP
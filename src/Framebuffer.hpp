@@ -1,14 +1,178 @@
 #ifndef SIMPLE_GAME_TEMPLATE_FRAMEBUFFER_HPP
 #define SIMPLE_GAME_TEMPLATE_FRAMEBUFFER_HPP
 
+#include "PixelFormat.hpp"
+#include <algorithm>
 #include <stdint.h>
 
+// The pixel format of the framebuffer is chosen at build time, with the
+// FRAMEBUFFER_PIXEL_FORMAT option of CMake, so the drawing code is compiled
+// for a single format.
+#if defined(FRAMEBUFFER_RGB565)
+typedef PixelFormatRGB565 FramebufferFormat;
+#elif defined(FRAMEBUFFER_INDEXED8)
+typedef PixelFormatIndexed8 FramebufferFormat;
+#else
+typedef PixelFormatABGR8888 FramebufferFormat;
+#endif
+
+typedef FramebufferFormat::Pixel FramebufferPixel;
+
+static constexpr uint32_t FramebufferTileSize = 64;
+static constexpr uint32_t FramebufferDirtyRectCapacity = 32;
+
+struct FramebufferRect
+{
+    uint32_t x;
+    uint32_t y;
+    uint32_t width;
+    uint32_t height;
+
+    bool isEmpty() const
+    {
+        return width == 0 || height == 0;
+    }
+
+    bool contains(const FramebufferRect &other) const
+    {
+        return x <= other.x && y <= other.y &&
+            other.x + other.width <= x + width && other.y + other.height <= y + height;
+    }
+
+    FramebufferRect intersection(const FramebufferRect &other) const
+    {
+        auto minX = std::max(x, other.x);
+        auto minY = std::max(y, other.y);
+        auto maxX = std::min(x + width, other.x + other.width);
+        auto maxY = std::min(y + height, other.y + other.height);
+        if(minX >= maxX || minY >= maxY)
+            return FramebufferRect{0, 0, 0, 0};
+        return FramebufferRect{minX, minY, maxX - minX, maxY - minY};
+    }
+
+    FramebufferRect boundingBox(const FramebufferRect &other) const
+    {
+        if(isEmpty())
+            return other;
+        if(other.isEmpty())
+            return *this;
+
+        auto minX = std::min(x, other.x);
+        auto minY = std::min(y, other.y);
+        auto maxX = std::max(x + width, other.x + other.width);
+        auto maxY = std::max(y + height, other.y + other.height);
+        return FramebufferRect{minX, minY, maxX - minX, maxY - minY};
+    }
+};
+
+/**
+ * The rectangles of the framebuffer that changed since the previous frame.
+ * When there are more of them than fit, they are merged into their bounding
+ * box, which redraws more pixels but never misses any.
+ */
+struct FramebufferDirtyRegion
+{
+    uint32_t rectCount;
+    FramebufferRect rects[FramebufferDirtyRectCapacity];
+
+    bool isEmpty() const
+    {
+        return rectCount == 0;
+    }
+
+    void clear()
+    {
+        rectCount = 0;
+    }
+
+    void add(const FramebufferRect &rect)
+    {
+        if(rect.isEmpty())
+            return;
+
+        for(uint32_t i = 0; i < rectCount; ++i)
+        {
+            if(rects[i].contains(rect))
+                return;
+        }
+
+        if(rectCount == FramebufferDirtyRectCapacity)
+        {
+            auto bounds = rect;
+            for(uint32_t i = 0; i < rectCount; ++i)
+                bounds = bounds.boundingBox(rects[i]);
+            rects[0] = bounds;
+            rectCount = 1;
+            return;
+        }
+
+        rects[rectCount++] = rect;
+    }
+
+    void add(const FramebufferDirtyRegion &other)
+    {
+        for(uint32_t i = 0; i < other.rectCount; ++i)
+            add(other.rects[i]);
+    }
+
+    void clip(uint32_t width, uint32_t height)
+    {
+        FramebufferRect bounds = {0, 0, width, height};
+        uint32_t destIndex = 0;
+        for(uint32_t i = 0; i < rectCount; ++i)
+        {
+            auto clipped = rects[i].intersection(bounds);
+            if(!clipped.isEmpty())
+                rects[destIndex++] = clipped;
+        }
+        rectCount = destIndex;
+    }
+};
+
+/**
+ * The framebuffer is retained between the frames, so only the pixels in the
+ * dirty region have to be drawn again.
+ */
 struct Framebuffer
 {
     uint32_t width;
     uint32_t height;
     int pitch;
     uint8_t *pixels;
+
+    // The pixels of the framebuffer per pixel of the full resolution. The host
+    // lowers it when the frames take too long to render, and the game draws
+    // the same view into the smaller framebuffer.
+    float scale;
+
+    // Filled in by GameInterface::render, with the regions that are drawn
+    // differently than in the previous frame.
+    FramebufferDirtyRegion *dirtyRegion;
+
+    FramebufferPixel *getRow(uint32_t y) const
+    {
+        return reinterpret_cast<FramebufferPixel*> (pixels + ptrdiff_t(y)*pitch);
+    }
+
+    SurfaceView<FramebufferFormat> getView() const
+    {
+        return SurfaceView<FramebufferFormat>{width, height, pitch, pixels};
+    }
+
+    void markDirty(uint32_t x, uint32_t y, uint32_t rectWidth, uint32_t rectHeight) const
+    {
+        dirtyRegion->add(FramebufferRect{x, y, rectWidth, rectHeight});
+    }
+
+    void markAllDirty() const
+    {
+        markDirty(0, 0, width, height);
+    }
 };
 
+/**
+ * A rectangle of the framebuffer that is rendered by a single worker thread.
+ */
+typedef FramebufferRect FramebufferTile;
+
 #endif //SIMPLE_GAME_TEMPLATE_FRAMEBUFFER_HPP
@@ -6,10 +6,44 @@
 #include "Framebuffer.hpp"
 
 static constexpr size_t PersistentMemorySize = 8*1024*1024;
-static constexpr size_t TransientMemorySize = 16*1024;//32*1024*1024;
+// The transient memory holds the broadphase of the update, which takes about
+// 70 bytes per entity.
+static constexpr size_t TransientMemorySize = 8*1024*1024;
+static constexpr size_t RenderSnapshotMemorySize = 8*1024*1024;
+static constexpr size_t RenderCacheMemorySize = 32*1024*1024;
 
 struct HostInterface;
 
+/**
+ * The state that a frame is rendered from. With the pipelined rendering of the
+ * host, a frame is rendered in another thread while the next one is updated,
+ * so the render functions must only read the snapshot, and never the
+ * persistent or the transient memory.
+ */
+struct RenderSnapshot
+{
+    // The data that was returned by GameInterface::makeRenderSnapshot.
+    const void *data;
+
+    // The zone of the snapshot. GameInterface::render can allocate the data
+    // that is shared by the tiles from it.
+    MemoryZone *memory;
+
+    // A zone that is kept between the frames, for the data that the rendering
+    // caches, such as pre-rendered images. It is only used by the rendering,
+    // one frame at a time. The host clears it before GameInterface::render
+    // when the game logic is reloaded or its state is restored. The game
+    // finds the zone empty then, with getMarker() == 0, and allocates its
+    // caches again, so it allocates them first and keeps nothing else there.
+    MemoryZone *cacheMemory;
+
+    // The fraction of a time step that elapsed since the last update. The
+    // moving objects are drawn at previous + (current - previous)*interpolation,
+    // so that the motion stays smooth when the frame rate differs from the
+    // update rate.
+    float interpolation;
+};
+
 struct GameInterface
 {
     virtual void setHostInterface(HostInterface *theHost) = 0;
@@ -17,8 +51,34 @@ struct GameInterface
     virtual void setPersistentMemory(MemoryZone *zone) = 0;
     virtual void setTransientMemory(MemoryZone *zone) = 0;
 
+    // Called after the host overwrites the persistent memory with a snapshot.
+    // Host resources that are referenced from the persistent memory, such as
+    // images, sound samples and asset handles, belong to the run that made
+    // the snapshot, which can be another process. They are not valid anymore,
+    // must not be released, and must be replaced by the ones of this run.
+    virtual void persistentMemoryRestored() = 0;
+
+    // Identifies the layout of the data in the persistent memory. Files with
+    // the persistent memory of a different layout version are rejected.
+    virtual uint64_t getPersistentMemoryLayoutVersion() = 0;
+
     virtual void update(float delta, const ControllerState &controllerState) = 0;
-    virtual void render(const Framebuffer &framebuffer) = 0;
+
+    // Called in the main thread after the updates of every rendered frame.
+    // Copies the state that the rendering needs into memory allocated from
+    // the zone, which stays untouched until the frame is rendered.
+    virtual const void *makeRenderSnapshot(MemoryZone *zone) = 0;
+
+    // Called once per frame, before rendering the tiles, in the main thread
+    // or in the render thread of the host. It marks the regions that changed
+    // since the previous frame in the framebuffer, and only those regions are
+    // rendered and presented. Nothing is rendered when nothing is marked.
+    virtual void render(const Framebuffer &framebuffer, const RenderSnapshot &snapshot) = 0;
+
+    // Called concurrently from the render worker threads. Only the pixels
+    // inside of the tile can be written. The tile is clipped to the dirty
+    // region, so it can be smaller than FramebufferTileSize anywhere.
+    virtual void renderTile(const Framebuffer &framebuffer, const RenderSnapshot &snapshot, const FramebufferTile &tile) = 0;
 };
 
 typedef GameInterface *(*GetGameInterfaceFunction)();
@@ -2,17 +2,158 @@
 #include "HostInterface.hpp"
 #include "GameLogic.hpp"
 #include <algorithm>
+#include <math.h>
 #include <stdio.h>
 #include <time.h>
 #include <stdlib.h>
 
 GlobalState *globalState;
 HostInterface *hostInterface;
-static MemoryZone *transientMemoryZone;
+MemoryZone *persistentMemoryZone;
+MemoryZone *transientMemoryZone;
 
-uint8_t *allocateTransientBytes(size_t byteCount)
+// The image of the boxes, which is drawn by the code, so the template needs
+// no image asset. It belongs to the game logic library, so it is made again
+// after a reload.
+static Image boxImage;
+
+// The last snapshot, for finding what changed. It is not in the persistent
+// memory, since the host redraws everything after a reload or a restore.
+static FrameSnapshot previousSnapshot;
+
+// The zone does not keep its position over a restore, so it continues from
+// the position in the state.
+static void restorePersistentMemoryPosition()
+{
+    persistentMemoryZone->restoreMarker(std::max(global.persistentMemoryPosition, sizeof(GlobalState)));
+}
+
+uint8_t *allocatePersistentBytes(size_t byteCount, size_t alignment)
+{
+    restorePersistentMemoryPosition();
+    auto bytes = persistentMemoryZone->allocateBytes(byteCount, alignment);
+    if(!bytes)
+    {
+        fprintf(stderr, "Out of persistent memory for %zu bytes\n", byteCount);
+        return nullptr;
+    }
+
+    global.persistentMemoryPosition = persistentMemoryZone->getMarker();
+    return bytes;
+}
+
+uint8_t *allocateTransientBytes(size_t byteCount, size_t alignment)
+{
+    return transientMemoryZone->allocateBytes(byteCount, alignment);
+}
+
+// The host resources of this run. A restored state refers to the resources of
+// the run that saved it, which can be another process, where the handles and
+// the stream were different, so those are never released. The state keeps
+// the ones of this run instead, which are loaded once and shared by the resets
+// and the restores.
+static bool hasRunAssets;
+static AssetHandle runEffectSampleHandle;
+static SoundSamplePtr runNoiseSample;
+
+static void useRunAssets()
+{
+    if(!hasRunAssets)
+    {
+        runEffectSampleHandle = hostInterface->requestSoundSample("noise.wav", AssetLoadPriority::Normal);
+
+        // Opening a stream only reads the header, and it is decoded while it
+        // plays, so the ambience starts right away.
+        runNoiseSample = hostInterface->openSoundStream("noise.wav");
+        if(runNoiseSample)
+            runNoiseSample->play(true);
+        hasRunAssets = true;
+    }
+
+    global.effectSampleHandle = runEffectSampleHandle;
+    global.effectSample = nullptr;
+    global.noiseSample = runNoiseSample;
+}
+
+// After the code is reloaded, the state is still the one of this run, and its
+// handle is known to the host. The host has no assets yet when the code is
+// loaded for the first time, so a state from another run is not taken.
+static void takeRunAssetsAfterReload()
+{
+    if(hasRunAssets || !global.isInitialized || hostInterface->getAssetLoadStatus(global.effectSampleHandle) == AssetLoadStatus::Invalid)
+        return;
+
+    runEffectSampleHandle = global.effectSampleHandle;
+    runNoiseSample = global.noiseSample;
+    hasRunAssets = true;
+}
+
+static void updateLoadedAssets()
+{
+    if(!global.effectSample)
+        global.effectSample = hostInterface->getLoadedSoundSample(global.effectSampleHandle);
+}
+
+static void makeBoxImage()
+{
+    if(boxImage.pixels)
+        return;
+
+    auto size = uint32_t(BoxSize);
+    boxImage.width = size;
+    boxImage.height = size;
+    boxImage.bpp = 32;
+    boxImage.pitch = size*4;
+    boxImage.data.reset(new uint8_t[boxImage.pitch*size]);
+    boxImage.pixels = boxImage.data.get();
+
+    // A light border around a translucent inside.
+    auto pixels = reinterpret_cast<uint32_t*> (boxImage.data.get());
+    for(uint32_t y = 0; y < size; ++y)
+    {
+        for(uint32_t x = 0; x < size; ++x)
+        {
+            auto isBorder = x == 0 || y == 0 || x + 1 == size || y + 1 == size;
+            pixels[y*size + x] = isBorder ? 0xffffe0c0 : 0x80804020;
+        }
+    }
+}
+
+static bool initializeEntityStore(EntityStore &store, uint32_t capacity, const uint32_t *columnElementSizes, uint32_t columnCount)
+{
+    auto storageSize = EntityStore::getStorageSize(capacity, columnElementSizes, columnCount);
+    auto storage = allocatePersistentBytes(storageSize, EntityStoreColumnAlignment);
+    return store.initialize(storage, capacity, columnElementSizes, columnCount);
+}
+
+// The boxes start at the same places in every run, so that the recorded
+// inputs replay the same game.
+static void spawnBoxes()
 {
-    return transientMemoryZone->allocateBytes(byteCount);
+    auto &entities = global.entities;
+    uint32_t random = 12345;
+    auto nextRandom = [&random]() {
+        random = random*1664525u + 1013904223u;
+        return float(random >> 8) / float(1 << 24);
+    };
+
+    for(uint32_t i = 0; i < BoxCount; ++i)
+    {
+        auto row = entities.getRow(entities.create());
+        if(row == EntityStore::InvalidRow)
+            return;
+
+        auto angle = nextRandom()*6.2832f;
+        auto speed = 40.0f + nextRandom()*80.0f;
+        auto x = nextRandom()*(WorldWidth - BoxSize);
+        auto y = nextRandom()*(WorldHeight - BoxSize);
+        entities.getColumn<float> (EntityColumn::PositionX)[row] = x;
+        entities.getColumn<float> (EntityColumn::PositionY)[row] = y;
+        entities.getColumn<float> (EntityColumn::VelocityX)[row] = cosf(angle)*speed;
+        entities.getColumn<float> (EntityColumn::VelocityY)[row] = sinf(angle)*speed;
+        entities.getColumn<float> (EntityColumn::PreviousPositionX)[row] = x;
+        entities.getColumn<float> (EntityColumn::PreviousPositionY)[row] = y;
+    }
 }
 
 static void initializeGlobalState()
@@ -20,59 +161,315 @@ static void initializeGlobalState()
     if(global.isInitialized)
         return;
 
-    // TODO. This is the place for loading the required game assets..
-    global.noiseSample = hostInterface->loadSoundSample("noise.wav");
-    global.noiseSample->play(true);
+    useRunAssets();
+
+    static const uint32_t entityColumnSizes[EntityColumn::Count] = {sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(float), sizeof(float)};
+    initializeEntityStore(global.entities, MaxEntityCount, entityColumnSizes, EntityColumn::Count);
+    spawnBoxes();
+
+    auto particleStorage = allocatePersistentBytes(ParticleSystem::getStorageSize(MaxParticleCount, MaxParticleEmitterCount), ParticleColumnAlignment);
+    if(global.particles.initialize(particleStorage, MaxParticleCount, MaxParticleEmitterCount))
+    {
+        // A fountain of sparks at the bottom of the screen.
+        ParticleEmitter fountain = {};
+        fountain.x = WorldWidth*0.5f;
+        fountain.y = WorldHeight - 8.0f;
+        fountain.rate = 200.0f;
+        fountain.direction = -1.5708f;
+        fountain.spread = 0.6f;
+        fountain.minSpeed = 120.0f;
+        fountain.maxSpeed = 200.0f;
+        fountain.lifetime = 1.5f;
+        fountain.color = 0xff2080ff;
+        fountain.isActive = true;
+        global.particles.addEmitter(fountain);
+    }
 
     global.isInitialized = true;
 }
 
+void persistentMemoryRestored()
+{
+    restorePersistentMemoryPosition();
+    if(global.isInitialized)
+        useRunAssets();
+}
+
+static void updateEntities(float delta)
+{
+    // The systems of the game loop over the columns, which are dense arrays.
+    auto &entities = global.entities;
+    auto count = entities.getCount();
+    auto positionX = entities.getColumn<float> (EntityColumn::PositionX);
+    auto positionY = entities.getColumn<float> (EntityColumn::PositionY);
+    auto velocityX = entities.getColumn<float> (EntityColumn::VelocityX);
+    auto velocityY = entities.getColumn<float> (EntityColumn::VelocityY);
+    std::copy_n(positionX, count, entities.getColumn<float> (EntityColumn::PreviousPositionX));
+    std::copy_n(positionY, count, entities.getColumn<float> (EntityColumn::PreviousPositionY));
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        positionX[i] += velocityX[i]*delta;
+        positionY[i] += velocityY[i]*delta;
+    }
+
+    // The boxes bounce off the edges of the world.
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if((positionX[i] < 0.0f && velocityX[i] < 0.0f) || (positionX[i] > WorldWidth - BoxSize && velocityX[i] > 0.0f))
+            velocityX[i] = -velocityX[i];
+        if((positionY[i] < 0.0f && velocityY[i] < 0.0f) || (positionY[i] > WorldHeight - BoxSize && velocityY[i] > 0.0f))
+            velocityY[i] = -velocityY[i];
+    }
+}
+
+// The broadphase is rebuilt from the boxes of the entities in every update,
+// in the transient memory, so it never has to follow them around.
+static void collideBoxes()
+{
+    PROFILE_ZONE("Collisions");
+    auto &entities = global.entities;
+    auto count = entities.getCount();
+    auto positionX = entities.getColumn<float> (EntityColumn::PositionX);
+    auto positionY = entities.getColumn<float> (EntityColumn::PositionY);
+    auto velocityX = entities.getColumn<float> (EntityColumn::VelocityX);
+    auto velocityY = entities.getColumn<float> (EntityColumn::VelocityY);
+
+    MemoryZoneScope scope(*transientMemoryZone);
+    auto boxes = newTransientArray<CollisionBox> (count);
+    SpatialHash spatialHash;
+    if(!boxes)
+        return;
+    for(uint32_t i = 0; i < count; ++i)
+        boxes[i] = CollisionBox{positionX[i], positionY[i], positionX[i] + BoxSize, positionY[i] + BoxSize};
+    if(!spatialHash.build(transientMemoryZone, boxes, count, BoxSize*2.0f))
+        return;
+
+    // The boxes have the same mass, so they exchange their velocities along
+    // the axis where they overlap the least, when they approach each other.
+    spatialHash.forEachPair([&](uint32_t first, uint32_t second) {
+        auto overlapX = std::min(boxes[first].maxX, boxes[second].maxX) - std::max(boxes[first].minX, boxes[second].minX);
+        auto overlapY = std::min(boxes[first].maxY, boxes[second].maxY) - std::max(boxes[first].minY, boxes[second].minY);
+        auto &firstVelocity = overlapX < overlapY ? velocityX[first] : velocityY[first];
+        auto &secondVelocity = overlapX < overlapY ? velocityX[second] : velocityY[second];
+        auto offset = overlapX < overlapY ? positionX[second] - positionX[first] : positionY[second] - positionY[first];
+        if((secondVelocity - firstVelocity)*offset < 0.0f)
+            std::swap(firstVelocity, secondVelocity);
+    });
+}
+
 void update(float delta, const ControllerState &controllerState)
 {
+    PROFILE_ZONE("Game update");
     initializeGlobalState();
+    updateLoadedAssets();
     global.oldControllerState = global.controllerState;
     global.controllerState = controllerState;
 
-    // TODO: Perform time dependant updates by using the delta.
-    (void)delta;
+    // The effect is silent until it is loaded.
+    if(global.isButtonPressed(ControllerButton::A) && global.effectSample)
+        global.effectSample->play(false);
 
     // Pause button
     if(global.isButtonPressed(ControllerButton::Start))
         global.isPaused = !global.isPaused;
+
+    if(!global.isPaused)
+    {
+        updateEntities(delta);
+        collideBoxes();
+
+        PROFILE_ZONE("Particles");
+        global.particles.update(hostInterface, delta, 0.0f, ParticleGravity);
+    }
 }
 
-void render(const Framebuffer &framebuffer)
+const void *makeRenderSnapshot(MemoryZone *zone)
 {
-    auto destRow = framebuffer.pixels;
-    for(uint32_t y = 0; y < framebuffer.height; ++y)
+    PROFILE_ZONE("Game snapshot");
+    auto snapshot = zone->allocate<FrameSnapshot> ();
+    if(!snapshot)
+        return nullptr;
+    snapshot->isPaused = global.isPaused;
+
+    // The positions of the boxes are copied, since the next update moves them
+    // while this frame may be rendering. The sprites are added in render,
+    // where the scale of the framebuffer is known.
+    auto &entities = global.entities;
+    snapshot->boxCount = entities.getCount();
+    snapshot->boxPositionX = zone->allocateArray<float> (snapshot->boxCount);
+    snapshot->boxPositionY = zone->allocateArray<float> (snapshot->boxCount);
+    snapshot->boxPreviousPositionX = zone->allocateArray<float> (snapshot->boxCount);
+    snapshot->boxPreviousPositionY = zone->allocateArray<float> (snapshot->boxCount);
+    if(!snapshot->boxPositionX || !snapshot->boxPositionY || !snapshot->boxPreviousPositionX || !snapshot->boxPreviousPositionY)
+        snapshot->boxCount = 0;
+    std::copy_n(entities.getColumn<float> (EntityColumn::PositionX), snapshot->boxCount, snapshot->boxPositionX);
+    std::copy_n(entities.getColumn<float> (EntityColumn::PositionY), snapshot->boxCount, snapshot->boxPositionY);
+
+    // The paused boxes stay where the last update left them.
+    auto isMoving = !snapshot->isPaused;
+    auto previousColumnX = isMoving ? EntityColumn::PreviousPositionX : EntityColumn::PositionX;
+    auto previousColumnY = isMoving ? EntityColumn::PreviousPositionY : EntityColumn::PositionY;
+    std::copy_n(entities.getColumn<float> (previousColumnX), snapshot->boxCount, snapshot->boxPreviousPositionX);
+    std::copy_n(entities.getColumn<float> (previousColumnY), snapshot->boxCount, snapshot->boxPreviousPositionY);
+
+    // The boxes or the particles are left out of a frame when the zone is
+    // full. Their regions of the previous frame are still redrawn.
+    snapshot->sprites = zone->allocate<SpriteBatch> ();
+    snapshot->particles = zone->allocate<ParticleView> ();
+    if(snapshot->particles)
     {
-        auto dest = reinterpret_cast<uint32_t*> (destRow);
-        for(uint32_t x = 0; x < framebuffer.width; ++x)
-            dest[x] = (x & 0xff) | ((y & 0xFF) << 8) | 0xff000000;
+        snapshot->particles->begin(zone, global.particles, ParticleBlendMode::Additive, 0.0f, 0.0f);
+        snapshot->particleBounds = snapshot->particles->getBounds();
+    }
+    snapshot->previousParticleBounds = previousSnapshot.particleBounds;
 
-        destRow += framebuffer.pitch;
+    // A box is drawn somewhere between its two positions. The corners left
+    // of or above the framebuffer are clamped to its edge, where the box can
+    // still be partially visible. Too many boxes merge into their bounding
+    // box.
+    snapshot->boxRegion.clear();
+    for(uint32_t i = 0; isMoving && i < snapshot->boxCount; ++i)
+    {
+        auto minX = std::max(floorf(std::min(snapshot->boxPositionX[i], snapshot->boxPreviousPositionX[i])), 0.0f);
+        auto minY = std::max(floorf(std::min(snapshot->boxPositionY[i], snapshot->boxPreviousPositionY[i])), 0.0f);
+        auto maxX = std::max(floorf(std::max(snapshot->boxPositionX[i], snapshot->boxPreviousPositionX[i])) + 1.0f, minX + 1.0f);
+        auto maxY = std::max(floorf(std::max(snapshot->boxPositionY[i], snapshot->boxPreviousPositionY[i])) + 1.0f, minY + 1.0f);
+        snapshot->boxRegion.add(FramebufferRect{uint32_t(minX), uint32_t(minY), uint32_t(maxX - minX), uint32_t(maxY - minY)});
+    }
+
+    // The boxes and the particles are redrawn at their old and their new
+    // places. Everything is redrawn when the pause toggles.
+    snapshot->previousBoxRegion = previousSnapshot.boxRegion;
+    snapshot->isAllDirty = snapshot->isPaused != previousSnapshot.isPaused;
+
+    previousSnapshot = *snapshot;
+    return snapshot;
+}
+
+// The corners are rounded outwards, so a smaller framebuffer redraws every
+// pixel that a box can touch.
+static void markBoxRegionDirty(const Framebuffer &framebuffer, const FramebufferDirtyRegion &boxRegion)
+{
+    for(uint32_t i = 0; i < boxRegion.rectCount; ++i)
+    {
+        auto &rect = boxRegion.rects[i];
+        auto minX = uint32_t(float(rect.x)*framebuffer.scale);
+        auto minY = uint32_t(float(rect.y)*framebuffer.scale);
+        auto maxX = uint32_t(ceilf(float(rect.x + rect.width)*framebuffer.scale)) + boxImage.width;
+        auto maxY = uint32_t(ceilf(float(rect.y + rect.height)*framebuffer.scale)) + boxImage.height;
+        framebuffer.markDirty(minX, minY, maxX - minX, maxY - minY);
     }
 }
 
+// The splats are a pixel, at their scaled position rounded down.
+static void markParticleBoundsDirty(const Framebuffer &framebuffer, const FramebufferRect &bounds)
+{
+    if(bounds.isEmpty())
+        return;
+
+    auto minX = uint32_t(float(bounds.x)*framebuffer.scale);
+    auto minY = uint32_t(float(bounds.y)*framebuffer.scale);
+    auto maxX = uint32_t(float(bounds.x + bounds.width - 1)*framebuffer.scale) + 1;
+    auto maxY = uint32_t(float(bounds.y + bounds.height - 1)*framebuffer.scale) + 1;
+    framebuffer.markDirty(minX, minY, maxX - minX, maxY - minY);
+}
+
+void render(const Framebuffer &framebuffer, const RenderSnapshot &snapshot)
+{
+    PROFILE_ZONE("Game render");
+    auto frameSnapshot = reinterpret_cast<const FrameSnapshot*> (snapshot.data);
+
+    // Without a snapshot only the background is drawn, everywhere.
+    if(!frameSnapshot)
+    {
+        framebuffer.markAllDirty();
+        return;
+    }
+
+    // The boxes are drawn between their last two updates, so they move
+    // smoothly at any frame rate. The batch only reserves the sprites that
+    // are added.
+    makeBoxImage();
+    auto sprites = frameSnapshot->sprites;
+    auto interpolation = snapshot.interpolation;
+    if(sprites)
+    {
+        sprites->begin(snapshot.memory, frameSnapshot->boxCount);
+        for(uint32_t i = 0; i < frameSnapshot->boxCount; ++i)
+        {
+            auto previousX = frameSnapshot->boxPreviousPositionX[i];
+            auto previousY = frameSnapshot->boxPreviousPositionY[i];
+            auto x = (previousX + (frameSnapshot->boxPositionX[i] - previousX)*interpolation)*framebuffer.scale;
+            auto y = (previousY + (frameSnapshot->boxPositionY[i] - previousY)*interpolation)*framebuffer.scale;
+            sprites->addSprite(0, &boxImage, int32_t(floorf(x)), int32_t(floorf(y)));
+        }
+        sprites->prepare(framebuffer);
+    }
+    if(frameSnapshot->particles)
+        frameSnapshot->particles->prepare(framebuffer);
+    if(frameSnapshot->isAllDirty)
+    {
+        framebuffer.markAllDirty();
+        return;
+    }
+
+    markBoxRegionDirty(framebuffer, frameSnapshot->boxRegion);
+    markBoxRegionDirty(framebuffer, frameSnapshot->previousBoxRegion);
+    markParticleBoundsDirty(framebuffer, frameSnapshot->particleBounds);
+    markParticleBoundsDirty(framebuffer, frameSnapshot->previousParticleBounds);
+}
+
+void renderTile(const Framebuffer &framebuffer, const RenderSnapshot &snapshot, const FramebufferTile &tile)
+{
+    PROFILE_ZONE("Game render tile");
+    auto frameSnapshot = reinterpret_cast<const FrameSnapshot*> (snapshot.data);
+
+    // The pattern is in the coordinates of the full resolution.
+    auto inverseScale = 1.0f / framebuffer.scale;
+    for(uint32_t y = tile.y; y < tile.y + tile.height; ++y)
+    {
+        auto dest = framebuffer.getRow(y) + tile.x;
+        auto patternY = uint32_t(float(y)*inverseScale);
+        for(uint32_t x = tile.x; x < tile.x + tile.width; ++x)
+        {
+            auto patternX = uint32_t(float(x)*inverseScale);
+            dest[x - tile.x] = FramebufferFormat::fromABGR8888((patternX & 0xff) | ((patternY & 0xFF) << 8) | 0xff000000);
+        }
+    }
+
+    if(!frameSnapshot)
+        return;
+    if(frameSnapshot->sprites)
+        frameSnapshot->sprites->renderTile(framebuffer, tile);
+    if(frameSnapshot->particles)
+        frameSnapshot->particles->renderTile(framebuffer, tile);
+}
+
 class GameInterfaceImpl : public GameInterface
 {
 public:
     virtual void setPersistentMemory(MemoryZone *zone) override;
     virtual void setTransientMemory(MemoryZone *zone) override;
+    virtual void persistentMemoryRestored() override;
+    virtual uint64_t getPersistentMemoryLayoutVersion() override;
     virtual void update(float delta, const ControllerState &controllerState) override;
-    virtual void render(const Framebuffer &framebuffer) override;
+    virtual const void *makeRenderSnapshot(MemoryZone *zone) override;
+    virtual void render(const Framebuffer &framebuffer, const RenderSnapshot &snapshot) override;
+    virtual void renderTile(const Framebuffer &framebuffer, const RenderSnapshot &snapshot, const FramebufferTile &tile) override;
     virtual void setHostInterface(HostInterface *theHost) override;
 
 };
 
 void GameInterfaceImpl::setPersistentMemory(MemoryZone *zone)
 {
+    persistentMemoryZone = zone;
     globalState = reinterpret_cast<GlobalState*> (zone->getData());
 }
 
 void GameInterfaceImpl::setHostInterface(HostInterface *theHost)
 {
     hostInterface = theHost;
+    takeRunAssetsAfterReload();
 }
 
 void GameInterfaceImpl::setTransientMemory(MemoryZone *zone)
@@ -80,14 +477,36 @@ void GameInterfaceImpl::setTransientMemory(MemoryZone *zone)
     transientMemoryZone = zone;
 }
 
+void GameInterfaceImpl::persistentMemoryRestored()
+{
+    ::persistentMemoryRestored();
+}
+
+uint64_t GameInterfaceImpl::getPersistentMemoryLayoutVersion()
+{
+    // The size catches most of the layout changes that are not accompanied
+    // by a version increase.
+    return (uint64_t(GlobalStateLayoutVersion) << 32) | uint64_t(sizeof(GlobalState));
+}
+
 void GameInterfaceImpl::update(float delta, const ControllerState &controllerState)
 {
     ::update(delta, controllerState);
 }
 
-void GameInterfaceImpl::render(const Framebuffer &framebuffer)
+const void *GameInterfaceImpl::makeRenderSnapshot(MemoryZone *zone)
+{
+    return ::makeRenderSnapshot(zone);
+}
+
+void GameInterfaceImpl::render(const Framebuffer &framebuffer, const RenderSnapshot &snapshot)
+{
+    ::render(framebuffer, snapshot);
+}
+
+void GameInterfaceImpl::renderTile(const Framebuffer &framebuffer, const RenderSnapshot &snapshot, const FramebufferTile &tile)
 {
-    ::render(framebuffer);
+    ::renderTile(framebuffer, snapshot, tile);
 }
 
 static GameInterfaceImpl gameInterfaceImpl;
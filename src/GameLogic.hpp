@@ -2,11 +2,52 @@
 #define SIMPLE_GAME_TEMPLATE_GAME_LOGIC_INTERFACE_HPP
 
 #include "GameInterface.hpp"
+#include "HostInterface.hpp"
 #include "ControllerState.hpp"
+#include "EntityStore.hpp"
 #include "Image.hpp"
+#include "ParticleSystem.hpp"
 #include "SoundSample.hpp"
+#include "SpatialHash.hpp"
+#include "SpriteBatch.hpp"
 #include <algorithm>
 
+// Increase this when the layout of GlobalState changes, so that the saved
+// persistent memory of older builds is rejected.
+static constexpr uint32_t GlobalStateLayoutVersion = 8;
+
+static constexpr uint32_t MaxEntityCount = 65536;
+
+// The template bounces a few boxes around a world of the size of the screen.
+static constexpr float WorldWidth = 640.0f;
+static constexpr float WorldHeight = 480.0f;
+static constexpr uint32_t BoxCount = 16;
+static constexpr float BoxSize = 16.0f;
+
+// A particle takes 24 bytes of the persistent memory, so more particles need
+// a larger PersistentMemorySize.
+static constexpr uint32_t MaxParticleCount = 131072;
+static constexpr uint32_t MaxParticleEmitterCount = 1024;
+static constexpr float ParticleGravity = 120.0f;
+
+// The columns of the boxes. A game adds a column per field of its components.
+namespace EntityColumn
+{
+enum Type
+{
+    PositionX = 0,
+    PositionY,
+    VelocityX,
+    VelocityY,
+
+    // The position before the last update, for interpolating the frames.
+    PreviousPositionX,
+    PreviousPositionY,
+
+    Count
+};
+}
+
 struct GlobalState
 {
     // Global states
@@ -18,7 +59,17 @@ struct GlobalState
     ControllerState oldControllerState;
     ControllerState controllerState;
 
-    // Assets.
+    // The end of the persistent memory that is allocated after GlobalState.
+    size_t persistentMemoryPosition;
+
+    EntityStore entities;
+    ParticleSystem particles;
+
+    // Assets. The effects are requested asynchronously, and used once they
+    // are loaded. The ambience is streamed. They are owned by the run, and
+    // only referred to from here.
+    AssetHandle effectSampleHandle;
+    SoundSamplePtr effectSample;
     SoundSamplePtr noiseSample;
 
     bool isButtonPressed(int button) const
@@ -29,16 +80,71 @@ struct GlobalState
 
 static_assert(sizeof(GlobalState) < PersistentMemorySize, "Increase the persistentMemory");
 
+// The state that the rendering reads. It is copied after the updates, since
+// the host may render it while the next frame is updated.
+struct FrameSnapshot
+{
+    bool isPaused;
+
+    uint32_t boxCount;
+    float *boxPositionX;
+    float *boxPositionY;
+    float *boxPreviousPositionX;
+    float *boxPreviousPositionY;
+
+    // Allocated from the zone of the snapshot, since the transient memory is
+    // released while the frame may still be rendering.
+    SpriteBatch *sprites;
+    ParticleView *particles;
+
+    // The bounds of the particles in this frame and in the previous one, in
+    // the coordinates of the full resolution.
+    FramebufferRect particleBounds;
+    FramebufferRect previousParticleBounds;
+
+    // The regions where the top left corners of the moving boxes can be in
+    // this frame and in the previous one, whatever their interpolation, in
+    // the coordinates of the full resolution. The sprites are not scaled, so
+    // render adds their size in framebuffer pixels.
+    FramebufferDirtyRegion boxRegion;
+    FramebufferDirtyRegion previousBoxRegion;
+
+    // Everything is drawn differently than in the previous snapshot.
+    bool isAllDirty;
+};
+
 extern GlobalState *globalState;
+extern HostInterface *hostInterface;
+extern MemoryZone *persistentMemoryZone;
+extern MemoryZone *transientMemoryZone;
 
 #define global (*globalState)
 
-uint8_t *allocateTransientBytes(size_t byteCount);
+// Profiles the rest of the scope, with the profiler of the host.
+#define PROFILE_ZONE(name) PROFILE_ZONE_WITH_RECORDER(HostInterface, hostInterface, name)
+
+// The persistent memory after GlobalState is never released. Its position is
+// kept in GlobalState, so it survives the reloads and the snapshots. The data
+// that is allocated from it refers to each other with OffsetPointers, since
+// the persistent memory can be at another address in the next run. Returns
+// nullptr when the persistent memory is full.
+uint8_t *allocatePersistentBytes(size_t byteCount, size_t alignment = MemoryZone::DefaultAlignment);
+
+// The transient memory is released by the host at the beginning of every
+// frame. It must only be allocated from the main thread. Use a
+// MemoryZoneScope on it for releasing scratch memory earlier.
+uint8_t *allocateTransientBytes(size_t byteCount, size_t alignment = MemoryZone::DefaultAlignment);
 
 template<typename T>
 T *newTransient()
 {
-    return allocateTransientBytes(sizeof(T));
+    return transientMemoryZone->allocate<T> ();
+}
+
+template<typename T>
+T *newTransientArray(size_t count)
+{
+    return transientMemoryZone->allocateArray<T> (count);
 }
 
 #endif //SIMPLE_GAME_TEMPLATE_GAME_LOGIC_INTERFACE_HPP
@@ -0,0 +1,284 @@
+#include "GameLogicLibraryWatcher.hpp"
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+// Time without further changes before the library is considered finished.
+static constexpr int SettleTimeMilliseconds = 100;
+static constexpr int PollingIntervalMilliseconds = 250;
+
+namespace
+{
+
+bool getFileStat(const std::string &path, struct stat &result)
+{
+    return stat(path.c_str(), &result) == 0;
+}
+
+bool isSameFileStat(const struct stat &a, const struct stat &b)
+{
+    return a.st_size == b.st_size && a.st_mtime == b.st_mtime && a.st_ino == b.st_ino;
+}
+
+bool copyFile(const std::string &source, const std::string &destination)
+{
+    auto input = open(source.c_str(), O_RDONLY);
+    if(input < 0)
+        return false;
+
+    auto output = open(destination.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0700);
+    if(output < 0)
+    {
+        close(input);
+        return false;
+    }
+
+    char buffer[64*1024];
+    bool success = true;
+    for(;;)
+    {
+        auto readCount = read(input, buffer, sizeof(buffer));
+        if(readCount <= 0)
+        {
+            success = readCount == 0;
+            break;
+        }
+
+        if(write(output, buffer, readCount) != readCount)
+        {
+            success = false;
+            break;
+        }
+    }
+
+    close(input);
+    success = close(output) == 0 && success;
+    return success;
+}
+
+std::string getTemporaryDirectory()
+{
+    auto directory = getenv("TMPDIR");
+    return directory && *directory ? directory : "/tmp";
+}
+
+}
+
+GameLogicLibraryWatcher::GameLogicLibraryWatcher()
+    : copyCount(0), inotifyFD(-1), stopping(false), loadedLibraryAvailable(false)
+{
+    stopPipe[0] = stopPipe[1] = -1;
+}
+
+GameLogicLibraryWatcher::~GameLogicLibraryWatcher()
+{
+    stop();
+}
+
+bool GameLogicLibraryWatcher::start(const char *libraryFileName)
+{
+    stop();
+
+    libraryPath = libraryFileName;
+    auto separator = libraryPath.rfind('/');
+    libraryDirectory = separator == std::string::npos ? "." : libraryPath.substr(0, separator);
+    libraryBaseName = separator == std::string::npos ? libraryPath : libraryPath.substr(separator + 1);
+
+    if(pipe(stopPipe) != 0)
+        return false;
+
+#ifdef __linux__
+    inotifyFD = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(inotifyFD >= 0 && inotify_add_watch(inotifyFD, libraryDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0)
+    {
+        close(inotifyFD);
+        inotifyFD = -1;
+    }
+#endif
+
+    stopping = false;
+    watcherThread = std::thread([this]() { watcherThreadEntry(); });
+    return true;
+}
+
+void GameLogicLibraryWatcher::stop()
+{
+    if(!watcherThread.joinable())
+        return;
+
+    stopping = true;
+    char stopSignal = 0;
+    if(write(stopPipe[1], &stopSignal, 1) != 1)
+        perror("Failed to signal the game logic library watcher");
+    watcherThread.join();
+
+    close(stopPipe[0]);
+    close(stopPipe[1]);
+    stopPipe[0] = stopPipe[1] = -1;
+    if(inotifyFD >= 0)
+        close(inotifyFD);
+    inotifyFD = -1;
+
+    LoadedGameLogicLibrary pendingLibrary;
+    if(takeLoadedLibrary(pendingLibrary))
+        unloadLibrary(pendingLibrary.handle);
+}
+
+bool GameLogicLibraryWatcher::takeLoadedLibrary(LoadedGameLogicLibrary &result)
+{
+    if(!hasLoadedLibrary())
+        return false;
+
+    std::unique_lock<std::mutex> lock(loadedLibraryMutex);
+    result = loadedLibrary;
+    loadedLibrary = LoadedGameLogicLibrary();
+    loadedLibraryAvailable.store(false, std::memory_order_release);
+    return result.handle != nullptr;
+}
+
+void GameLogicLibraryWatcher::unloadLibrary(void *handle)
+{
+    if(handle)
+        dlclose(handle);
+}
+
+void GameLogicLibraryWatcher::publishLibrary(const LoadedGameLogicLibrary &library)
+{
+    LoadedGameLogicLibrary replacedLibrary;
+    {
+        std::unique_lock<std::mutex> lock(loadedLibraryMutex);
+        replacedLibrary = loadedLibrary;
+        loadedLibrary = library;
+        loadedLibraryAvailable.store(true, std::memory_order_release);
+    }
+
+    // A newer build arrived before the main thread took the previous one.
+    unloadLibrary(replacedLibrary.handle);
+}
+
+bool GameLogicLibraryWatcher::loadLibraryCopy()
+{
+    // Each build is loaded from its own path, so that the dynamic loader
+    // never returns the handle of the previous build.
+    char copyName[64];
+    snprintf(copyName, sizeof(copyName), "-%d-%u.so", int(getpid()), ++copyCount);
+    auto copyPath = getTemporaryDirectory() + "/" + libraryBaseName + copyName;
+    if(!copyFile(libraryPath, copyPath))
+    {
+        unlink(copyPath.c_str());
+        return false;
+    }
+
+    auto handle = dlopen(copyPath.c_str(), RTLD_NOW | RTLD_GLOBAL | RTLD_DEEPBIND);
+
+    // The mapping stays valid after removing the copy.
+    unlink(copyPath.c_str());
+    if(!handle)
+    {
+        fprintf(stderr, "Failed to load game logic library: %s\n", dlerror());
+        return false;
+    }
+
+    LoadedGameLogicLibrary library;
+    library.handle = handle;
+    library.getGameInterface = reinterpret_cast<GetGameInterfaceFunction> (dlsym(handle, "getGameInterface"));
+    if(!library.getGameInterface)
+    {
+        fprintf(stderr, "The game logic library does not export getGameInterface\n");
+        dlclose(handle);
+        return false;
+    }
+
+    publishLibrary(library);
+    return true;
+}
+
+void GameLogicLibraryWatcher::watcherThreadEntry()
+{
+    struct stat lastLoadedStat;
+    memset(&lastLoadedStat, 0, sizeof(lastLoadedStat));
+    if(getFileStat(libraryPath, lastLoadedStat) && !loadLibraryCopy())
+        memset(&lastLoadedStat, 0, sizeof(lastLoadedStat));
+
+    while(!stopping)
+    {
+        waitForChanges();
+        if(stopping)
+            break;
+
+        // Only load once the file stopped changing.
+        struct stat currentStat;
+        if(!getFileStat(libraryPath, currentStat) || isSameFileStat(currentStat, lastLoadedStat))
+            continue;
+
+        usleep(SettleTimeMilliseconds*1000);
+        struct stat settledStat;
+        if(!getFileStat(libraryPath, settledStat) || !isSameFileStat(currentStat, settledStat))
+            continue;
+
+        if(loadLibraryCopy())
+            lastLoadedStat = settledStat;
+    }
+}
+
+void GameLogicLibraryWatcher::waitForChanges()
+{
+#ifdef __linux__
+    if(inotifyFD >= 0)
+    {
+        pollfd fds[2];
+        fds[0].fd = inotifyFD;
+        fds[0].events = POLLIN;
+        fds[1].fd = stopPipe[0];
+        fds[1].events = POLLIN;
+
+        // Keep waiting until an event about the library arrives, and then
+        // until the build stops touching it.
+        bool libraryChanged = false;
+        int timeout = -1;
+        for(;;)
+        {
+            fds[0].revents = fds[1].revents = 0;
+            auto result = poll(fds, 2, timeout);
+            if(stopping || fds[1].revents)
+                return;
+            if(result == 0)
+                return;
+            if(result < 0)
+                continue;
+
+            alignas(inotify_event) char buffer[4096];
+            ssize_t length;
+            while((length = read(inotifyFD, buffer, sizeof(buffer))) > 0)
+            {
+                for(ssize_t offset = 0; offset < length; )
+                {
+                    auto event = reinterpret_cast<const inotify_event*> (buffer + offset);
+                    if(event->len > 0 && libraryBaseName == event->name)
+                        libraryChanged = true;
+                    offset += sizeof(inotify_event) + event->len;
+                }
+            }
+
+            if(libraryChanged)
+                timeout = SettleTimeMilliseconds;
+        }
+    }
+#endif
+
+    // Without inotify, the file is polled from this thread.
+    pollfd stopFD;
+    stopFD.fd = stopPipe[0];
+    stopFD.events = POLLIN;
+    stopFD.revents = 0;
+    poll(&stopFD, 1, PollingIntervalMilliseconds);
+}
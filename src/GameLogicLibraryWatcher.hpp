@@ -0,0 +1,68 @@
+#ifndef SIMPLE_GAME_TEMPLATE_GAME_LOGIC_LIBRARY_WATCHER_HPP
+#define SIMPLE_GAME_TEMPLATE_GAME_LOGIC_LIBRARY_WATCHER_HPP
+
+#include "GameInterface.hpp"
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/**
+ * A game logic library that is loaded and ready for being swapped in.
+ */
+struct LoadedGameLogicLibrary
+{
+    LoadedGameLogicLibrary()
+        : handle(nullptr), getGameInterface(nullptr) {}
+
+    void *handle;
+    GetGameInterfaceFunction getGameInterface;
+};
+
+/**
+ * Watches the game logic library from a background thread. When the library
+ * is rebuilt, the finished file is copied into a versioned temporary path,
+ * loaded and resolved in the background thread. The main thread only checks
+ * an atomic flag every frame.
+ */
+class GameLogicLibraryWatcher
+{
+public:
+    GameLogicLibraryWatcher();
+    ~GameLogicLibraryWatcher();
+
+    // The library is loaded for the first time right after starting.
+    bool start(const char *libraryFileName);
+    void stop();
+
+    bool hasLoadedLibrary() const
+    {
+        return loadedLibraryAvailable.load(std::memory_order_acquire);
+    }
+
+    bool takeLoadedLibrary(LoadedGameLogicLibrary &result);
+
+    static void unloadLibrary(void *handle);
+
+private:
+    void watcherThreadEntry();
+    void waitForChanges();
+    bool loadLibraryCopy();
+    void publishLibrary(const LoadedGameLogicLibrary &library);
+
+    std::string libraryPath;
+    std::string libraryDirectory;
+    std::string libraryBaseName;
+    unsigned int copyCount;
+
+    std::thread watcherThread;
+    int inotifyFD;
+    int stopPipe[2];
+    std::atomic<bool> stopping;
+
+    std::mutex loadedLibraryMutex;
+    LoadedGameLogicLibrary loadedLibrary;
+    std::atomic<bool> loadedLibraryAvailable;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_GAME_LOGIC_LIBRARY_WATCHER_HPP
@@ -0,0 +1,537 @@
+#include "SDL.h"
+#include "SDL_image.h"
+#include "HostInterface.hpp"
+#include "GameInterface.hpp"
+#include "AsyncAssetLoader.hpp"
+#include "AudioMixer.hpp"
+#include "ControllerState.hpp"
+#include "FrameStatistics.hpp"
+#include "HostAssets.hpp"
+#include "InputRecording.hpp"
+#include "Profiler.hpp"
+#include "RenderPipeline.hpp"
+#include "RewindBuffer.hpp"
+#include "WorkerThreadPool.hpp"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" GameInterface *getGameInterface();
+
+/**
+ * A host that runs the game logic without a window, a renderer or an audio
+ * device. The game is stepped with a fixed timestep as fast as possible, and
+ * the update and render times are reported at the end.
+ */
+class HeadlessHostInterface : public HostInterface
+{
+public:
+    virtual Image *loadImage(const char *fileName) override;
+    virtual SoundSample *loadSoundSample(const char *fileName) override;
+    virtual SoundSample *openSoundStream(const char *fileName) override;
+
+    virtual AssetHandle requestImage(const char *fileName, AssetLoadPriority::Type priority) override;
+    virtual AssetHandle requestSoundSample(const char *fileName, AssetLoadPriority::Type priority) override;
+    virtual AssetLoadStatus::Type getAssetLoadStatus(AssetHandle handle) override;
+    virtual Image *getLoadedImage(AssetHandle handle) override;
+    virtual SoundSamplePtr getLoadedSoundSample(AssetHandle handle) override;
+    virtual void releaseAsset(AssetHandle handle) override;
+    virtual uint32_t registerProfileZone(const char *name) override;
+    virtual void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime) override;
+    virtual void parallelFor(size_t count, HostParallelForFunction function, void *userData) override;
+
+    static HeadlessHostInterface singleton;
+};
+
+HeadlessHostInterface HeadlessHostInterface::singleton;
+static AssetArchive assetArchive;
+static AsyncAssetLoader asyncAssetLoader;
+static AudioMixer audioMixer;
+static AudioStreamer audioStreamer;
+static WorkerThreadPool updateThreadPool;
+
+Image *HeadlessHostInterface::loadImage(const char *fileName)
+{
+    return loadImageAsset(assetArchive, fileName);
+}
+
+SoundSample *HeadlessHostInterface::loadSoundSample(const char *fileName)
+{
+    return loadSoundSampleAsset(audioMixer, assetArchive, fileName);
+}
+
+SoundSample *HeadlessHostInterface::openSoundStream(const char *fileName)
+{
+    return openSoundStreamAsset(audioMixer, audioStreamer, assetArchive, fileName);
+}
+
+AssetHandle HeadlessHostInterface::requestImage(const char *fileName, AssetLoadPriority::Type priority)
+{
+    return asyncAssetLoader.requestImage(fileName, priority);
+}
+
+AssetHandle HeadlessHostInterface::requestSoundSample(const char *fileName, AssetLoadPriority::Type priority)
+{
+    return asyncAssetLoader.requestSoundSample(fileName, priority);
+}
+
+AssetLoadStatus::Type HeadlessHostInterface::getAssetLoadStatus(AssetHandle handle)
+{
+    return asyncAssetLoader.getStatus(handle);
+}
+
+Image *HeadlessHostInterface::getLoadedImage(AssetHandle handle)
+{
+    return asyncAssetLoader.getImage(handle);
+}
+
+SoundSamplePtr HeadlessHostInterface::getLoadedSoundSample(AssetHandle handle)
+{
+    return asyncAssetLoader.getSoundSample(handle);
+}
+
+void HeadlessHostInterface::releaseAsset(AssetHandle handle)
+{
+    asyncAssetLoader.release(handle);
+}
+
+uint32_t HeadlessHostInterface::registerProfileZone(const char *name)
+{
+    return Profiler::singleton.registerProfileZone(name);
+}
+
+void HeadlessHostInterface::recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime)
+{
+    Profiler::singleton.recordProfileZone(zoneId, startTime, endTime);
+}
+
+void HeadlessHostInterface::parallelFor(size_t count, HostParallelForFunction function, void *userData)
+{
+    updateThreadPool.parallelFor(count, function, userData);
+}
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsBetween(Clock::time_point start, Clock::time_point end)
+{
+    return std::chrono::duration<double, std::milli> (end - start).count();
+}
+
+// FNV-1a hash of the visible pixels of the framebuffer.
+static uint64_t hashFramebuffer(uint64_t hash, const Framebuffer &framebuffer)
+{
+    auto row = framebuffer.pixels;
+    for(uint32_t y = 0; y < framebuffer.height; ++y)
+    {
+        for(uint32_t x = 0; x < framebuffer.width*sizeof(FramebufferPixel); ++x)
+        {
+            hash ^= row[x];
+            hash *= 1099511628211ull;
+        }
+
+        row += framebuffer.pitch;
+    }
+
+    return hash;
+}
+
+/**
+ * Mixes the audio that a device would consume during the simulated time, and
+ * optionally writes it into a wave file.
+ */
+class HeadlessAudioOutput
+{
+public:
+    HeadlessAudioOutput()
+        : file(nullptr), simulatedTime(0), mixedFrameCount(0) {}
+
+    ~HeadlessAudioOutput()
+    {
+        close();
+    }
+
+    bool open(const char *fileName)
+    {
+        file = fopen(fileName, "wb");
+        if(!file)
+        {
+            fprintf(stderr, "Failed to create the audio output file %s\n", fileName);
+            return false;
+        }
+
+        // The sizes in the header are written when the file is closed.
+        return writeHeader();
+    }
+
+    void advance(double delta)
+    {
+        simulatedTime += delta;
+        auto targetFrameCount = uint64_t(simulatedTime*audioMixer.getFrequency() + 0.5);
+        while(mixedFrameCount < targetFrameCount)
+        {
+            auto chunkFrameCount = size_t(std::min(targetFrameCount - mixedFrameCount, uint64_t(ChunkFrameCount)));
+            audioStreamer.update();
+            audioMixer.mix(samples, chunkFrameCount);
+            if(file)
+                fwrite(samples, sizeof(int16_t)*AudioMixer::ChannelCount, chunkFrameCount, file);
+            mixedFrameCount += chunkFrameCount;
+        }
+    }
+
+    void close()
+    {
+        if(!file)
+            return;
+
+        fseek(file, 0, SEEK_SET);
+        writeHeader();
+        fclose(file);
+        file = nullptr;
+    }
+
+private:
+    static constexpr size_t ChunkFrameCount = 1024;
+
+    bool writeHeader()
+    {
+        auto frameSize = uint32_t(sizeof(int16_t)*AudioMixer::ChannelCount);
+        auto dataSize = uint32_t(mixedFrameCount*frameSize);
+        uint8_t header[44];
+        memcpy(header, "RIFF", 4);
+        writeLittleEndian32(header + 4, 36 + dataSize);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        writeLittleEndian32(header + 16, 16);
+        writeLittleEndian16(header + 20, 1);
+        writeLittleEndian16(header + 22, uint16_t(AudioMixer::ChannelCount));
+        writeLittleEndian32(header + 24, audioMixer.getFrequency());
+        writeLittleEndian32(header + 28, audioMixer.getFrequency()*frameSize);
+        writeLittleEndian16(header + 32, uint16_t(frameSize));
+        writeLittleEndian16(header + 34, 16);
+        memcpy(header + 36, "data", 4);
+        writeLittleEndian32(header + 40, dataSize);
+        return fwrite(header, sizeof(header), 1, file) == 1;
+    }
+
+    static void writeLittleEndian16(uint8_t *destination, uint16_t value)
+    {
+        destination[0] = uint8_t(value);
+        destination[1] = uint8_t(value >> 8);
+    }
+
+    static void writeLittleEndian32(uint8_t *destination, uint32_t value)
+    {
+        writeLittleEndian16(destination, uint16_t(value));
+        writeLittleEndian16(destination + 2, uint16_t(value >> 16));
+    }
+
+    FILE *file;
+    double simulatedTime;
+    uint64_t mixedFrameCount;
+    int16_t samples[ChunkFrameCount*AudioMixer::ChannelCount];
+};
+
+static void printHelp()
+{
+    printf("Usage: SimpleGameTemplateHeadless [options]\n");
+    printf("  --frames <count>          Number of frames to simulate. Default 1000.\n");
+    printf("  --timestep <seconds>      Fixed update timestep. Default 1/60.\n");
+    printf("  --width <pixels>          Framebuffer width. Default 640.\n");
+    printf("  --height <pixels>         Framebuffer height. Default 480.\n");
+    printf("  --render-scale <scale>    Render at a fixed fraction of the resolution, from 0.1 to 1. Default 1.\n");
+    printf("  --render-threads <count>  Number of threads used for rendering the framebuffer tiles.\n");
+    printf("  --update-threads <count>  Number of threads for the parallel loops of the update.\n");
+    printf("  --pipelined               Render each frame in a separate thread while the next one updates.\n");
+    printf("                            The render time is then the wait for the previous frame.\n");
+    printf("  --no-render               Only run the update.\n");
+    printf("  --checksum                Print a single checksum of all of the rendered frames at the end.\n");
+    printf("  --replay <file>           Replay an input recording. Without --frames, all of its ticks are run.\n");
+    printf("  --memory-backend <name>   Backend of the memory zones: heap, virtual-memory or huge-pages.\n");
+    printf("  --rewind-seconds <s>      Record the persistent memory of every tick for rewinding, and report the time it takes.\n");
+    printf("  --rewind-memory <MB>      Memory for the rewind history. Default %zu.\n", RewindBuffer::DefaultHistoryCapacity / (1024*1024));
+    printf("  --rollback <ticks>        Rewind every tick by this many ticks and simulate them again with the same inputs.\n");
+    printf("                            The checksum stays the same when the game is deterministic.\n");
+    printf("  --asset-archive <file>    Asset archive to load the assets from. Default %s when it exists.\n", DefaultAssetArchiveFileName);
+    printf("  --audio-output <file>     Write the mixed audio into a wave file.\n");
+    printf("  --asset-threads <count>   Number of threads for the asynchronous asset loads. Zero loads them on request.\n");
+    printf("  --trace <file>            Write a Chrome trace of the last frames.\n");
+}
+
+int main(int argc, char* argv[])
+{
+    int frameCount = 1000;
+    bool hasFrameCount = false;
+    const char *replayFileName = nullptr;
+    const char *assetArchiveFileName = nullptr;
+    size_t assetThreadCount = AsyncAssetLoader::DefaultThreadCount;
+    const char *audioOutputFileName = nullptr;
+    const char *traceFileName = nullptr;
+    auto memoryBackend = MemoryZoneBackend::getDefault();
+    float timestep = 1.0f/60.0f;
+    uint32_t width = 640;
+    uint32_t height = 480;
+    float renderScale = 1.0f;
+    size_t renderThreadCount = WorkerThreadPool::getDefaultThreadCount();
+    size_t updateThreadCount = WorkerThreadPool::getDefaultThreadCount();
+    bool renderEnabled = true;
+    bool pipelined = false;
+    bool checksumEnabled = false;
+    double rewindSeconds = 0;
+    size_t rewindMemory = RewindBuffer::DefaultHistoryCapacity;
+    uint32_t rollbackTickCount = 0;
+
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--frames" && i + 1 < argc)
+        {
+            frameCount = std::max(1, atoi(argv[++i]));
+            hasFrameCount = true;
+        }
+        else if(arg == "--timestep" && i + 1 < argc)
+            timestep = float(atof(argv[++i]));
+        else if(arg == "--width" && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if(arg == "--height" && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+        else if(arg == "--render-threads" && i + 1 < argc)
+            renderThreadCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--update-threads" && i + 1 < argc)
+            updateThreadCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--render-scale" && i + 1 < argc)
+        {
+            renderScale = float(atof(argv[++i]));
+            if(!(renderScale >= 0.1f && renderScale <= 1.0f))
+            {
+                fprintf(stderr, "The render scale %s is not between 0.1 and 1\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(arg == "--pipelined")
+            pipelined = true;
+        else if(arg == "--no-render")
+            renderEnabled = false;
+        else if(arg == "--checksum")
+            checksumEnabled = true;
+        else if(arg == "--replay" && i + 1 < argc)
+            replayFileName = argv[++i];
+        else if(arg == "--rewind-seconds" && i + 1 < argc)
+            rewindSeconds = std::max(0.0, atof(argv[++i]));
+        else if(arg == "--rewind-memory" && i + 1 < argc)
+            rewindMemory = size_t(std::max(1, atoi(argv[++i])))*1024*1024;
+        else if(arg == "--rollback" && i + 1 < argc)
+            rollbackTickCount = uint32_t(std::max(0, atoi(argv[++i])));
+        else if(arg == "--asset-archive" && i + 1 < argc)
+            assetArchiveFileName = argv[++i];
+        else if(arg == "--audio-output" && i + 1 < argc)
+            audioOutputFileName = argv[++i];
+        else if(arg == "--trace" && i + 1 < argc)
+            traceFileName = argv[++i];
+        else if(arg == "--asset-threads" && i + 1 < argc)
+            assetThreadCount = std::max(0, atoi(argv[++i]));
+        else if(arg == "--memory-backend" && i + 1 < argc)
+        {
+            if(!MemoryZoneBackend::parseName(argv[++i], memoryBackend))
+            {
+                fprintf(stderr, "Unknown memory backend %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(arg == "-h" || arg == "--help")
+        {
+            printHelp();
+            return 0;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            printHelp();
+            return 1;
+        }
+    }
+
+    IMG_Init(IMG_INIT_PNG);
+    if(!openAssetArchive(assetArchive, assetArchiveFileName) && assetArchiveFileName)
+        return 1;
+
+    audioMixer.initialize(AssetArchiveSoundFrequency);
+    HeadlessAudioOutput audioOutput;
+    if(audioOutputFileName && !audioOutput.open(audioOutputFileName))
+        return 1;
+
+    MemoryZone persistentMemory;
+    MemoryZone transientMemory;
+    persistentMemory.reserve(PersistentMemorySize, memoryBackend);
+    transientMemory.reserve(TransientMemorySize, memoryBackend);
+
+    InputPlayer inputPlayer;
+    if(replayFileName)
+    {
+        if(!inputPlayer.begin(replayFileName, persistentMemory))
+            return 1;
+        if(!hasFrameCount)
+            frameCount = INT_MAX;
+    }
+
+    Profiler::singleton.setThreadName("Main");
+    WorkerThreadPool renderThreadPool;
+    renderThreadPool.start(renderThreadCount);
+    updateThreadPool.start(updateThreadCount);
+    asyncAssetLoader.start(&HeadlessHostInterface::singleton, assetThreadCount, AsyncAssetLoader::DefaultMemoryBudget);
+
+    // The streams are decoded right before mixing, so that the output does not
+    // depend on the timing of a thread.
+    audioStreamer.start(false);
+
+    auto gameInterface = getGameInterface();
+    gameInterface->setPersistentMemory(&persistentMemory);
+    gameInterface->setTransientMemory(&transientMemory);
+    gameInterface->setHostInterface(&HeadlessHostInterface::singleton);
+    if(inputPlayer.isPlaying())
+        gameInterface->persistentMemoryRestored();
+
+    RenderPipeline renderPipeline;
+    renderPipeline.start(&renderThreadPool, width, height, pipelined, memoryBackend);
+    renderPipeline.setScale(renderScale);
+
+    // A rollback needs the history of the ticks that it simulates again.
+    if(rollbackTickCount > 0)
+        rewindSeconds = std::max(rewindSeconds, double(rollbackTickCount + 1)*timestep);
+
+    RewindBuffer rewindBuffer;
+    if(!rewindBuffer.initialize(PersistentMemorySize, rewindMemory, uint32_t(rewindSeconds / timestep + 0.5)))
+        return 1;
+    std::vector<InputRecordingTick> rollbackTicks;
+
+    DurationSamples updateTimes;
+    DurationSamples renderTimes;
+    DurationSamples rewindTimes;
+    DurationSamples rollbackTimes;
+    if(!inputPlayer.isPlaying())
+    {
+        updateTimes.reserve(frameCount);
+        renderTimes.reserve(frameCount);
+    }
+
+    InputRecordingTick tick;
+    tick.delta = timestep;
+    uint64_t checksum = 14695981039346656037ull;
+    int simulatedFrameCount = 0;
+    size_t transientAllocatedBytes = 0;
+    size_t transientAllocationCount = 0;
+    auto startTime = Clock::now();
+    for(; simulatedFrameCount < frameCount; ++simulatedFrameCount)
+    {
+        transientMemory.beginFrame();
+        if(simulatedFrameCount > 0)
+        {
+            transientAllocatedBytes += transientMemory.getStats().lastFrameAllocatedBytes;
+            transientAllocationCount += transientMemory.getStats().lastFrameAllocationCount;
+        }
+
+        if(inputPlayer.isPlaying())
+        {
+            if(!inputPlayer.nextTick(tick))
+                break;
+            if(tick.resetPersistentMemory)
+            {
+                persistentMemory.reset();
+                transientMemory.reset();
+                rewindBuffer.clear();
+            }
+        }
+
+        auto updateStartTime = Clock::now();
+        gameInterface->update(tick.delta, tick.controllerState);
+        auto updateEndTime = Clock::now();
+        updateTimes.add(millisecondsBetween(updateStartTime, updateEndTime));
+
+        if(rewindBuffer.isEnabled())
+        {
+            auto rewindStartTime = Clock::now();
+            rewindBuffer.recordTick(persistentMemory, tick);
+            rewindTimes.add(millisecondsBetween(rewindStartTime, Clock::now()));
+        }
+
+        // Like a late input of a networked game, which rolls back to the tick
+        // of the input. The inputs are the same here, so the state must be too.
+        if(rollbackTickCount > 0 && rewindBuffer.getTickCount() >= rollbackTickCount)
+        {
+            auto rollbackStartTime = Clock::now();
+            rollbackTicks.clear();
+            for(auto i = rollbackTickCount; i > 0; --i)
+                rollbackTicks.push_back(rewindBuffer.getTick(i - 1));
+
+            rewindBuffer.rewind(persistentMemory, rollbackTickCount);
+            for(auto &rollbackTick : rollbackTicks)
+            {
+                gameInterface->update(rollbackTick.delta, rollbackTick.controllerState);
+                rewindBuffer.recordTick(persistentMemory, rollbackTick);
+            }
+            rollbackTimes.add(millisecondsBetween(rollbackStartTime, Clock::now()));
+        }
+
+        audioOutput.advance(tick.delta);
+        audioMixer.collectReleasedResources();
+
+        if(!renderEnabled)
+            continue;
+
+        // Every frame is rendered right after its update, at the latest state.
+        auto renderStartTime = Clock::now();
+        auto snapshotMemory = renderPipeline.beginSnapshot();
+        auto snapshotData = gameInterface->makeRenderSnapshot(snapshotMemory);
+        auto renderedFramebuffer = renderPipeline.submitFrame(gameInterface, snapshotData, 1.0f);
+        auto renderEndTime = Clock::now();
+        renderTimes.add(millisecondsBetween(renderStartTime, renderEndTime));
+
+        if(checksumEnabled && renderedFramebuffer)
+            checksum = hashFramebuffer(checksum, *renderedFramebuffer);
+    }
+
+    auto lastFramebuffer = renderPipeline.finishFrame();
+    if(checksumEnabled && lastFramebuffer)
+        checksum = hashFramebuffer(checksum, *lastFramebuffer);
+
+    auto totalTime = millisecondsBetween(startTime, Clock::now());
+    transientMemory.beginFrame();
+    transientAllocatedBytes += transientMemory.getStats().lastFrameAllocatedBytes;
+    transientAllocationCount += transientMemory.getStats().lastFrameAllocationCount;
+
+    printf("Frames: %d  Timestep: %.6f s  Framebuffer: %ux%u  Render threads: %u%s\n",
+        simulatedFrameCount, timestep, width, height, unsigned(renderThreadPool.getThreadCount()), renderPipeline.isPipelined() ? "  Pipelined" : "");
+    printf("Total: %.3f ms  (%.1f frames/s)\n", totalTime, simulatedFrameCount*1000.0/totalTime);
+    updateTimes.printSummary("update");
+    if(renderEnabled)
+        renderTimes.printSummary("render");
+    if(!rewindTimes.isEmpty())
+        rewindTimes.printSummary("rewind");
+    if(!rollbackTimes.isEmpty())
+        rollbackTimes.printSummary("rollback");
+    rewindBuffer.printStatistics();
+    printMemoryZoneStats("persistent", persistentMemory.getStats());
+    printMemoryZoneStats("transient", transientMemory.getStats());
+    if(simulatedFrameCount > 0)
+    {
+        printf("transient  %.1f bytes in %.1f allocations per frame\n",
+            double(transientAllocatedBytes) / simulatedFrameCount, double(transientAllocationCount) / simulatedFrameCount);
+    }
+    if(checksumEnabled)
+        printf("Checksum: %016llx\n", (unsigned long long)checksum);
+    if(traceFileName)
+        Profiler::singleton.exportChromeTrace(traceFileName);
+
+    renderPipeline.shutdown();
+    renderThreadPool.shutdown();
+    updateThreadPool.shutdown();
+    audioOutput.close();
+    asyncAssetLoader.shutdown();
+    audioMixer.shutdown();
+    audioStreamer.shutdown();
+    assetArchive.close();
+    IMG_Quit();
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "SDL.h"
+#include "SDL_image.h"
+#include "HostAssets.hpp"
+#include <algorithm>
+#include <memory>
+
+std::string makeFullAssetPath(const std::string &virtualPath)
+{
+    return "assets/" + virtualPath;
+}
+
+bool openAssetArchive(AssetArchive &archive, const char *fileName)
+{
+    if(!fileName)
+    {
+        auto file = fopen(DefaultAssetArchiveFileName, "rb");
+        if(!file)
+            return false;
+
+        fclose(file);
+        fileName = DefaultAssetArchiveFileName;
+    }
+
+    return archive.open(fileName);
+}
+
+static Image *createImageFromSurface(SDL_Surface *surface, const char *fileName)
+{
+    if(!surface)
+    {
+        fprintf(stderr, "Failed to load image %s: %s\n", fileName, IMG_GetError());
+        return nullptr;
+    }
+
+    auto expectedSurface = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0);
+    SDL_FreeSurface(surface);
+
+    auto result = ImagePtr(new Image);
+    result->width = expectedSurface->w;
+    result->height = expectedSurface->h;
+    result->pitch = expectedSurface->pitch;
+    result->bpp = expectedSurface->format->BitsPerPixel;
+    result->data.reset(new uint8_t[result->pitch*result->height]);
+    memcpy(result->data.get(), expectedSurface->pixels, result->pitch*result->height);
+    result->pixels = result->data.get();
+    SDL_FreeSurface(expectedSurface);
+    return result.release();
+}
+
+Image *loadImageAsset(const char *fileName)
+{
+    auto fullPath = makeFullAssetPath(fileName);
+    return createImageFromSurface(IMG_Load(fullPath.c_str()), fileName);
+}
+
+Image *loadImageAssetFromMemory(const void *fileData, size_t fileSize, const char *fileName)
+{
+    return createImageFromSurface(IMG_Load_RW(SDL_RWFromConstMem(fileData, int(fileSize)), 1), fileName);
+}
+
+Image *loadImageAsset(const AssetArchive &archive, const char *fileName)
+{
+    auto image = archive.loadImage(fileName);
+    if(image)
+        return image;
+
+    return loadImageAsset(fileName);
+}
+
+static_assert(AssetArchiveSoundChannels == AudioMixer::ChannelCount, "The packed sound samples must have the channels of the mixer");
+
+static AudioBuffer *loadArchiveAudioBuffer(const AudioMixer &mixer, const AssetArchive &archive, const char *fileName)
+{
+    auto entry = archive.findEntry(fileName);
+    if(!entry || entry->type != AssetArchiveEntryType::SoundSample ||
+        entry->frequency != mixer.getFrequency() || entry->channels != AudioMixer::ChannelCount || entry->sampleFormat != AUDIO_S16SYS)
+        return nullptr;
+
+    auto buffer = new AudioBuffer;
+    buffer->samples = reinterpret_cast<const int16_t*> (archive.getEntryData(*entry));
+    buffer->frameCount = size_t(entry->size / (AudioMixer::ChannelCount*sizeof(int16_t)));
+    return buffer;
+}
+
+static AudioBuffer *loadAudioBuffer(const AudioMixer &mixer, const char *fileName)
+{
+    auto fullPath = makeFullAssetPath(fileName);
+    SDL_AudioSpec spec;
+    Uint8 *samples = nullptr;
+    Uint32 samplesSize = 0;
+    if(!SDL_LoadWAV(fullPath.c_str(), &spec, &samples, &samplesSize))
+    {
+        fprintf(stderr, "Failed to load sound sample %s: %s\n", fullPath.c_str(), SDL_GetError());
+        return nullptr;
+    }
+
+    SDL_AudioCVT conversion;
+    if(SDL_BuildAudioCVT(&conversion, spec.format, spec.channels, spec.freq,
+        AUDIO_S16SYS, Uint8(AudioMixer::ChannelCount), int(mixer.getFrequency())) < 0)
+    {
+        fprintf(stderr, "Failed to convert sound sample %s: %s\n", fullPath.c_str(), SDL_GetError());
+        SDL_FreeWAV(samples);
+        return nullptr;
+    }
+
+    // The conversion is done in place, in a buffer that is big enough for its intermediate steps.
+    auto convertedSize = size_t(samplesSize);
+    std::unique_ptr<uint8_t[]> convertedSamples(new uint8_t[samplesSize*std::max(conversion.len_mult, 1)]);
+    memcpy(convertedSamples.get(), samples, samplesSize);
+    SDL_FreeWAV(samples);
+    if(conversion.needed)
+    {
+        conversion.buf = convertedSamples.get();
+        conversion.len = int(samplesSize);
+        if(SDL_ConvertAudio(&conversion) < 0)
+        {
+            fprintf(stderr, "Failed to convert sound sample %s: %s\n", fullPath.c_str(), SDL_GetError());
+            return nullptr;
+        }
+        convertedSize = size_t(conversion.len_cvt);
+    }
+
+    auto frameSize = AudioMixer::ChannelCount*sizeof(int16_t);
+    auto buffer = new AudioBuffer;
+    buffer->frameCount = convertedSize / frameSize;
+    buffer->ownedSamples.reset(new int16_t[buffer->frameCount*AudioMixer::ChannelCount]);
+    memcpy(buffer->ownedSamples.get(), convertedSamples.get(), buffer->frameCount*frameSize);
+    buffer->samples = buffer->ownedSamples.get();
+    return buffer;
+}
+
+SoundSample *loadSoundSampleAsset(AudioMixer &mixer, const AssetArchive &archive, const char *fileName)
+{
+    auto buffer = loadArchiveAudioBuffer(mixer, archive, fileName);
+    if(!buffer)
+        buffer = loadAudioBuffer(mixer, fileName);
+    if(!buffer)
+        return new NullSoundSample;
+
+    return new AudioMixerSoundSample(mixer, buffer);
+}
+
+SoundSample *openSoundStreamAsset(AudioMixer &mixer, AudioStreamer &streamer, const AssetArchive &archive, const char *fileName)
+{
+    std::unique_ptr<AudioStream> stream(new AudioStream);
+    bool isOpen = false;
+    auto entry = archive.findEntry(fileName);
+    if(entry && entry->type == AssetArchiveEntryType::SoundSample)
+    {
+        // Compressed entries are decompressed whole by the regular load.
+        isOpen = entry->compression == AssetArchiveCompression::None &&
+            stream->openSamples(archive.getEntryData(*entry), size_t(entry->size), entry->frequency, entry->channels, entry->sampleFormat, mixer.getFrequency());
+    }
+    else
+    {
+        isOpen = stream->openWaveFile(makeFullAssetPath(fileName).c_str(), mixer.getFrequency());
+    }
+
+    if(!isOpen)
+        return loadSoundSampleAsset(mixer, archive, fileName);
+
+    auto openStream = stream.release();
+    streamer.addStream(openStream);
+    return new AudioStreamSoundSample(mixer, streamer, openStream);
+}
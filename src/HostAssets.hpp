@@ -0,0 +1,52 @@
+#ifndef SIMPLE_GAME_TEMPLATE_HOST_ASSETS_HPP
+#define SIMPLE_GAME_TEMPLATE_HOST_ASSETS_HPP
+
+#include "AssetArchive.hpp"
+#include "AudioMixer.hpp"
+#include "AudioStream.hpp"
+#include "Image.hpp"
+#include "SoundSample.hpp"
+#include <string>
+
+// The archive that is packed from the assets directory by SimpleGameTemplateAssetPacker.
+static constexpr const char *DefaultAssetArchiveFileName = "assets.pak";
+
+std::string makeFullAssetPath(const std::string &virtualPath);
+
+// Opens the asset archive, or the default one when the file name is nullptr
+// and it exists. The assets that are not in the archive are still loaded from
+// the assets directory.
+bool openAssetArchive(AssetArchive &archive, const char *fileName);
+
+// Loads an image asset with SDL2_image, converted into ABGR8888.
+Image *loadImageAsset(const char *fileName);
+
+// Decodes an image file that is already in memory, the same as loadImageAsset.
+// The file name is only for the errors.
+Image *loadImageAssetFromMemory(const void *fileData, size_t fileSize, const char *fileName);
+
+// Returns a view of the image in the archive, or loads it from the assets directory.
+Image *loadImageAsset(const AssetArchive &archive, const char *fileName);
+
+// Returns the samples in the archive, or loads them from the assets directory
+// converted into the format of the mixer. A sample that fails to load is silent.
+SoundSample *loadSoundSampleAsset(AudioMixer &mixer, const AssetArchive &archive, const char *fileName);
+
+// Opens a stream of the samples in the archive, or of a wave file in the
+// assets directory. The sounds that cannot be streamed are fully loaded instead.
+SoundSample *openSoundStreamAsset(AudioMixer &mixer, AudioStreamer &streamer, const AssetArchive &archive, const char *fileName);
+
+class NullSoundSample : public SoundSample
+{
+public:
+    virtual void play(bool looped) override
+    {
+        (void) looped;
+    }
+
+    virtual void resume() override {}
+    virtual void pause() override {}
+    virtual void stop() override {}
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_HOST_ASSETS_HPP
@@ -2,12 +2,81 @@
 #define HOST_INTERFACE_HPP
 
 #include "Image.hpp"
+#include "ProfileZone.hpp"
 #include "SoundSample.hpp"
 
+// Identifies an asynchronous asset load. Zero is never a valid handle.
+typedef uint32_t AssetHandle;
+
+typedef void (*HostParallelForFunction)(void *userData, size_t index);
+
+namespace AssetLoadPriority
+{
+
+enum Type
+{
+    // Loaded after everything else, such as the assets of the next level.
+    Prefetch = 0,
+
+    Normal,
+
+    // Loaded before anything else. The other priorities wait while the
+    // loaded assets exceed the memory budget of the host, but this one does not.
+    Urgent,
+};
+
+}
+
+namespace AssetLoadStatus
+{
+
+enum Type
+{
+    // The handle was released, or it was never valid.
+    Invalid = 0,
+    Queued,
+    Loading,
+    Loaded,
+    Failed,
+};
+
+}
+
 struct HostInterface
 {
+    // Synchronous loads. They block the caller until the asset is decoded.
     virtual Image *loadImage(const char *fileName) = 0;
     virtual SoundSamplePtr loadSoundSample(const char *fileName) = 0;
+
+    // Opens a sound that is decoded in a background thread while it plays,
+    // with a small fixed amount of memory, for music and long ambience tracks.
+    // The stream is owned by the caller.
+    virtual SoundSamplePtr openSoundStream(const char *fileName) = 0;
+
+    // Asynchronous loads, decoded by background threads. The requests of the
+    // same asset share their handle, and they are reference counted, so a
+    // level can prefetch its assets and request them again when it starts.
+    // A request with a higher priority raises the priority of a pending load.
+    virtual AssetHandle requestImage(const char *fileName, AssetLoadPriority::Type priority) = 0;
+    virtual AssetHandle requestSoundSample(const char *fileName, AssetLoadPriority::Type priority) = 0;
+    virtual AssetLoadStatus::Type getAssetLoadStatus(AssetHandle handle) = 0;
+
+    // These return nullptr until the asset is loaded. The asset is owned by
+    // the host, and it is destroyed when its last request is released.
+    virtual Image *getLoadedImage(AssetHandle handle) = 0;
+    virtual SoundSamplePtr getLoadedSoundSample(AssetHandle handle) = 0;
+    virtual void releaseAsset(AssetHandle handle) = 0;
+
+    // Profiling, from any thread. The zones are usually recorded with the
+    // PROFILE_ZONE macro. The name is copied, so the identifier stays the
+    // same after the game logic is reloaded.
+    virtual uint32_t registerProfileZone(const char *name) = 0;
+    virtual void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime) = 0;
+
+    // Calls the function with every index below the count, spread over the
+    // worker threads of the update, and returns when all of them are done.
+    // Only called from the update, since the rendering has its own threads.
+    virtual void parallelFor(size_t count, HostParallelForFunction function, void *userData) = 0;
 };
 
 #endif //SIMPLE_GAME_TEMPLATE_GAME_INTERFACE_HPP
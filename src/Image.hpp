@@ -4,17 +4,22 @@
 #include <stdint.h>
 #include <memory>
 
+/**
+ * The pixels are either owned by the image in data, or they are a read only
+ * view of memory that outlives the image, such as a mapped asset archive.
+ */
 class Image
 {
 public:
     Image()
-        : width(0), height(0), pitch(0), bpp(0)
+        : width(0), height(0), pitch(0), bpp(0), pixels(nullptr)
     {}
 
     uint32_t width;
     uint32_t height;
     uint32_t pitch;
     uint32_t bpp;
+    const uint8_t *pixels;
     std::unique_ptr<uint8_t[]> data;
 };
 
@@ -0,0 +1,247 @@
+#include "InputRecording.hpp"
+#include <string.h>
+
+namespace
+{
+
+static constexpr char InputRecordingMagic[8] = {'S', 'G', 'T', 'I', 'N', 'P', 'U', 'T'};
+static constexpr uint32_t InputRecordingVersion = 1;
+
+struct InputRecordingHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t persistentMemorySize;
+
+    // The snapshot omits the trailing zeros of the persistent memory.
+    uint64_t snapshotSize;
+};
+
+namespace TickField
+{
+enum Bits
+{
+    Delta = 1<<0,
+    LeftXAxis = 1<<1,
+    LeftYAxis = 1<<2,
+    RightXAxis = 1<<3,
+    RightYAxis = 1<<4,
+    Buttons = 1<<5,
+    ResetPersistentMemory = 1<<6,
+};
+}
+
+template<typename T>
+inline bool writeValue(FILE *file, const T &value)
+{
+    return fwrite(&value, sizeof(T), 1, file) == 1;
+}
+
+template<typename T>
+inline bool readValue(FILE *file, T &value)
+{
+    return fread(&value, sizeof(T), 1, file) == 1;
+}
+
+}
+
+InputRecorder::InputRecorder()
+    : file(nullptr)
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+    end();
+}
+
+bool InputRecorder::begin(const char *theFileName, const MemoryZone &persistentMemory)
+{
+    end();
+
+    file = fopen(theFileName, "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open input recording %s for writing\n", theFileName);
+        return false;
+    }
+
+    fileName = theFileName;
+
+    InputRecordingHeader header;
+    memcpy(header.magic, InputRecordingMagic, sizeof(header.magic));
+    header.version = InputRecordingVersion;
+    header.reserved = 0;
+    header.persistentMemorySize = persistentMemory.getSize();
+    header.snapshotSize = persistentMemory.getSize();
+    auto data = persistentMemory.getData();
+    while(header.snapshotSize > 0 && data[header.snapshotSize - 1] == 0)
+        --header.snapshotSize;
+
+    if(!writeValue(file, header) || fwrite(data, 1, header.snapshotSize, file) != header.snapshotSize)
+    {
+        fail();
+        return false;
+    }
+
+    previousTick = InputRecordingTick();
+    return true;
+}
+
+void InputRecorder::end()
+{
+    if(!file)
+        return;
+
+    auto closed = fclose(file) == 0;
+    file = nullptr;
+    if(!closed)
+        fprintf(stderr, "Failed to write input recording %s\n", fileName.c_str());
+}
+
+void InputRecorder::fail()
+{
+    fprintf(stderr, "Failed to write input recording %s, stopping the recording\n", fileName.c_str());
+    fclose(file);
+    file = nullptr;
+}
+
+void InputRecorder::recordTick(const InputRecordingTick &tick)
+{
+    if(!file)
+        return;
+
+    auto &state = tick.controllerState;
+    auto &previousState = previousTick.controllerState;
+    uint8_t fields = 0;
+    if(tick.delta != previousTick.delta)
+        fields |= TickField::Delta;
+    if(state.leftXAxis != previousState.leftXAxis)
+        fields |= TickField::LeftXAxis;
+    if(state.leftYAxis != previousState.leftYAxis)
+        fields |= TickField::LeftYAxis;
+    if(state.rightXAxis != previousState.rightXAxis)
+        fields |= TickField::RightXAxis;
+    if(state.rightYAxis != previousState.rightYAxis)
+        fields |= TickField::RightYAxis;
+    if(state.buttons != previousState.buttons)
+        fields |= TickField::Buttons;
+    if(tick.resetPersistentMemory)
+        fields |= TickField::ResetPersistentMemory;
+
+    auto written = writeValue(file, fields);
+    if(fields & TickField::Delta)
+        written = written && writeValue(file, tick.delta);
+    if(fields & TickField::LeftXAxis)
+        written = written && writeValue(file, state.leftXAxis);
+    if(fields & TickField::LeftYAxis)
+        written = written && writeValue(file, state.leftYAxis);
+    if(fields & TickField::RightXAxis)
+        written = written && writeValue(file, state.rightXAxis);
+    if(fields & TickField::RightYAxis)
+        written = written && writeValue(file, state.rightYAxis);
+    if(fields & TickField::Buttons)
+        written = written && writeValue(file, int32_t(state.buttons));
+    if(!written)
+    {
+        fail();
+        return;
+    }
+
+    previousTick = tick;
+}
+
+InputPlayer::InputPlayer()
+    : file(nullptr)
+{
+}
+
+InputPlayer::~InputPlayer()
+{
+    end();
+}
+
+bool InputPlayer::begin(const char *fileName, MemoryZone &persistentMemory)
+{
+    end();
+
+    file = fopen(fileName, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open input recording %s\n", fileName);
+        return false;
+    }
+
+    InputRecordingHeader header;
+    if(!readValue(file, header) || memcmp(header.magic, InputRecordingMagic, sizeof(header.magic)) != 0 ||
+        header.version != InputRecordingVersion)
+    {
+        fprintf(stderr, "%s is not a supported input recording\n", fileName);
+        end();
+        return false;
+    }
+
+    if(header.persistentMemorySize != persistentMemory.getSize() || header.snapshotSize > header.persistentMemorySize)
+    {
+        fprintf(stderr, "Input recording %s was made with a different persistent memory size\n", fileName);
+        end();
+        return false;
+    }
+
+    auto data = persistentMemory.getData();
+    memset(data + header.snapshotSize, 0, persistentMemory.getSize() - header.snapshotSize);
+    if(fread(data, 1, header.snapshotSize, file) != header.snapshotSize)
+    {
+        fprintf(stderr, "Input recording %s is truncated\n", fileName);
+        end();
+        return false;
+    }
+
+    previousTick = InputRecordingTick();
+    return true;
+}
+
+void InputPlayer::end()
+{
+    if(!file)
+        return;
+
+    fclose(file);
+    file = nullptr;
+}
+
+bool InputPlayer::nextTick(InputRecordingTick &tick)
+{
+    if(!file)
+        return false;
+
+    uint8_t fields;
+    if(!readValue(file, fields))
+        return false;
+
+    tick = previousTick;
+    tick.resetPersistentMemory = (fields & TickField::ResetPersistentMemory) != 0;
+
+    auto &state = tick.controllerState;
+    bool complete = true;
+    if(fields & TickField::Delta)
+        complete = complete && readValue(file, tick.delta);
+    if(fields & TickField::LeftXAxis)
+        complete = complete && readValue(file, state.leftXAxis);
+    if(fields & TickField::LeftYAxis)
+        complete = complete && readValue(file, state.leftYAxis);
+    if(fields & TickField::RightXAxis)
+        complete = complete && readValue(file, state.rightXAxis);
+    if(fields & TickField::RightYAxis)
+        complete = complete && readValue(file, state.rightYAxis);
+    if(fields & TickField::Buttons)
+    {
+        int32_t buttons = 0;
+        complete = complete && readValue(file, buttons);
+        state.buttons = buttons;
+    }
+
+    previousTick = tick;
+    return complete;
+}
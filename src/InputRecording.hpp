@@ -0,0 +1,80 @@
+#ifndef SIMPLE_GAME_TEMPLATE_INPUT_RECORDING_HPP
+#define SIMPLE_GAME_TEMPLATE_INPUT_RECORDING_HPP
+
+#include "ControllerState.hpp"
+#include "MemoryZone.hpp"
+#include <stdio.h>
+#include <string>
+
+/**
+ * The inputs of a single update tick.
+ */
+struct InputRecordingTick
+{
+    InputRecordingTick()
+        : delta(0), resetPersistentMemory(false) {}
+
+    float delta;
+    ControllerState controllerState;
+
+    // The player pressed the reset key before this tick.
+    bool resetPersistentMemory;
+};
+
+/**
+ * Writes a snapshot of the persistent memory followed by the inputs of every
+ * update tick. Each tick only stores the fields that are different to the
+ * previous tick.
+ */
+class InputRecorder
+{
+public:
+    InputRecorder();
+    ~InputRecorder();
+
+    bool begin(const char *fileName, const MemoryZone &persistentMemory);
+    void end();
+
+    bool isRecording() const
+    {
+        return file != nullptr;
+    }
+
+    // A failed write stops the recording.
+    void recordTick(const InputRecordingTick &tick);
+
+private:
+    void fail();
+
+    FILE *file;
+    std::string fileName;
+    InputRecordingTick previousTick;
+};
+
+/**
+ * Restores the persistent memory snapshot of a recording, and reads back the
+ * inputs of every tick.
+ */
+class InputPlayer
+{
+public:
+    InputPlayer();
+    ~InputPlayer();
+
+    bool begin(const char *fileName, MemoryZone &persistentMemory);
+    void end();
+
+    bool isPlaying() const
+    {
+        return file != nullptr;
+    }
+
+    // Returns false when the end of the recording is reached.
+    bool nextTick(InputRecordingTick &tick);
+
+private:
+    FILE *file;
+    InputRecordingTick previousTick;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_INPUT_RECORDING_HPP
@@ -1,15 +1,24 @@
 #include "SDL.h"
 #include "SDL_image.h"
-#ifndef NO_SDL_MIXER_AVAILABLE
-#include "SDL_mixer.h"
-#endif
-
 #include "SDL_main.h"
 #include "HostInterface.hpp"
 #include "GameInterface.hpp"
+#include "AsyncAssetLoader.hpp"
+#include "AudioMixer.hpp"
 #include "ControllerState.hpp"
+#include "DynamicResolution.hpp"
+#include "FramePacer.hpp"
+#include "FrameStatistics.hpp"
+#include "HostAssets.hpp"
+#include "InputRecording.hpp"
+#include "PersistentMemoryFile.hpp"
+#include "Profiler.hpp"
+#include "RenderPipeline.hpp"
+#include "RewindBuffer.hpp"
+#include "WorkerThreadPool.hpp"
 #include <string>
 #include <algorithm>
+#include <math.h>
 
 #define GAME_TITLE "Simple Game Template"
 
@@ -21,45 +30,27 @@
 #ifdef _WIN32
 #error Implement livecoding support for windows
 #else
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <unistd.h>
-#include <dlfcn.h>
+#include "GameLogicLibraryWatcher.hpp"
 
 #define LIBRARY_FILENAME(baseName) "./lib" baseName ".so"
 
-inline void *loadLibrary(const char *name)
-{
-    auto result = dlopen(name, RTLD_NOW | RTLD_GLOBAL | RTLD_DEEPBIND);
-    if(!result)
-        fprintf(stderr, "Failed to load game logic library: %s\n", dlerror());
-    return result;
-}
-
-inline void freeLibrary(void *handle)
-{
-    dlclose(handle);
-}
-
-inline void *getLibrarySymbol(void *handle, const char *symbol)
-{
-    return dlsym(handle, symbol);
-}
-
-typedef double FileTimestamp;
-
-inline FileTimestamp getFileLastModificationTimestamp(const char *fileName)
-{
-    struct stat s;
-    stat(fileName, &s);
-    return double(s.st_mtim.tv_sec) + double(s.st_mtim.tv_nsec)*1e-9;
-}
-
 typedef void *LibraryHandle;
 
 #endif
 #endif
 
+// The texture has the format of the framebuffer, except that the renderers
+// do not take palette textures, so the indices are expanded while uploading.
+#if defined(FRAMEBUFFER_RGB565)
+static constexpr Uint32 FramebufferTextureFormat = SDL_PIXELFORMAT_RGB565;
+#else
+static constexpr Uint32 FramebufferTextureFormat = SDL_PIXELFORMAT_ABGR8888;
+#endif
+
+// The render time that the dynamic resolution aims for, by default.
+static constexpr double DefaultRenderBudgetFraction = 0.75;
+static constexpr float DefaultMinimumRenderScale = 0.5f;
+
 static int screenWidth = 640;
 static int screenHeight = 480;
 #ifdef USE_LIVE_CODING
@@ -76,6 +67,14 @@ static GameInterface *currentGameInterface;
 static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *texture;
+static WorkerThreadPool renderThreadPool;
+static WorkerThreadPool updateThreadPool;
+static RenderPipeline renderPipeline;
+static DynamicResolution dynamicResolution;
+
+// The part of the texture with the last presented frame. The texture has the
+// full resolution, and a frame at a lower one only fills its corner.
+static SDL_Rect presentedRect;
 
 static int gameControllerIndex;
 static SDL_GameController *gameController;
@@ -86,11 +85,47 @@ static ControllerState oldGamepadControllerState;
 static ControllerState gamepadControllerState;
 static ControllerState currentControllerState;
 
+static InputRecorder inputRecorder;
+static InputPlayer inputPlayer;
+static bool pendingPersistentMemoryReset;
+static bool pendingPersistentMemoryRestored;
+
+// While the rewind key is held, every update goes a tick back instead.
+static RewindBuffer rewindBuffer;
+static bool isRewindKeyDown;
+
+static PersistentMemoryFile persistentMemoryFile;
+static bool pendingPersistentMemoryFileValidation;
+static SaveSlotWriter saveSlotWriter;
+static constexpr const char *SaveSlotFileName = "save-slot.sav";
+static constexpr const char *DefaultTraceFileName = "trace.json";
+static const char *traceFileName = DefaultTraceFileName;
+static bool isTraceExportedOnExit;
+static bool isProfilerOverlayVisible;
+static std::vector<ProfileZoneTime> profilerZoneTimes;
+static uint32_t profilerZoneFrameCount;
+static AssetArchive assetArchive;
+static AsyncAssetLoader asyncAssetLoader;
+static AudioMixer audioMixer;
+static AudioStreamer audioStreamer;
+static SDL_AudioDeviceID audioDevice;
+
 class SDL2HostInterface : public HostInterface
 {
 public:
     virtual Image *loadImage(const char *fileName) override;
     virtual SoundSample *loadSoundSample(const char *fileName) override;
+    virtual SoundSample *openSoundStream(const char *fileName) override;
+
+    virtual AssetHandle requestImage(const char *fileName, AssetLoadPriority::Type priority) override;
+    virtual AssetHandle requestSoundSample(const char *fileName, AssetLoadPriority::Type priority) override;
+    virtual AssetLoadStatus::Type getAssetLoadStatus(AssetHandle handle) override;
+    virtual Image *getLoadedImage(AssetHandle handle) override;
+    virtual SoundSamplePtr getLoadedSoundSample(AssetHandle handle) override;
+    virtual void releaseAsset(AssetHandle handle) override;
+    virtual uint32_t registerProfileZone(const char *name) override;
+    virtual void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime) override;
+    virtual void parallelFor(size_t count, HostParallelForFunction function, void *userData) override;
 
     static SDL2HostInterface singleton;
 };
@@ -99,39 +134,38 @@ public:
 static constexpr const char *GameLogicLibraryName = LIBRARY_FILENAME("SimpleGameTemplateGameLogic");
 
 static LibraryHandle libraryHandle;
-static FileTimestamp lastLibraryModification;
-
-static bool isLoadedLibraryOld()
-{
-    if(!libraryHandle)
-        return true;
-
-    return getFileLastModificationTimestamp(GameLogicLibraryName) > lastLibraryModification;
-}
+static GameLogicLibraryWatcher gameLogicLibraryWatcher;
 
 static void reloadGameInterface()
 {
-    if(isLoadedLibraryOld())
-    {
-        if(libraryHandle)
-        {
-            currentGameInterface = nullptr;
-            freeLibrary(libraryHandle);
-        }
+    PROFILE_ZONE("Reload game logic");
 
-        libraryHandle = loadLibrary(GameLogicLibraryName);
-        if(!libraryHandle)
-            return;
+    // The library is loaded by the watcher thread, so swapping it does not
+    // touch the file system.
+    if(!gameLogicLibraryWatcher.hasLoadedLibrary())
+        return;
 
-        //printf("Library loaded %p\n", libraryHandle);
-        lastLibraryModification = getFileLastModificationTimestamp(GameLogicLibraryName);
+    LoadedGameLogicLibrary loadedLibrary;
+    if(!gameLogicLibraryWatcher.takeLoadedLibrary(loadedLibrary))
+        return;
 
-        auto getGameInterface = reinterpret_cast<GetGameInterfaceFunction> (getLibrarySymbol(libraryHandle, "getGameInterface"));
-        currentGameInterface = getGameInterface();
-        currentGameInterface->setPersistentMemory(&persistentMemory);
-        currentGameInterface->setTransientMemory(&transientMemory);
-        currentGameInterface->setHostInterface(&SDL2HostInterface::singleton);
+    if(libraryHandle)
+    {
+        // The frame that is rendering calls into the old library. It is not
+        // presented, and the screen keeps the frame before it.
+        renderPipeline.finishFrame();
+        currentGameInterface = nullptr;
+        GameLogicLibraryWatcher::unloadLibrary(libraryHandle);
     }
+
+    libraryHandle = loadedLibrary.handle;
+    currentGameInterface = loadedLibrary.getGameInterface();
+    currentGameInterface->setPersistentMemory(&persistentMemory);
+    currentGameInterface->setTransientMemory(&transientMemory);
+    currentGameInterface->setHostInterface(&SDL2HostInterface::singleton);
+
+    // The new code may draw the same state differently.
+    renderPipeline.invalidate();
 }
 
 #else
@@ -150,105 +184,157 @@ void reloadGameInterface()
 
 #endif
 
-static std::string makeFullAssetPath(const std::string virtualPath)
+SDL2HostInterface SDL2HostInterface::singleton;
+
+Image *SDL2HostInterface::loadImage(const char *fileName)
 {
-    return "assets/" + virtualPath;
+    return loadImageAsset(assetArchive, fileName);
 }
 
-class NullSoundSample : public SoundSample
+SoundSample *SDL2HostInterface::loadSoundSample(const char *fileName)
 {
-public:
-    virtual void play(bool looped) override
-    {
-        (void) looped;
-    }
+    if(!audioDevice)
+        return new NullSoundSample;
 
-    virtual void resume() override {}
-    virtual void pause() override {}
-    virtual void stop() override {}
-};
+    return loadSoundSampleAsset(audioMixer, assetArchive, fileName);
+}
 
-class SDL2MixSoundSample : public SoundSample
+SoundSample *SDL2HostInterface::openSoundStream(const char *fileName)
 {
-public:
-    SDL2MixSoundSample(Mix_Chunk *theChunk)
-        : chunk(theChunk), playingChannel(-1) {}
+    if(!audioDevice)
+        return new NullSoundSample;
 
-    ~SDL2MixSoundSample()
-    {
-        Mix_FreeChunk(chunk);
-    }
+    return openSoundStreamAsset(audioMixer, audioStreamer, assetArchive, fileName);
+}
 
-    virtual void play(bool looped) override
-    {
-        playingChannel = Mix_PlayChannel(-1, chunk, looped ? -1 : 0);
-    }
+AssetHandle SDL2HostInterface::requestImage(const char *fileName, AssetLoadPriority::Type priority)
+{
+    return asyncAssetLoader.requestImage(fileName, priority);
+}
 
-    virtual void resume() override
-    {
-        if(isPlaying())
-            Mix_Resume(playingChannel);
-    }
+AssetHandle SDL2HostInterface::requestSoundSample(const char *fileName, AssetLoadPriority::Type priority)
+{
+    return asyncAssetLoader.requestSoundSample(fileName, priority);
+}
 
-    virtual void pause() override
-    {
-        if(isPlaying())
-            Mix_Pause(playingChannel);
-    }
+AssetLoadStatus::Type SDL2HostInterface::getAssetLoadStatus(AssetHandle handle)
+{
+    return asyncAssetLoader.getStatus(handle);
+}
 
-    virtual void stop() override
-    {
-        if(isPlaying())
-            Mix_HaltChannel(playingChannel);
-        playingChannel = -1;
-    }
+Image *SDL2HostInterface::getLoadedImage(AssetHandle handle)
+{
+    return asyncAssetLoader.getImage(handle);
+}
+
+SoundSamplePtr SDL2HostInterface::getLoadedSoundSample(AssetHandle handle)
+{
+    return asyncAssetLoader.getSoundSample(handle);
+}
+
+void SDL2HostInterface::releaseAsset(AssetHandle handle)
+{
+    asyncAssetLoader.release(handle);
+}
+
+uint32_t SDL2HostInterface::registerProfileZone(const char *name)
+{
+    return Profiler::singleton.registerProfileZone(name);
+}
 
-    bool isPlaying()
+void SDL2HostInterface::recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime)
+{
+    Profiler::singleton.recordProfileZone(zoneId, startTime, endTime);
+}
+
+void SDL2HostInterface::parallelFor(size_t count, HostParallelForFunction function, void *userData)
+{
+    updateThreadPool.parallelFor(count, function, userData);
+}
+
+static void toggleProfilerOverlay()
+{
+    isProfilerOverlayVisible = !isProfilerOverlayVisible;
+    profilerZoneTimes.clear();
+
+    // The zones of the frames before are discarded.
+    if(isProfilerOverlayVisible)
     {
-        return playingChannel != -1 && Mix_GetChunk(playingChannel) == chunk;
+        std::vector<ProfileZoneTime> discardedZoneTimes;
+        Profiler::singleton.collectZoneTimes(discardedZoneTimes);
     }
+}
 
-    Mix_Chunk *chunk;
-    int playingChannel;
-};
+static void updateProfilerOverlay(uint32_t frameCount)
+{
+    if(!isProfilerOverlayVisible)
+        return;
 
-SDL2HostInterface SDL2HostInterface::singleton;
+    // There is no text rendering, so the names of the bars are printed.
+    Profiler::singleton.collectZoneTimes(profilerZoneTimes);
+    profilerZoneFrameCount = frameCount;
+    printf("%-24s %9s %9s\n", "zone", "ms/frame", "calls");
+    for(auto &zoneTime : profilerZoneTimes)
+        printf("%-24s %9.3f %9u\n", zoneTime.name.c_str(), zoneTime.milliseconds / frameCount, zoneTime.count / frameCount);
+}
 
-Image *SDL2HostInterface::loadImage(const char *fileName)
+static void drawProfilerOverlay()
 {
-    auto fullPath = makeFullAssetPath(fileName);
-    auto surface = IMG_Load(fullPath.c_str());
-    if(!surface)
+    if(!isProfilerOverlayVisible || profilerZoneTimes.empty())
+        return;
+
+    // A bar per zone, in the order of the printed table. The full width of the
+    // screen is two frames at 60 Hz.
+    int outputWidth = 0;
+    int outputHeight = 0;
+    SDL_GetRendererOutputSize(renderer, &outputWidth, &outputHeight);
+    auto pixelsPerMillisecond = outputWidth / (2000.0 / 60.0);
+    static constexpr int BarHeight = 8;
+    static constexpr int BarSpacing = 2;
+
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
+    SDL_Rect background = {0, 0, outputWidth, int(profilerZoneTimes.size())*(BarHeight + BarSpacing) + BarSpacing};
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 160);
+    SDL_RenderFillRect(renderer, &background);
+    for(size_t i = 0; i < profilerZoneTimes.size(); ++i)
     {
-        fprintf(stderr, "Failed to load image %s: %s\n", fileName, IMG_GetError());
-        return nullptr;
+        auto milliseconds = profilerZoneTimes[i].milliseconds / profilerZoneFrameCount;
+        SDL_Rect bar = {0, int(i)*(BarHeight + BarSpacing) + BarSpacing, std::max(1, int(milliseconds*pixelsPerMillisecond)), BarHeight};
+        auto hash = uint32_t(i + 1)*2654435761u;
+        SDL_SetRenderDrawColor(renderer, Uint8(128 + (hash >> 25)), Uint8(128 + ((hash >> 17) & 127)), Uint8(128 + ((hash >> 9) & 127)), 255);
+        SDL_RenderFillRect(renderer, &bar);
     }
+    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+}
 
-    auto expectedSurface = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0);
-    SDL_FreeSurface(surface);
+static void saveSlot()
+{
+    if(!currentGameInterface)
+        return;
 
-    auto result = ImagePtr(new Image);
-    result->width = expectedSurface->w;
-    result->height = expectedSurface->h;
-    result->pitch = expectedSurface->pitch;
-    result->bpp = expectedSurface->format->BitsPerPixel;
-    result->data.reset(new uint8_t[result->pitch*result->height]);
-    memcpy(result->data.get(), expectedSurface->pixels, result->pitch*result->height);
-    SDL_FreeSurface(expectedSurface);
-    return result.release();
+    if(!saveSlotWriter.save(SaveSlotFileName, persistentMemory, currentGameInterface->getPersistentMemoryLayoutVersion()))
+        fprintf(stderr, "The previous save slot is still being written\n");
 }
 
-SoundSample *SDL2HostInterface::loadSoundSample(const char *fileName)
+static void loadSlot()
 {
-    auto fullPath = makeFullAssetPath(fileName);
-    auto sample = Mix_LoadWAV(fullPath.c_str());
-    if(!sample)
+    if(!currentGameInterface)
+        return;
+
+    // Loading would make the recorded inputs diverge.
+    if(inputRecorder.isRecording() || inputPlayer.isPlaying())
     {
-        fprintf(stderr, "Failed to load sound sample %s\n", fullPath.c_str());
-        return new NullSoundSample;
+        fprintf(stderr, "Save slots cannot be loaded while recording or replaying inputs\n");
+        return;
     }
 
-    return new SDL2MixSoundSample(sample);
+    saveSlotWriter.wait();
+    if(loadSaveSlot(SaveSlotFileName, persistentMemory, currentGameInterface->getPersistentMemoryLayoutVersion()))
+    {
+        transientMemory.reset();
+        rewindBuffer.clear();
+        pendingPersistentMemoryRestored = true;
+    }
 }
 
 static void onKeyEvent(const SDL_KeyboardEvent &event, bool isDown)
@@ -310,17 +396,38 @@ static void onKeyEvent(const SDL_KeyboardEvent &event, bool isDown)
         keyboardControllerState.setButton(ControllerButton::Select, isDown);
         break;
     case SDLK_r:
-        if(isDown)
+        if(isDown && !inputPlayer.isPlaying())
         {
             persistentMemory.reset();
             transientMemory.reset();
+            rewindBuffer.clear();
+            pendingPersistentMemoryReset = true;
         }
         break;
+    case SDLK_BACKSPACE:
+        isRewindKeyDown = isDown;
+        break;
 #ifdef USE_LIVE_CODING
     case SDLK_F1:
         quitting = true;
         break;
 #endif
+    case SDLK_F2:
+        if(isDown)
+            Profiler::singleton.exportChromeTrace(traceFileName);
+        break;
+    case SDLK_F3:
+        if(isDown)
+            toggleProfilerOverlay();
+        break;
+    case SDLK_F5:
+        if(isDown)
+            saveSlot();
+        break;
+    case SDLK_F9:
+        if(isDown)
+            loadSlot();
+        break;
     default:
         break;
     }
@@ -412,6 +519,7 @@ static void pollJoysticks()
 
 static void processEvents()
 {
+    PROFILE_ZONE("Process events");
     oldKeyboardControllerState = keyboardControllerState;
 
     SDL_Event event;
@@ -456,27 +564,107 @@ static void processEvents()
 
 static void update(float timestep)
 {
-    if(currentGameInterface)
-        currentGameInterface->update(timestep, currentControllerState);
+    if(!currentGameInterface)
+        return;
+
+    PROFILE_ZONE("Update");
+
+    // Rewinding would make the recorded inputs diverge.
+    if(isRewindKeyDown && !inputRecorder.isRecording() && !inputPlayer.isPlaying())
+    {
+        // The host resources that the state refers to stay valid within a
+        // run, so the game is not notified like after a restore.
+        if(rewindBuffer.rewind(persistentMemory, 1) > 0)
+            renderPipeline.invalidate();
+        return;
+    }
+
+    InputRecordingTick tick;
+    tick.delta = timestep;
+    tick.controllerState = currentControllerState;
+    tick.resetPersistentMemory = pendingPersistentMemoryReset;
+    pendingPersistentMemoryReset = false;
+
+    if(inputPlayer.isPlaying())
+    {
+        if(!inputPlayer.nextTick(tick))
+        {
+            printf("Input replay finished\n");
+            inputPlayer.end();
+            quitting = true;
+            return;
+        }
+
+        if(tick.resetPersistentMemory)
+        {
+            persistentMemory.reset();
+            transientMemory.reset();
+            rewindBuffer.clear();
+        }
+    }
+    else
+    {
+        inputRecorder.recordTick(tick);
+    }
+
+    currentGameInterface->update(tick.delta, tick.controllerState);
+
+    PROFILE_ZONE("Record rewind");
+    rewindBuffer.recordTick(persistentMemory, tick);
 }
 
-static void render()
+template<typename Format>
+static void uploadFramebufferRect(const Framebuffer &framebuffer, const FramebufferRect &rect)
 {
-    uint8_t *backBuffer;
-    int pitch;
+    SDL_Rect textureRect = {int(rect.x), int(rect.y), int(rect.width), int(rect.height)};
+    SDL_UpdateTexture(texture, &textureRect, framebuffer.getRow(rect.y) + rect.x, framebuffer.pitch);
+}
 
+#if defined(FRAMEBUFFER_INDEXED8)
+template<>
+void uploadFramebufferRect<PixelFormatIndexed8> (const Framebuffer &framebuffer, const FramebufferRect &rect)
+{
+    static std::vector<uint32_t> convertedPixels;
+    convertedPixels.resize(size_t(rect.width)*rect.height);
+    SurfaceView<PixelFormatIndexed8> view = {framebuffer.width, framebuffer.height, framebuffer.pitch, framebuffer.pixels};
+    for(uint32_t y = 0; y < rect.height; ++y)
+        convertPixelRow<PixelFormatIndexed8, PixelFormatABGR8888> (&convertedPixels[size_t(y)*rect.width], view.getRow(rect.y + y) + rect.x, rect.width);
+
+    SDL_Rect textureRect = {int(rect.x), int(rect.y), int(rect.width), int(rect.height)};
+    SDL_UpdateTexture(texture, &textureRect, convertedPixels.data(), int(rect.width*4));
+}
+#endif
+
+static void uploadFramebuffer(const Framebuffer &framebuffer)
+{
+    PROFILE_ZONE("Upload texture");
+    // The texture keeps the previous frame, so only the dirty region is uploaded.
+    auto &region = *framebuffer.dirtyRegion;
+    for(uint32_t i = 0; i < region.rectCount; ++i)
+        uploadFramebufferRect<FramebufferFormat> (framebuffer, region.rects[i]);
+}
+
+static void render(float interpolation)
+{
     if(currentGameInterface)
     {
-        SDL_LockTexture(texture, nullptr, reinterpret_cast<void**> (&backBuffer), &pitch);
-        Framebuffer fb;
-        fb.width = screenWidth;
-        fb.height = screenHeight;
-        fb.pixels = backBuffer;
-        fb.pitch = pitch;
-        currentGameInterface->render(fb);
-        SDL_UnlockTexture(texture);
+        PROFILE_ZONE("Submit frame");
+        auto snapshotMemory = renderPipeline.beginSnapshot();
+        auto snapshotData = currentGameInterface->makeRenderSnapshot(snapshotMemory);
+        auto framebuffer = renderPipeline.submitFrame(currentGameInterface, snapshotData, interpolation);
+        if(framebuffer)
+        {
+            uploadFramebuffer(*framebuffer);
+            presentedRect = SDL_Rect{0, 0, int(framebuffer->width), int(framebuffer->height)};
+
+            // The next frame that is submitted has the new scale.
+            if(dynamicResolution.addRenderTime(renderPipeline.getRenderTime()))
+                renderPipeline.setScale(dynamicResolution.getScale());
+        }
     }
 
+    PROFILE_ZONE("Present");
+
 #ifdef USE_LIVE_CODING
     SDL_SetRenderDrawColor(renderer, 255, 0, 255, 255);
 #else
@@ -484,49 +672,88 @@ static void render()
 #endif
     SDL_RenderClear(renderer);
     if(currentGameInterface)
-        SDL_RenderCopy(renderer, texture, nullptr, nullptr);
+        SDL_RenderCopy(renderer, texture, &presentedRect, nullptr);
+    drawProfilerOverlay();
     SDL_RenderPresent(renderer);
 }
 
-static float accumulatedTime;
-static Uint32 lastUpdateTime;
-static Uint32 frameRenderTime;
+static constexpr double UpdateTimeStep = 1.0/60.0;
+static constexpr int MaxUpdatesPerFrame = 3;
+
+// Frame times this close to a whole number of time steps are snapped to it,
+// so that the timer jitter does not alternate frames of zero and two updates.
+static constexpr double FrameTimeSnapTolerance = 0.0002;
+
+static FramePacer framePacer;
+static double accumulatedTime;
+static double frameRenderTime;
 static Uint32 frameRenderCount;
-static void mainLoopIteration()
+
+static double snapFrameTime(double frameTime)
 {
-    static constexpr float TimeStep = 1.0f/60.0f;
+    for(int stepCount = 1; stepCount <= MaxUpdatesPerFrame; ++stepCount)
+    {
+        if(fabs(frameTime - stepCount*UpdateTimeStep) < FrameTimeSnapTolerance)
+            return stepCount*UpdateTimeStep;
+    }
 
+    return frameTime;
+}
+
+static void mainLoopIteration()
+{
     reloadGameInterface();
+    if(currentGameInterface && pendingPersistentMemoryFileValidation)
+    {
+        // A state from the previous run is resumed without initializing it again.
+        if(persistentMemoryFile.validateLayout(currentGameInterface->getPersistentMemoryLayoutVersion()))
+            pendingPersistentMemoryRestored = true;
+        else
+            printf("Discarded the persistent memory file from an incompatible build\n");
+        pendingPersistentMemoryFileValidation = false;
+    }
+
+    // A save slot is loaded by the events, and the game is notified before
+    // it updates the loaded state.
     processEvents();
+    if(currentGameInterface && pendingPersistentMemoryRestored)
+    {
+        rewindBuffer.clear();
+        currentGameInterface->persistentMemoryRestored();
+        renderPipeline.invalidate();
+        pendingPersistentMemoryRestored = false;
+    }
 
-    // Compute the delta ticks.
-    auto newUpdateTime = SDL_GetTicks();
-    auto deltaTicks = newUpdateTime - lastUpdateTime;
-    lastUpdateTime = newUpdateTime;
+    transientMemory.beginFrame();
+    audioMixer.collectReleasedResources();
+    audioStreamer.update();
 
     // Accumulate the the time.
-    accumulatedTime += deltaTicks * 0.001f;
-    accumulatedTime = std::min(accumulatedTime, 3*TimeStep);
+    auto frameTime = framePacer.beginFrame();
+    accumulatedTime += snapFrameTime(frameTime);
     auto iterationCount = 0;
-    while(accumulatedTime >= TimeStep - 0.01f && iterationCount < 3)
+    while(accumulatedTime >= UpdateTimeStep && iterationCount < MaxUpdatesPerFrame)
     {
-        update(TimeStep);
-        accumulatedTime -= TimeStep;
+        update(float(UpdateTimeStep));
+        accumulatedTime -= UpdateTimeStep;
         ++iterationCount;
     }
 
-    //if(iterationCount == 0)
-    //    printf("Not iterated update %f\n", accumulatedTime);
-    //else if(iterationCount > 1)
-    //    printf("Multiples iterations %d\n", iterationCount);
+    // The time that is left after a long stall is dropped.
+    if(accumulatedTime >= UpdateTimeStep)
+        accumulatedTime = fmod(accumulatedTime, UpdateTimeStep);
 
-    render();
+    render(float(accumulatedTime / UpdateTimeStep));
 
-    frameRenderTime += deltaTicks;
+    frameRenderTime += frameTime;
     ++frameRenderCount;
-    if(frameRenderTime >= 1000)
+    if(frameRenderTime >= 1.0)
     {
-        float fps = frameRenderCount * 1000.0f / frameRenderTime;
+        persistentMemoryFile.flushAsync();
+
+        updateProfilerOverlay(frameRenderCount);
+
+        float fps = float(frameRenderCount / frameRenderTime);
         char buffer[256];
         sprintf(buffer, GAME_TITLE " - %03.2f", fps);
         SDL_SetWindowTitle(window, buffer);
@@ -535,29 +762,209 @@ static void mainLoopIteration()
     }
 }
 
+static void audioCallback(void *userData, Uint8 *stream, int length)
+{
+    (void)userData;
+    audioMixer.mix(reinterpret_cast<int16_t*> (stream), size_t(length) / (AudioMixer::ChannelCount*sizeof(int16_t)));
+}
+
+static void openAudioDevice(int bufferFrameCount)
+{
+    // SDL converts the mix when the device uses a different format.
+    SDL_AudioSpec desiredSpec;
+    memset(&desiredSpec, 0, sizeof(desiredSpec));
+    desiredSpec.freq = AssetArchiveSoundFrequency;
+    desiredSpec.format = AUDIO_S16SYS;
+    desiredSpec.channels = AudioMixer::ChannelCount;
+    desiredSpec.samples = Uint16(bufferFrameCount);
+    desiredSpec.callback = audioCallback;
+
+    SDL_AudioSpec obtainedSpec;
+    audioDevice = SDL_OpenAudioDevice(nullptr, 0, &desiredSpec, &obtainedSpec, 0);
+    if(!audioDevice)
+    {
+        fprintf(stderr, "Failed to open the audio device: %s\n", SDL_GetError());
+        return;
+    }
+
+    audioMixer.initialize(obtainedSpec.freq);
+    SDL_PauseAudioDevice(audioDevice, 0);
+}
+
+static void printHelp()
+{
+    printf("Usage: SimpleGameTemplate [options]\n");
+    printf("  --render-threads <count>  Number of threads used for rendering the framebuffer tiles.\n");
+    printf("  --update-threads <count>  Number of threads for the parallel loops of the update.\n");
+    printf("  --pipelined               Render each frame in a separate thread while the next one updates.\n");
+    printf("  --record <file>           Record the persistent memory and the inputs of every update.\n");
+    printf("  --replay <file>           Replay an input recording, and quit at its end.\n");
+    printf("  --memory-backend <name>   Backend of the memory zones: heap, virtual-memory or huge-pages.\n");
+    printf("  --persistent-file <file>  Map the persistent memory from a file, for resuming the game on the next run.\n");
+    printf("  --asset-archive <file>    Asset archive to load the assets from. Default %s when it exists.\n", DefaultAssetArchiveFileName);
+    printf("  --audio-buffer <frames>   Size of the audio device buffer. Default %u.\n", AudioMixer::DefaultBufferFrameCount);
+    printf("  --frame-rate <fps>        Frames per second, independent of the 60 updates per second. 0 for no limit. Default %g.\n", FramePacer::DefaultFrameRate);
+    printf("  --render-budget <ms>      Render time above which the resolution drops. Default %g%% of the frame period.\n", DefaultRenderBudgetFraction*100.0);
+    printf("  --min-render-scale <s>    Lowest scale of the resolution. 1 keeps the full resolution. Default %g.\n", DefaultMinimumRenderScale);
+    printf("  --rewind-seconds <s>      Length of the history that holding backspace rewinds. Off by default, since it costs about a millisecond per update.\n");
+    printf("  --rewind-memory <MB>      Memory for the rewind history. The oldest ticks are dropped over it. Default %zu.\n", RewindBuffer::DefaultHistoryCapacity / (1024*1024));
+    printf("  --asset-budget <MB>       Memory for the asynchronously loaded assets. Over it, only urgent loads are started.\n");
+    printf("  --trace <file>            Write a Chrome trace of the last seconds at exit. F2 writes it at any time, to %s by default.\n", DefaultTraceFileName);
+}
+
 int main(int argc, char* argv[])
 {
-    (void)argc;
-    (void)argv;
+    size_t renderThreadCount = WorkerThreadPool::getDefaultThreadCount();
+    size_t updateThreadCount = WorkerThreadPool::getDefaultThreadCount();
+    const char *recordFileName = nullptr;
+    const char *replayFileName = nullptr;
+    auto memoryBackend = MemoryZoneBackend::getDefault();
+    const char *persistentFileName = nullptr;
+    const char *assetArchiveFileName = nullptr;
+    size_t assetMemoryBudget = AsyncAssetLoader::DefaultMemoryBudget;
+    int audioBufferFrameCount = AudioMixer::DefaultBufferFrameCount;
+    double frameRate = FramePacer::DefaultFrameRate;
+    double renderBudget = 0;
+    float minimumRenderScale = DefaultMinimumRenderScale;
+    double rewindSeconds = 0;
+    size_t rewindMemory = RewindBuffer::DefaultHistoryCapacity;
+    bool pipelined = false;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--render-threads" && i + 1 < argc)
+        {
+            renderThreadCount = std::max(1, atoi(argv[++i]));
+        }
+        else if(arg == "--update-threads" && i + 1 < argc)
+        {
+            updateThreadCount = std::max(1, atoi(argv[++i]));
+        }
+        else if(arg == "--pipelined")
+        {
+            pipelined = true;
+        }
+        else if(arg == "--record" && i + 1 < argc)
+        {
+            recordFileName = argv[++i];
+        }
+        else if(arg == "--replay" && i + 1 < argc)
+        {
+            replayFileName = argv[++i];
+        }
+        else if(arg == "--persistent-file" && i + 1 < argc)
+        {
+            persistentFileName = argv[++i];
+        }
+        else if(arg == "--asset-archive" && i + 1 < argc)
+        {
+            assetArchiveFileName = argv[++i];
+        }
+        else if(arg == "--frame-rate" && i + 1 < argc)
+        {
+            frameRate = std::max(0.0, atof(argv[++i]));
+        }
+        else if(arg == "--render-budget" && i + 1 < argc)
+        {
+            renderBudget = std::max(0.0, atof(argv[++i]));
+        }
+        else if(arg == "--min-render-scale" && i + 1 < argc)
+        {
+            minimumRenderScale = float(atof(argv[++i]));
+        }
+        else if(arg == "--rewind-seconds" && i + 1 < argc)
+        {
+            rewindSeconds = std::max(0.0, atof(argv[++i]));
+        }
+        else if(arg == "--rewind-memory" && i + 1 < argc)
+        {
+            rewindMemory = size_t(std::max(1, atoi(argv[++i])))*1024*1024;
+        }
+        else if(arg == "--audio-buffer" && i + 1 < argc)
+        {
+            audioBufferFrameCount = std::min(std::max(64, atoi(argv[++i])), 8192);
+        }
+        else if(arg == "--asset-budget" && i + 1 < argc)
+        {
+            assetMemoryBudget = size_t(std::max(0, atoi(argv[++i])))*1024*1024;
+        }
+        else if(arg == "--trace" && i + 1 < argc)
+        {
+            traceFileName = argv[++i];
+            isTraceExportedOnExit = true;
+        }
+        else if(arg == "--memory-backend" && i + 1 < argc)
+        {
+            if(!MemoryZoneBackend::parseName(argv[++i], memoryBackend))
+            {
+                fprintf(stderr, "Unknown memory backend %s\n", argv[i]);
+                return 1;
+            }
+        }
+        else if(arg == "-h" || arg == "--help")
+        {
+            printHelp();
+            return 0;
+        }
+    }
+
     SDL_SetHint("SDL_HINT_NO_SIGNAL_HANDLERS", "1");
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_JOYSTICK | SDL_INIT_GAMECONTROLLER | SDL_INIT_AUDIO);
+    Profiler::singleton.setThreadName("Main");
     IMG_Init(IMG_INIT_PNG);
 
-#ifndef NO_SDL_MIXER_AVAILABLE
-    Mix_Init(0);
-    Mix_OpenAudio(44100, MIX_DEFAULT_FORMAT, 2, 4096);
-    Mix_AllocateChannels(16);
-#endif
+    openAudioDevice(audioBufferFrameCount);
 
     window = SDL_CreateWindow(GAME_TITLE, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, windowWidth, windowHeight, SDL_WINDOW_SHOWN);
     renderer = SDL_CreateRenderer(window, 0, SDL_RENDERER_PRESENTVSYNC);
-    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ABGR8888, SDL_TEXTUREACCESS_STREAMING, screenWidth, screenHeight);
+    texture = SDL_CreateTexture(renderer, FramebufferTextureFormat, SDL_TEXTUREACCESS_STREAMING, screenWidth, screenHeight);
+    openAssetArchive(assetArchive, assetArchiveFileName);
 
-    persistentMemory.reserve(PersistentMemorySize);
-    transientMemory.reserve(TransientMemorySize);
+    if(persistentFileName && (replayFileName || recordFileName))
+    {
+        fprintf(stderr, "The persistent memory file is not used when recording or replaying inputs\n");
+        persistentFileName = nullptr;
+    }
+
+    if(persistentFileName && persistentMemoryFile.open(persistentFileName, PersistentMemorySize))
+    {
+        persistentMemory.attach(persistentMemoryFile.getZoneData(), PersistentMemorySize);
+        pendingPersistentMemoryFileValidation = true;
+    }
+    else
+    {
+        persistentMemory.reserve(PersistentMemorySize, memoryBackend);
+    }
+    transientMemory.reserve(TransientMemorySize, memoryBackend);
+    if(!rewindBuffer.initialize(PersistentMemorySize, rewindMemory, uint32_t(rewindSeconds / UpdateTimeStep + 0.5)))
+        return 1;
 
-    lastUpdateTime = SDL_GetTicks();
+    if(replayFileName)
+    {
+        if(!inputPlayer.begin(replayFileName, persistentMemory))
+            return 1;
+        pendingPersistentMemoryRestored = true;
+    }
+    else if(recordFileName)
+    {
+        if(!inputRecorder.begin(recordFileName, persistentMemory))
+            return 1;
+    }
 
+    renderThreadPool.start(renderThreadCount);
+    updateThreadPool.start(updateThreadCount);
+    renderPipeline.start(&renderThreadPool, uint32_t(screenWidth), uint32_t(screenHeight), pipelined, memoryBackend);
+    presentedRect = SDL_Rect{0, 0, screenWidth, screenHeight};
+    if(renderBudget <= 0)
+        renderBudget = DefaultRenderBudgetFraction*1000.0 / (frameRate > 0 ? frameRate : FramePacer::DefaultFrameRate);
+    dynamicResolution.start(renderBudget, minimumRenderScale);
+    asyncAssetLoader.start(&SDL2HostInterface::singleton, AsyncAssetLoader::DefaultThreadCount, assetMemoryBudget);
+    audioStreamer.start(true);
+#ifdef USE_LIVE_CODING
+    gameLogicLibraryWatcher.start(GameLogicLibraryName);
+#endif
+    // The browser paces the frames of the Emscripten builds, so the pacer only measures them.
+    framePacer.start(frameRate);
 #ifdef __EMSCRIPTEN__
     emscripten_set_main_loop(mainLoopIteration, 60, 1);
 #else
@@ -565,20 +972,34 @@ int main(int argc, char* argv[])
     while(!quitting)
     {
         mainLoopIteration();
-
-        int frameDuration = 1000/60;
-        int nextFrameTime = lastUpdateTime + frameDuration;
-        int delayTime = nextFrameTime - SDL_GetTicks();
-        if(delayTime > 0)
-            SDL_Delay(delayTime);
+        framePacer.waitForNextFrame();
     }
 
+    inputRecorder.end();
+    saveSlotWriter.wait();
+#ifdef USE_LIVE_CODING
+    gameLogicLibraryWatcher.stop();
+#endif
+    renderPipeline.shutdown();
+    renderThreadPool.shutdown();
+    updateThreadPool.shutdown();
+    if(audioDevice)
+        SDL_CloseAudioDevice(audioDevice);
+    asyncAssetLoader.shutdown();
+    audioMixer.shutdown();
+    audioStreamer.shutdown();
+    framePacer.printStatistics();
+    dynamicResolution.printStatistics();
+    rewindBuffer.printStatistics();
+    if(isTraceExportedOnExit)
+        Profiler::singleton.exportChromeTrace(traceFileName);
+    printMemoryZoneStats("persistent", persistentMemory.getStats());
+    printMemoryZoneStats("transient", transientMemory.getStats());
+    persistentMemoryFile.close();
     SDL_Quit();
 
     IMG_Quit();
-#ifndef NO_SDL_MIXER_AVAILABLE
-    Mix_Quit();
-#endif
+    assetArchive.close();
 #endif
 
     return 0;
@@ -1,39 +1,182 @@
 #ifndef SIMPLE_GAME_TEMPLATE_GAME_MEMORY_ZONE_HPP
 #define SIMPLE_GAME_TEMPLATE_GAME_MEMORY_ZONE_HPP
 
+#include "VirtualMemory.hpp"
 #include <stddef.h>
 #include <stdint.h>
 #include <assert.h>
 #include <string.h>
+#include <algorithm>
+#include <new>
+
+namespace MemoryZoneBackend
+{
+
+enum Type
+{
+    // Allocated with new, and zeroed with memset.
+    Heap = 0,
+
+    // Reserved from the operating system, with pages zeroed lazily.
+    VirtualMemory,
+
+    // Like VirtualMemory, but also requests transparent huge pages.
+    VirtualMemoryHugePages,
+
+    // Memory that is owned by someone else, such as a mapped file.
+    External,
+};
+
+inline const char *getName(Type backend)
+{
+    switch(backend)
+    {
+    case VirtualMemory: return "virtual-memory";
+    case VirtualMemoryHugePages: return "huge-pages";
+    case External: return "external";
+    case Heap:
+    default:
+        return "heap";
+    }
+}
+
+inline Type getDefault()
+{
+    return ::VirtualMemory::isSupported() ? VirtualMemory : Heap;
+}
+
+inline bool parseName(const char *name, Type &result)
+{
+    static const Type backends[] = {Heap, VirtualMemory, VirtualMemoryHugePages};
+    for(auto backend : backends)
+    {
+        if(strcmp(name, getName(backend)) == 0)
+        {
+            result = backend;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+}
+
+/**
+ * Usage statistics of a memory zone. The frame statistics are the ones of
+ * the last frame that was finished with MemoryZone::beginFrame.
+ */
+struct MemoryZoneStats
+{
+    MemoryZoneBackend::Type backend;
+    size_t size;
+    size_t usedBytes;
+    size_t highWaterMark;
+
+    size_t lastFramePeakBytes;
+    size_t lastFrameAllocatedBytes;
+    size_t lastFrameAllocationCount;
+};
 
 class MemoryZone
 {
 public:
+    static constexpr size_t DefaultAlignment = 16;
+
+    typedef size_t Marker;
+
     MemoryZone()
-        : data(nullptr), size(0), currentPosition(0) {}
+        : data(nullptr), size(0), mappedSize(0), backend(MemoryZoneBackend::Heap), currentPosition(0), highWaterMark(0),
+          framePeakBytes(0), frameAllocatedBytes(0), frameAllocationCount(0),
+          lastFramePeakBytes(0), lastFrameAllocatedBytes(0), lastFrameAllocationCount(0) {}
     ~MemoryZone()
     {
-        delete [] data;
+        release();
     }
 
-    void reserve(size_t newSize)
+    void reserve(size_t newSize, MemoryZoneBackend::Type newBackend = MemoryZoneBackend::getDefault())
     {
-        delete [] data;
+        release();
+
+        if(newBackend != MemoryZoneBackend::Heap)
+        {
+            // The size is rounded to full pages, so that discarding them
+            // never touches memory outside of the zone.
+            auto pageSize = VirtualMemory::getPageSize();
+            auto mappingSize = (newSize + pageSize - 1) / pageSize * pageSize;
+            data = VirtualMemory::reserve(mappingSize, newBackend == MemoryZoneBackend::VirtualMemoryHugePages);
+            if(data)
+            {
+                size = newSize;
+                mappedSize = mappingSize;
+                backend = newBackend;
+                currentPosition = 0;
+                return;
+            }
+        }
+
         data = new uint8_t[newSize];
         size = newSize;
+        mappedSize = 0;
+        backend = MemoryZoneBackend::Heap;
         reset();
     }
 
+    // Uses memory that is owned by someone else. It is not zeroed.
+    void attach(uint8_t *externalData, size_t externalSize)
+    {
+        release();
+        data = externalData;
+        size = externalSize;
+        backend = MemoryZoneBackend::External;
+        currentPosition = 0;
+    }
+
     void reset()
     {
-        memset(data, 0, size);
+        auto isVirtualMemory = backend == MemoryZoneBackend::VirtualMemory || backend == MemoryZoneBackend::VirtualMemoryHugePages;
+        if(!isVirtualMemory || !VirtualMemory::discard(data, mappedSize))
+            memset(data, 0, size);
+        currentPosition = 0;
     }
 
-    uint8_t *allocateBytes(size_t byteCount)
+    // Returns nullptr when the zone is full, which the callers handle, in the
+    // debug builds too.
+    uint8_t *allocateBytes(size_t byteCount, size_t alignment = DefaultAlignment)
     {
-        assert(currentPosition + byteCount <= size);
-        auto result = data + currentPosition;
-        currentPosition += byteCount;
+        assert(alignment > 0 && (alignment & (alignment - 1)) == 0);
+        auto address = reinterpret_cast<uintptr_t> (data + currentPosition);
+        auto padding = size_t(((address + alignment - 1) & ~uintptr_t(alignment - 1)) - address);
+        if(currentPosition + padding + byteCount > size)
+            return nullptr;
+
+        auto result = data + currentPosition + padding;
+        currentPosition += padding + byteCount;
+
+        highWaterMark = std::max(highWaterMark, currentPosition);
+        framePeakBytes = std::max(framePeakBytes, currentPosition);
+        frameAllocatedBytes += padding + byteCount;
+        ++frameAllocationCount;
+        return result;
+    }
+
+    template<typename T>
+    T *allocate()
+    {
+        auto storage = allocateBytes(sizeof(T), alignof(T));
+        return storage ? new (storage) T() : nullptr;
+    }
+
+    template<typename T>
+    T *allocateArray(size_t count)
+    {
+        auto storage = allocateBytes(sizeof(T)*count, alignof(T) > DefaultAlignment ? alignof(T) : DefaultAlignment);
+        if(!storage)
+            return nullptr;
+
+        auto result = reinterpret_cast<T*> (storage);
+        for(size_t i = 0; i < count; ++i)
+            new (result + i) T();
         return result;
     }
 
@@ -42,15 +185,120 @@ public:
         return data;
     }
 
+    size_t getSize() const
+    {
+        return size;
+    }
+
+    MemoryZoneBackend::Type getBackend() const
+    {
+        return backend;
+    }
+
     void clearAll()
     {
         currentPosition = 0;
     }
 
+    Marker getMarker() const
+    {
+        return currentPosition;
+    }
+
+    // Releases everything that was allocated after the marker was taken.
+    void rollback(Marker marker)
+    {
+        assert(marker <= currentPosition);
+        currentPosition = marker;
+    }
+
+    // Moves the position to a marker that is kept with the data, such as in
+    // a snapshot of the zone that was restored. It can be past the current
+    // position.
+    void restoreMarker(Marker marker)
+    {
+        assert(marker <= size);
+        currentPosition = marker;
+        highWaterMark = std::max(highWaterMark, currentPosition);
+    }
+
+    // Finishes the statistics of the current frame, and releases all of its
+    // allocations. The host calls this on the transient zone at the
+    // beginning of every frame.
+    void beginFrame()
+    {
+        lastFramePeakBytes = framePeakBytes;
+        lastFrameAllocatedBytes = frameAllocatedBytes;
+        lastFrameAllocationCount = frameAllocationCount;
+
+        clearAll();
+        framePeakBytes = 0;
+        frameAllocatedBytes = 0;
+        frameAllocationCount = 0;
+    }
+
+    MemoryZoneStats getStats() const
+    {
+        MemoryZoneStats stats;
+        stats.backend = backend;
+        stats.size = size;
+        stats.usedBytes = currentPosition;
+        stats.highWaterMark = highWaterMark;
+        stats.lastFramePeakBytes = lastFramePeakBytes;
+        stats.lastFrameAllocatedBytes = lastFrameAllocatedBytes;
+        stats.lastFrameAllocationCount = lastFrameAllocationCount;
+        return stats;
+    }
+
 private:
+    void release()
+    {
+        if(backend == MemoryZoneBackend::Heap)
+            delete [] data;
+        else if(backend != MemoryZoneBackend::External)
+            VirtualMemory::release(data, mappedSize);
+
+        data = nullptr;
+        size = 0;
+        mappedSize = 0;
+        backend = MemoryZoneBackend::Heap;
+    }
+
     uint8_t *data;
     size_t size;
+    size_t mappedSize;
+    MemoryZoneBackend::Type backend;
     size_t currentPosition;
+
+    size_t highWaterMark;
+    size_t framePeakBytes;
+    size_t frameAllocatedBytes;
+    size_t frameAllocationCount;
+    size_t lastFramePeakBytes;
+    size_t lastFrameAllocatedBytes;
+    size_t lastFrameAllocationCount;
+};
+
+/**
+ * Rolls back the allocations made in a memory zone during its lifetime.
+ */
+class MemoryZoneScope
+{
+public:
+    explicit MemoryZoneScope(MemoryZone &theZone)
+        : zone(theZone), marker(theZone.getMarker()) {}
+
+    ~MemoryZoneScope()
+    {
+        zone.rollback(marker);
+    }
+
+    MemoryZoneScope(const MemoryZoneScope &) = delete;
+    MemoryZoneScope &operator=(const MemoryZoneScope &) = delete;
+
+private:
+    MemoryZone &zone;
+    MemoryZone::Marker marker;
 };
 
 #endif //SIMPLE_GAME_TEMPLATE_GAME_MEMORY_ZONE_HPP
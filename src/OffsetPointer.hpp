@@ -0,0 +1,77 @@
+#ifndef SIMPLE_GAME_TEMPLATE_OFFSET_POINTER_HPP
+#define SIMPLE_GAME_TEMPLATE_OFFSET_POINTER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A pointer that is stored as the distance from itself to its target. It stays
+ * valid when the memory that holds both of them is moved as a whole, such as
+ * the persistent memory that is mapped at another address in the next run, or
+ * restored from a snapshot. It must not point outside of that memory.
+ */
+template<typename T>
+class OffsetPointer
+{
+public:
+    OffsetPointer()
+        : offset(0) {}
+    OffsetPointer(T *pointer)
+    {
+        set(pointer);
+    }
+    OffsetPointer(const OffsetPointer<T> &other)
+    {
+        set(other.get());
+    }
+
+    OffsetPointer<T> &operator=(const OffsetPointer<T> &other)
+    {
+        set(other.get());
+        return *this;
+    }
+
+    OffsetPointer<T> &operator=(T *pointer)
+    {
+        set(pointer);
+        return *this;
+    }
+
+    T *get() const
+    {
+        if(offset == 0)
+            return nullptr;
+        return reinterpret_cast<T*> (const_cast<uint8_t*> (reinterpret_cast<const uint8_t*> (this)) + offset);
+    }
+
+    T *operator->() const
+    {
+        return get();
+    }
+
+    T &operator*() const
+    {
+        return *get();
+    }
+
+    T &operator[](size_t index) const
+    {
+        return get()[index];
+    }
+
+    explicit operator bool() const
+    {
+        return offset != 0;
+    }
+
+private:
+    void set(T *pointer)
+    {
+        // Zero is null, since a pointer never points to itself.
+        offset = pointer ? reinterpret_cast<const uint8_t*> (pointer) - reinterpret_cast<const uint8_t*> (this) : 0;
+    }
+
+    ptrdiff_t offset;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_OFFSET_POINTER_HPP
@@ -0,0 +1,198 @@
+#include "HostInterface.hpp"
+#include "ParticleSystem.hpp"
+#include "Profiler.hpp"
+#include "WorkerThreadPool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static constexpr float Timestep = 1.0f/60.0f;
+static constexpr float Gravity = 60.0f;
+static constexpr float ParticleLifetime = 2.0f;
+static constexpr size_t SnapshotMemorySize = 32*1024*1024;
+
+// The particle system only needs the parallel loops of the host.
+class BenchmarkHostInterface : public HostInterface
+{
+public:
+    virtual Image *loadImage(const char *) override { return nullptr; }
+    virtual SoundSamplePtr loadSoundSample(const char *) override { return nullptr; }
+    virtual SoundSamplePtr openSoundStream(const char *) override { return nullptr; }
+
+    virtual AssetHandle requestImage(const char *, AssetLoadPriority::Type) override { return 0; }
+    virtual AssetHandle requestSoundSample(const char *, AssetLoadPriority::Type) override { return 0; }
+    virtual AssetLoadStatus::Type getAssetLoadStatus(AssetHandle) override { return AssetLoadStatus::Invalid; }
+    virtual Image *getLoadedImage(AssetHandle) override { return nullptr; }
+    virtual SoundSamplePtr getLoadedSoundSample(AssetHandle) override { return nullptr; }
+    virtual void releaseAsset(AssetHandle) override {}
+
+    virtual uint32_t registerProfileZone(const char *name) override
+    {
+        return Profiler::singleton.registerProfileZone(name);
+    }
+
+    virtual void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime) override
+    {
+        Profiler::singleton.recordProfileZone(zoneId, startTime, endTime);
+    }
+
+    virtual void parallelFor(size_t count, HostParallelForFunction function, void *userData) override
+    {
+        threadPool.parallelFor(count, function, userData);
+    }
+
+    WorkerThreadPool threadPool;
+};
+
+struct TileJob
+{
+    const ParticleView *view;
+    const Framebuffer *framebuffer;
+    uint32_t tileColumns;
+};
+
+static void renderTileJob(void *userData, size_t index)
+{
+    auto &job = *reinterpret_cast<TileJob*> (userData);
+    auto &framebuffer = *job.framebuffer;
+    auto x = uint32_t(index % job.tileColumns)*FramebufferTileSize;
+    auto y = uint32_t(index / job.tileColumns)*FramebufferTileSize;
+    FramebufferTile tile = {x, y, std::min(FramebufferTileSize, framebuffer.width - x), std::min(FramebufferTileSize, framebuffer.height - y)};
+    job.view->renderTile(framebuffer, tile);
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+static double median(std::vector<double> &values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t particleCount = 200000;
+    uint32_t emitterCount = 2000;
+    uint32_t width = 640;
+    uint32_t height = 480;
+    int frameCount = 300;
+    size_t threadCount = WorkerThreadPool::getDefaultThreadCount();
+    auto blendMode = ParticleBlendMode::Additive;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--particles" && i + 1 < argc)
+            particleCount = uint32_t(std::max(1, atoi(argv[++i])));
+        else if(arg == "--emitters" && i + 1 < argc)
+            emitterCount = uint32_t(std::max(1, atoi(argv[++i])));
+        else if(arg == "--frames" && i + 1 < argc)
+            frameCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--threads" && i + 1 < argc)
+            threadCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--alpha-blend")
+            blendMode = ParticleBlendMode::AlphaBlend;
+    }
+
+    BenchmarkHostInterface host;
+    host.threadPool.start(threadCount);
+
+    MemoryZone persistentMemory;
+    MemoryZone snapshotMemory;
+    persistentMemory.reserve(ParticleSystem::getStorageSize(particleCount, emitterCount) + ParticleColumnAlignment);
+    snapshotMemory.reserve(SnapshotMemorySize);
+
+    // The emitters are spread over the framebuffer, and they emit enough for
+    // the system to be full after a lifetime.
+    ParticleSystem particles;
+    auto storage = persistentMemory.allocateBytes(ParticleSystem::getStorageSize(particleCount, emitterCount), ParticleColumnAlignment);
+    if(!particles.initialize(storage, particleCount, emitterCount))
+        return 1;
+
+    for(uint32_t i = 0; i < emitterCount; ++i)
+    {
+        ParticleEmitter emitter = {};
+        emitter.x = float((i*7919) % width);
+        emitter.y = float((i*104729) % height);
+        emitter.rate = float(particleCount) / (float(emitterCount)*ParticleLifetime);
+        emitter.direction = -1.5708f;
+        emitter.spread = 6.2832f;
+        emitter.minSpeed = 10.0f;
+        emitter.maxSpeed = 80.0f;
+        emitter.lifetime = ParticleLifetime;
+        emitter.color = blendMode == ParticleBlendMode::Additive ? 0xff102040 : 0x80ffc080;
+        particles.addEmitter(emitter);
+    }
+
+    FramebufferDirtyRegion dirtyRegion;
+    dirtyRegion.clear();
+    Framebuffer framebuffer;
+    framebuffer.width = width;
+    framebuffer.height = height;
+    framebuffer.pitch = int(width*sizeof(FramebufferPixel));
+    framebuffer.scale = 1.0f;
+    std::unique_ptr<uint8_t[]> pixels(new uint8_t[framebuffer.pitch*height]);
+    framebuffer.pixels = pixels.get();
+    framebuffer.dirtyRegion = &dirtyRegion;
+
+    auto tileColumns = (width + FramebufferTileSize - 1) / FramebufferTileSize;
+    auto tileRows = (height + FramebufferTileSize - 1) / FramebufferTileSize;
+
+    // Fills the system before measuring.
+    auto warmUpFrameCount = int(ParticleLifetime / Timestep) + 10;
+    for(int i = 0; i < warmUpFrameCount; ++i)
+        particles.update(&host, Timestep, 0.0f, Gravity);
+
+    std::vector<double> updateTimes;
+    std::vector<double> snapshotTimes;
+    std::vector<double> binTimes;
+    std::vector<double> splatTimes;
+    uint64_t visibleCount = 0;
+    for(int frame = 0; frame < frameCount; ++frame)
+    {
+        auto startTime = std::chrono::steady_clock::now();
+        particles.update(&host, Timestep, 0.0f, Gravity);
+        updateTimes.push_back(millisecondsSince(startTime));
+
+        snapshotMemory.beginFrame();
+        startTime = std::chrono::steady_clock::now();
+        ParticleView view;
+        view.begin(&snapshotMemory, particles, blendMode, 0.0f, 0.0f);
+        snapshotTimes.push_back(millisecondsSince(startTime));
+
+        startTime = std::chrono::steady_clock::now();
+        view.prepare(framebuffer);
+        binTimes.push_back(millisecondsSince(startTime));
+
+        memset(framebuffer.pixels, 0, framebuffer.pitch*height);
+        TileJob job = {&view, &framebuffer, tileColumns};
+        startTime = std::chrono::steady_clock::now();
+        host.threadPool.parallelFor(tileColumns*tileRows, renderTileJob, &job);
+        splatTimes.push_back(millisecondsSince(startTime));
+        visibleCount += view.getVisibleParticleCount();
+    }
+
+    auto updateTime = median(updateTimes);
+    auto snapshotTime = median(snapshotTimes);
+    auto binTime = median(binTimes);
+    auto splatTime = median(splatTimes);
+    printf("Particles: %u alive of %u, %u emitters, %s, %ux%u, %u threads, median of %d frames\n",
+        particles.getParticleCount(), particles.getParticleCapacity(), emitterCount,
+        blendMode == ParticleBlendMode::Additive ? "additive" : "alpha blend", width, height, unsigned(threadCount), frameCount);
+    printf("  update      %7.3f ms\n", updateTime);
+    printf("  snapshot    %7.3f ms\n", snapshotTime);
+    printf("  bin         %7.3f ms\n", binTime);
+    printf("  splat       %7.3f ms\n", splatTime);
+    printf("  total       %7.3f ms, %.0f visible particles per frame\n", updateTime + snapshotTime + binTime + splatTime,
+        double(visibleCount) / frameCount);
+
+    host.threadPool.shutdown();
+    return 0;
+}
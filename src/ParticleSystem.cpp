@@ -0,0 +1,510 @@
+#include "ParticleSystem.hpp"
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLE_SYSTEM_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+size_t alignColumnSize(size_t size)
+{
+    return (size + ParticleColumnAlignment - 1) & ~(ParticleColumnAlignment - 1);
+}
+
+uint32_t getBatchCountForCapacity(uint32_t particleCapacity)
+{
+    return (particleCapacity + ParticleBatchSize - 1) / ParticleBatchSize;
+}
+
+template<typename T>
+T *allocateUninitializedArray(MemoryZone *zone, size_t count)
+{
+    return reinterpret_cast<T*> (zone->allocateBytes(sizeof(T)*count, alignof(T)));
+}
+
+}
+
+struct ParticleSystem::UpdateJob
+{
+    ParticleSystem *system;
+    float delta;
+    float gravityX;
+    float gravityY;
+};
+
+size_t ParticleSystem::getStorageSize(uint32_t particleCapacity, uint32_t emitterCapacity)
+{
+    size_t batchCount = getBatchCountForCapacity(particleCapacity);
+    auto columnSize = alignColumnSize(sizeof(float)*batchCount*ParticleBatchSize);
+    return 6*columnSize + alignColumnSize(sizeof(uint32_t)*batchCount) +
+        alignColumnSize(sizeof(ParticleEmitter)*emitterCapacity);
+}
+
+bool ParticleSystem::initialize(uint8_t *storage, uint32_t theParticleCapacity, uint32_t theEmitterCapacity, uint32_t randomSeed)
+{
+    if(!storage || theParticleCapacity == 0)
+    {
+        fprintf(stderr, "Invalid particle system with %u particles\n", theParticleCapacity);
+        return false;
+    }
+
+    batchCount = getBatchCountForCapacity(theParticleCapacity);
+    particleCapacity = batchCount*ParticleBatchSize;
+    particleCount = 0;
+    firstOpenBatch = 0;
+    emitterCapacity = theEmitterCapacity;
+    emitterCount = 0;
+
+    // Xorshift gets stuck at zero.
+    randomState = randomSeed != 0 ? randomSeed : 1;
+
+    auto columnSize = alignColumnSize(sizeof(float)*particleCapacity);
+    positionsX = reinterpret_cast<float*> (storage);
+    positionsY = reinterpret_cast<float*> (storage + columnSize);
+    velocitiesX = reinterpret_cast<float*> (storage + 2*columnSize);
+    velocitiesY = reinterpret_cast<float*> (storage + 3*columnSize);
+    remainingLifetimes = reinterpret_cast<float*> (storage + 4*columnSize);
+    colors = reinterpret_cast<uint32_t*> (storage + 5*columnSize);
+    storage += 6*columnSize;
+
+    batchParticleCounts = reinterpret_cast<uint32_t*> (storage);
+    memset(storage, 0, sizeof(uint32_t)*batchCount);
+    storage += alignColumnSize(sizeof(uint32_t)*batchCount);
+
+    emitters = reinterpret_cast<ParticleEmitter*> (storage);
+    memset(storage, 0, sizeof(ParticleEmitter)*emitterCapacity);
+    return true;
+}
+
+uint32_t ParticleSystem::addEmitter(const ParticleEmitter &emitter)
+{
+    // The slots of the removed emitters are reused first.
+    uint32_t index = 0;
+    while(index < emitterCount && emitters[index].isActive)
+        ++index;
+    if(index == emitterCapacity)
+        return InvalidEmitter;
+
+    emitters[index] = emitter;
+    emitters[index].isActive = true;
+    emitterCount = std::max(emitterCount, index + 1);
+    return index;
+}
+
+void ParticleSystem::removeEmitter(uint32_t index)
+{
+    if(index >= emitterCount)
+        return;
+
+    emitters[index].isActive = false;
+    while(emitterCount > 0 && !emitters[emitterCount - 1].isActive)
+        --emitterCount;
+}
+
+bool ParticleSystem::emit(float x, float y, float velocityX, float velocityY, float lifetime, uint32_t color)
+{
+    while(firstOpenBatch < batchCount && batchParticleCounts[firstOpenBatch] == ParticleBatchSize)
+        ++firstOpenBatch;
+    if(firstOpenBatch == batchCount)
+        return false;
+
+    auto index = firstOpenBatch*ParticleBatchSize + batchParticleCounts[firstOpenBatch]++;
+    positionsX[index] = x;
+    positionsY[index] = y;
+    velocitiesX[index] = velocityX;
+    velocitiesY[index] = velocityY;
+    remainingLifetimes[index] = lifetime;
+    colors[index] = color;
+    ++particleCount;
+    return true;
+}
+
+float ParticleSystem::nextRandom()
+{
+    randomState ^= randomState << 13;
+    randomState ^= randomState >> 17;
+    randomState ^= randomState << 5;
+    return float(randomState >> 8)*(1.0f / 16777216.0f);
+}
+
+void ParticleSystem::update(HostInterface *host, float delta, float gravityX, float gravityY)
+{
+    if(particleCount > 0)
+    {
+        UpdateJob job = {this, delta, gravityX, gravityY};
+        host->parallelFor(batchCount, &ParticleSystem::updateBatch, &job);
+
+        particleCount = 0;
+        for(uint32_t batch = 0; batch < batchCount; ++batch)
+            particleCount += batchParticleCounts[batch];
+        firstOpenBatch = 0;
+    }
+
+    emitFromEmitters(delta);
+}
+
+void ParticleSystem::updateBatch(void *userData, size_t batch)
+{
+    auto &job = *reinterpret_cast<UpdateJob*> (userData);
+    auto &system = *job.system;
+    auto begin = uint32_t(batch)*ParticleBatchSize;
+    auto end = begin + system.batchParticleCounts[batch];
+    auto positionsX = system.positionsX.get();
+    auto positionsY = system.positionsY.get();
+    auto velocitiesX = system.velocitiesX.get();
+    auto velocitiesY = system.velocitiesY.get();
+    auto remainingLifetimes = system.remainingLifetimes.get();
+    auto colors = system.colors.get();
+    auto delta = job.delta;
+    auto velocityStepX = job.gravityX*delta;
+    auto velocityStepY = job.gravityY*delta;
+
+    // The particles that survive are written at the alive index, which stays
+    // behind the particle that is read.
+    auto alive = begin;
+    auto i = begin;
+#ifdef PARTICLE_SYSTEM_HAS_SSE2
+    auto deltas = _mm_set1_ps(delta);
+    auto velocityStepsX = _mm_set1_ps(velocityStepX);
+    auto velocityStepsY = _mm_set1_ps(velocityStepY);
+    auto zero = _mm_setzero_ps();
+    for(; i + 4 <= end; i += 4)
+    {
+        auto velocityX = _mm_add_ps(_mm_load_ps(velocitiesX + i), velocityStepsX);
+        auto velocityY = _mm_add_ps(_mm_load_ps(velocitiesY + i), velocityStepsY);
+        auto positionX = _mm_add_ps(_mm_load_ps(positionsX + i), _mm_mul_ps(velocityX, deltas));
+        auto positionY = _mm_add_ps(_mm_load_ps(positionsY + i), _mm_mul_ps(velocityY, deltas));
+        auto remainingLifetime = _mm_sub_ps(_mm_load_ps(remainingLifetimes + i), deltas);
+        auto aliveMask = _mm_movemask_ps(_mm_cmpgt_ps(remainingLifetime, zero));
+
+        // Until the first particle expires, the survivors stay in place, and
+        // afterwards the groups without an expired particle move as a whole.
+        if(aliveMask == 0xf)
+        {
+            if(alive == i)
+            {
+                _mm_store_ps(velocitiesX + i, velocityX);
+                _mm_store_ps(velocitiesY + i, velocityY);
+                _mm_store_ps(positionsX + i, positionX);
+                _mm_store_ps(positionsY + i, positionY);
+                _mm_store_ps(remainingLifetimes + i, remainingLifetime);
+            }
+            else
+            {
+                _mm_storeu_ps(velocitiesX + alive, velocityX);
+                _mm_storeu_ps(velocitiesY + alive, velocityY);
+                _mm_storeu_ps(positionsX + alive, positionX);
+                _mm_storeu_ps(positionsY + alive, positionY);
+                _mm_storeu_ps(remainingLifetimes + alive, remainingLifetime);
+                auto groupColors = _mm_load_si128(reinterpret_cast<const __m128i*> (colors + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*> (colors + alive), groupColors);
+            }
+            alive += 4;
+            continue;
+        }
+
+        alignas(16) float lanes[5][4];
+        _mm_store_ps(lanes[0], positionX);
+        _mm_store_ps(lanes[1], positionY);
+        _mm_store_ps(lanes[2], velocityX);
+        _mm_store_ps(lanes[3], velocityY);
+        _mm_store_ps(lanes[4], remainingLifetime);
+        for(uint32_t lane = 0; lane < 4; ++lane)
+        {
+            if((aliveMask & (1 << lane)) == 0)
+                continue;
+
+            positionsX[alive] = lanes[0][lane];
+            positionsY[alive] = lanes[1][lane];
+            velocitiesX[alive] = lanes[2][lane];
+            velocitiesY[alive] = lanes[3][lane];
+            remainingLifetimes[alive] = lanes[4][lane];
+            colors[alive] = colors[i + lane];
+            ++alive;
+        }
+    }
+#endif
+
+    for(; i < end; ++i)
+    {
+        auto velocityX = velocitiesX[i] + velocityStepX;
+        auto velocityY = velocitiesY[i] + velocityStepY;
+        auto positionX = positionsX[i] + velocityX*delta;
+        auto positionY = positionsY[i] + velocityY*delta;
+        auto remainingLifetime = remainingLifetimes[i] - delta;
+        if(remainingLifetime <= 0.0f)
+            continue;
+
+        positionsX[alive] = positionX;
+        positionsY[alive] = positionY;
+        velocitiesX[alive] = velocityX;
+        velocitiesY[alive] = velocityY;
+        remainingLifetimes[alive] = remainingLifetime;
+        colors[alive] = colors[i];
+        ++alive;
+    }
+
+    system.batchParticleCounts[batch] = alive - begin;
+}
+
+void ParticleSystem::emitFromEmitters(float delta)
+{
+    for(uint32_t i = 0; i < emitterCount; ++i)
+    {
+        auto &emitter = emitters[i];
+        if(!emitter.isActive)
+            continue;
+
+        emitter.accumulator += emitter.rate*delta;
+        auto emittedCount = uint32_t(emitter.accumulator);
+        emitter.accumulator -= float(emittedCount);
+        for(uint32_t j = 0; j < emittedCount; ++j)
+        {
+            auto angle = emitter.direction + emitter.spread*(nextRandom() - 0.5f);
+            auto speed = emitter.minSpeed + (emitter.maxSpeed - emitter.minSpeed)*nextRandom();
+            if(!emit(emitter.x, emitter.y, cosf(angle)*speed, sinf(angle)*speed, emitter.lifetime, emitter.color))
+                return;
+        }
+    }
+}
+
+ParticleView::ParticleView()
+    : zone(nullptr), mode(ParticleBlendMode::Additive), splats(nullptr), count(0), bounds{0, 0, 0, 0},
+      cellColumns(0), cellRows(0), cellFirstSplats(nullptr), cellSplats(nullptr)
+{
+}
+
+bool ParticleView::begin(MemoryZone *theZone, const ParticleSystem &system, ParticleBlendMode::Mode theMode, float scrollX, float scrollY)
+{
+    zone = theZone;
+    mode = theMode;
+    count = 0;
+    bounds = FramebufferRect{0, 0, 0, 0};
+    cellColumns = 0;
+    cellRows = 0;
+    cellFirstSplats = nullptr;
+    cellSplats = nullptr;
+    splats = allocateUninitializedArray<Splat> (zone, system.getParticleCount());
+    if(!splats)
+        return false;
+
+    // Every particle is written, and the index only advances past the ones
+    // that fit in the coordinates of the splats, which avoids a branch per
+    // particle. The framebuffer culls the rest in prepare. The bounds take
+    // the invisible particles as the opposite corners, without branches too.
+    auto minX = 65536.0f;
+    auto minY = 65536.0f;
+    auto maxX = 0.0f;
+    auto maxY = 0.0f;
+    auto positionsX = system.getPositionsX();
+    auto positionsY = system.getPositionsY();
+    auto colors = system.getColors();
+#ifdef PARTICLE_SYSTEM_HAS_SSE2
+    // The bounds of four lanes are kept apart, so they are not a chain of
+    // dependent instructions per particle.
+    auto scrollsX = _mm_set1_ps(scrollX);
+    auto scrollsY = _mm_set1_ps(scrollY);
+    auto zero = _mm_setzero_ps();
+    auto limit = _mm_set1_ps(65536.0f);
+    auto minimumsX = limit;
+    auto minimumsY = limit;
+    auto maximumsX = zero;
+    auto maximumsY = zero;
+#endif
+    for(uint32_t batch = 0; batch < system.getBatchCount(); ++batch)
+    {
+        auto begin = batch*ParticleBatchSize;
+        auto end = begin + system.getBatchParticleCount(batch);
+        auto i = begin;
+#ifdef PARTICLE_SYSTEM_HAS_SSE2
+        for(; i + 4 <= end; i += 4)
+        {
+            auto x = _mm_sub_ps(_mm_load_ps(positionsX + i), scrollsX);
+            auto y = _mm_sub_ps(_mm_load_ps(positionsY + i), scrollsY);
+            auto visibleMask = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(x, zero), _mm_cmplt_ps(x, limit)),
+                _mm_and_ps(_mm_cmpge_ps(y, zero), _mm_cmplt_ps(y, limit)));
+            auto visibleX = _mm_and_ps(visibleMask, x);
+            auto visibleY = _mm_and_ps(visibleMask, y);
+            minimumsX = _mm_min_ps(minimumsX, _mm_or_ps(visibleX, _mm_andnot_ps(visibleMask, limit)));
+            minimumsY = _mm_min_ps(minimumsY, _mm_or_ps(visibleY, _mm_andnot_ps(visibleMask, limit)));
+            maximumsX = _mm_max_ps(maximumsX, visibleX);
+            maximumsY = _mm_max_ps(maximumsY, visibleY);
+
+            alignas(16) int32_t lanesX[4];
+            alignas(16) int32_t lanesY[4];
+            _mm_store_si128(reinterpret_cast<__m128i*> (lanesX), _mm_cvttps_epi32(visibleX));
+            _mm_store_si128(reinterpret_cast<__m128i*> (lanesY), _mm_cvttps_epi32(visibleY));
+            auto visibleLanes = _mm_movemask_ps(visibleMask);
+            for(uint32_t lane = 0; lane < 4; ++lane)
+            {
+                auto &splat = splats[count];
+                splat.x = uint16_t(lanesX[lane]);
+                splat.y = uint16_t(lanesY[lane]);
+                splat.color = colors[i + lane];
+                count += (visibleLanes >> lane) & 1;
+            }
+        }
+#endif
+
+        for(; i < end; ++i)
+        {
+            auto x = positionsX[i] - scrollX;
+            auto y = positionsY[i] - scrollY;
+            auto isVisible = x >= 0.0f && x < 65536.0f && y >= 0.0f && y < 65536.0f;
+            auto &splat = splats[count];
+            splat.x = isVisible ? uint16_t(x) : 0;
+            splat.y = isVisible ? uint16_t(y) : 0;
+            splat.color = colors[i];
+            minX = std::min(minX, isVisible ? x : 65536.0f);
+            minY = std::min(minY, isVisible ? y : 65536.0f);
+            maxX = std::max(maxX, isVisible ? x : 0.0f);
+            maxY = std::max(maxY, isVisible ? y : 0.0f);
+            count += isVisible ? 1 : 0;
+        }
+    }
+
+#ifdef PARTICLE_SYSTEM_HAS_SSE2
+    alignas(16) float lanes[4][4];
+    _mm_store_ps(lanes[0], minimumsX);
+    _mm_store_ps(lanes[1], minimumsY);
+    _mm_store_ps(lanes[2], maximumsX);
+    _mm_store_ps(lanes[3], maximumsY);
+    for(uint32_t lane = 0; lane < 4; ++lane)
+    {
+        minX = std::min(minX, lanes[0][lane]);
+        minY = std::min(minY, lanes[1][lane]);
+        maxX = std::max(maxX, lanes[2][lane]);
+        maxY = std::max(maxY, lanes[3][lane]);
+    }
+#endif
+
+    if(count > 0)
+    {
+        auto boundsX = uint32_t(minX);
+        auto boundsY = uint32_t(minY);
+        bounds = FramebufferRect{boundsX, boundsY, uint32_t(maxX) - boundsX + 1, uint32_t(maxY) - boundsY + 1};
+    }
+    return true;
+}
+
+void ParticleView::prepare(const Framebuffer &framebuffer)
+{
+    cellColumns = (framebuffer.width + FramebufferTileSize - 1) / FramebufferTileSize;
+    cellRows = (framebuffer.height + FramebufferTileSize - 1) / FramebufferTileSize;
+    auto cellCount = cellColumns*cellRows;
+    cellFirstSplats = zone->allocateArray<uint32_t> (cellCount + 1);
+    if(count == 0 || !cellFirstSplats)
+        return;
+
+    // The splats are counted per cell and then filled in, like the sprites
+    // of SpriteBatch, so a tile reads its splats from a single range. The
+    // splats outside of the framebuffer count in an extra cell at the end.
+    auto cellCursors = zone->allocateArray<uint32_t> (cellCount + 1);
+    if(!cellCursors)
+        return;
+
+    // The splats are in the coordinates of the full resolution.
+    if(framebuffer.scale != 1.0f)
+    {
+        auto scale = framebuffer.scale;
+        for(uint32_t i = 0; i < count; ++i)
+        {
+            splats[i].x = uint16_t(float(splats[i].x)*scale);
+            splats[i].y = uint16_t(float(splats[i].y)*scale);
+        }
+    }
+
+    // The sizes are copied, since the stores into the counts could alias them.
+    auto width = framebuffer.width;
+    auto height = framebuffer.height;
+    auto columns = cellColumns;
+    auto getCell = [=](const Splat &splat) {
+        if(splat.x >= width || splat.y >= height)
+            return cellCount;
+        return (splat.y / FramebufferTileSize)*columns + splat.x / FramebufferTileSize;
+    };
+
+    auto splatCount = count;
+    for(uint32_t i = 0; i < splatCount; ++i)
+        ++cellCursors[getCell(splats[i])];
+
+    uint32_t binnedCount = 0;
+    for(uint32_t cell = 0; cell < cellCount; ++cell)
+    {
+        cellFirstSplats[cell] = binnedCount;
+        binnedCount += cellCursors[cell];
+        cellCursors[cell] = cellFirstSplats[cell];
+    }
+    cellFirstSplats[cellCount] = binnedCount;
+    cellCursors[cellCount] = binnedCount;
+
+    cellSplats = allocateUninitializedArray<Splat> (zone, count);
+    if(!cellSplats)
+    {
+        memset(cellFirstSplats, 0, sizeof(uint32_t)*(cellCount + 1));
+        return;
+    }
+
+    auto destSplats = cellSplats;
+    for(uint32_t i = 0; i < splatCount; ++i)
+    {
+        auto &splat = splats[i];
+        destSplats[cellCursors[getCell(splat)]++] = splat;
+    }
+}
+
+void ParticleView::renderTile(const Framebuffer &framebuffer, const FramebufferTile &tile) const
+{
+    if(!cellSplats || tile.isEmpty())
+        return;
+
+    auto firstColumn = tile.x / FramebufferTileSize;
+    auto lastColumn = std::min((tile.x + tile.width - 1) / FramebufferTileSize, cellColumns - 1);
+    auto firstRow = tile.y / FramebufferTileSize;
+    auto lastRow = std::min((tile.y + tile.height - 1) / FramebufferTileSize, cellRows - 1);
+    auto clipRect = BlitClipRect::forTile(tile);
+    for(auto row = firstRow; row <= lastRow; ++row)
+    {
+        for(auto column = firstColumn; column <= lastColumn; ++column)
+            renderCell(framebuffer, row*cellColumns + column, clipRect);
+    }
+}
+
+void ParticleView::renderCell(const Framebuffer &framebuffer, uint32_t cellIndex, const BlitClipRect &clipRect) const
+{
+    auto begin = cellFirstSplats[cellIndex];
+    auto end = cellFirstSplats[cellIndex + 1];
+
+    // A cell is always inside of the tile of the host, but a tile that only
+    // covers the dirty part of a cell clips its splats.
+    if(mode == ParticleBlendMode::Additive)
+    {
+        for(auto i = begin; i < end; ++i)
+        {
+            auto &splat = cellSplats[i];
+            if(splat.x < clipRect.minX || splat.x >= clipRect.maxX || splat.y < clipRect.minY || splat.y >= clipRect.maxY)
+                continue;
+
+            auto pixel = framebuffer.getRow(splat.y) + splat.x;
+            *pixel = FramebufferFormat::add(*pixel, splat.color);
+        }
+    }
+    else
+    {
+        for(auto i = begin; i < end; ++i)
+        {
+            auto &splat = cellSplats[i];
+            if(splat.x < clipRect.minX || splat.x >= clipRect.maxX || splat.y < clipRect.minY || splat.y >= clipRect.maxY)
+                continue;
+
+            auto pixel = framebuffer.getRow(splat.y) + splat.x;
+            *pixel = FramebufferFormat::blend(*pixel, splat.color);
+        }
+    }
+}
@@ -0,0 +1,233 @@
+#ifndef SIMPLE_GAME_TEMPLATE_PARTICLE_SYSTEM_HPP
+#define SIMPLE_GAME_TEMPLATE_PARTICLE_SYSTEM_HPP
+
+#include "Blitter.hpp"
+#include "HostInterface.hpp"
+#include "MemoryZone.hpp"
+#include "OffsetPointer.hpp"
+
+// The particles are kept in batches of this many, and a job of the worker
+// threads updates a batch.
+static constexpr uint32_t ParticleBatchSize = 8192;
+
+// The columns start at cache lines, for the vector loads.
+static constexpr size_t ParticleColumnAlignment = 64;
+
+namespace ParticleBlendMode
+{
+
+enum Mode
+{
+    // Adds the color of the particle to the framebuffer, with saturation,
+    // for sparks and fire.
+    Additive = 0,
+
+    // Blends the color of the particle by using its alpha, for smoke and dust.
+    AlphaBlend,
+};
+
+}
+
+struct ParticleEmitter
+{
+    float x;
+    float y;
+
+    // Particles per second. The fractions of a particle carry over to the
+    // next updates.
+    float rate;
+    float accumulator;
+
+    // The particles leave in a random direction inside of the spread, which
+    // is in radians around the direction, with a random speed in the range.
+    float direction;
+    float spread;
+    float minSpeed;
+    float maxSpeed;
+
+    // In seconds.
+    float lifetime;
+
+    // ABGR8888.
+    uint32_t color;
+
+    bool isActive;
+};
+
+/**
+ * Particles stored as a column per field in the persistent memory. The
+ * columns are divided into batches of ParticleBatchSize, whose live particles
+ * are packed at the beginning of the batch, so a batch is updated in a
+ * single pass that integrates four particles at a time and moves the
+ * survivors over the dead ones. The batches are updated by the worker
+ * threads of the host, and they never move particles between each other, so
+ * nothing is allocated or copied across the whole system.
+ *
+ * The emission uses a random generator of the system, so the particles are
+ * the same when the inputs are replayed, whatever the number of threads is.
+ * Like EntityStore, the system only has OffsetPointers.
+ */
+class ParticleSystem
+{
+public:
+    static constexpr uint32_t InvalidEmitter = ~0u;
+
+    // The number of bytes that initialize needs. The capacity of the
+    // particles is rounded up to the batches.
+    static size_t getStorageSize(uint32_t particleCapacity, uint32_t emitterCapacity);
+
+    // The storage must be aligned to ParticleColumnAlignment.
+    bool initialize(uint8_t *storage, uint32_t theParticleCapacity, uint32_t theEmitterCapacity, uint32_t randomSeed = 1);
+
+    bool isInitialized() const
+    {
+        return particleCapacity > 0;
+    }
+
+    // Returns InvalidEmitter when every emitter is used. The emitters keep
+    // their index until they are removed, and they can be changed through
+    // getEmitter.
+    uint32_t addEmitter(const ParticleEmitter &emitter);
+    void removeEmitter(uint32_t index);
+
+    ParticleEmitter &getEmitter(uint32_t index)
+    {
+        return emitters[index];
+    }
+
+    // A single particle, such as for a burst. Returns false when the system
+    // is full.
+    bool emit(float x, float y, float velocityX, float velocityY, float lifetime, uint32_t color);
+
+    // Moves the particles and removes the ones that expired, in parallel
+    // through the host, and then lets the emitters add the new particles.
+    void update(HostInterface *host, float delta, float gravityX, float gravityY);
+
+    uint32_t getParticleCount() const
+    {
+        return particleCount;
+    }
+
+    uint32_t getParticleCapacity() const
+    {
+        return particleCapacity;
+    }
+
+    // The particles of a batch are its first getBatchParticleCount elements
+    // of the columns, starting at batch*ParticleBatchSize.
+    uint32_t getBatchCount() const
+    {
+        return batchCount;
+    }
+
+    uint32_t getBatchParticleCount(uint32_t batch) const
+    {
+        return batchParticleCounts[batch];
+    }
+
+    const float *getPositionsX() const
+    {
+        return positionsX.get();
+    }
+
+    const float *getPositionsY() const
+    {
+        return positionsY.get();
+    }
+
+    const uint32_t *getColors() const
+    {
+        return colors.get();
+    }
+
+private:
+    struct UpdateJob;
+
+    static void updateBatch(void *userData, size_t batch);
+
+    void emitFromEmitters(float delta);
+    float nextRandom();
+
+    uint32_t particleCapacity;
+    uint32_t particleCount;
+    uint32_t batchCount;
+
+    // The first batch that may have room for new particles.
+    uint32_t firstOpenBatch;
+
+    uint32_t emitterCapacity;
+    uint32_t emitterCount;
+    uint32_t randomState;
+
+    OffsetPointer<float> positionsX;
+    OffsetPointer<float> positionsY;
+    OffsetPointer<float> velocitiesX;
+    OffsetPointer<float> velocitiesY;
+    OffsetPointer<float> remainingLifetimes;
+    OffsetPointer<uint32_t> colors;
+    OffsetPointer<uint32_t> batchParticleCounts;
+    OffsetPointer<ParticleEmitter> emitters;
+};
+
+/**
+ * The particles of a frame, as they are drawn. The visible particles are
+ * copied into the zone of the render snapshot, and binned into the tiles of
+ * the framebuffer before the tiles are rendered. A particle covers a single
+ * pixel, and the larger ones are better drawn as sprites.
+ */
+class ParticleView
+{
+public:
+    ParticleView();
+
+    // The particles are drawn at their position minus the scroll. The zone
+    // must stay untouched until the frame is rendered, such as the zone of
+    // the render snapshot.
+    bool begin(MemoryZone *theZone, const ParticleSystem &system, ParticleBlendMode::Mode theMode, float scrollX, float scrollY);
+
+    // Scales the particles to the framebuffer, and culls and bins them.
+    // Called once, from GameInterface::render.
+    void prepare(const Framebuffer &framebuffer);
+
+    // Draws the particles inside of the tile. Called concurrently from
+    // GameInterface::renderTile, after prepare.
+    void renderTile(const Framebuffer &framebuffer, const FramebufferTile &tile) const;
+
+    uint32_t getVisibleParticleCount() const
+    {
+        return count;
+    }
+
+    // The rectangle that holds the visible particles, in the coordinates of
+    // the full resolution, which is empty without particles. A game marks it
+    // dirty with the one of the previous frame, instead of the whole
+    // framebuffer.
+    FramebufferRect getBounds() const
+    {
+        return bounds;
+    }
+
+private:
+    struct Splat
+    {
+        uint16_t x;
+        uint16_t y;
+        uint32_t color;
+    };
+
+    void renderCell(const Framebuffer &framebuffer, uint32_t cellIndex, const BlitClipRect &clipRect) const;
+
+    MemoryZone *zone;
+    ParticleBlendMode::Mode mode;
+    Splat *splats;
+    uint32_t count;
+    FramebufferRect bounds;
+
+    // The result of prepare, like in SpriteBatch.
+    uint32_t cellColumns;
+    uint32_t cellRows;
+    uint32_t *cellFirstSplats;
+    Splat *cellSplats;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_PARTICLE_SYSTEM_HPP
@@ -0,0 +1,185 @@
+#include "PersistentMemoryFile.hpp"
+#include <stdio.h>
+
+static constexpr char PersistentMemoryMagic[8] = {'S', 'G', 'T', 'P', 'M', 'E', 'M', '\0'};
+static constexpr uint32_t PersistentMemoryFormatVersion = 1;
+
+void PersistentMemoryHeader::initialize(uint64_t theLayoutVersion, uint64_t theZoneSize)
+{
+    memcpy(magic, PersistentMemoryMagic, sizeof(magic));
+    formatVersion = PersistentMemoryFormatVersion;
+    headerSize = PersistentMemoryHeaderSize;
+    layoutVersion = theLayoutVersion;
+    zoneSize = theZoneSize;
+}
+
+bool PersistentMemoryHeader::isCompatible(uint64_t expectedLayoutVersion, uint64_t expectedZoneSize) const
+{
+    return memcmp(magic, PersistentMemoryMagic, sizeof(magic)) == 0 &&
+        formatVersion == PersistentMemoryFormatVersion &&
+        headerSize == PersistentMemoryHeaderSize &&
+        layoutVersion == expectedLayoutVersion &&
+        zoneSize == expectedZoneSize;
+}
+
+PersistentMemoryFile::PersistentMemoryFile()
+    : zoneSize(0)
+{
+}
+
+PersistentMemoryFile::~PersistentMemoryFile()
+{
+    close();
+}
+
+bool PersistentMemoryFile::open(const char *fileName, size_t theZoneSize)
+{
+    close();
+    if(!VirtualMemory::mapFile(fileName, PersistentMemoryHeaderSize + theZoneSize, mappedFile))
+    {
+        fprintf(stderr, "Failed to map the persistent memory file %s\n", fileName);
+        return false;
+    }
+
+    zoneSize = theZoneSize;
+    return true;
+}
+
+void PersistentMemoryFile::close()
+{
+    if(!isOpen())
+        return;
+
+    VirtualMemory::flushMappedFile(mappedFile, true);
+    VirtualMemory::unmapFile(mappedFile);
+}
+
+bool PersistentMemoryFile::validateLayout(uint64_t layoutVersion)
+{
+    auto header = reinterpret_cast<PersistentMemoryHeader*> (mappedFile.data);
+    if(header->isCompatible(layoutVersion, zoneSize))
+        return true;
+
+    memset(getZoneData(), 0, zoneSize);
+    header->initialize(layoutVersion, zoneSize);
+    return false;
+}
+
+void PersistentMemoryFile::flushAsync()
+{
+    if(isOpen())
+        VirtualMemory::flushMappedFile(mappedFile, false);
+}
+
+SaveSlotWriter::SaveSlotWriter()
+    : busy(false), stagingBufferSize(0)
+{
+}
+
+SaveSlotWriter::~SaveSlotWriter()
+{
+    wait();
+}
+
+bool SaveSlotWriter::isBusy() const
+{
+    return busy.load();
+}
+
+void SaveSlotWriter::wait()
+{
+    if(writerThread.joinable())
+        writerThread.join();
+}
+
+bool SaveSlotWriter::save(const char *fileName, const MemoryZone &zone, uint64_t layoutVersion)
+{
+    if(isBusy())
+        return false;
+    wait();
+
+    // Only the copy into the staging buffer happens in the calling thread.
+    auto requiredSize = PersistentMemoryHeaderSize + zone.getSize();
+    if(stagingBufferSize != requiredSize)
+    {
+        stagingBuffer.reset(new uint8_t[requiredSize]());
+        stagingBufferSize = requiredSize;
+    }
+
+    auto header = reinterpret_cast<PersistentMemoryHeader*> (stagingBuffer.get());
+    header->initialize(layoutVersion, zone.getSize());
+    memcpy(stagingBuffer.get() + PersistentMemoryHeaderSize, zone.getData(), zone.getSize());
+    stagingFileName = fileName;
+
+    busy = true;
+#ifdef __EMSCRIPTEN__
+    writeStagingBuffer();
+#else
+    writerThread = std::thread([this]() { writeStagingBuffer(); });
+#endif
+    return true;
+}
+
+void SaveSlotWriter::writeStagingBuffer()
+{
+    // Write into a temporary file first, so that a crash never leaves a
+    // partially written save slot.
+    auto temporaryFileName = stagingFileName + ".tmp";
+    auto file = fopen(temporaryFileName.c_str(), "wb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open save slot %s for writing\n", temporaryFileName.c_str());
+        busy = false;
+        return;
+    }
+
+    auto written = fwrite(stagingBuffer.get(), 1, stagingBufferSize, file);
+    auto closed = fclose(file) == 0;
+    if(written != stagingBufferSize || !closed)
+    {
+        fprintf(stderr, "Failed to write save slot %s\n", temporaryFileName.c_str());
+        remove(temporaryFileName.c_str());
+        busy = false;
+        return;
+    }
+
+#ifdef _WIN32
+    remove(stagingFileName.c_str());
+#endif
+    if(rename(temporaryFileName.c_str(), stagingFileName.c_str()) != 0)
+        fprintf(stderr, "Failed to replace save slot %s\n", stagingFileName.c_str());
+
+    busy = false;
+}
+
+bool loadSaveSlot(const char *fileName, MemoryZone &zone, uint64_t layoutVersion)
+{
+    auto file = fopen(fileName, "rb");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to open save slot %s\n", fileName);
+        return false;
+    }
+
+    PersistentMemoryHeader header;
+    if(fread(&header, sizeof(header), 1, file) != 1 || !header.isCompatible(layoutVersion, zone.getSize()))
+    {
+        fprintf(stderr, "Save slot %s was written by an incompatible build\n", fileName);
+        fclose(file);
+        return false;
+    }
+
+    // Check the size before reading, so that the zone is never left with a
+    // partially loaded state.
+    if(fseek(file, 0, SEEK_END) != 0 || ftell(file) < long(PersistentMemoryHeaderSize + zone.getSize()))
+    {
+        fprintf(stderr, "Save slot %s is truncated\n", fileName);
+        fclose(file);
+        return false;
+    }
+
+    auto success = fseek(file, PersistentMemoryHeaderSize, SEEK_SET) == 0 &&
+        fread(zone.getData(), 1, zone.getSize(), file) == zone.getSize();
+    fclose(file);
+    return success;
+}
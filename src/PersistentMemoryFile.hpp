@@ -0,0 +1,93 @@
+#ifndef SIMPLE_GAME_TEMPLATE_PERSISTENT_MEMORY_FILE_HPP
+#define SIMPLE_GAME_TEMPLATE_PERSISTENT_MEMORY_FILE_HPP
+
+#include "MemoryZone.hpp"
+#include "VirtualMemory.hpp"
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+// The header occupies a full page, so that the zone is page aligned.
+static constexpr size_t PersistentMemoryHeaderSize = 4096;
+
+/**
+ * The header of the files that hold the persistent memory. A file is only
+ * accepted when it was written with the same layout version of the game
+ * state and the same zone size.
+ */
+struct PersistentMemoryHeader
+{
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t headerSize;
+    uint64_t layoutVersion;
+    uint64_t zoneSize;
+
+    void initialize(uint64_t theLayoutVersion, uint64_t theZoneSize);
+    bool isCompatible(uint64_t expectedLayoutVersion, uint64_t expectedZoneSize) const;
+};
+
+/**
+ * Maps the persistent memory zone from a file, so that the game state
+ * survives quitting or crashing and the game resumes where it was left.
+ */
+class PersistentMemoryFile
+{
+public:
+    PersistentMemoryFile();
+    ~PersistentMemoryFile();
+
+    bool open(const char *fileName, size_t zoneSize);
+    void close();
+
+    bool isOpen() const
+    {
+        return mappedFile.data != nullptr;
+    }
+
+    uint8_t *getZoneData() const
+    {
+        return mappedFile.data + PersistentMemoryHeaderSize;
+    }
+
+    // Returns true when the file holds a state with the same layout. Otherwise
+    // the zone is cleared, and the header is written for the new layout.
+    bool validateLayout(uint64_t layoutVersion);
+
+    // Schedules writing back the modified pages, without waiting for them.
+    void flushAsync();
+
+private:
+    VirtualMemory::MappedFile mappedFile;
+    size_t zoneSize;
+};
+
+/**
+ * Writes copies of the persistent memory into save slot files from a
+ * background thread, so that saving does not stall the frame.
+ */
+class SaveSlotWriter
+{
+public:
+    SaveSlotWriter();
+    ~SaveSlotWriter();
+
+    // Returns false when the previous save is still being written.
+    bool save(const char *fileName, const MemoryZone &zone, uint64_t layoutVersion);
+    bool isBusy() const;
+    void wait();
+
+private:
+    void writeStagingBuffer();
+
+    std::thread writerThread;
+    std::atomic<bool> busy;
+    std::string stagingFileName;
+    std::unique_ptr<uint8_t[]> stagingBuffer;
+    size_t stagingBufferSize;
+};
+
+bool loadSaveSlot(const char *fileName, MemoryZone &zone, uint64_t layoutVersion);
+
+#endif //SIMPLE_GAME_TEMPLATE_PERSISTENT_MEMORY_FILE_HPP
@@ -0,0 +1,206 @@
+#ifndef SIMPLE_GAME_TEMPLATE_PIXEL_FORMAT_HPP
+#define SIMPLE_GAME_TEMPLATE_PIXEL_FORMAT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace PixelFormat
+{
+
+enum Type
+{
+    ABGR8888 = 0,
+    RGB565,
+
+    // An index into the fixed palette of PixelFormatIndexed8.
+    Indexed8,
+};
+
+}
+
+// Exact rounded division by 255 of a value that fits in 16 bits.
+inline uint32_t divideBy255(uint32_t value)
+{
+    value += 128;
+    return (value + (value >> 8)) >> 8;
+}
+
+// Blends an ABGR8888 pixel on top of another one by using its alpha, the same
+// as BlitMode::AlphaBlend.
+inline uint32_t blendPixel(uint32_t dest, uint32_t source)
+{
+    auto alpha = source >> 24;
+    if(alpha == 0xff)
+        return source;
+    if(alpha == 0)
+        return dest;
+
+    // The source alpha channel is treated as 255 so that the result alpha is
+    // the usual alpha + destAlpha*(1 - alpha).
+    auto inverseAlpha = 255 - alpha;
+    source |= 0xff000000;
+    uint32_t result = 0;
+    for(uint32_t shift = 0; shift < 32; shift += 8)
+    {
+        auto s = (source >> shift) & 0xff;
+        auto d = (dest >> shift) & 0xff;
+        result |= divideBy255(s*alpha + d*inverseAlpha) << shift;
+    }
+
+    return result;
+}
+
+// Adds the channels of two ABGR8888 pixels, saturating each of them at 255.
+// The high bits of the channels are added separately, so no carry crosses a
+// channel.
+inline uint32_t addPixelSaturated(uint32_t dest, uint32_t source)
+{
+    auto highBits = (dest ^ source) & 0x80808080u;
+    auto carries = dest & source & 0x80808080u;
+    auto sum = (dest & 0x7f7f7f7fu) + (source & 0x7f7f7f7fu);
+    carries |= highBits & sum;
+    auto saturated = (carries << 1) - (carries >> 7);
+    return (sum ^ highBits) | saturated;
+}
+
+/**
+ * The pixel formats of the framebuffer. The colors of the game and the
+ * pixels of the images are ABGR8888, and every format converts from and to
+ * it. The blending of the narrower formats goes through ABGR8888, so they
+ * save memory bandwidth rather than arithmetic.
+ */
+struct PixelFormatABGR8888
+{
+    typedef uint32_t Pixel;
+    static constexpr PixelFormat::Type Id = PixelFormat::ABGR8888;
+
+    static Pixel fromABGR8888(uint32_t color)
+    {
+        return color;
+    }
+
+    static uint32_t toABGR8888(Pixel pixel)
+    {
+        return pixel;
+    }
+
+    static Pixel blend(Pixel dest, uint32_t color)
+    {
+        return blendPixel(dest, color);
+    }
+
+    static Pixel add(Pixel dest, uint32_t color)
+    {
+        return addPixelSaturated(dest, color);
+    }
+};
+
+// Red in the high bits, without alpha.
+struct PixelFormatRGB565
+{
+    typedef uint16_t Pixel;
+    static constexpr PixelFormat::Type Id = PixelFormat::RGB565;
+
+    static Pixel fromABGR8888(uint32_t color)
+    {
+        return Pixel(((color & 0xf8) << 8) | ((color >> 5) & 0x7e0) | ((color >> 19) & 0x1f));
+    }
+
+    // The high bits are repeated in the low bits, so white stays white.
+    static uint32_t toABGR8888(Pixel pixel)
+    {
+        uint32_t red = (pixel >> 11) & 0x1f;
+        uint32_t green = (pixel >> 5) & 0x3f;
+        uint32_t blue = pixel & 0x1f;
+        red = (red << 3) | (red >> 2);
+        green = (green << 2) | (green >> 4);
+        blue = (blue << 3) | (blue >> 2);
+        return 0xff000000 | (blue << 16) | (green << 8) | red;
+    }
+
+    static Pixel blend(Pixel dest, uint32_t color)
+    {
+        return fromABGR8888(blendPixel(toABGR8888(dest), color));
+    }
+
+    static Pixel add(Pixel dest, uint32_t color)
+    {
+        return fromABGR8888(addPixelSaturated(toABGR8888(dest), color));
+    }
+};
+
+// The palette is fixed to 3 bits of red, 3 of green and 2 of blue, so a color
+// is converted into an index without searching the palette.
+struct PixelFormatIndexed8
+{
+    typedef uint8_t Pixel;
+    static constexpr PixelFormat::Type Id = PixelFormat::Indexed8;
+
+    static Pixel fromABGR8888(uint32_t color)
+    {
+        return Pixel((color & 0xe0) | ((color >> 11) & 0x1c) | ((color >> 22) & 0x03));
+    }
+
+    static uint32_t toABGR8888(Pixel pixel)
+    {
+        uint32_t red = pixel >> 5;
+        uint32_t green = (pixel >> 2) & 0x7;
+        uint32_t blue = pixel & 0x3;
+        red = (red << 5) | (red << 2) | (red >> 1);
+        green = (green << 5) | (green << 2) | (green >> 1);
+        blue *= 0x55;
+        return 0xff000000 | (blue << 16) | (green << 8) | red;
+    }
+
+    static Pixel blend(Pixel dest, uint32_t color)
+    {
+        return fromABGR8888(blendPixel(toABGR8888(dest), color));
+    }
+
+    static Pixel add(Pixel dest, uint32_t color)
+    {
+        return fromABGR8888(addPixelSaturated(toABGR8888(dest), color));
+    }
+};
+
+/**
+ * Typed access to the rows of pixels of a surface in the format.
+ */
+template<typename Format>
+struct SurfaceView
+{
+    typedef typename Format::Pixel Pixel;
+
+    uint32_t width;
+    uint32_t height;
+    int pitch;
+    uint8_t *pixels;
+
+    Pixel *getRow(uint32_t y) const
+    {
+        return reinterpret_cast<Pixel*> (pixels + ptrdiff_t(y)*pitch);
+    }
+};
+
+// Fills a rectangle, which must be inside of the surface, with an ABGR8888
+// color.
+template<typename Format>
+void fillSurfaceRect(const SurfaceView<Format> &surface, uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t color)
+{
+    auto pixel = Format::fromABGR8888(color);
+    for(uint32_t row = y; row < y + height; ++row)
+    {
+        auto dest = surface.getRow(row) + x;
+        for(uint32_t i = 0; i < width; ++i)
+            dest[i] = pixel;
+    }
+}
+
+template<typename SourceFormat, typename DestFormat>
+void convertPixelRow(typename DestFormat::Pixel *dest, const typename SourceFormat::Pixel *source, uint32_t count)
+{
+    for(uint32_t i = 0; i < count; ++i)
+        dest[i] = DestFormat::fromABGR8888(SourceFormat::toABGR8888(source[i]));
+}
+
+#endif //SIMPLE_GAME_TEMPLATE_PIXEL_FORMAT_HPP
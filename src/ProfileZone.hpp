@@ -0,0 +1,63 @@
+#ifndef SIMPLE_GAME_TEMPLATE_PROFILE_ZONE_HPP
+#define SIMPLE_GAME_TEMPLATE_PROFILE_ZONE_HPP
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#define PROFILER_CLOCK_IS_TSC
+#else
+#include <chrono>
+#endif
+
+// A cheap timestamp for the profiler. The host converts it to time by
+// comparing it with the steady clock.
+inline uint64_t readProfilerClock()
+{
+#ifdef PROFILER_CLOCK_IS_TSC
+    return __rdtsc();
+#else
+    return uint64_t(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+/**
+ * Measures a scope, and records it as an event of a profile zone with the
+ * recordProfileZone method of the recorder.
+ */
+template<typename Recorder>
+class ProfileZoneScope
+{
+public:
+    ProfileZoneScope(Recorder *theRecorder, uint32_t theZoneId)
+        : recorder(theRecorder), zoneId(theZoneId), startTime(readProfilerClock())
+    {
+    }
+
+    ~ProfileZoneScope()
+    {
+        recorder->recordProfileZone(zoneId, startTime, readProfilerClock());
+    }
+
+private:
+    ProfileZoneScope(const ProfileZoneScope&) = delete;
+    ProfileZoneScope &operator=(const ProfileZoneScope&) = delete;
+
+    Recorder *recorder;
+    uint32_t zoneId;
+    uint64_t startTime;
+};
+
+#define PROFILE_ZONE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_ZONE_CONCAT(a, b) PROFILE_ZONE_CONCAT_IMPL(a, b)
+
+// Profiles the rest of the scope. The zone is registered once per call site.
+#define PROFILE_ZONE_WITH_RECORDER(RecorderType, recorder, name) \
+    static const uint32_t PROFILE_ZONE_CONCAT(profileZoneId, __LINE__) = (recorder)->registerProfileZone(name); \
+    ProfileZoneScope<RecorderType> PROFILE_ZONE_CONCAT(profileZoneScope, __LINE__) ((recorder), PROFILE_ZONE_CONCAT(profileZoneId, __LINE__))
+
+#endif //SIMPLE_GAME_TEMPLATE_PROFILE_ZONE_HPP
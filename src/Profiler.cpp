@@ -0,0 +1,255 @@
+#include "Profiler.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+
+struct ProfilerEvent
+{
+    // The fields are atomic, so that a trace can be read while the ring
+    // buffer is written. The relaxed stores are plain stores.
+    std::atomic<uint64_t> startTime;
+    std::atomic<uint64_t> endTime;
+    std::atomic<uint32_t> zoneId;
+};
+
+struct ProfilerThreadBuffer
+{
+    uint32_t threadIndex;
+    std::string name;
+    std::unique_ptr<ProfilerEvent[]> events;
+    std::atomic<uint64_t> writeCount;
+
+    // The events before it were summed up by Profiler::collectZoneTimes.
+    uint64_t collectedCount;
+};
+
+namespace
+{
+
+struct ProfilerEventCopy
+{
+    uint64_t startTime;
+    uint64_t endTime;
+    uint32_t zoneId;
+};
+
+thread_local ProfilerThreadBuffer *currentThreadBuffer;
+
+double getSteadyMilliseconds()
+{
+    return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Copies the events that are still in the ring buffer, starting at an index.
+// Returns the index after the last copied event.
+uint64_t copyEvents(ProfilerThreadBuffer &buffer, uint64_t firstIndex, std::vector<ProfilerEventCopy> &events)
+{
+    auto capacity = uint64_t(Profiler::ThreadEventCapacity);
+    auto endIndex = buffer.writeCount.load(std::memory_order_acquire);
+    auto beginIndex = std::max(firstIndex, endIndex > capacity ? endIndex - capacity : 0);
+    auto firstCopy = events.size();
+    for(auto i = beginIndex; i < endIndex; ++i)
+    {
+        auto &event = buffer.events[i & (capacity - 1)];
+        events.push_back(ProfilerEventCopy{event.startTime.load(std::memory_order_relaxed),
+            event.endTime.load(std::memory_order_relaxed), event.zoneId.load(std::memory_order_relaxed)});
+    }
+
+    // The thread may have overwritten the oldest events while they were
+    // copied, including the one that it is writing now.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    auto newEndIndex = buffer.writeCount.load(std::memory_order_relaxed) + 1;
+    if(newEndIndex > beginIndex + capacity)
+    {
+        auto overwrittenCount = std::min(size_t(newEndIndex - capacity - beginIndex), events.size() - firstCopy);
+        events.erase(events.begin() + firstCopy, events.begin() + firstCopy + overwrittenCount);
+    }
+
+    return endIndex;
+}
+
+void writeJsonString(FILE *file, const char *string)
+{
+    fputc('"', file);
+    for(; *string; ++string)
+    {
+        auto c = *string;
+        if(c == '"' || c == '\\')
+            fprintf(file, "\\%c", c);
+        else if(uint8_t(c) < 0x20)
+            fprintf(file, "\\u%04x", unsigned(c));
+        else
+            fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+}
+
+Profiler Profiler::singleton;
+
+Profiler::Profiler()
+    : startTicks(readProfilerClock()), startMilliseconds(getSteadyMilliseconds())
+{
+}
+
+Profiler::~Profiler()
+{
+}
+
+uint32_t Profiler::registerProfileZone(const char *name)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for(size_t i = 0; i < zoneNames.size(); ++i)
+    {
+        if(zoneNames[i] == name)
+            return uint32_t(i);
+    }
+
+    zoneNames.push_back(name);
+    return uint32_t(zoneNames.size() - 1);
+}
+
+void Profiler::recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime)
+{
+    auto buffer = currentThreadBuffer;
+    if(!buffer)
+        buffer = createThreadBuffer();
+
+    auto index = buffer->writeCount.load(std::memory_order_relaxed);
+    auto &event = buffer->events[index & (ThreadEventCapacity - 1)];
+    event.startTime.store(startTime, std::memory_order_relaxed);
+    event.endTime.store(endTime, std::memory_order_relaxed);
+    event.zoneId.store(zoneId, std::memory_order_relaxed);
+    buffer->writeCount.store(index + 1, std::memory_order_release);
+}
+
+void Profiler::setThreadName(const char *name)
+{
+    auto buffer = currentThreadBuffer;
+    if(!buffer)
+        buffer = createThreadBuffer();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    buffer->name = name;
+}
+
+ProfilerThreadBuffer *Profiler::createThreadBuffer()
+{
+    static_assert((ThreadEventCapacity & (ThreadEventCapacity - 1)) == 0, "The capacity must be a power of two");
+
+    auto buffer = new ProfilerThreadBuffer();
+    buffer->events.reset(new ProfilerEvent[ThreadEventCapacity]);
+    buffer->writeCount.store(0, std::memory_order_relaxed);
+    buffer->collectedCount = 0;
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        buffer->threadIndex = uint32_t(threadBuffers.size());
+        threadBuffers.push_back(std::unique_ptr<ProfilerThreadBuffer> (buffer));
+    }
+
+    currentThreadBuffer = buffer;
+    return buffer;
+}
+
+double Profiler::getTicksPerMillisecond()
+{
+    // A longer interval gives a more precise rate.
+    auto ticks = readProfilerClock();
+    auto milliseconds = getSteadyMilliseconds();
+    while(milliseconds - startMilliseconds < 10.0)
+    {
+        ticks = readProfilerClock();
+        milliseconds = getSteadyMilliseconds();
+    }
+
+    return double(ticks - startTicks) / (milliseconds - startMilliseconds);
+}
+
+bool Profiler::exportChromeTrace(const char *fileName)
+{
+    auto ticksPerMicrosecond = getTicksPerMillisecond() / 1000.0;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<std::vector<ProfilerEventCopy>> threadEvents(threadBuffers.size());
+    auto baseTime = UINT64_MAX;
+    for(size_t i = 0; i < threadBuffers.size(); ++i)
+    {
+        copyEvents(*threadBuffers[i], 0, threadEvents[i]);
+        for(auto &event : threadEvents[i])
+            baseTime = std::min(baseTime, event.startTime);
+    }
+
+    auto file = fopen(fileName, "w");
+    if(!file)
+    {
+        fprintf(stderr, "Failed to write the trace %s\n", fileName);
+        return false;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    auto isFirstEvent = true;
+    for(size_t i = 0; i < threadBuffers.size(); ++i)
+    {
+        auto &buffer = *threadBuffers[i];
+        fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", isFirstEvent ? "" : ",\n", buffer.threadIndex);
+        if(buffer.name.empty())
+            fprintf(file, "\"Thread %u\"", buffer.threadIndex);
+        else
+            writeJsonString(file, buffer.name.c_str());
+        fprintf(file, "}}");
+        isFirstEvent = false;
+
+        for(auto &event : threadEvents[i])
+        {
+            if(event.zoneId >= zoneNames.size())
+                continue;
+
+            fprintf(file, ",\n{\"name\":");
+            writeJsonString(file, zoneNames[event.zoneId].c_str());
+            fprintf(file, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}", buffer.threadIndex,
+                double(event.startTime - baseTime) / ticksPerMicrosecond, double(event.endTime - event.startTime) / ticksPerMicrosecond);
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    auto succeeded = ferror(file) == 0;
+    fclose(file);
+    if(!succeeded)
+    {
+        fprintf(stderr, "Failed to write the trace %s\n", fileName);
+        return false;
+    }
+
+    printf("Wrote the trace %s\n", fileName);
+    return true;
+}
+
+void Profiler::collectZoneTimes(std::vector<ProfileZoneTime> &zoneTimes)
+{
+    auto ticksPerMillisecond = getTicksPerMillisecond();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    std::vector<uint64_t> zoneTicks(zoneNames.size());
+    std::vector<uint32_t> zoneCounts(zoneNames.size());
+    std::vector<ProfilerEventCopy> events;
+    for(auto &buffer : threadBuffers)
+    {
+        events.clear();
+        buffer->collectedCount = copyEvents(*buffer, buffer->collectedCount, events);
+        for(auto &event : events)
+        {
+            if(event.zoneId >= zoneNames.size())
+                continue;
+            zoneTicks[event.zoneId] += event.endTime - event.startTime;
+            ++zoneCounts[event.zoneId];
+        }
+    }
+
+    zoneTimes.clear();
+    for(size_t i = 0; i < zoneNames.size(); ++i)
+    {
+        if(zoneCounts[i] > 0)
+            zoneTimes.push_back(ProfileZoneTime{zoneNames[i], double(zoneTicks[i]) / ticksPerMillisecond, zoneCounts[i]});
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef SIMPLE_GAME_TEMPLATE_PROFILER_HPP
+#define SIMPLE_GAME_TEMPLATE_PROFILER_HPP
+
+#include "ProfileZone.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct ProfilerThreadBuffer;
+
+struct ProfileZoneTime
+{
+    std::string name;
+    double milliseconds;
+    uint32_t count;
+};
+
+/**
+ * Records the profile zones of every thread into a ring buffer per thread.
+ * Recording an event does not take a lock, except for the first event of a
+ * thread, and it costs a few tens of nanoseconds, so the profiler is always
+ * on. The oldest events are overwritten, so a trace covers the last few
+ * seconds.
+ *
+ * There is only one profiler, since the buffer of a thread is found through
+ * a thread local variable.
+ */
+class Profiler
+{
+public:
+    static constexpr size_t ThreadEventCapacity = 32768;
+
+    Profiler();
+    ~Profiler();
+
+    // Any thread. Returns the same identifier for the same name, so that the
+    // zones of a reloaded game logic library keep their identifiers. The name
+    // is copied.
+    uint32_t registerProfileZone(const char *name);
+
+    // Any thread.
+    void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime);
+
+    // Names the calling thread in the traces.
+    void setThreadName(const char *name);
+
+    // Writes the recorded events in the trace event format of Chrome, for
+    // chrome://tracing or Perfetto.
+    bool exportChromeTrace(const char *fileName);
+
+    // Sums up the zones that ended since the previous call. Main thread.
+    void collectZoneTimes(std::vector<ProfileZoneTime> &zoneTimes);
+
+    static Profiler singleton;
+
+private:
+    ProfilerThreadBuffer *createThreadBuffer();
+    double getTicksPerMillisecond();
+
+    std::mutex mutex;
+    std::vector<std::string> zoneNames;
+    std::vector<std::unique_ptr<ProfilerThreadBuffer>> threadBuffers;
+
+    // The clock is calibrated over the whole run.
+    uint64_t startTicks;
+    double startMilliseconds;
+};
+
+// Profiles the rest of the scope in the host.
+#define PROFILE_ZONE(name) PROFILE_ZONE_WITH_RECORDER(Profiler, &Profiler::singleton, name)
+
+#endif //SIMPLE_GAME_TEMPLATE_PROFILER_HPP
@@ -0,0 +1,204 @@
+#include "RenderPipeline.hpp"
+#include "Profiler.hpp"
+#include "TiledRenderer.hpp"
+#include <chrono>
+#include <string.h>
+
+// The lowest scale, as for the dynamic resolution. The tiles divide by the
+// scale, so it cannot be zero.
+static constexpr float MinimumScale = 0.1f;
+
+RenderPipeline::RenderPipeline()
+    : threadPool(nullptr), nextIndex(0), isFullRedrawPending(true), fullWidth(0), fullHeight(0), targetScale(1.0f), presentedRenderTime(0),
+      frameGameInterface(nullptr), frameIndex(0), isFrameFullRedraw(false), isFrameResized(false), isFrameRendering(false),
+      isFrameSubmitted(false), isFrameFinished(false), shuttingDown(false)
+{
+    renderTimes[0] = renderTimes[1] = 0;
+    memset(framebuffers, 0, sizeof(framebuffers));
+    memset(dirtyRegions, 0, sizeof(dirtyRegions));
+    memset(&renderRegion, 0, sizeof(renderRegion));
+}
+
+RenderPipeline::~RenderPipeline()
+{
+    shutdown();
+}
+
+void RenderPipeline::start(WorkerThreadPool *theThreadPool, uint32_t width, uint32_t height, bool pipelined, MemoryZoneBackend::Type backend)
+{
+    shutdown();
+
+    threadPool = theThreadPool;
+    nextIndex = 0;
+    isFullRedrawPending = true;
+    fullWidth = width;
+    fullHeight = height;
+    targetScale = 1.0f;
+    presentedRenderTime = 0;
+    cacheMemory.reserve(RenderCacheMemorySize, backend);
+    for(size_t i = 0; i < 2; ++i)
+    {
+        snapshotMemory[i].reserve(RenderSnapshotMemorySize, backend);
+        framebuffers[i].width = width;
+        framebuffers[i].height = height;
+        framebuffers[i].pitch = int(width*sizeof(FramebufferPixel));
+        framebufferPixels[i].reset(new uint8_t[size_t(framebuffers[i].pitch)*height]());
+        framebuffers[i].pixels = framebufferPixels[i].get();
+        framebuffers[i].scale = 1.0f;
+        framebuffers[i].dirtyRegion = &dirtyRegions[i];
+        dirtyRegions[i].clear();
+    }
+
+    shuttingDown = false;
+#ifdef __EMSCRIPTEN__
+    // Emscripten builds are single threaded.
+    (void)pipelined;
+#else
+    if(pipelined)
+        thread = std::thread([this]() { threadEntry(); });
+#endif
+}
+
+void RenderPipeline::shutdown()
+{
+    finishFrame();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shuttingDown = true;
+    }
+    frameSubmittedCondition.notify_all();
+    if(thread.joinable())
+        thread.join();
+}
+
+MemoryZone *RenderPipeline::beginSnapshot()
+{
+    auto zone = &snapshotMemory[nextIndex];
+    zone->beginFrame();
+    return zone;
+}
+
+const Framebuffer *RenderPipeline::submitFrame(GameInterface *gameInterface, const void *snapshotData, float interpolation)
+{
+    auto index = nextIndex;
+    auto isFullRedraw = isFullRedrawPending;
+    nextIndex ^= 1;
+    isFullRedrawPending = false;
+
+    // The framebuffer was presented already, so it can change its size.
+    auto isResized = resizeFramebuffer(index);
+    if(!isPipelined())
+    {
+        frameGameInterface = gameInterface;
+        frameSnapshot = RenderSnapshot{snapshotData, &snapshotMemory[index], &cacheMemory, interpolation};
+        isFrameFullRedraw = isFullRedraw;
+        isFrameResized = isResized;
+        renderFrame(index);
+        presentedRenderTime = renderTimes[index];
+        return &framebuffers[index];
+    }
+
+    auto previousFrame = finishFrame();
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        frameGameInterface = gameInterface;
+        frameSnapshot = RenderSnapshot{snapshotData, &snapshotMemory[index], &cacheMemory, interpolation};
+        frameIndex = index;
+        isFrameFullRedraw = isFullRedraw;
+        isFrameResized = isResized;
+        isFrameRendering = true;
+        isFrameSubmitted = true;
+        isFrameFinished = false;
+    }
+    frameSubmittedCondition.notify_one();
+    return previousFrame;
+}
+
+const Framebuffer *RenderPipeline::finishFrame()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if(!isFrameRendering)
+        return nullptr;
+
+    while(!isFrameFinished)
+        frameFinishedCondition.wait(lock);
+    isFrameRendering = false;
+    presentedRenderTime = renderTimes[frameIndex];
+    return &framebuffers[frameIndex];
+}
+
+void RenderPipeline::invalidate()
+{
+    isFullRedrawPending = true;
+}
+
+void RenderPipeline::setScale(float scale)
+{
+    targetScale = std::min(std::max(scale, MinimumScale), 1.0f);
+}
+
+bool RenderPipeline::resizeFramebuffer(size_t index)
+{
+    auto &framebuffer = framebuffers[index];
+    auto width = std::max(uint32_t(fullWidth*targetScale + 0.5f), 1u);
+    auto height = std::max(uint32_t(fullHeight*targetScale + 0.5f), 1u);
+    if(framebuffer.width == width && framebuffer.height == height)
+        return false;
+
+    // The pitch stays the one of the full width.
+    framebuffer.width = width;
+    framebuffer.height = height;
+    framebuffer.scale = targetScale;
+    return true;
+}
+
+void RenderPipeline::renderFrame(size_t index)
+{
+    PROFILE_ZONE("Render frame");
+    auto startTime = std::chrono::steady_clock::now();
+    auto &framebuffer = framebuffers[index];
+    auto &dirtyRegion = dirtyRegions[index];
+    dirtyRegion.clear();
+
+    // The cache may have been made by the game logic before a reload, or from
+    // a state that was replaced.
+    if(isFrameFullRedraw)
+        cacheMemory.clearAll();
+    frameGameInterface->render(framebuffer, frameSnapshot);
+    if(isFrameFullRedraw || isFrameResized)
+    {
+        dirtyRegion.clear();
+        framebuffer.markAllDirty();
+    }
+    dirtyRegion.clip(framebuffer.width, framebuffer.height);
+
+    // The framebuffer holds the frame before the previous one, so it misses
+    // the changes of both frames. The previous frame can be larger.
+    renderRegion = dirtyRegion;
+    renderRegion.add(dirtyRegions[index ^ 1]);
+    renderRegion.clip(framebuffer.width, framebuffer.height);
+    renderFramebufferTiles(*threadPool, frameGameInterface, framebuffer, frameSnapshot, &renderRegion);
+    renderTimes[index] = std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+void RenderPipeline::threadEntry()
+{
+    Profiler::singleton.setThreadName("Render");
+    std::unique_lock<std::mutex> lock(mutex);
+    for(;;)
+    {
+        while(!shuttingDown && !isFrameSubmitted)
+            frameSubmittedCondition.wait(lock);
+        if(shuttingDown)
+            return;
+
+        // The main thread does not touch the frame until it is finished.
+        isFrameSubmitted = false;
+        auto index = frameIndex;
+        lock.unlock();
+        renderFrame(index);
+        lock.lock();
+        isFrameFinished = true;
+        frameFinishedCondition.notify_all();
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef SIMPLE_GAME_TEMPLATE_RENDER_PIPELINE_HPP
+#define SIMPLE_GAME_TEMPLATE_RENDER_PIPELINE_HPP
+
+#include "GameInterface.hpp"
+#include "WorkerThreadPool.hpp"
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/**
+ * Renders the frames of the game from their snapshots. In the pipelined mode
+ * a frame is rendered in a thread of its own, while the main thread updates
+ * the next one. There are two snapshot zones and two framebuffers, used in
+ * turns, so that the main thread prepares the snapshot of the next frame and
+ * presents the previous frame while the current one renders.
+ *
+ * The framebuffers are retained, and only the dirty regions are rendered
+ * again. A framebuffer is two frames old when it is reused, so the region
+ * that is rendered into it also covers the dirty region of the frame before.
+ */
+class RenderPipeline
+{
+public:
+    RenderPipeline();
+    ~RenderPipeline();
+
+    // The framebuffers are allocated at the full resolution, which is their
+    // size until setScale is called.
+    void start(WorkerThreadPool *theThreadPool, uint32_t width, uint32_t height, bool pipelined, MemoryZoneBackend::Type backend);
+    void shutdown();
+
+    bool isPipelined() const
+    {
+        return thread.joinable();
+    }
+
+    // Returns the zone for the snapshot of the next frame. The frame that is
+    // rendering does not use it.
+    MemoryZone *beginSnapshot();
+
+    // Starts rendering the snapshot, and returns the framebuffer that is ready
+    // for presenting. In the pipelined mode that is the previous frame, or
+    // nullptr for the first one. Otherwise the frame is rendered right away.
+    const Framebuffer *submitFrame(GameInterface *gameInterface, const void *snapshotData, float interpolation);
+
+    // Waits for the frame that is rendering, and returns it, or nullptr when
+    // there is none. Called before the game logic is unloaded, and at the end.
+    const Framebuffer *finishFrame();
+
+    // Renders all of the next frame, marks it all dirty, and clears the render
+    // cache memory. Called when the retained pixels are not valid anymore,
+    // such as after the game logic is reloaded or its state is restored.
+    void invalidate();
+
+    // Resizes the framebuffers of the next frames, inside of their memory, to
+    // the full resolution times the scale, which is clamped to [0.1, 1]. A
+    // resized framebuffer is rendered all over, without clearing the render
+    // cache memory.
+    void setScale(float scale);
+
+    // The milliseconds that the last returned frame took to render.
+    double getRenderTime() const
+    {
+        return presentedRenderTime;
+    }
+
+private:
+    bool resizeFramebuffer(size_t index);
+    void renderFrame(size_t index);
+    void threadEntry();
+
+    WorkerThreadPool *threadPool;
+    MemoryZone snapshotMemory[2];
+    MemoryZone cacheMemory;
+    Framebuffer framebuffers[2];
+    std::unique_ptr<uint8_t[]> framebufferPixels[2];
+    FramebufferDirtyRegion dirtyRegions[2];
+    size_t nextIndex;
+    bool isFullRedrawPending;
+    uint32_t fullWidth;
+    uint32_t fullHeight;
+    float targetScale;
+    double renderTimes[2];
+    double presentedRenderTime;
+
+    // Used by the thread that renders.
+    FramebufferDirtyRegion renderRegion;
+
+    // The frame that is submitted to the render thread.
+    GameInterface *frameGameInterface;
+    RenderSnapshot frameSnapshot;
+    size_t frameIndex;
+    bool isFrameFullRedraw;
+    bool isFrameResized;
+    bool isFrameRendering;
+    bool isFrameSubmitted;
+    bool isFrameFinished;
+
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable frameSubmittedCondition;
+    std::condition_variable frameFinishedCondition;
+    bool shuttingDown;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_RENDER_PIPELINE_HPP
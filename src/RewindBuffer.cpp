@@ -0,0 +1,330 @@
+#include "RewindBuffer.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define REWIND_BUFFER_HAS_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+
+static constexpr size_t PageWordCount = RewindBuffer::PageSize / sizeof(uint64_t);
+
+// A page is its index and the size of its runs, followed by the runs. A run is
+// a count of zero words and a count of literal words, followed by the literal
+// words. A page needs at most one run per two words.
+struct EncodedPageHeader
+{
+    uint32_t page;
+    uint32_t byteSize;
+};
+
+struct EncodedRun
+{
+    uint16_t zeroWordCount;
+    uint16_t literalWordCount;
+};
+
+static constexpr size_t MaxEncodedPageSize = sizeof(EncodedPageHeader) + (PageWordCount / 2 + 1)*sizeof(EncodedRun) + RewindBuffer::PageSize;
+
+inline uint64_t rotateLeft(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint64_t loadWord(const uint8_t *source)
+{
+    uint64_t word;
+    memcpy(&word, source, sizeof(word));
+    return word;
+}
+
+inline uint64_t mixLanes(const uint64_t *lanes)
+{
+    static constexpr uint64_t Prime = 11400714785074694791ull;
+    return (lanes[0] + rotateLeft(lanes[1], 17))*Prime ^ (lanes[2] + rotateLeft(lanes[3], 43));
+}
+
+// The accumulation of XXH3, where every word is mixed with a key that is
+// different for every position, so that moving data within a page changes the
+// hash too. A change that goes unnoticed would corrupt the rewound states, but
+// this runs over the whole zone every tick, so it only does a multiplication
+// per 8 bytes. Reading the whole zone from memory is still most of the time
+// of recording a tick.
+#ifdef REWIND_BUFFER_HAS_SSE2
+static uint64_t hashPage(const uint8_t *page)
+{
+    auto key0 = _mm_set_epi32(0x7c01812c, 0xf721ad1c, 0xded46de9, 0x839097db);
+    auto key1 = _mm_set_epi32(0x1e0d6b8e, 0x5c4b32ad, 0x165d9c91, 0x8e93a0b5);
+    auto keyStep = _mm_set_epi32(0x9e3779b9, 0x85ebca6b, 0xc2b2ae35, 0x27d4eb2f);
+    auto accumulator0 = _mm_setzero_si128();
+    auto accumulator1 = _mm_setzero_si128();
+    for(size_t i = 0; i < RewindBuffer::PageSize; i += 32)
+    {
+        auto data0 = _mm_loadu_si128(reinterpret_cast<const __m128i*> (page + i));
+        auto data1 = _mm_loadu_si128(reinterpret_cast<const __m128i*> (page + i + 16));
+        auto keyed0 = _mm_xor_si128(data0, key0);
+        auto keyed1 = _mm_xor_si128(data1, key1);
+        auto product0 = _mm_mul_epu32(keyed0, _mm_shuffle_epi32(keyed0, _MM_SHUFFLE(3, 3, 1, 1)));
+        auto product1 = _mm_mul_epu32(keyed1, _mm_shuffle_epi32(keyed1, _MM_SHUFFLE(3, 3, 1, 1)));
+        accumulator0 = _mm_add_epi64(accumulator0, _mm_add_epi64(product0, _mm_shuffle_epi32(data0, _MM_SHUFFLE(1, 0, 3, 2))));
+        accumulator1 = _mm_add_epi64(accumulator1, _mm_add_epi64(product1, _mm_shuffle_epi32(data1, _MM_SHUFFLE(1, 0, 3, 2))));
+        key0 = _mm_add_epi32(key0, keyStep);
+        key1 = _mm_add_epi32(key1, keyStep);
+    }
+
+    uint64_t lanes[4];
+    _mm_storeu_si128(reinterpret_cast<__m128i*> (lanes), accumulator0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*> (lanes + 2), accumulator1);
+    return mixLanes(lanes);
+}
+#else
+static uint64_t hashPage(const uint8_t *page)
+{
+    uint64_t keys[4] = {0xded46de9839097dbull, 0x7c01812cf721ad1cull, 0x165d9c918e93a0b5ull, 0x1e0d6b8e5c4b32adull};
+    uint64_t lanes[4] = {0, 0, 0, 0};
+    for(size_t i = 0; i < RewindBuffer::PageSize; i += 32)
+    {
+        for(size_t lane = 0; lane < 4; ++lane)
+        {
+            auto data = loadWord(page + i + lane*8);
+            auto keyed = data ^ keys[lane];
+            lanes[lane ^ 1] += data;
+            lanes[lane] += (keyed & 0xffffffff)*(keyed >> 32);
+            keys[lane] += 0x85ebca6b27d4eb2full;
+        }
+    }
+
+    return mixLanes(lanes);
+}
+#endif
+}
+
+RewindBuffer::RewindBuffer()
+    : zoneSize(0), pageCount(0), historyCapacity(0), maxTickCount(0), hasBase(false), writePosition(0),
+      recordedTickCount(0), recordedPageCount(0), recordedByteCount(0)
+{
+}
+
+bool RewindBuffer::initialize(size_t theZoneSize, size_t theHistoryCapacity, uint32_t theMaxTickCount)
+{
+    if(theZoneSize % PageSize != 0)
+    {
+        fprintf(stderr, "The rewind buffer needs a memory zone of whole %zu byte pages\n", PageSize);
+        return false;
+    }
+
+    zoneSize = theZoneSize;
+    pageCount = uint32_t(zoneSize / PageSize);
+    historyCapacity = theHistoryCapacity;
+    maxTickCount = theMaxTickCount;
+    if(!isEnabled())
+        return true;
+
+    shadow.reset(new uint8_t[zoneSize]);
+    pageHashes.reset(new uint64_t[pageCount]);
+    history.reset(new uint8_t[historyCapacity]);
+    dirtyPages.reserve(pageCount);
+    isPageRestored.resize(pageCount);
+    clear();
+    return true;
+}
+
+void RewindBuffer::clear()
+{
+    hasBase = false;
+    writePosition = 0;
+    records.clear();
+}
+
+void RewindBuffer::recordTick(const MemoryZone &zone, const InputRecordingTick &tick)
+{
+    if(!isEnabled())
+        return;
+
+    assert(zone.getSize() == zoneSize);
+    auto zoneData = zone.getData();
+    if(!hasBase)
+    {
+        memcpy(shadow.get(), zoneData, zoneSize);
+        for(uint32_t page = 0; page < pageCount; ++page)
+            pageHashes[page] = hashPage(zoneData + page*PageSize);
+        hasBase = true;
+        return;
+    }
+
+    dirtyPages.clear();
+    for(uint32_t page = 0; page < pageCount; ++page)
+    {
+        auto hash = hashPage(zoneData + page*PageSize);
+        if(hash != pageHashes[page])
+        {
+            pageHashes[page] = hash;
+            dirtyPages.push_back(page);
+        }
+    }
+
+    // The worst case is reserved, and the unused part is given back.
+    auto record = allocateRecordBytes(dirtyPages.size()*MaxEncodedPageSize);
+    if(!record)
+    {
+        // The tick does not fit into the history at all, so it starts over.
+        fprintf(stderr, "A tick of %zu changed pages does not fit into the rewind history\n", dirtyPages.size());
+        clear();
+        recordTick(zone, tick);
+        return;
+    }
+
+    size_t byteSize = 0;
+    for(auto page : dirtyPages)
+        byteSize += encodePage(record + byteSize, page, zoneData);
+
+    TickRecord tickRecord = {writePosition, byteSize, uint32_t(dirtyPages.size()), tick};
+    records.push_back(tickRecord);
+    writePosition += byteSize;
+
+    ++recordedTickCount;
+    recordedPageCount += dirtyPages.size();
+    recordedByteCount += byteSize;
+}
+
+uint8_t *RewindBuffer::allocateRecordBytes(size_t byteCount)
+{
+    if(byteCount > historyCapacity)
+        return nullptr;
+
+    if(records.size() >= maxTickCount)
+        records.pop_front();
+
+    // A tick that does not fit before the end of the ring starts at its
+    // beginning, and the records are dropped from the oldest one until the
+    // bytes that are written over are free.
+    if(writePosition % historyCapacity + byteCount > historyCapacity)
+        writePosition = (writePosition / historyCapacity + 1)*historyCapacity;
+    while(!records.empty() && records.front().position + historyCapacity < writePosition + byteCount)
+        records.pop_front();
+
+    return history.get() + writePosition % historyCapacity;
+}
+
+size_t RewindBuffer::encodePage(uint8_t *dest, uint32_t page, const uint8_t *zoneData)
+{
+    auto current = zoneData + page*PageSize;
+    auto previous = shadow.get() + page*PageSize;
+    auto output = dest + sizeof(EncodedPageHeader);
+    size_t word = 0;
+    while(word < PageWordCount)
+    {
+        EncodedRun run = {0, 0};
+        while(word < PageWordCount && loadWord(current + word*8) == loadWord(previous + word*8))
+        {
+            ++run.zeroWordCount;
+            ++word;
+        }
+
+        auto runOutput = output;
+        output += sizeof(EncodedRun);
+        while(word < PageWordCount)
+        {
+            // A single equal word between literals is cheaper than a new run.
+            auto difference = loadWord(current + word*8) ^ loadWord(previous + word*8);
+            if(difference == 0 && (word + 1 == PageWordCount || loadWord(current + word*8 + 8) == loadWord(previous + word*8 + 8)))
+                break;
+
+            memcpy(output, &difference, sizeof(difference));
+            output += sizeof(difference);
+            ++run.literalWordCount;
+            ++word;
+        }
+
+        memcpy(runOutput, &run, sizeof(run));
+    }
+
+    memcpy(previous, current, PageSize);
+
+    EncodedPageHeader header = {page, uint32_t(output - dest)};
+    memcpy(dest, &header, sizeof(header));
+    return header.byteSize;
+}
+
+const uint8_t *RewindBuffer::decodePage(const uint8_t *source)
+{
+    EncodedPageHeader header;
+    memcpy(&header, source, sizeof(header));
+    auto end = source + header.byteSize;
+    auto input = source + sizeof(header);
+    auto target = shadow.get() + header.page*PageSize;
+    while(input < end)
+    {
+        EncodedRun run;
+        memcpy(&run, input, sizeof(run));
+        input += sizeof(run);
+        target += run.zeroWordCount*sizeof(uint64_t);
+        for(uint32_t i = 0; i < run.literalWordCount; ++i)
+        {
+            auto word = loadWord(target) ^ loadWord(input);
+            memcpy(target, &word, sizeof(word));
+            target += sizeof(word);
+            input += sizeof(word);
+        }
+    }
+
+    isPageRestored[header.page] = 1;
+    return end;
+}
+
+uint32_t RewindBuffer::rewind(MemoryZone &zone, uint32_t tickCount)
+{
+    assert(zone.getSize() == zoneSize);
+    tickCount = std::min(tickCount, getTickCount());
+    if(tickCount == 0)
+        return 0;
+
+    // The shadow goes back a tick at a time, and the zone only gets the final
+    // contents of the pages that changed on the way.
+    for(uint32_t i = 0; i < tickCount; ++i)
+    {
+        auto &record = records.back();
+        const uint8_t *input = history.get() + record.position % historyCapacity;
+        auto end = input + record.byteSize;
+        while(input < end)
+            input = decodePage(input);
+
+        writePosition = record.position;
+        records.pop_back();
+    }
+
+    auto zoneData = zone.getData();
+    for(uint32_t page = 0; page < pageCount; ++page)
+    {
+        if(!isPageRestored[page])
+            continue;
+
+        memcpy(zoneData + page*PageSize, shadow.get() + page*PageSize, PageSize);
+        pageHashes[page] = hashPage(zoneData + page*PageSize);
+        isPageRestored[page] = 0;
+    }
+
+    return tickCount;
+}
+
+size_t RewindBuffer::getHistoryByteSize() const
+{
+    size_t byteSize = 0;
+    for(auto &record : records)
+        byteSize += record.byteSize;
+    return byteSize;
+}
+
+void RewindBuffer::printStatistics() const
+{
+    if(!isEnabled() || recordedTickCount == 0)
+        return;
+
+    printf("Rewind: %u ticks in %.2f MB, %.1f changed pages and %.1f KB per tick\n", getTickCount(),
+        double(getHistoryByteSize()) / (1024*1024), double(recordedPageCount) / recordedTickCount,
+        double(recordedByteCount) / recordedTickCount / 1024);
+}
@@ -0,0 +1,109 @@
+#ifndef SIMPLE_GAME_TEMPLATE_REWIND_BUFFER_HPP
+#define SIMPLE_GAME_TEMPLATE_REWIND_BUFFER_HPP
+
+#include "InputRecording.hpp"
+#include "MemoryZone.hpp"
+#include <deque>
+#include <memory>
+#include <vector>
+
+/**
+ * The history of the persistent memory over the last ticks, for rewinding the
+ * game and for rolling it back and simulating it again with other inputs.
+ *
+ * A tick only stores the pages that changed, which are found by comparing a
+ * hash of every page with the one of the previous tick. The changed pages are
+ * stored as the XOR with their previous contents, in which the unchanged words
+ * are zero, with the runs of zero words removed. A shadow copy holds the
+ * contents of the last tick, and rewinding XORs the ticks back into it, from
+ * the newest one, so any tick of the history is restored without a full copy
+ * per tick.
+ *
+ * The ticks are kept in a ring of bytes, and the oldest ones are dropped when
+ * there is no room for a new tick, or when there are more than the maximum.
+ */
+class RewindBuffer
+{
+public:
+    static constexpr size_t PageSize = 4096;
+    static constexpr size_t DefaultHistoryCapacity = 64*1024*1024;
+
+    RewindBuffer();
+
+    // The zone size must be a multiple of PageSize. A maximum of zero ticks
+    // disables the history.
+    bool initialize(size_t theZoneSize, size_t theHistoryCapacity, uint32_t theMaxTickCount);
+
+    bool isEnabled() const
+    {
+        return maxTickCount > 0;
+    }
+
+    // Drops the history. Called when the zone is replaced as a whole, such as
+    // by a reset or by loading a save slot. The next recorded tick starts a
+    // new history.
+    void clear();
+
+    // Called after every update, with the inputs of the update. The first
+    // tick after clear only copies the zone.
+    void recordTick(const MemoryZone &zone, const InputRecordingTick &tick);
+
+    // The number of ticks that can be rewound.
+    uint32_t getTickCount() const
+    {
+        return uint32_t(records.size());
+    }
+
+    // The inputs of a recorded tick, where 0 is the last one. They are what a
+    // rollback simulates again after rewinding.
+    const InputRecordingTick &getTick(uint32_t ticksAgo) const
+    {
+        return records[records.size() - 1 - ticksAgo].tick;
+    }
+
+    // Restores the zone to its state before the last ticks, and drops those
+    // ticks from the history. Called between the updates, after recordTick.
+    // Returns the number of rewound ticks, which is lower when the history is
+    // shorter.
+    uint32_t rewind(MemoryZone &zone, uint32_t tickCount);
+
+    size_t getHistoryByteSize() const;
+    void printStatistics() const;
+
+private:
+    struct TickRecord
+    {
+        // The position in the stream of all the recorded bytes, which is
+        // wrapped into the ring.
+        uint64_t position;
+        size_t byteSize;
+        uint32_t pageCount;
+        InputRecordingTick tick;
+    };
+
+    uint8_t *allocateRecordBytes(size_t byteCount);
+    size_t encodePage(uint8_t *dest, uint32_t page, const uint8_t *zoneData);
+    const uint8_t *decodePage(const uint8_t *source);
+
+    size_t zoneSize;
+    uint32_t pageCount;
+    size_t historyCapacity;
+    uint32_t maxTickCount;
+    bool hasBase;
+
+    std::unique_ptr<uint8_t[]> shadow;
+    std::unique_ptr<uint64_t[]> pageHashes;
+    std::unique_ptr<uint8_t[]> history;
+    uint64_t writePosition;
+    std::deque<TickRecord> records;
+
+    // Scratch of recordTick and rewind.
+    std::vector<uint32_t> dirtyPages;
+    std::vector<uint8_t> isPageRestored;
+
+    uint64_t recordedTickCount;
+    uint64_t recordedPageCount;
+    uint64_t recordedByteCount;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_REWIND_BUFFER_HPP
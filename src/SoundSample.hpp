@@ -1,6 +1,7 @@
 #ifndef SIMPLE_GAME_TEMPLATE_SOUND_SAMPLE_HPP
 #define SIMPLE_GAME_TEMPLATE_SOUND_SAMPLE_HPP
 
+#include <stddef.h>
 #include <stdint.h>
 
 class SoundSample
@@ -12,6 +13,25 @@ public:
     virtual void resume() = 0;
     virtual void pause() = 0;
     virtual void stop() = 0;
+
+    // Moves the playback to the given time from the beginning of the sample.
+    virtual void seek(double seconds)
+    {
+        (void)seconds;
+    }
+
+    // The pan goes from -1 for the left channel to 1 for the right channel.
+    virtual void setVolume(float volume, float pan)
+    {
+        (void)volume;
+        (void)pan;
+    }
+
+    // Memory used by the decoded samples, for the asset memory budget.
+    virtual size_t getByteSize() const
+    {
+        return 0;
+    }
 };
 
 typedef SoundSample* SoundSamplePtr;
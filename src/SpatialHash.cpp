@@ -0,0 +1,203 @@
+#include "SpatialHash.hpp"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+// A ray that does not hit anything stops after this many cells.
+static constexpr uint32_t MaxRaycastCellCount = 1 << 20;
+
+SpatialHash::SpatialHash()
+    : cellSize(1.0f), inverseCellSize(1.0f), bucketCount(0), bucketRowStride(0), bucketStarts(nullptr),
+      cellBodies(nullptr), cellBodyCount(0), largeBodies(nullptr), largeBodyCount(0)
+{
+}
+
+bool SpatialHash::build(MemoryZone *zone, const CollisionBox *boxes, uint32_t bodyCount, float theCellSize)
+{
+    cellSize = theCellSize;
+    inverseCellSize = 1.0f / theCellSize;
+    cellBodyCount = 0;
+    largeBodyCount = 0;
+
+    // About a body per bucket keeps the collisions of the cells low.
+    uint32_t bucketBits = 6;
+    while((1u << bucketBits) < bodyCount)
+        ++bucketBits;
+    bucketCount = 1u << bucketBits;
+    bucketRowStride = (1u << (bucketBits / 2)) + 1;
+
+    bucketStarts = zone->allocateArray<uint32_t> (bucketCount + 1);
+    cellBodies = reinterpret_cast<CellBody*> (zone->allocateBytes(sizeof(CellBody)*bodyCount, alignof(CellBody)));
+    largeBodies = reinterpret_cast<LargeBody*> (zone->allocateBytes(sizeof(LargeBody)*bodyCount, alignof(LargeBody)));
+    if(!bucketStarts || !cellBodies || !largeBodies)
+    {
+        bucketCount = 0;
+        return false;
+    }
+
+    // The bodies are counted per bucket and then filled in, like the sprites
+    // of the tiles, which keeps their order inside of a bucket.
+    for(uint32_t body = 0; body < bodyCount; ++body)
+    {
+        auto &box = boxes[body];
+        if(box.maxX - box.minX > cellSize || box.maxY - box.minY > cellSize)
+        {
+            largeBodies[largeBodyCount++] = LargeBody{box, body};
+            continue;
+        }
+
+        ++bucketStarts[getBucket(getCellCoordinate(box.minX), getCellCoordinate(box.minY))];
+    }
+
+    for(uint32_t bucket = 0; bucket < bucketCount; ++bucket)
+    {
+        auto count = bucketStarts[bucket];
+        bucketStarts[bucket] = cellBodyCount;
+        cellBodyCount += count;
+    }
+    bucketStarts[bucketCount] = cellBodyCount;
+
+    for(uint32_t body = 0; body < bodyCount; ++body)
+    {
+        auto &box = boxes[body];
+        if(box.maxX - box.minX > cellSize || box.maxY - box.minY > cellSize)
+            continue;
+
+        auto cellX = getCellCoordinate(box.minX);
+        auto cellY = getCellCoordinate(box.minY);
+        auto bucket = getBucket(cellX, cellY);
+        cellBodies[bucketStarts[bucket]++] = CellBody{box, cellX, cellY, bucket, body};
+    }
+
+    // Filling moved every start to the start of the next bucket.
+    memmove(bucketStarts + 1, bucketStarts, sizeof(uint32_t)*(bucketCount - 1));
+    bucketStarts[0] = 0;
+    return true;
+}
+
+uint32_t SpatialHash::queryRegion(const CollisionBox &region, uint32_t *results, uint32_t maxResults) const
+{
+    uint32_t resultCount = 0;
+    if(bucketCount == 0)
+        return 0;
+
+    auto addResult = [&](uint32_t body) {
+        if(resultCount < maxResults)
+            results[resultCount] = body;
+        ++resultCount;
+    };
+
+    for(uint32_t i = 0; i < largeBodyCount; ++i)
+    {
+        if(largeBodies[i].box.overlaps(region))
+            addResult(largeBodies[i].body);
+    }
+
+    forEachCellBodyInRegion(region, [&](const CellBody &cellBody) {
+        addResult(cellBody.body);
+    });
+    return resultCount;
+}
+
+// Returns the distance along the ray where it enters the box, if that is
+// before the maximum.
+static bool intersectRay(const CollisionBox &box, float originX, float originY, float directionX, float directionY, float maxDistance, float &distance)
+{
+    auto entry = 0.0f;
+    auto exit = maxDistance;
+    const float origins[2] = {originX, originY};
+    const float directions[2] = {directionX, directionY};
+    const float minima[2] = {box.minX, box.minY};
+    const float maxima[2] = {box.maxX, box.maxY};
+    for(int axis = 0; axis < 2; ++axis)
+    {
+        if(directions[axis] == 0.0f)
+        {
+            if(origins[axis] < minima[axis] || origins[axis] > maxima[axis])
+                return false;
+            continue;
+        }
+
+        auto inverseDirection = 1.0f / directions[axis];
+        auto near = (minima[axis] - origins[axis])*inverseDirection;
+        auto far = (maxima[axis] - origins[axis])*inverseDirection;
+        if(near > far)
+            std::swap(near, far);
+        entry = std::max(entry, near);
+        exit = std::min(exit, far);
+        if(entry > exit)
+            return false;
+    }
+
+    distance = entry;
+    return true;
+}
+
+bool SpatialHash::raycast(float originX, float originY, float directionX, float directionY, float maxDistance, RaycastHit &hit) const
+{
+    if(bucketCount == 0 || (directionX == 0.0f && directionY == 0.0f))
+        return false;
+
+    auto isHit = false;
+    auto closestDistance = maxDistance;
+    auto testBody = [&](const CollisionBox &box, uint32_t body) {
+        float distance;
+        if(intersectRay(box, originX, originY, directionX, directionY, closestDistance, distance) &&
+            (!isHit || distance < closestDistance))
+        {
+            isHit = true;
+            closestDistance = distance;
+            hit.body = body;
+            hit.distance = distance;
+        }
+    };
+
+    for(uint32_t i = 0; i < largeBodyCount; ++i)
+        testBody(largeBodies[i].box, largeBodies[i].body);
+
+    // The cells along the ray are visited in order, until the closest hit is
+    // inside of the cells that were visited. The bodies that reach into a
+    // cell are binned in it or in the cells before it.
+    auto cellX = getCellCoordinate(originX);
+    auto cellY = getCellCoordinate(originY);
+    auto stepX = directionX > 0.0f ? 1 : -1;
+    auto stepY = directionY > 0.0f ? 1 : -1;
+    auto deltaX = directionX != 0.0f ? cellSize / fabsf(directionX) : FLT_MAX;
+    auto deltaY = directionY != 0.0f ? cellSize / fabsf(directionY) : FLT_MAX;
+    auto nextX = directionX != 0.0f ? (float(cellX + (stepX > 0 ? 1 : 0))*cellSize - originX) / directionX : FLT_MAX;
+    auto nextY = directionY != 0.0f ? (float(cellY + (stepY > 0 ? 1 : 0))*cellSize - originY) / directionY : FLT_MAX;
+    for(uint32_t step = 0; step < MaxRaycastCellCount; ++step)
+    {
+        for(auto binCellY = cellY - 1; binCellY <= cellY; ++binCellY)
+        {
+            for(auto binCellX = cellX - 1; binCellX <= cellX; ++binCellX)
+            {
+                auto bucket = getBucket(binCellX, binCellY);
+                for(auto i = bucketStarts[bucket]; i < bucketStarts[bucket + 1]; ++i)
+                {
+                    auto &cellBody = cellBodies[i];
+                    if(cellBody.cellX == binCellX && cellBody.cellY == binCellY)
+                        testBody(cellBody.box, cellBody.body);
+                }
+            }
+        }
+
+        auto cellExit = std::min(nextX, nextY);
+        if(cellExit >= closestDistance)
+            break;
+
+        if(nextX < nextY)
+        {
+            cellX += stepX;
+            nextX += deltaX;
+        }
+        else
+        {
+            cellY += stepY;
+            nextY += deltaY;
+        }
+    }
+
+    return isHit;
+}
@@ -0,0 +1,226 @@
+#ifndef SIMPLE_GAME_TEMPLATE_SPATIAL_HASH_HPP
+#define SIMPLE_GAME_TEMPLATE_SPATIAL_HASH_HPP
+
+#include "MemoryZone.hpp"
+#include <algorithm>
+
+struct CollisionBox
+{
+    float minX;
+    float minY;
+    float maxX;
+    float maxY;
+
+    bool overlaps(const CollisionBox &other) const
+    {
+        return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY && other.minY <= maxY;
+    }
+};
+
+struct RaycastHit
+{
+    uint32_t body;
+    float distance;
+};
+
+/**
+ * A broadphase that is rebuilt every update from the boxes of the bodies. The
+ * plane is divided into square cells, which are hashed into a table, so the
+ * world has no bounds. A body is binned only into the cell of its minimum
+ * corner, so a body that is not larger than a cell can only overlap the
+ * bodies of the neighboring cells. The bodies that are larger than a cell are
+ * kept in a list of their own, and checked against every query, so the cell
+ * size is best a bit larger than a typical body.
+ *
+ * The bodies are identified by their index in the array of boxes, such as
+ * the row of an entity in an EntityStore.
+ */
+class SpatialHash
+{
+public:
+    SpatialHash();
+
+    // The tables are allocated from the zone, which must stay untouched while
+    // the hash is used, such as the transient memory of an update. The boxes
+    // are copied.
+    bool build(MemoryZone *zone, const CollisionBox *boxes, uint32_t bodyCount, float theCellSize);
+
+    // Calls function(first, second) once for every pair of overlapping boxes,
+    // with first < second.
+    template<typename Function>
+    void forEachPair(Function function) const
+    {
+        // Every cell is paired with itself and with half of its neighbors,
+        // so that a pair of cells is only visited once. Those neighbors are
+        // in the next bucket and in three buckets a row later, whatever the
+        // cell of the bucket is.
+        for(uint32_t bucket = 0; bucket < bucketCount; ++bucket)
+        {
+            auto begin = bucketStarts[bucket];
+            auto end = bucketStarts[bucket + 1];
+            if(begin == end)
+                continue;
+
+            // The three buckets of the next row are next to each other,
+            // unless they wrap around the end of the table.
+            auto nextBucket = (bucket + 1) & (bucketCount - 1);
+            auto rowBucket = (bucket + bucketRowStride - 1) & (bucketCount - 1);
+            auto rowBucketCount = std::min(3u, bucketCount - rowBucket);
+            auto rowBegin = bucketStarts[rowBucket];
+            auto rowEnd = bucketStarts[rowBucket + rowBucketCount];
+            auto wrappedRowEnd = bucketStarts[3 - rowBucketCount];
+            for(auto i = begin; i < end; ++i)
+            {
+                auto &first = cellBodies[i];
+                for(auto j = i + 1; j < end; ++j)
+                    checkPair(function, first, cellBodies[j], 0, 0);
+                for(auto j = bucketStarts[nextBucket]; j < bucketStarts[nextBucket + 1]; ++j)
+                    checkPair(function, first, cellBodies[j], 1, 0);
+                for(auto j = rowBegin; j < rowEnd; ++j)
+                    checkPair(function, first, cellBodies[j], cellBodies[j].cellX - first.cellX, 1);
+                for(uint32_t j = 0; j < wrappedRowEnd; ++j)
+                    checkPair(function, first, cellBodies[j], cellBodies[j].cellX - first.cellX, 1);
+            }
+        }
+
+        for(uint32_t i = 0; i < largeBodyCount; ++i)
+        {
+            auto &first = largeBodies[i];
+            for(auto j = i + 1; j < largeBodyCount; ++j)
+            {
+                if(first.box.overlaps(largeBodies[j].box))
+                    reportPair(function, first.body, largeBodies[j].body);
+            }
+
+            forEachCellBodyInRegion(first.box, [&](const CellBody &second) {
+                reportPair(function, first.body, second.body);
+            });
+        }
+    }
+
+    // Writes the bodies that overlap the region, up to the maximum, and
+    // returns their count, which can be larger than the maximum.
+    uint32_t queryRegion(const CollisionBox &region, uint32_t *results, uint32_t maxResults) const;
+
+    // Finds the closest body that the ray hits, within the distance. The
+    // direction does not need to be normalized, and the distance is in its
+    // units. A ray that starts inside of a box hits it at zero.
+    bool raycast(float originX, float originY, float directionX, float directionY, float maxDistance, RaycastHit &hit) const;
+
+    uint32_t getBodyCount() const
+    {
+        return cellBodyCount + largeBodyCount;
+    }
+
+    // The bodies that are larger than a cell.
+    uint32_t getLargeBodyCount() const
+    {
+        return largeBodyCount;
+    }
+
+private:
+    struct CellBody
+    {
+        CollisionBox box;
+        int32_t cellX;
+        int32_t cellY;
+        uint32_t bucket;
+        uint32_t body;
+    };
+
+    struct LargeBody
+    {
+        CollisionBox box;
+        uint32_t body;
+    };
+
+    // Reports the pair when the second body is in the neighboring cell at the
+    // offset, and a neighbor in the next row can be on either side.
+    template<typename Function>
+    static void checkPair(Function &function, const CellBody &first, const CellBody &second, int32_t offsetX, int32_t offsetY)
+    {
+        if(second.cellY == first.cellY + offsetY && second.cellX == first.cellX + offsetX &&
+            offsetX >= -1 && offsetX <= 1 && first.box.overlaps(second.box))
+        {
+            reportPair(function, first.body, second.body);
+        }
+    }
+
+    template<typename Function>
+    static void reportPair(Function &function, uint32_t first, uint32_t second)
+    {
+        if(first < second)
+            function(first, second);
+        else
+            function(second, first);
+    }
+
+    // Calls function(cellBody) for the bodies of the cells that overlap the
+    // region. The bodies of the cells before the region can reach into it.
+    template<typename Function>
+    void forEachCellBodyInRegion(const CollisionBox &region, Function function) const
+    {
+        auto minCellX = getCellCoordinate(region.minX) - 1;
+        auto minCellY = getCellCoordinate(region.minY) - 1;
+        auto maxCellX = getCellCoordinate(region.maxX);
+        auto maxCellY = getCellCoordinate(region.maxY);
+
+        // A region with more cells than there are buckets checks every body.
+        if(double(maxCellX - minCellX + 1)*double(maxCellY - minCellY + 1) > double(bucketCount))
+        {
+            for(uint32_t i = 0; i < cellBodyCount; ++i)
+            {
+                if(cellBodies[i].box.overlaps(region))
+                    function(cellBodies[i]);
+            }
+            return;
+        }
+
+        for(auto cellY = minCellY; cellY <= maxCellY; ++cellY)
+        {
+            for(auto cellX = minCellX; cellX <= maxCellX; ++cellX)
+            {
+                auto bucket = getBucket(cellX, cellY);
+                for(auto i = bucketStarts[bucket]; i < bucketStarts[bucket + 1]; ++i)
+                {
+                    auto &cellBody = cellBodies[i];
+                    if(cellBody.cellX == cellX && cellBody.cellY == cellY && cellBody.box.overlaps(region))
+                        function(cellBody);
+                }
+            }
+        }
+    }
+
+    int32_t getCellCoordinate(float value) const
+    {
+        // floorf is a library call without SSE4.1.
+        auto scaled = value*inverseCellSize;
+        auto truncated = int32_t(scaled);
+        return truncated - (float(truncated) > scaled ? 1 : 0);
+    }
+
+    // The rows of cells are laid one after the other, so the neighboring cells
+    // are in nearby buckets. The stride is odd, so that the rows of a tall
+    // world still spread over every bucket.
+    uint32_t getBucket(int32_t cellX, int32_t cellY) const
+    {
+        return (uint32_t(cellY)*bucketRowStride + uint32_t(cellX)) & (bucketCount - 1);
+    }
+
+    float cellSize;
+    float inverseCellSize;
+
+    // The bodies of a bucket are cellBodies[bucketStarts[bucket]] up to the
+    // first body of the next bucket. A bucket holds the bodies of several
+    // cells when their hashes collide.
+    uint32_t bucketCount;
+    uint32_t bucketRowStride;
+    uint32_t *bucketStarts;
+    CellBody *cellBodies;
+    uint32_t cellBodyCount;
+
+    LargeBody *largeBodies;
+    uint32_t largeBodyCount;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_SPATIAL_HASH_HPP
@@ -0,0 +1,256 @@
+#include "SpriteBatch.hpp"
+#include <algorithm>
+#include <string.h>
+
+// The keys have the layer in the high half and the image in the low half.
+// The images are numbered through a hash table that is at most half full.
+static constexpr uint32_t ImageTableSize = 4096;
+static constexpr uint32_t MaxImageId = ImageTableSize/2 - 1;
+
+namespace
+{
+
+template<typename Entry>
+Entry *radixSort(Entry *entries, Entry *scratch, uint32_t count)
+{
+    // The histograms of all of the digits are counted in a single pass.
+    uint32_t histograms[4][256];
+    memset(histograms, 0, sizeof(histograms));
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        auto key = entries[i].key;
+        ++histograms[0][key & 0xff];
+        ++histograms[1][(key >> 8) & 0xff];
+        ++histograms[2][(key >> 16) & 0xff];
+        ++histograms[3][key >> 24];
+    }
+
+    for(uint32_t digit = 0; digit < 4; ++digit)
+    {
+        auto shift = digit*8;
+        auto &histogram = histograms[digit];
+
+        // The digit is the same in every key, such as the high byte of the
+        // layer when there are few layers.
+        if(histogram[(entries[0].key >> shift) & 0xff] == count)
+            continue;
+
+        uint32_t offset = 0;
+        for(auto &bucket : histogram)
+        {
+            auto bucketCount = bucket;
+            bucket = offset;
+            offset += bucketCount;
+        }
+
+        for(uint32_t i = 0; i < count; ++i)
+            scratch[histogram[(entries[i].key >> shift) & 0xff]++] = entries[i];
+        std::swap(entries, scratch);
+    }
+
+    return entries;
+}
+
+template<typename T>
+T *allocateUninitializedArray(MemoryZone *zone, size_t count)
+{
+    return reinterpret_cast<T*> (zone->allocateBytes(sizeof(T)*count, alignof(T)));
+}
+
+}
+
+SpriteBatch::SpriteBatch()
+    : zone(nullptr), commands(nullptr), capacity(0), count(0), droppedCount(0),
+      visibleCount(0), cellColumns(0), cellRows(0), cellFirstSprites(nullptr), cellSprites(nullptr)
+{
+}
+
+bool SpriteBatch::begin(MemoryZone *theZone, uint32_t theCapacity)
+{
+    zone = theZone;
+    count = 0;
+    droppedCount = 0;
+    visibleCount = 0;
+    cellColumns = 0;
+    cellRows = 0;
+    cellFirstSprites = nullptr;
+    cellSprites = nullptr;
+
+    // The commands are written by addSprite, so they are not constructed.
+    commands = allocateUninitializedArray<SpriteCommand> (zone, theCapacity);
+    capacity = commands ? theCapacity : 0;
+    return commands != nullptr;
+}
+
+BlitClipRect SpriteBatch::getDestRect(const SpriteCommand &command, const Framebuffer &framebuffer)
+{
+    BlitClipRect empty = {0, 0, 0, 0};
+    auto image = command.image;
+    if(!image || !image->pixels)
+        return empty;
+
+    // The same clipping as in blitImageRegion.
+    auto sourceX = command.sourceX;
+    auto sourceY = command.sourceY;
+    auto sourceWidth = command.sourceWidth;
+    auto sourceHeight = command.sourceHeight;
+    auto destX = command.destX;
+    auto destY = command.destY;
+    if(sourceX < 0)
+    {
+        sourceWidth += sourceX;
+        destX -= sourceX;
+        sourceX = 0;
+    }
+    if(sourceY < 0)
+    {
+        sourceHeight += sourceY;
+        destY -= sourceY;
+        sourceY = 0;
+    }
+    sourceWidth = std::min(sourceWidth, int32_t(image->width) - sourceX);
+    sourceHeight = std::min(sourceHeight, int32_t(image->height) - sourceY);
+
+    BlitClipRect rect;
+    rect.minX = std::max(destX, 0);
+    rect.minY = std::max(destY, 0);
+    rect.maxX = std::min(destX + sourceWidth, int32_t(framebuffer.width));
+    rect.maxY = std::min(destY + sourceHeight, int32_t(framebuffer.height));
+    if(rect.minX >= rect.maxX || rect.minY >= rect.maxY)
+        return empty;
+    return rect;
+}
+
+void SpriteBatch::prepare(const Framebuffer &framebuffer)
+{
+    cellColumns = (framebuffer.width + FramebufferTileSize - 1) / FramebufferTileSize;
+    cellRows = (framebuffer.height + FramebufferTileSize - 1) / FramebufferTileSize;
+    auto cellCount = cellColumns*cellRows;
+    cellFirstSprites = zone->allocateArray<uint32_t> (cellCount + 1);
+    visibleCount = 0;
+    if(count == 0 || !cellFirstSprites)
+        return;
+
+    // The images are numbered in the order of their first sprite.
+    auto imageTable = zone->allocateArray<const Image*> (ImageTableSize);
+    auto imageIds = allocateUninitializedArray<uint32_t> (zone, ImageTableSize);
+    auto entries = allocateUninitializedArray<SortEntry> (zone, count);
+    auto scratchEntries = allocateUninitializedArray<SortEntry> (zone, count);
+    if(!imageTable || !imageIds || !entries || !scratchEntries)
+        return;
+
+    uint32_t imageCount = 0;
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        auto &command = commands[i];
+        auto rect = getDestRect(command, framebuffer);
+        if(rect.minX == rect.maxX)
+            continue;
+
+        // The images over the limit share the last identifier, which only
+        // makes their grouping worse.
+        auto hash = uint32_t((reinterpret_cast<uintptr_t> (command.image) >> 4)*2654435761u);
+        auto slot = hash & (ImageTableSize - 1);
+        while(imageTable[slot] && imageTable[slot] != command.image)
+            slot = (slot + 1) & (ImageTableSize - 1);
+        if(!imageTable[slot] && imageCount < MaxImageId)
+        {
+            imageTable[slot] = command.image;
+            imageIds[slot] = imageCount++;
+        }
+        auto imageId = imageTable[slot] ? imageIds[slot] : MaxImageId;
+
+        entries[visibleCount++] = SortEntry{(uint32_t(command.layer) << 16) | imageId, i};
+    }
+
+    if(visibleCount == 0)
+        return;
+    auto sortedEntries = radixSort(entries, scratchEntries, visibleCount);
+
+    // Every sprite is binned into each cell that it overlaps, by counting the
+    // sprites of the cells and then filling them in the drawing order.
+    auto cellCursors = zone->allocateArray<uint32_t> (cellCount);
+    if(!cellCursors)
+        return;
+
+    uint32_t binnedCount = 0;
+    for(uint32_t pass = 0; pass < 2; ++pass)
+    {
+        for(uint32_t i = 0; i < visibleCount; ++i)
+        {
+            auto commandIndex = sortedEntries[i].commandIndex;
+            auto rect = getDestRect(commands[commandIndex], framebuffer);
+            auto firstColumn = uint32_t(rect.minX) / FramebufferTileSize;
+            auto lastColumn = uint32_t(rect.maxX - 1) / FramebufferTileSize;
+            auto firstRow = uint32_t(rect.minY) / FramebufferTileSize;
+            auto lastRow = uint32_t(rect.maxY - 1) / FramebufferTileSize;
+            for(auto row = firstRow; row <= lastRow; ++row)
+            {
+                for(auto column = firstColumn; column <= lastColumn; ++column)
+                {
+                    auto cell = row*cellColumns + column;
+                    if(pass == 0)
+                        ++cellCursors[cell];
+                    else
+                        cellSprites[cellCursors[cell]++] = commandIndex;
+                }
+            }
+        }
+
+        if(pass == 0)
+        {
+            for(uint32_t cell = 0; cell < cellCount; ++cell)
+            {
+                cellFirstSprites[cell] = binnedCount;
+                binnedCount += cellCursors[cell];
+                cellCursors[cell] = cellFirstSprites[cell];
+            }
+            cellFirstSprites[cellCount] = binnedCount;
+
+            cellSprites = allocateUninitializedArray<uint32_t> (zone, binnedCount);
+            if(!cellSprites)
+            {
+                memset(cellFirstSprites, 0, sizeof(uint32_t)*(cellCount + 1));
+                return;
+            }
+        }
+    }
+}
+
+void SpriteBatch::renderTile(const Framebuffer &framebuffer, const FramebufferTile &tile) const
+{
+    if(!cellSprites || tile.isEmpty())
+        return;
+
+    // The tiles of the host are inside of a single cell, but a larger tile
+    // is drawn cell by cell, so that no sprite is drawn twice.
+    auto firstColumn = tile.x / FramebufferTileSize;
+    auto lastColumn = std::min((tile.x + tile.width - 1) / FramebufferTileSize, cellColumns - 1);
+    auto firstRow = tile.y / FramebufferTileSize;
+    auto lastRow = std::min((tile.y + tile.height - 1) / FramebufferTileSize, cellRows - 1);
+    auto tileClipRect = BlitClipRect::forTile(tile);
+    for(auto row = firstRow; row <= lastRow; ++row)
+    {
+        for(auto column = firstColumn; column <= lastColumn; ++column)
+        {
+            BlitClipRect clipRect;
+            clipRect.minX = std::max(tileClipRect.minX, int32_t(column*FramebufferTileSize));
+            clipRect.minY = std::max(tileClipRect.minY, int32_t(row*FramebufferTileSize));
+            clipRect.maxX = std::min(tileClipRect.maxX, int32_t((column + 1)*FramebufferTileSize));
+            clipRect.maxY = std::min(tileClipRect.maxY, int32_t((row + 1)*FramebufferTileSize));
+            renderCell(framebuffer, row*cellColumns + column, clipRect);
+        }
+    }
+}
+
+void SpriteBatch::renderCell(const Framebuffer &framebuffer, uint32_t cellIndex, const BlitClipRect &clipRect) const
+{
+    auto end = cellFirstSprites[cellIndex + 1];
+    for(auto i = cellFirstSprites[cellIndex]; i < end; ++i)
+    {
+        auto &command = commands[cellSprites[i]];
+        blitImageRegion(framebuffer, clipRect, *command.image,
+            command.sourceX, command.sourceY, command.sourceWidth, command.sourceHeight,
+            command.destX, command.destY, BlitMode::Mode(command.mode), command.color);
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef SIMPLE_GAME_TEMPLATE_SPRITE_BATCH_HPP
+#define SIMPLE_GAME_TEMPLATE_SPRITE_BATCH_HPP
+
+#include "Blitter.hpp"
+#include "MemoryZone.hpp"
+
+struct SpriteCommand
+{
+    const Image *image;
+    int32_t sourceX;
+    int32_t sourceY;
+    int32_t sourceWidth;
+    int32_t sourceHeight;
+    int32_t destX;
+    int32_t destY;
+    uint32_t color;
+    uint16_t layer;
+    uint8_t mode;
+};
+
+/**
+ * Collects the sprites of a frame, and draws them tile by tile. The commands
+ * are allocated from a memory zone. Before the tiles are rendered, the
+ * sprites outside of the framebuffer are culled, the rest are radix sorted
+ * by layer and image, and they are binned into the tiles that they overlap.
+ * A tile then draws its own sprites in one pass, while its pixels and the
+ * images of its sprites stay in the cache.
+ *
+ * The sprites of a lower layer are drawn below the ones of a higher layer.
+ * Inside of a layer, the sprites are grouped by image, and the sprites of the
+ * same image are drawn in the order that they were added, so the overlapping
+ * sprites of different images need different layers.
+ */
+class SpriteBatch
+{
+public:
+    static constexpr uint32_t DefaultCapacity = 32768;
+
+    SpriteBatch();
+
+    // The zone must stay untouched until the frame is rendered, such as the
+    // zone of the render snapshot.
+    bool begin(MemoryZone *theZone, uint32_t theCapacity = DefaultCapacity);
+
+    void addSprite(uint16_t layer, const Image *image, int32_t destX, int32_t destY,
+        BlitMode::Mode mode = BlitMode::AlphaBlend, uint32_t color = 0xffffffff)
+    {
+        addSpriteRegion(layer, image, 0, 0, int32_t(image->width), int32_t(image->height), destX, destY, mode, color);
+    }
+
+    void addSpriteRegion(uint16_t layer, const Image *image, int32_t sourceX, int32_t sourceY, int32_t sourceWidth, int32_t sourceHeight,
+        int32_t destX, int32_t destY, BlitMode::Mode mode = BlitMode::AlphaBlend, uint32_t color = 0xffffffff)
+    {
+        if(count == capacity)
+        {
+            ++droppedCount;
+            return;
+        }
+
+        auto &command = commands[count++];
+        command.image = image;
+        command.sourceX = sourceX;
+        command.sourceY = sourceY;
+        command.sourceWidth = sourceWidth;
+        command.sourceHeight = sourceHeight;
+        command.destX = destX;
+        command.destY = destY;
+        command.color = color;
+        command.layer = layer;
+        command.mode = uint8_t(mode);
+    }
+
+    // Culls, sorts and bins the sprites. Called once, from GameInterface::render.
+    void prepare(const Framebuffer &framebuffer);
+
+    // Draws the sprites inside of the tile. Called concurrently from
+    // GameInterface::renderTile, after prepare.
+    void renderTile(const Framebuffer &framebuffer, const FramebufferTile &tile) const;
+
+    uint32_t getSpriteCount() const
+    {
+        return count;
+    }
+
+    uint32_t getVisibleSpriteCount() const
+    {
+        return visibleCount;
+    }
+
+    // The sprites that did not fit in the capacity.
+    uint32_t getDroppedSpriteCount() const
+    {
+        return droppedCount;
+    }
+
+private:
+    struct SortEntry
+    {
+        uint32_t key;
+        uint32_t commandIndex;
+    };
+
+    // Clips the sprite against its image, and returns its rectangle in the
+    // framebuffer, which is empty when it is culled.
+    static BlitClipRect getDestRect(const SpriteCommand &command, const Framebuffer &framebuffer);
+
+    void renderCell(const Framebuffer &framebuffer, uint32_t cellIndex, const BlitClipRect &clipRect) const;
+
+    MemoryZone *zone;
+    SpriteCommand *commands;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t droppedCount;
+
+    // The result of prepare. The sprites of a cell of FramebufferTileSize
+    // pixels are cellSprites[cellFirstSprites[cell]] up to the first sprite
+    // of the next cell, in the drawing order.
+    uint32_t visibleCount;
+    uint32_t cellColumns;
+    uint32_t cellRows;
+    uint32_t *cellFirstSprites;
+    uint32_t *cellSprites;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_SPRITE_BATCH_HPP
@@ -0,0 +1,141 @@
+#include "Blitter.hpp"
+#include "SpriteBatch.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+static constexpr uint32_t FramebufferWidth = 320;
+static constexpr uint32_t FramebufferHeight = 200;
+static constexpr uint32_t SpriteCount = 3000;
+
+static void makeImage(Image &image, uint32_t width, uint32_t height, uint32_t seed)
+{
+    image.width = width;
+    image.height = height;
+    image.bpp = 32;
+    image.pitch = width*4;
+    image.data.reset(new uint8_t[image.pitch*height]);
+    image.pixels = image.data.get();
+
+    // Random colors with every kind of alpha, and some pixels of the key color.
+    std::mt19937 random(seed);
+    auto pixels = reinterpret_cast<uint32_t*> (image.data.get());
+    for(uint32_t i = 0; i < width*height; ++i)
+    {
+        auto pixel = random();
+        if(i % 7 == 0)
+            pixel = 0xffff00ff;
+        else if(i % 5 == 0)
+            pixel |= 0xff000000;
+        pixels[i] = pixel;
+    }
+}
+
+static Framebuffer makeFramebuffer(std::vector<FramebufferPixel> &pixels, FramebufferDirtyRegion &dirtyRegion)
+{
+    pixels.assign(FramebufferWidth*FramebufferHeight, FramebufferFormat::fromABGR8888(0xff402010));
+    Framebuffer framebuffer;
+    framebuffer.width = FramebufferWidth;
+    framebuffer.height = FramebufferHeight;
+    framebuffer.pitch = int(FramebufferWidth*sizeof(FramebufferPixel));
+    framebuffer.pixels = reinterpret_cast<uint8_t*> (pixels.data());
+    framebuffer.scale = 1.0f;
+    framebuffer.dirtyRegion = &dirtyRegion;
+    dirtyRegion.clear();
+    return framebuffer;
+}
+
+// Draws the sprites of a batch tile by tile, and the same sprites one at a
+// time into the whole framebuffer, in the order that the batch promises.
+int main()
+{
+    Image images[3];
+    makeImage(images[0], 16, 16, 1);
+    makeImage(images[1], 24, 8, 2);
+    makeImage(images[2], 80, 72, 3);
+
+    std::vector<SpriteCommand> commands;
+    std::mt19937 random(4);
+    for(uint32_t i = 0; i < SpriteCount; ++i)
+    {
+        // Some of the sprites are partially or completely outside.
+        SpriteCommand command;
+        auto &image = images[random() % 3];
+        command.image = &image;
+        command.sourceX = int32_t(random() % 12) - 4;
+        command.sourceY = int32_t(random() % 12) - 4;
+        command.sourceWidth = int32_t(random() % (image.width + 8));
+        command.sourceHeight = int32_t(random() % (image.height + 8));
+        command.destX = int32_t(random() % (FramebufferWidth + 200)) - 100;
+        command.destY = int32_t(random() % (FramebufferHeight + 200)) - 100;
+        command.color = random() | 0x80000000;
+        command.layer = uint16_t(random() % 4)*300;
+        command.mode = uint8_t(random() % 4);
+
+        // The first sprite of every image is visible, so the images are
+        // numbered in the order of their first sprites.
+        if(i < 3)
+        {
+            command.image = &images[i];
+            command.sourceX = 0;
+            command.sourceY = 0;
+            command.sourceWidth = int32_t(images[i].width);
+            command.sourceHeight = int32_t(images[i].height);
+            command.destX = int32_t(i*100);
+            command.destY = 10;
+        }
+        commands.push_back(command);
+    }
+
+    MemoryZone zone;
+    zone.reserve(4*1024*1024, MemoryZoneBackend::Heap);
+    SpriteBatch batch;
+    if(!batch.begin(&zone, SpriteCount))
+        return 1;
+    for(auto &command : commands)
+    {
+        batch.addSpriteRegion(command.layer, command.image, command.sourceX, command.sourceY, command.sourceWidth, command.sourceHeight,
+            command.destX, command.destY, BlitMode::Mode(command.mode), command.color);
+    }
+
+    FramebufferDirtyRegion batchDirtyRegion;
+    std::vector<FramebufferPixel> batchPixels;
+    auto batchFramebuffer = makeFramebuffer(batchPixels, batchDirtyRegion);
+    batch.prepare(batchFramebuffer);
+    for(uint32_t y = 0; y < FramebufferHeight; y += FramebufferTileSize)
+    {
+        for(uint32_t x = 0; x < FramebufferWidth; x += FramebufferTileSize)
+        {
+            FramebufferTile tile = {x, y, std::min(FramebufferTileSize, FramebufferWidth - x), std::min(FramebufferTileSize, FramebufferHeight - y)};
+            batch.renderTile(batchFramebuffer, tile);
+        }
+    }
+
+    // The layers go first, and inside of a layer the images in the order of
+    // their first sprite. The sort keeps the order of the sprites of an image.
+    std::stable_sort(commands.begin(), commands.end(), [](const SpriteCommand &first, const SpriteCommand &second) {
+        if(first.layer != second.layer)
+            return first.layer < second.layer;
+        return first.image < second.image;
+    });
+
+    FramebufferDirtyRegion referenceDirtyRegion;
+    std::vector<FramebufferPixel> referencePixels;
+    auto referenceFramebuffer = makeFramebuffer(referencePixels, referenceDirtyRegion);
+    for(auto &command : commands)
+    {
+        blitImageRegion(referenceFramebuffer, BlitClipRect::forFramebuffer(referenceFramebuffer), *command.image,
+            command.sourceX, command.sourceY, command.sourceWidth, command.sourceHeight,
+            command.destX, command.destY, BlitMode::Mode(command.mode), command.color);
+    }
+
+    uint32_t differentPixelCount = 0;
+    for(size_t i = 0; i < batchPixels.size(); ++i)
+        differentPixelCount += memcmp(&batchPixels[i], &referencePixels[i], sizeof(FramebufferPixel)) != 0 ? 1 : 0;
+
+    printf("SpriteBatch: %u of %u sprites visible, %u different pixels from the immediate blits\n",
+        batch.getVisibleSpriteCount(), batch.getSpriteCount(), differentPixelCount);
+    return differentPixelCount == 0 && batch.getDroppedSpriteCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#ifndef SIMPLE_GAME_TEMPLATE_SPSC_QUEUE_HPP
+#define SIMPLE_GAME_TEMPLATE_SPSC_QUEUE_HPP
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * A bounded lock free queue with a single producer thread and a single
+ * consumer thread. Neither side ever blocks or allocates memory, so it is
+ * suitable for talking with real time threads such as the audio callback.
+ */
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+public:
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "The capacity must be a power of two");
+
+    SpscQueue()
+        : readIndex(0), writeIndex(0) {}
+
+    // Producer side. Returns false when the queue is full.
+    bool push(const T &value)
+    {
+        auto write = writeIndex.load(std::memory_order_relaxed);
+        if(write - readIndex.load(std::memory_order_acquire) == Capacity)
+            return false;
+
+        elements[write & (Capacity - 1)] = value;
+        writeIndex.store(write + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. Returns false when the queue is empty.
+    bool pop(T &result)
+    {
+        auto read = readIndex.load(std::memory_order_relaxed);
+        if(read == writeIndex.load(std::memory_order_acquire))
+            return false;
+
+        result = elements[read & (Capacity - 1)];
+        readIndex.store(read + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T elements[Capacity];
+
+    // The indices are kept in separate cache lines, so that the producer and
+    // the consumer do not invalidate each other.
+    alignas(64) std::atomic<size_t> readIndex;
+    alignas(64) std::atomic<size_t> writeIndex;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_SPSC_QUEUE_HPP
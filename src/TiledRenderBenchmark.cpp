@@ -0,0 +1,134 @@
+#include "GameInterface.hpp"
+#include "HostInterface.hpp"
+#include "Profiler.hpp"
+#include "TiledRenderer.hpp"
+#include "WorkerThreadPool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+
+extern "C" GameInterface *getGameInterface();
+
+// The rendering does not load assets, so the host only provides the profiler,
+// and the update loops run inline.
+class BenchmarkHostInterface : public HostInterface
+{
+public:
+    virtual Image *loadImage(const char *) override { return nullptr; }
+    virtual SoundSamplePtr loadSoundSample(const char *) override { return nullptr; }
+    virtual SoundSamplePtr openSoundStream(const char *) override { return nullptr; }
+
+    virtual AssetHandle requestImage(const char *, AssetLoadPriority::Type) override { return 0; }
+    virtual AssetHandle requestSoundSample(const char *, AssetLoadPriority::Type) override { return 0; }
+    virtual AssetLoadStatus::Type getAssetLoadStatus(AssetHandle) override { return AssetLoadStatus::Invalid; }
+    virtual Image *getLoadedImage(AssetHandle) override { return nullptr; }
+    virtual SoundSamplePtr getLoadedSoundSample(AssetHandle) override { return nullptr; }
+    virtual void releaseAsset(AssetHandle) override {}
+
+    virtual uint32_t registerProfileZone(const char *name) override
+    {
+        return Profiler::singleton.registerProfileZone(name);
+    }
+
+    virtual void recordProfileZone(uint32_t zoneId, uint64_t startTime, uint64_t endTime) override
+    {
+        Profiler::singleton.recordProfileZone(zoneId, startTime, endTime);
+    }
+
+    virtual void parallelFor(size_t count, HostParallelForFunction function, void *userData) override
+    {
+        for(size_t i = 0; i < count; ++i)
+            function(userData, i);
+    }
+
+    static BenchmarkHostInterface singleton;
+};
+
+BenchmarkHostInterface BenchmarkHostInterface::singleton;
+
+static double measureFrameTime(GameInterface *gameInterface, const Framebuffer &framebuffer, const RenderSnapshot &snapshot, size_t threadCount, int frameCount)
+{
+    WorkerThreadPool threadPool;
+    threadPool.start(threadCount);
+
+    // Warm up the caches and the worker threads.
+    gameInterface->render(framebuffer, snapshot);
+    renderFramebufferTiles(threadPool, gameInterface, framebuffer, snapshot);
+
+    auto startTime = std::chrono::steady_clock::now();
+    for(int i = 0; i < frameCount; ++i)
+    {
+        gameInterface->render(framebuffer, snapshot);
+        renderFramebufferTiles(threadPool, gameInterface, framebuffer, snapshot);
+    }
+    auto endTime = std::chrono::steady_clock::now();
+
+    return std::chrono::duration<double, std::milli> (endTime - startTime).count() / frameCount;
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = 640;
+    uint32_t height = 480;
+    int frameCount = 500;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--frames" && i + 1 < argc)
+            frameCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--width" && i + 1 < argc)
+            width = std::max(1, atoi(argv[++i]));
+        else if(arg == "--height" && i + 1 < argc)
+            height = std::max(1, atoi(argv[++i]));
+    }
+
+    MemoryZone persistentMemory;
+    MemoryZone transientMemory;
+    MemoryZone snapshotMemory;
+    MemoryZone cacheMemory;
+    persistentMemory.reserve(PersistentMemorySize);
+    transientMemory.reserve(TransientMemorySize);
+    snapshotMemory.reserve(RenderSnapshotMemorySize);
+    cacheMemory.reserve(RenderCacheMemorySize);
+
+    auto gameInterface = getGameInterface();
+    gameInterface->setPersistentMemory(&persistentMemory);
+    gameInterface->setTransientMemory(&transientMemory);
+    gameInterface->setHostInterface(&BenchmarkHostInterface::singleton);
+
+    // Every frame renders the same snapshot.
+    snapshotMemory.beginFrame();
+    auto snapshotData = gameInterface->makeRenderSnapshot(&snapshotMemory);
+    RenderSnapshot snapshot = {snapshotData, &snapshotMemory, &cacheMemory, 1.0f};
+
+    // Every tile is rendered, whatever the dirty region of the game is.
+    FramebufferDirtyRegion dirtyRegion;
+    dirtyRegion.clear();
+
+    Framebuffer framebuffer;
+    framebuffer.width = width;
+    framebuffer.height = height;
+    framebuffer.pitch = int(width*sizeof(FramebufferPixel));
+    framebuffer.scale = 1.0f;
+    std::unique_ptr<uint8_t[]> pixels(new uint8_t[framebuffer.pitch*height]);
+    framebuffer.pixels = pixels.get();
+    framebuffer.dirtyRegion = &dirtyRegion;
+
+    printf("Tiled rendering %ux%u, %d frames, %u hardware threads\n", width, height, frameCount, unsigned(WorkerThreadPool::getDefaultThreadCount()));
+    printf("threads  ms/frame  speedup\n");
+
+    double singleThreadTime = 0;
+    static const size_t threadCounts[] = {1, 2, 4, 8};
+    for(auto threadCount : threadCounts)
+    {
+        auto frameTime = measureFrameTime(gameInterface, framebuffer, snapshot, threadCount, frameCount);
+        if(threadCount == 1)
+            singleThreadTime = frameTime;
+        printf("%7u  %8.3f  %6.2fx\n", unsigned(threadCount), frameTime, singleThreadTime / frameTime);
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#include "TiledRenderer.hpp"
+#include "GameInterface.hpp"
+#include "Profiler.hpp"
+#include <algorithm>
+
+namespace
+{
+
+struct TiledRenderJob
+{
+    GameInterface *gameInterface;
+    const Framebuffer *framebuffer;
+    const RenderSnapshot *snapshot;
+    const FramebufferDirtyRegion *region;
+    uint32_t tileColumns;
+};
+
+void renderTileJob(void *userData, size_t index)
+{
+    auto job = reinterpret_cast<TiledRenderJob*> (userData);
+    auto &framebuffer = *job->framebuffer;
+
+    FramebufferTile tile;
+    tile.x = uint32_t(index % job->tileColumns) * FramebufferTileSize;
+    tile.y = uint32_t(index / job->tileColumns) * FramebufferTileSize;
+    tile.width = std::min(FramebufferTileSize, framebuffer.width - tile.x);
+    tile.height = std::min(FramebufferTileSize, framebuffer.height - tile.y);
+    if(job->region)
+    {
+        // The tile shrinks to the bounding box of the region inside of it.
+        FramebufferTile clippedTile = {0, 0, 0, 0};
+        for(uint32_t i = 0; i < job->region->rectCount; ++i)
+            clippedTile = clippedTile.boundingBox(job->region->rects[i].intersection(tile));
+        if(clippedTile.isEmpty())
+            return;
+        tile = clippedTile;
+    }
+
+    PROFILE_ZONE("Render tile");
+    job->gameInterface->renderTile(framebuffer, *job->snapshot, tile);
+}
+
+}
+
+void renderFramebufferTiles(WorkerThreadPool &threadPool, GameInterface *gameInterface, const Framebuffer &framebuffer, const RenderSnapshot &snapshot, const FramebufferDirtyRegion *region)
+{
+    if(region && region->isEmpty())
+        return;
+
+    TiledRenderJob job;
+    job.gameInterface = gameInterface;
+    job.framebuffer = &framebuffer;
+    job.snapshot = &snapshot;
+    job.region = region;
+    job.tileColumns = (framebuffer.width + FramebufferTileSize - 1) / FramebufferTileSize;
+    auto tileRows = (framebuffer.height + FramebufferTileSize - 1) / FramebufferTileSize;
+
+    threadPool.parallelFor(job.tileColumns*tileRows, renderTileJob, &job);
+}
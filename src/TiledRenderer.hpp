@@ -0,0 +1,20 @@
+#ifndef SIMPLE_GAME_TEMPLATE_TILED_RENDERER_HPP
+#define SIMPLE_GAME_TEMPLATE_TILED_RENDERER_HPP
+
+#include "Framebuffer.hpp"
+#include "WorkerThreadPool.hpp"
+
+struct GameInterface;
+struct RenderSnapshot;
+
+/**
+ * Splits the framebuffer into tiles of FramebufferTileSize pixels and renders
+ * them with GameInterface::renderTile on the worker thread pool. This returns
+ * once every tile has been rendered. With a region, only the parts of the
+ * tiles that overlap it are rendered, and the rest of the framebuffer keeps
+ * its pixels.
+ */
+void renderFramebufferTiles(WorkerThreadPool &threadPool, GameInterface *gameInterface, const Framebuffer &framebuffer, const RenderSnapshot &snapshot,
+    const FramebufferDirtyRegion *region = nullptr);
+
+#endif //SIMPLE_GAME_TEMPLATE_TILED_RENDERER_HPP
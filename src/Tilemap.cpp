@@ -0,0 +1,290 @@
+#include "Tilemap.hpp"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+namespace
+{
+
+// Blends the tiles of a chunk, whose top left corner is at the origin, over
+// the pixels of the framebuffer. Only the tiles that overlap the clip
+// rectangle are drawn.
+void drawChunkTiles(const Framebuffer &framebuffer, const BlitClipRect &clipRect, const TilemapChunk &tiles, uint32_t layerCount,
+    const Image *atlas, uint32_t tileSize, int32_t originX, int32_t originY)
+{
+    if(!atlas || !atlas->pixels || atlas->width < tileSize)
+        return;
+
+    auto size = int32_t(tileSize);
+    auto lastIndex = int32_t(TilemapChunkSize) - 1;
+    auto firstColumn = std::max((clipRect.minX - originX) / size, 0);
+    auto firstRow = std::max((clipRect.minY - originY) / size, 0);
+    auto lastColumn = std::min((clipRect.maxX - originX - 1) / size, lastIndex);
+    auto lastRow = std::min((clipRect.maxY - originY - 1) / size, lastIndex);
+    auto atlasColumns = atlas->width / tileSize;
+    for(uint32_t layer = 0; layer < layerCount; ++layer)
+    {
+        auto layerTiles = tiles.tiles[layer];
+        for(auto row = firstRow; row <= lastRow; ++row)
+        {
+            for(auto column = firstColumn; column <= lastColumn; ++column)
+            {
+                auto tile = layerTiles[row*int32_t(TilemapChunkSize) + column];
+                if(tile == 0)
+                    continue;
+
+                auto sourceX = int32_t(((tile - 1u) % atlasColumns)*tileSize);
+                auto sourceY = int32_t(((tile - 1u) / atlasColumns)*tileSize);
+                blitImageRegion(framebuffer, clipRect, *atlas, sourceX, sourceY, size, size,
+                    originX + column*size, originY + row*size, BlitMode::AlphaBlend);
+            }
+        }
+    }
+}
+
+}
+
+size_t Tilemap::getStorageSize(uint32_t theWidth, uint32_t theHeight, uint32_t theLayerCount)
+{
+    size_t chunkColumns = (theWidth + TilemapChunkSize - 1) / TilemapChunkSize;
+    size_t chunkRows = (theHeight + TilemapChunkSize - 1) / TilemapChunkSize;
+    return chunkColumns*chunkRows*theLayerCount*TilemapChunkTileCount*sizeof(TileIndex);
+}
+
+bool Tilemap::initialize(uint8_t *storage, uint32_t theWidth, uint32_t theHeight, uint32_t theLayerCount, uint32_t theTileSize, uint32_t theBackgroundColor)
+{
+    // The pixels of the level are addressed with int32_t.
+    if(!storage || theLayerCount > TilemapMaxLayerCount || theTileSize == 0 ||
+        uint64_t(theWidth)*theTileSize > INT32_MAX || uint64_t(theHeight)*theTileSize > INT32_MAX)
+    {
+        fprintf(stderr, "Invalid tilemap of %ux%u tiles with %u layers\n", theWidth, theHeight, theLayerCount);
+        return false;
+    }
+
+    width = theWidth;
+    height = theHeight;
+    layerCount = theLayerCount;
+    tileSize = theTileSize;
+    backgroundColor = theBackgroundColor;
+    chunks = reinterpret_cast<TileIndex*> (storage);
+    memset(storage, 0, getStorageSize(width, height, layerCount));
+    return true;
+}
+
+TilemapChunkCache::TilemapChunkCache()
+    : slots(nullptr), slotCount(0), tileSize(0), chunkPixelSize(0), frame(0), renderedChunkCount(0)
+{
+}
+
+bool TilemapChunkCache::initialize(MemoryZone *zone, uint32_t theTileSize, uint32_t theSlotCount)
+{
+    tileSize = theTileSize;
+    chunkPixelSize = tileSize*TilemapChunkSize;
+    slots = zone->allocateArray<Slot> (theSlotCount);
+    slotCount = 0;
+    if(!slots)
+        return false;
+
+    auto chunkByteSize = size_t(getChunkPitch())*chunkPixelSize;
+    for(; slotCount < theSlotCount; ++slotCount)
+    {
+        if(zone->getSize() - zone->getMarker() < chunkByteSize + MemoryZone::DefaultAlignment)
+            break;
+        slots[slotCount].pixels = zone->allocateBytes(chunkByteSize);
+    }
+
+    return slotCount > 0;
+}
+
+void TilemapChunkCache::beginFrame()
+{
+    ++frame;
+    renderedChunkCount = 0;
+}
+
+const uint8_t *TilemapChunkCache::getChunkPixels(int32_t chunkX, int32_t chunkY, const TilemapChunk &tiles, uint32_t layerCount,
+    const Image *atlas, uint32_t backgroundColor)
+{
+    // A chunk is cached at most once, so the slot at its position is either
+    // a hit or stale.
+    Slot *freeSlot = nullptr;
+    for(uint32_t i = 0; i < slotCount; ++i)
+    {
+        auto &slot = slots[i];
+        if(slot.isValid && slot.chunkX == chunkX && slot.chunkY == chunkY)
+        {
+            freeSlot = &slot;
+            break;
+        }
+
+        if(!freeSlot || !slot.isValid || (freeSlot->isValid && slot.lastUsedFrame < freeSlot->lastUsedFrame))
+            freeSlot = &slot;
+    }
+
+    if(!freeSlot || (freeSlot->isValid && freeSlot->lastUsedFrame == frame && (freeSlot->chunkX != chunkX || freeSlot->chunkY != chunkY)))
+        return nullptr;
+
+    auto &slot = *freeSlot;
+    auto isHit = slot.isValid && slot.chunkX == chunkX && slot.chunkY == chunkY && slot.atlas == atlas &&
+        slot.layerCount == layerCount && slot.backgroundColor == backgroundColor &&
+        memcmp(slot.tiles.tiles, tiles.tiles, sizeof(TileIndex)*TilemapChunkTileCount*layerCount) == 0;
+    slot.lastUsedFrame = frame;
+    if(isHit)
+        return slot.pixels;
+
+    slot.isValid = true;
+    slot.chunkX = chunkX;
+    slot.chunkY = chunkY;
+    slot.atlas = atlas;
+    slot.layerCount = layerCount;
+    slot.backgroundColor = backgroundColor;
+    memcpy(slot.tiles.tiles, tiles.tiles, sizeof(TileIndex)*TilemapChunkTileCount*layerCount);
+    renderChunk(slot);
+    ++renderedChunkCount;
+    return slot.pixels;
+}
+
+void TilemapChunkCache::renderChunk(Slot &slot)
+{
+    Framebuffer chunkFramebuffer;
+    chunkFramebuffer.width = chunkPixelSize;
+    chunkFramebuffer.height = chunkPixelSize;
+    chunkFramebuffer.pitch = int(getChunkPitch());
+    chunkFramebuffer.scale = 1.0f;
+    chunkFramebuffer.pixels = slot.pixels;
+    chunkFramebuffer.dirtyRegion = nullptr;
+
+    auto firstRow = chunkFramebuffer.getRow(0);
+    std::fill(firstRow, firstRow + chunkPixelSize, FramebufferFormat::fromABGR8888(slot.backgroundColor));
+    for(uint32_t y = 1; y < chunkPixelSize; ++y)
+        memcpy(slot.pixels + y*getChunkPitch(), firstRow, getChunkPitch());
+
+    drawChunkTiles(chunkFramebuffer, BlitClipRect::forFramebuffer(chunkFramebuffer), slot.tiles, slot.layerCount, slot.atlas, tileSize, 0, 0);
+}
+
+TilemapView::TilemapView()
+    : atlas(nullptr), layerCount(0), tileSize(0), backgroundColor(0), scrollX(0), scrollY(0),
+      pixelWidth(0), pixelHeight(0), chunkPitch(0), chunks(nullptr), chunkCount(0)
+{
+}
+
+bool TilemapView::begin(MemoryZone *zone, const Tilemap &tilemap, const Image *theAtlas,
+    int32_t theScrollX, int32_t theScrollY, uint32_t viewWidth, uint32_t viewHeight)
+{
+    atlas = theAtlas;
+    layerCount = tilemap.layerCount;
+    tileSize = tilemap.tileSize;
+    backgroundColor = tilemap.backgroundColor;
+    scrollX = theScrollX;
+    scrollY = theScrollY;
+    pixelWidth = int32_t(tilemap.width*tileSize);
+    pixelHeight = int32_t(tilemap.height*tileSize);
+    chunkCount = 0;
+    chunks = nullptr;
+
+    // The chunks that overlap the view, clamped to the tilemap.
+    auto chunkPixelSize = int32_t(tileSize*TilemapChunkSize);
+    auto firstColumn = std::max(scrollX, 0) / chunkPixelSize;
+    auto firstRow = std::max(scrollY, 0) / chunkPixelSize;
+    auto lastColumn = std::min(scrollX + int32_t(viewWidth), pixelWidth) - 1;
+    auto lastRow = std::min(scrollY + int32_t(viewHeight), pixelHeight) - 1;
+    if(lastColumn < 0 || lastRow < 0)
+        return true;
+    lastColumn /= chunkPixelSize;
+    lastRow /= chunkPixelSize;
+    if(firstColumn > lastColumn || firstRow > lastRow)
+        return true;
+
+    auto maxChunkCount = uint32_t((lastColumn - firstColumn + 1)*(lastRow - firstRow + 1));
+    chunks = reinterpret_cast<VisibleChunk*> (zone->allocateBytes(sizeof(VisibleChunk)*maxChunkCount, alignof(VisibleChunk)));
+    if(!chunks)
+        return false;
+
+    auto copiedSize = sizeof(TileIndex)*TilemapChunkTileCount*layerCount;
+    for(auto row = firstRow; row <= lastRow; ++row)
+    {
+        for(auto column = firstColumn; column <= lastColumn; ++column)
+        {
+            auto &chunk = chunks[chunkCount++];
+            chunk.chunkX = column;
+            chunk.chunkY = row;
+            chunk.pixels = nullptr;
+            memcpy(chunk.tiles.tiles, tilemap.getChunk(uint32_t(column), uint32_t(row)), copiedSize);
+        }
+    }
+
+    return true;
+}
+
+void TilemapView::prepare(TilemapChunkCache &cache)
+{
+    chunkPitch = cache.getChunkPitch();
+    if(cache.getTileSize() != tileSize)
+        return;
+
+    cache.beginFrame();
+    for(uint32_t i = 0; i < chunkCount; ++i)
+    {
+        auto &chunk = chunks[i];
+        chunk.pixels = cache.getChunkPixels(chunk.chunkX, chunk.chunkY, chunk.tiles, layerCount, atlas, backgroundColor);
+    }
+}
+
+void TilemapView::renderTile(const Framebuffer &framebuffer, const FramebufferTile &tile) const
+{
+    // The view at scroll is drawn at the origin of the framebuffer.
+    auto tileMinX = int32_t(tile.x);
+    auto tileMinY = int32_t(tile.y);
+    auto tileMaxX = int32_t(tile.x + tile.width);
+    auto tileMaxY = int32_t(tile.y + tile.height);
+
+    // The background is only filled where the tilemap does not cover the tile.
+    auto mapMinX = std::max(tileMinX, -scrollX);
+    auto mapMinY = std::max(tileMinY, -scrollY);
+    auto mapMaxX = std::min(tileMaxX, pixelWidth - scrollX);
+    auto mapMaxY = std::min(tileMaxY, pixelHeight - scrollY);
+    auto isCovered = mapMinX == tileMinX && mapMinY == tileMinY && mapMaxX == tileMaxX && mapMaxY == tileMaxY;
+    if(!isCovered)
+        fillSurfaceRect(framebuffer.getView(), tile.x, tile.y, tile.width, tile.height, backgroundColor);
+
+    auto chunkPixelSize = int32_t(tileSize*TilemapChunkSize);
+    for(uint32_t i = 0; i < chunkCount; ++i)
+    {
+        auto &chunk = chunks[i];
+        auto chunkMinX = chunk.chunkX*chunkPixelSize - scrollX;
+        auto chunkMinY = chunk.chunkY*chunkPixelSize - scrollY;
+        auto minX = std::max(std::max(chunkMinX, mapMinX), tileMinX);
+        auto minY = std::max(std::max(chunkMinY, mapMinY), tileMinY);
+        auto maxX = std::min(std::min(chunkMinX + chunkPixelSize, mapMaxX), tileMaxX);
+        auto maxY = std::min(std::min(chunkMinY + chunkPixelSize, mapMaxY), tileMaxY);
+        if(minX >= maxX || minY >= maxY)
+            continue;
+
+        if(!chunk.pixels)
+        {
+            renderUncachedChunk(framebuffer, chunk, chunkMinX, chunkMinY, minX, minY, maxX, maxY);
+            continue;
+        }
+
+        auto pixelSize = int32_t(sizeof(FramebufferPixel));
+        auto source = chunk.pixels + (minY - chunkMinY)*chunkPitch + (minX - chunkMinX)*pixelSize;
+        auto dest = framebuffer.pixels + minY*framebuffer.pitch + minX*pixelSize;
+        auto rowSize = size_t(maxX - minX)*pixelSize;
+        for(auto y = minY; y < maxY; ++y)
+        {
+            memcpy(dest, source, rowSize);
+            source += chunkPitch;
+            dest += framebuffer.pitch;
+        }
+    }
+}
+
+// The same pixels as the cached chunk, drawn only inside of the tile, which
+// costs a blit per tile instead of a copy per row.
+void TilemapView::renderUncachedChunk(const Framebuffer &framebuffer, const VisibleChunk &chunk, int32_t chunkMinX, int32_t chunkMinY,
+    int32_t minX, int32_t minY, int32_t maxX, int32_t maxY) const
+{
+    fillSurfaceRect(framebuffer.getView(), uint32_t(minX), uint32_t(minY), uint32_t(maxX - minX), uint32_t(maxY - minY), backgroundColor);
+    BlitClipRect clipRect = {minX, minY, maxX, maxY};
+    drawChunkTiles(framebuffer, clipRect, chunk.tiles, layerCount, atlas, tileSize, chunkMinX, chunkMinY);
+}
@@ -0,0 +1,211 @@
+#ifndef SIMPLE_GAME_TEMPLATE_TILEMAP_HPP
+#define SIMPLE_GAME_TEMPLATE_TILEMAP_HPP
+
+#include "Blitter.hpp"
+#include "MemoryZone.hpp"
+#include "OffsetPointer.hpp"
+
+static constexpr uint32_t TilemapChunkSize = 16;
+static constexpr uint32_t TilemapChunkTileCount = TilemapChunkSize*TilemapChunkSize;
+static constexpr uint32_t TilemapMaxLayerCount = 4;
+
+// The tiles of an atlas are numbered row by row starting from one, and zero
+// is an empty tile.
+typedef uint16_t TileIndex;
+
+struct TilemapChunk
+{
+    TileIndex tiles[TilemapMaxLayerCount][TilemapChunkTileCount];
+};
+
+/**
+ * The tile indices of a level with up to four layers, which are drawn on top
+ * of each other. The tiles are stored chunk by chunk, so that the tiles of a
+ * chunk are copied into a render snapshot at once. A chunk holds the tiles of
+ * its layers one after the other, like the first layers of a TilemapChunk.
+ * The chunks are allocated for the size of the level, and like EntityStore,
+ * the tilemap only has OffsetPointers, so it can live in the persistent
+ * memory.
+ */
+struct Tilemap
+{
+    uint32_t width;
+    uint32_t height;
+    uint32_t layerCount;
+    uint32_t tileSize;
+    uint32_t backgroundColor;
+    OffsetPointer<TileIndex> chunks;
+
+    // The number of bytes that initialize needs.
+    static size_t getStorageSize(uint32_t theWidth, uint32_t theHeight, uint32_t theLayerCount);
+
+    // Clears all of the tiles. Returns false when the storage is missing or
+    // the level is too large for the coordinates of its pixels.
+    bool initialize(uint8_t *storage, uint32_t theWidth, uint32_t theHeight, uint32_t theLayerCount, uint32_t theTileSize, uint32_t theBackgroundColor);
+
+    TileIndex getTile(uint32_t layer, uint32_t x, uint32_t y) const
+    {
+        if(layer >= layerCount || x >= width || y >= height)
+            return 0;
+        return getChunk(x / TilemapChunkSize, y / TilemapChunkSize)[layer*TilemapChunkTileCount + (y % TilemapChunkSize)*TilemapChunkSize + x % TilemapChunkSize];
+    }
+
+    void setTile(uint32_t layer, uint32_t x, uint32_t y, TileIndex tile)
+    {
+        if(layer >= layerCount || x >= width || y >= height)
+            return;
+        auto chunk = chunks.get() + getChunkOffset(x / TilemapChunkSize, y / TilemapChunkSize);
+        chunk[layer*TilemapChunkTileCount + (y % TilemapChunkSize)*TilemapChunkSize + x % TilemapChunkSize] = tile;
+    }
+
+    // The tiles of the layers of a chunk.
+    const TileIndex *getChunk(uint32_t chunkX, uint32_t chunkY) const
+    {
+        return chunks.get() + getChunkOffset(chunkX, chunkY);
+    }
+
+    size_t getChunkOffset(uint32_t chunkX, uint32_t chunkY) const
+    {
+        return (size_t(chunkY)*getChunkColumns() + chunkX)*layerCount*TilemapChunkTileCount;
+    }
+
+    uint32_t getChunkColumns() const
+    {
+        return (width + TilemapChunkSize - 1) / TilemapChunkSize;
+    }
+
+    uint32_t getChunkRows() const
+    {
+        return (height + TilemapChunkSize - 1) / TilemapChunkSize;
+    }
+};
+
+/**
+ * Pre-rendered chunks of a tilemap, with all of their layers composited on the
+ * background color. A chunk is rendered again only when its tiles differ from
+ * the ones that it was rendered from. It is meant to be allocated from the
+ * cache memory of the render snapshot, which is kept between the frames, and
+ * only used by the rendering. GameInterface::render allocates the cache and
+ * initializes it again whenever that zone is empty, because the host has
+ * cleared it.
+ */
+class TilemapChunkCache
+{
+public:
+    static constexpr uint32_t DefaultSlotCount = 32;
+
+    TilemapChunkCache();
+
+    // Allocates the chunk bitmaps from the zone. Fewer slots are allocated
+    // when the zone does not have room for all of them.
+    bool initialize(MemoryZone *zone, uint32_t theTileSize, uint32_t theSlotCount = DefaultSlotCount);
+
+    bool isInitialized() const
+    {
+        return slotCount > 0;
+    }
+
+    uint32_t getTileSize() const
+    {
+        return tileSize;
+    }
+
+    // The chunks of a frame are not evicted in the same frame.
+    void beginFrame();
+
+    // Returns nullptr when every slot is used in this frame, and the view then
+    // draws the tiles of the chunk directly.
+    const uint8_t *getChunkPixels(int32_t chunkX, int32_t chunkY, const TilemapChunk &tiles, uint32_t layerCount,
+        const Image *atlas, uint32_t backgroundColor);
+
+    uint32_t getChunkPitch() const
+    {
+        return chunkPixelSize*uint32_t(sizeof(FramebufferPixel));
+    }
+
+    // The chunks that were rendered in this frame.
+    uint32_t getRenderedChunkCount() const
+    {
+        return renderedChunkCount;
+    }
+
+private:
+    struct Slot
+    {
+        bool isValid;
+        int32_t chunkX;
+        int32_t chunkY;
+        const Image *atlas;
+        uint32_t layerCount;
+        uint32_t backgroundColor;
+        uint64_t lastUsedFrame;
+        TilemapChunk tiles;
+        uint8_t *pixels;
+    };
+
+    void renderChunk(Slot &slot);
+
+    Slot *slots;
+    uint32_t slotCount;
+    uint32_t tileSize;
+    uint32_t chunkPixelSize;
+    uint64_t frame;
+    uint32_t renderedChunkCount;
+};
+
+/**
+ * The part of a tilemap that is visible in a frame. It is made by the game in
+ * GameInterface::makeRenderSnapshot, with copies of the visible chunks, so
+ * that the rendering does not read the persistent memory. GameInterface::render
+ * prepares it, and the tiles are then drawn by copying the rows of the cached
+ * chunks.
+ */
+class TilemapView
+{
+public:
+    TilemapView();
+
+    // The view size is usually the size of the framebuffer. The pixels of the
+    // view that are outside of the tilemap have the background color.
+    bool begin(MemoryZone *zone, const Tilemap &tilemap, const Image *theAtlas,
+        int32_t theScrollX, int32_t theScrollY, uint32_t viewWidth, uint32_t viewHeight);
+
+    // Renders the chunks that are not in the cache yet. Called once, from
+    // GameInterface::render. A cache with fewer slots than the visible chunks
+    // still works, but the chunks that do not fit are drawn tile by tile.
+    void prepare(TilemapChunkCache &cache);
+
+    uint32_t getChunkCount() const
+    {
+        return chunkCount;
+    }
+
+    // Called concurrently from GameInterface::renderTile, after prepare.
+    void renderTile(const Framebuffer &framebuffer, const FramebufferTile &tile) const;
+
+private:
+    struct VisibleChunk
+    {
+        int32_t chunkX;
+        int32_t chunkY;
+        const uint8_t *pixels;
+        TilemapChunk tiles;
+    };
+
+    void renderUncachedChunk(const Framebuffer &framebuffer, const VisibleChunk &chunk, int32_t chunkMinX, int32_t chunkMinY,
+        int32_t minX, int32_t minY, int32_t maxX, int32_t maxY) const;
+
+    const Image *atlas;
+    uint32_t layerCount;
+    uint32_t tileSize;
+    uint32_t backgroundColor;
+    int32_t scrollX;
+    int32_t scrollY;
+    int32_t pixelWidth;
+    int32_t pixelHeight;
+    uint32_t chunkPitch;
+    VisibleChunk *chunks;
+    uint32_t chunkCount;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_TILEMAP_HPP
@@ -0,0 +1,252 @@
+#include "GameInterface.hpp"
+#include "Tilemap.hpp"
+#include "WorkerThreadPool.hpp"
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static constexpr uint32_t TileSize = 16;
+static constexpr uint32_t MapWidth = 1024;
+static constexpr uint32_t MapHeight = 68;
+static constexpr uint32_t BackgroundColor = 0xff603010;
+static constexpr size_t SnapshotMemorySize = 4*1024*1024;
+
+// The ground layer is full, and the layers above it get sparser.
+static const uint32_t LayerTilePercents[TilemapMaxLayerCount] = {100, 50, 25, 10};
+
+static void makeAtlas(Image &atlas)
+{
+    atlas.width = 256;
+    atlas.height = 256;
+    atlas.bpp = 32;
+    atlas.pitch = atlas.width*4;
+    atlas.data.reset(new uint8_t[atlas.pitch*atlas.height]);
+    atlas.pixels = atlas.data.get();
+
+    // Opaque and translucent tiles, with transparent borders.
+    std::mt19937 random(1);
+    auto pixels = reinterpret_cast<uint32_t*> (atlas.data.get());
+    for(uint32_t y = 0; y < atlas.height; ++y)
+    {
+        for(uint32_t x = 0; x < atlas.width; ++x)
+        {
+            auto isBorder = x % TileSize == 0 || y % TileSize == 0;
+            auto alpha = (x / TileSize) % 2 == 0 ? 0xff000000u : 0x80000000u;
+            pixels[y*atlas.width + x] = isBorder ? 0 : alpha | (random() & 0x00ffffff);
+        }
+    }
+}
+
+struct TileJob
+{
+    const TilemapView *view;
+    const Tilemap *tilemap;
+    const Image *atlas;
+    int32_t scrollX;
+    int32_t scrollY;
+    const Framebuffer *framebuffer;
+    uint32_t tileColumns;
+};
+
+static FramebufferTile getTile(const TileJob &job, size_t index)
+{
+    auto &framebuffer = *job.framebuffer;
+    auto x = uint32_t(index % job.tileColumns)*FramebufferTileSize;
+    auto y = uint32_t(index / job.tileColumns)*FramebufferTileSize;
+    return FramebufferTile{x, y, std::min(FramebufferTileSize, framebuffer.width - x), std::min(FramebufferTileSize, framebuffer.height - y)};
+}
+
+static void renderViewTileJob(void *userData, size_t index)
+{
+    auto &job = *reinterpret_cast<TileJob*> (userData);
+    job.view->renderTile(*job.framebuffer, getTile(job, index));
+}
+
+// Without the chunks, every tile of every layer that overlaps the framebuffer
+// tile is blitted into it.
+static void renderBlitTileJob(void *userData, size_t index)
+{
+    auto &job = *reinterpret_cast<TileJob*> (userData);
+    auto &framebuffer = *job.framebuffer;
+    auto &tilemap = *job.tilemap;
+    auto tile = getTile(job, index);
+    fillSurfaceRect(framebuffer.getView(), tile.x, tile.y, tile.width, tile.height, tilemap.backgroundColor);
+
+    BlitClipRect clipRect = {int32_t(tile.x), int32_t(tile.y), int32_t(tile.x + tile.width), int32_t(tile.y + tile.height)};
+    auto size = int32_t(tilemap.tileSize);
+    auto firstColumn = std::max((clipRect.minX + job.scrollX) / size, 0);
+    auto firstRow = std::max((clipRect.minY + job.scrollY) / size, 0);
+    auto lastColumn = std::min((clipRect.maxX + job.scrollX - 1) / size, int32_t(tilemap.width) - 1);
+    auto lastRow = std::min((clipRect.maxY + job.scrollY - 1) / size, int32_t(tilemap.height) - 1);
+    auto atlasColumns = job.atlas->width / tilemap.tileSize;
+    for(uint32_t layer = 0; layer < tilemap.layerCount; ++layer)
+    {
+        for(auto row = firstRow; row <= lastRow; ++row)
+        {
+            for(auto column = firstColumn; column <= lastColumn; ++column)
+            {
+                auto tileIndex = tilemap.getTile(layer, uint32_t(column), uint32_t(row));
+                if(tileIndex == 0)
+                    continue;
+
+                blitImageRegion(framebuffer, clipRect, *job.atlas,
+                    int32_t(((tileIndex - 1u) % atlasColumns)*tilemap.tileSize), int32_t(((tileIndex - 1u) / atlasColumns)*tilemap.tileSize), size, size,
+                    column*size - job.scrollX, row*size - job.scrollY, BlitMode::AlphaBlend);
+            }
+        }
+    }
+}
+
+static double millisecondsSince(std::chrono::steady_clock::time_point startTime)
+{
+    return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now() - startTime).count();
+}
+
+static double median(std::vector<double> &values)
+{
+    std::sort(values.begin(), values.end());
+    return values[values.size() / 2];
+}
+
+int main(int argc, char* argv[])
+{
+    uint32_t width = 1920;
+    uint32_t height = 1080;
+    uint32_t layerCount = TilemapMaxLayerCount;
+    int frameCount = 600;
+    int32_t scrollSpeed = 3;
+    size_t threadCount = WorkerThreadPool::getDefaultThreadCount();
+
+    // Enough slots for the chunks that a scrolled view overlaps.
+    auto chunkPixelSize = TileSize*TilemapChunkSize;
+    uint32_t slotCount = 0;
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--width" && i + 1 < argc)
+            width = uint32_t(std::max(1, atoi(argv[++i])));
+        else if(arg == "--height" && i + 1 < argc)
+            height = uint32_t(std::max(1, std::min(atoi(argv[++i]), int(MapHeight*TileSize))));
+        else if(arg == "--layers" && i + 1 < argc)
+            layerCount = uint32_t(std::max(1, std::min(atoi(argv[++i]), int(TilemapMaxLayerCount))));
+        else if(arg == "--frames" && i + 1 < argc)
+            frameCount = std::max(1, atoi(argv[++i]));
+        else if(arg == "--scroll-speed" && i + 1 < argc)
+            scrollSpeed = std::max(0, atoi(argv[++i]));
+        else if(arg == "--slots" && i + 1 < argc)
+            slotCount = uint32_t(std::max(1, atoi(argv[++i])));
+        else if(arg == "--threads" && i + 1 < argc)
+            threadCount = std::max(1, atoi(argv[++i]));
+    }
+
+    if(slotCount == 0)
+        slotCount = (width / chunkPixelSize + 2)*(height / chunkPixelSize + 2);
+
+    WorkerThreadPool threadPool;
+    threadPool.start(threadCount);
+
+    Image atlas;
+    makeAtlas(atlas);
+    auto atlasTileCount = (atlas.width / TileSize)*(atlas.height / TileSize);
+
+    std::vector<uint8_t> storage(Tilemap::getStorageSize(MapWidth, MapHeight, layerCount));
+    Tilemap tilemap;
+    if(!tilemap.initialize(storage.data(), MapWidth, MapHeight, layerCount, TileSize, BackgroundColor))
+        return 1;
+
+    std::mt19937 random(2);
+    for(uint32_t layer = 0; layer < layerCount; ++layer)
+    {
+        for(uint32_t y = 0; y < MapHeight; ++y)
+        {
+            for(uint32_t x = 0; x < MapWidth; ++x)
+            {
+                if(random() % 100 < LayerTilePercents[layer])
+                    tilemap.setTile(layer, x, y, TileIndex(random() % atlasTileCount + 1));
+            }
+        }
+    }
+
+    // The cache takes the cache memory of the host, like in a game.
+    MemoryZone cacheMemory;
+    MemoryZone snapshotMemory;
+    cacheMemory.reserve(RenderCacheMemorySize);
+    snapshotMemory.reserve(SnapshotMemorySize);
+    auto cache = cacheMemory.allocate<TilemapChunkCache> ();
+    if(!cache || !cache->initialize(&cacheMemory, TileSize, slotCount))
+        return 1;
+
+    FramebufferDirtyRegion dirtyRegion;
+    dirtyRegion.clear();
+    Framebuffer framebuffer;
+    framebuffer.width = width;
+    framebuffer.height = height;
+    framebuffer.pitch = int(width*sizeof(FramebufferPixel));
+    framebuffer.scale = 1.0f;
+    std::unique_ptr<uint8_t[]> pixels(new uint8_t[framebuffer.pitch*height]);
+    framebuffer.pixels = pixels.get();
+    framebuffer.dirtyRegion = &dirtyRegion;
+
+    auto tileColumns = (width + FramebufferTileSize - 1) / FramebufferTileSize;
+    auto tileRows = (height + FramebufferTileSize - 1) / FramebufferTileSize;
+    auto maxScrollX = int32_t(MapWidth*TileSize) - int32_t(width);
+
+    std::vector<double> snapshotTimes;
+    std::vector<double> prepareTimes;
+    std::vector<double> copyTimes;
+    std::vector<double> blitTimes;
+    uint64_t renderedChunkCount = 0;
+    uint64_t visibleChunkCount = 0;
+    for(int frame = 0; frame < frameCount; ++frame)
+    {
+        // Back and forth over the level.
+        auto scrollX = maxScrollX > 0 ? int32_t(int64_t(frame)*scrollSpeed % (2*maxScrollX)) : 0;
+        if(scrollX > maxScrollX)
+            scrollX = 2*maxScrollX - scrollX;
+        auto scrollY = int32_t(MapHeight*TileSize - height) / 2;
+
+        snapshotMemory.beginFrame();
+        auto startTime = std::chrono::steady_clock::now();
+        TilemapView view;
+        view.begin(&snapshotMemory, tilemap, &atlas, scrollX, scrollY, width, height);
+        snapshotTimes.push_back(millisecondsSince(startTime));
+
+        startTime = std::chrono::steady_clock::now();
+        view.prepare(*cache);
+        prepareTimes.push_back(millisecondsSince(startTime));
+        renderedChunkCount += cache->getRenderedChunkCount();
+        visibleChunkCount += view.getChunkCount();
+
+        TileJob job = {&view, &tilemap, &atlas, scrollX, scrollY, &framebuffer, tileColumns};
+        startTime = std::chrono::steady_clock::now();
+        threadPool.parallelFor(tileColumns*tileRows, renderViewTileJob, &job);
+        copyTimes.push_back(millisecondsSince(startTime));
+
+        startTime = std::chrono::steady_clock::now();
+        threadPool.parallelFor(tileColumns*tileRows, renderBlitTileJob, &job);
+        blitTimes.push_back(millisecondsSince(startTime));
+    }
+
+    auto snapshotTime = median(snapshotTimes);
+    auto prepareTime = median(prepareTimes);
+    auto maxPrepareTime = prepareTimes.back();
+    auto copyTime = median(copyTimes);
+    auto blitTime = median(blitTimes);
+    printf("Tilemap: %ux%u tiles of %u pixels, %u layers, %ux%u view scrolling %d pixels per frame, %u slots, %u threads, median of %d frames\n",
+        MapWidth, MapHeight, TileSize, layerCount, width, height, scrollSpeed, slotCount, unsigned(threadCount), frameCount);
+    printf("  snapshot    %7.3f ms, %.1f visible chunks per frame\n", snapshotTime, double(visibleChunkCount) / frameCount);
+    printf("  prepare     %7.3f ms, %.3f ms at most, %.2f chunks rendered per frame\n", prepareTime, maxPrepareTime,
+        double(renderedChunkCount) / frameCount);
+    printf("  copy rows   %7.3f ms\n", copyTime);
+    printf("  total       %7.3f ms with the chunk cache\n", snapshotTime + prepareTime + copyTime);
+    printf("  tile blits  %7.3f ms without it\n", blitTime);
+
+    threadPool.shutdown();
+    return 0;
+}
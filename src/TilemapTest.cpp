@@ -0,0 +1,182 @@
+#include "Tilemap.hpp"
+#include <algorithm>
+#include <random>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+static constexpr uint32_t FramebufferWidth = 320;
+static constexpr uint32_t FramebufferHeight = 200;
+static constexpr uint32_t TileSize = 8;
+static constexpr uint32_t MapWidth = 100;
+static constexpr uint32_t MapHeight = 40;
+static constexpr uint32_t LayerCount = 3;
+static constexpr uint32_t BackgroundColor = 0xff304050;
+static constexpr size_t CacheMemorySize = 8*1024*1024;
+static constexpr size_t SnapshotMemorySize = 1024*1024;
+
+struct ScrollPosition
+{
+    int32_t x;
+    int32_t y;
+};
+
+// Inside of the map, across the chunk edges, and partially or completely
+// outside of it on every side.
+static const ScrollPosition ScrollPositions[] = {
+    {0, 0}, {13, -5}, {17, 9}, {130, 70}, {-100, -60}, {600, 200}, {2000, 0}, {-400, 0}, {13, -5},
+};
+
+static void makeAtlas(Image &atlas)
+{
+    atlas.width = 64;
+    atlas.height = 64;
+    atlas.bpp = 32;
+    atlas.pitch = atlas.width*4;
+    atlas.data.reset(new uint8_t[atlas.pitch*atlas.height]);
+    atlas.pixels = atlas.data.get();
+
+    // Random colors with every kind of alpha, and some transparent pixels.
+    std::mt19937 random(1);
+    auto pixels = reinterpret_cast<uint32_t*> (atlas.data.get());
+    for(uint32_t i = 0; i < atlas.width*atlas.height; ++i)
+    {
+        auto pixel = random();
+        if(i % 5 == 0)
+            pixel &= 0x00ffffff;
+        else if(i % 3 == 0)
+            pixel |= 0xff000000;
+        pixels[i] = pixel;
+    }
+}
+
+static Framebuffer makeFramebuffer(std::vector<FramebufferPixel> &pixels, FramebufferDirtyRegion &dirtyRegion)
+{
+    pixels.assign(FramebufferWidth*FramebufferHeight, FramebufferFormat::fromABGR8888(0xff00ff00));
+    Framebuffer framebuffer;
+    framebuffer.width = FramebufferWidth;
+    framebuffer.height = FramebufferHeight;
+    framebuffer.pitch = int(FramebufferWidth*sizeof(FramebufferPixel));
+    framebuffer.pixels = reinterpret_cast<uint8_t*> (pixels.data());
+    framebuffer.scale = 1.0f;
+    framebuffer.dirtyRegion = &dirtyRegion;
+    dirtyRegion.clear();
+    return framebuffer;
+}
+
+// Every tile of every layer blitted into the whole framebuffer.
+static void renderReference(const Framebuffer &framebuffer, const Tilemap &tilemap, const Image &atlas, const ScrollPosition &scroll)
+{
+    fillSurfaceRect(framebuffer.getView(), 0, 0, framebuffer.width, framebuffer.height, tilemap.backgroundColor);
+    auto atlasColumns = atlas.width / tilemap.tileSize;
+    auto size = int32_t(tilemap.tileSize);
+    for(uint32_t layer = 0; layer < tilemap.layerCount; ++layer)
+    {
+        for(uint32_t y = 0; y < tilemap.height; ++y)
+        {
+            for(uint32_t x = 0; x < tilemap.width; ++x)
+            {
+                auto tile = tilemap.getTile(layer, x, y);
+                if(tile == 0)
+                    continue;
+
+                blitImageRegion(framebuffer, BlitClipRect::forFramebuffer(framebuffer), atlas,
+                    int32_t(((tile - 1u) % atlasColumns)*tilemap.tileSize), int32_t(((tile - 1u) / atlasColumns)*tilemap.tileSize), size, size,
+                    int32_t(x)*size - scroll.x, int32_t(y)*size - scroll.y, BlitMode::AlphaBlend);
+            }
+        }
+    }
+}
+
+// Scrolls through the positions with a cache that is kept between the frames,
+// like the cache memory of the host, and changes some tiles between the
+// frames, which have to be rendered again. The cache memory is cleared in the
+// middle, like the host does after a reload, and the cache is made again when
+// its zone is empty.
+static bool checkCache(Tilemap &tilemap, const Image &atlas, uint32_t cacheTileSize, uint32_t slotCount, const char *name)
+{
+    MemoryZone cacheMemory;
+    MemoryZone snapshotMemory;
+    cacheMemory.reserve(CacheMemorySize, MemoryZoneBackend::Heap);
+    snapshotMemory.reserve(SnapshotMemorySize, MemoryZoneBackend::Heap);
+    std::mt19937 random(2);
+    TilemapChunkCache *cache = nullptr;
+    uint32_t differentPixelCount = 0;
+    uint32_t renderedChunkCount = 0;
+    uint32_t frameCount = sizeof(ScrollPositions) / sizeof(ScrollPositions[0]);
+    for(uint32_t frame = 0; frame < frameCount; ++frame)
+    {
+        auto &scroll = ScrollPositions[frame];
+        if(frame == frameCount / 2)
+            cacheMemory.clearAll();
+        if(cacheMemory.getMarker() == 0)
+        {
+            cache = cacheMemory.allocate<TilemapChunkCache> ();
+            if(!cache || !cache->initialize(&cacheMemory, cacheTileSize, slotCount))
+                return false;
+        }
+
+        for(uint32_t i = 0; i < 20; ++i)
+            tilemap.setTile(random() % LayerCount, random() % MapWidth, random() % MapHeight, TileIndex(random() % 70));
+
+        snapshotMemory.beginFrame();
+        TilemapView view;
+        if(!view.begin(&snapshotMemory, tilemap, &atlas, scroll.x, scroll.y, FramebufferWidth, FramebufferHeight))
+            return false;
+        view.prepare(*cache);
+        renderedChunkCount += cache->getRenderedChunkCount();
+
+        FramebufferDirtyRegion viewDirtyRegion;
+        std::vector<FramebufferPixel> viewPixels;
+        auto viewFramebuffer = makeFramebuffer(viewPixels, viewDirtyRegion);
+        for(uint32_t y = 0; y < FramebufferHeight; y += FramebufferTileSize)
+        {
+            for(uint32_t x = 0; x < FramebufferWidth; x += FramebufferTileSize)
+            {
+                FramebufferTile tile = {x, y, std::min(FramebufferTileSize, FramebufferWidth - x), std::min(FramebufferTileSize, FramebufferHeight - y)};
+                view.renderTile(viewFramebuffer, tile);
+            }
+        }
+
+        FramebufferDirtyRegion referenceDirtyRegion;
+        std::vector<FramebufferPixel> referencePixels;
+        auto referenceFramebuffer = makeFramebuffer(referencePixels, referenceDirtyRegion);
+        renderReference(referenceFramebuffer, tilemap, atlas, scroll);
+
+        for(size_t i = 0; i < viewPixels.size(); ++i)
+            differentPixelCount += memcmp(&viewPixels[i], &referencePixels[i], sizeof(FramebufferPixel)) != 0 ? 1 : 0;
+    }
+
+    printf("Tilemap %s: %u chunks rendered in %u frames, %u different pixels from the tile blits\n",
+        name, renderedChunkCount, frameCount, differentPixelCount);
+    return differentPixelCount == 0;
+}
+
+int main()
+{
+    Image atlas;
+    makeAtlas(atlas);
+
+    // Some of the tiles are empty, and some are past the end of the atlas.
+    std::vector<uint8_t> storage(Tilemap::getStorageSize(MapWidth, MapHeight, LayerCount));
+    Tilemap tilemap;
+    if(!tilemap.initialize(storage.data(), MapWidth, MapHeight, LayerCount, TileSize, BackgroundColor))
+        return 1;
+
+    std::mt19937 random(3);
+    for(uint32_t layer = 0; layer < LayerCount; ++layer)
+    {
+        for(uint32_t y = 0; y < MapHeight; ++y)
+        {
+            for(uint32_t x = 0; x < MapWidth; ++x)
+                tilemap.setTile(layer, x, y, TileIndex(random() % 70));
+        }
+    }
+
+    // All of the visible chunks cached, a single slot where the rest is drawn
+    // tile by tile, and a cache of another tile size that is not used.
+    auto isSame = checkCache(tilemap, atlas, TileSize, 64, "cached");
+    isSame = checkCache(tilemap, atlas, TileSize, 1, "one slot") && isSame;
+    isSame = checkCache(tilemap, atlas, TileSize*2, 4, "other tile size") && isSame;
+    return isSame ? 0 : 1;
+}
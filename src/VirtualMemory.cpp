@@ -0,0 +1,325 @@
+#include "VirtualMemory.hpp"
+
+#if defined(__EMSCRIPTEN__)
+#define VIRTUAL_MEMORY_UNSUPPORTED
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <algorithm>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace VirtualMemory
+{
+
+#if defined(VIRTUAL_MEMORY_UNSUPPORTED)
+
+bool isSupported()
+{
+    return false;
+}
+
+size_t getPageSize()
+{
+    return 4096;
+}
+
+uint8_t *reserve(size_t size, bool useHugePages)
+{
+    (void)size;
+    (void)useHugePages;
+    return nullptr;
+}
+
+void release(uint8_t *data, size_t size)
+{
+    (void)data;
+    (void)size;
+}
+
+bool discard(uint8_t *data, size_t size)
+{
+    (void)data;
+    (void)size;
+    return false;
+}
+
+bool mapFile(const char *fileName, size_t size, MappedFile &result)
+{
+    (void)fileName;
+    (void)size;
+    (void)result;
+    return false;
+}
+
+bool mapFileForReading(const char *fileName, MappedFile &result)
+{
+    (void)fileName;
+    (void)result;
+    return false;
+}
+
+void unmapFile(MappedFile &file)
+{
+    (void)file;
+}
+
+bool flushMappedFile(const MappedFile &file, bool wait)
+{
+    (void)file;
+    (void)wait;
+    return false;
+}
+
+#elif defined(_WIN32)
+
+bool isSupported()
+{
+    return true;
+}
+
+size_t getPageSize()
+{
+    SYSTEM_INFO systemInfo;
+    GetSystemInfo(&systemInfo);
+    return systemInfo.dwPageSize;
+}
+
+uint8_t *reserve(size_t size, bool useHugePages)
+{
+    // Large pages require a special privilege on Windows, so they are not used.
+    (void)useHugePages;
+    return reinterpret_cast<uint8_t*> (VirtualAlloc(nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE));
+}
+
+void release(uint8_t *data, size_t size)
+{
+    (void)size;
+    VirtualFree(data, 0, MEM_RELEASE);
+}
+
+bool discard(uint8_t *data, size_t size)
+{
+    // Decommitted pages are zero when they are committed again.
+    if(!VirtualFree(data, size, MEM_DECOMMIT))
+        return false;
+    return VirtualAlloc(data, size, MEM_COMMIT, PAGE_READWRITE) == data;
+}
+
+bool mapFile(const char *fileName, size_t size, MappedFile &result)
+{
+    auto file = CreateFileA(fileName, GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize))
+        fileSize.QuadPart = 0;
+    auto mappingSize = std::max(uint64_t(fileSize.QuadPart), uint64_t(size));
+
+    // The mapping keeps a reference to the file.
+    auto mapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE, DWORD(mappingSize >> 32), DWORD(mappingSize & 0xFFFFFFFF), nullptr);
+    CloseHandle(file);
+    if(!mapping)
+        return false;
+
+    auto data = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+    if(!data)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    result.data = reinterpret_cast<uint8_t*> (data);
+    result.size = size;
+    result.mappingHandle = mapping;
+    return true;
+}
+
+bool mapFileForReading(const char *fileName, MappedFile &result)
+{
+    auto file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if(!mapping)
+        return false;
+
+    auto data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if(!data)
+    {
+        CloseHandle(mapping);
+        return false;
+    }
+
+    result.data = reinterpret_cast<uint8_t*> (data);
+    result.size = size_t(fileSize.QuadPart);
+    result.mappingHandle = mapping;
+    return true;
+}
+
+void unmapFile(MappedFile &file)
+{
+    if(!file.data)
+        return;
+
+    UnmapViewOfFile(file.data);
+    CloseHandle(file.mappingHandle);
+    file = MappedFile();
+}
+
+bool flushMappedFile(const MappedFile &file, bool wait)
+{
+    // FlushViewOfFile only schedules the writes, so waiting is not supported.
+    (void)wait;
+    return FlushViewOfFile(file.data, file.size) != 0;
+}
+
+#else
+
+static constexpr size_t HugePageSize = 2*1024*1024;
+
+bool isSupported()
+{
+    return true;
+}
+
+size_t getPageSize()
+{
+    return size_t(sysconf(_SC_PAGESIZE));
+}
+
+uint8_t *reserve(size_t size, bool useHugePages)
+{
+#if defined(MADV_HUGEPAGE)
+    if(useHugePages)
+    {
+        // Transparent huge pages are only used for aligned ranges, so the
+        // mapping is over allocated and trimmed into an aligned one.
+        auto mappingSize = size + HugePageSize;
+        auto mapping = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(mapping == MAP_FAILED)
+            return nullptr;
+
+        auto mappingStart = reinterpret_cast<uintptr_t> (mapping);
+        auto alignedStart = (mappingStart + HugePageSize - 1) & ~uintptr_t(HugePageSize - 1);
+        auto alignedEnd = alignedStart + size;
+        auto mappingEnd = mappingStart + mappingSize;
+        if(alignedStart > mappingStart)
+            munmap(mapping, alignedStart - mappingStart);
+        if(mappingEnd > alignedEnd)
+            munmap(reinterpret_cast<void*> (alignedEnd), mappingEnd - alignedEnd);
+
+        auto result = reinterpret_cast<uint8_t*> (alignedStart);
+        madvise(result, size, MADV_HUGEPAGE);
+        return result;
+    }
+#else
+    (void)useHugePages;
+#endif
+
+    auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(mapping == MAP_FAILED)
+        return nullptr;
+    return reinterpret_cast<uint8_t*> (mapping);
+}
+
+void release(uint8_t *data, size_t size)
+{
+    munmap(data, size);
+}
+
+bool discard(uint8_t *data, size_t size)
+{
+#if defined(__linux__)
+    // Private anonymous pages are zero filled after MADV_DONTNEED.
+    return madvise(data, size, MADV_DONTNEED) == 0;
+#else
+    // Elsewhere MADV_DONTNEED does not guarantee zeroes, so the range is
+    // replaced by a fresh anonymous mapping.
+    auto mapping = mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    return mapping == data;
+#endif
+}
+
+bool mapFile(const char *fileName, size_t size, MappedFile &result)
+{
+    auto fd = open(fileName, O_RDWR | O_CREAT, 0644);
+    if(fd < 0)
+        return false;
+
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0 || (size_t(fileStat.st_size) < size && ftruncate(fd, off_t(size)) != 0))
+    {
+        close(fd);
+        return false;
+    }
+
+    // The mapping keeps a reference to the file.
+    auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    result.data = reinterpret_cast<uint8_t*> (mapping);
+    result.size = size;
+    result.mappingHandle = nullptr;
+    return true;
+}
+
+bool mapFileForReading(const char *fileName, MappedFile &result)
+{
+    auto fd = open(fileName, O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat fileStat;
+    if(fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+        close(fd);
+        return false;
+    }
+
+    auto size = size_t(fileStat.st_size);
+    auto mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(mapping == MAP_FAILED)
+        return false;
+
+    result.data = reinterpret_cast<uint8_t*> (mapping);
+    result.size = size;
+    result.mappingHandle = nullptr;
+    return true;
+}
+
+void unmapFile(MappedFile &file)
+{
+    if(!file.data)
+        return;
+
+    munmap(file.data, file.size);
+    file = MappedFile();
+}
+
+bool flushMappedFile(const MappedFile &file, bool wait)
+{
+    return msync(file.data, file.size, wait ? MS_SYNC : MS_ASYNC) == 0;
+}
+
+#endif
+
+}
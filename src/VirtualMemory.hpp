@@ -0,0 +1,51 @@
+#ifndef SIMPLE_GAME_TEMPLATE_VIRTUAL_MEMORY_HPP
+#define SIMPLE_GAME_TEMPLATE_VIRTUAL_MEMORY_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Thin wrappers over the operating system virtual memory. The pages of a
+ * reservation are zeroed lazily by the kernel the first time they are touched.
+ */
+namespace VirtualMemory
+{
+
+bool isSupported();
+size_t getPageSize();
+
+// Returns nullptr on failure.
+uint8_t *reserve(size_t size, bool useHugePages);
+void release(uint8_t *data, size_t size);
+
+// Gives the pages back to the operating system, so they are zero when they
+// are touched again.
+bool discard(uint8_t *data, size_t size);
+
+/**
+ * A file that is mapped into memory. The writes into a file that is mapped for
+ * writing are kept by the operating system even if the process crashes.
+ */
+struct MappedFile
+{
+    MappedFile()
+        : data(nullptr), size(0), mappingHandle(nullptr) {}
+
+    uint8_t *data;
+    size_t size;
+    void *mappingHandle;
+};
+
+// Creates the file or grows it when it is smaller than the size.
+bool mapFile(const char *fileName, size_t size, MappedFile &result);
+// Maps a full existing file as read only memory.
+bool mapFileForReading(const char *fileName, MappedFile &result);
+void unmapFile(MappedFile &file);
+
+// Schedules the write back of the modified pages. When wait is true, this
+// returns once they are on disk.
+bool flushMappedFile(const MappedFile &file, bool wait);
+
+}
+
+#endif //SIMPLE_GAME_TEMPLATE_VIRTUAL_MEMORY_HPP
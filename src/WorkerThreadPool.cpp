@@ -0,0 +1,119 @@
+#include "WorkerThreadPool.hpp"
+#include "Profiler.hpp"
+
+WorkerThreadPool::WorkerThreadPool()
+    : shuttingDown(false), jobGeneration(0), jobFunction(nullptr), jobUserData(nullptr),
+      jobCount(0), nextJobIndex(0), activeWorkerCount(0)
+{
+}
+
+WorkerThreadPool::~WorkerThreadPool()
+{
+    shutdown();
+}
+
+void WorkerThreadPool::start(size_t threadCount)
+{
+    shutdown();
+
+#ifdef __EMSCRIPTEN__
+    // Emscripten builds are single threaded.
+    (void)threadCount;
+#else
+    shuttingDown = false;
+    auto currentJobGeneration = jobGeneration;
+    for(size_t i = 1; i < threadCount; ++i)
+        workers.push_back(std::thread([this, currentJobGeneration]() { workerThreadEntry(currentJobGeneration); }));
+#endif
+}
+
+void WorkerThreadPool::shutdown()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        shuttingDown = true;
+    }
+    jobAvailableCondition.notify_all();
+
+    for(auto &worker : workers)
+        worker.join();
+    workers.clear();
+}
+
+size_t WorkerThreadPool::getDefaultThreadCount()
+{
+    auto count = std::thread::hardware_concurrency();
+    return count > 0 ? count : 1;
+}
+
+void WorkerThreadPool::parallelFor(size_t count, ParallelForFunction function, void *userData)
+{
+    if(count == 0)
+        return;
+
+    // Avoid waking up the workers for trivial loops.
+    if(workers.empty() || count == 1)
+    {
+        for(size_t i = 0; i < count; ++i)
+            function(userData, i);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        jobFunction = function;
+        jobUserData = userData;
+        jobCount = count;
+        nextJobIndex.store(0, std::memory_order_relaxed);
+        activeWorkerCount = workers.size();
+        ++jobGeneration;
+    }
+    jobAvailableCondition.notify_all();
+
+    runJobIterations();
+
+    // Wait for the workers to finish their last iterations.
+    std::unique_lock<std::mutex> lock(mutex);
+    while(activeWorkerCount > 0)
+        jobFinishedCondition.wait(lock);
+    jobFunction = nullptr;
+    jobUserData = nullptr;
+}
+
+void WorkerThreadPool::runJobIterations()
+{
+    for(;;)
+    {
+        auto index = nextJobIndex.fetch_add(1, std::memory_order_relaxed);
+        if(index >= jobCount)
+            return;
+
+        jobFunction(jobUserData, index);
+    }
+}
+
+void WorkerThreadPool::workerThreadEntry(uint64_t lastJobGeneration)
+{
+    Profiler::singleton.setThreadName("Worker");
+    for(;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while(!shuttingDown && jobGeneration == lastJobGeneration)
+                jobAvailableCondition.wait(lock);
+            if(shuttingDown)
+                return;
+            lastJobGeneration = jobGeneration;
+        }
+
+        runJobIterations();
+
+        bool isLastWorker = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            isLastWorker = --activeWorkerCount == 0;
+        }
+        if(isLastWorker)
+            jobFinishedCondition.notify_one();
+    }
+}
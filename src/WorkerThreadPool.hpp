@@ -0,0 +1,56 @@
+#ifndef SIMPLE_GAME_TEMPLATE_WORKER_THREAD_POOL_HPP
+#define SIMPLE_GAME_TEMPLATE_WORKER_THREAD_POOL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef void (*ParallelForFunction)(void *userData, size_t index);
+
+/**
+ * A fixed set of worker threads that execute parallel for loops. The thread
+ * that calls parallelFor also takes part in the loop, so a pool started with
+ * a single thread runs everything inline.
+ */
+class WorkerThreadPool
+{
+public:
+    WorkerThreadPool();
+    ~WorkerThreadPool();
+
+    void start(size_t threadCount);
+    void shutdown();
+
+    size_t getThreadCount() const
+    {
+        return workers.size() + 1;
+    }
+
+    void parallelFor(size_t count, ParallelForFunction function, void *userData);
+
+    static size_t getDefaultThreadCount();
+
+private:
+    void workerThreadEntry(uint64_t lastJobGeneration);
+    void runJobIterations();
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable jobAvailableCondition;
+    std::condition_variable jobFinishedCondition;
+    bool shuttingDown;
+
+    // The current job.
+    uint64_t jobGeneration;
+    ParallelForFunction jobFunction;
+    void *jobUserData;
+    size_t jobCount;
+    std::atomic<size_t> nextJobIndex;
+    size_t activeWorkerCount;
+};
+
+#endif //SIMPLE_GAME_TEMPLATE_WORKER_THREAD_POOL_HPP